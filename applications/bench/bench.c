@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <syscall.h>
+#include <vdso.h>
+#include <uring.h>
+#include <procspawn.h>
+#include <procthread.h>
+#include <bcache.h>
+#include <softirq.h>
+#include <preempt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <common.h>
+
+// Kernel micro benchmarks
+// Usage: bench [name], run all benchmarks if no name given
+
+#define N_ITERATION 100000
+
+static inline _syscall0(SYS_GET_PID, int, sys_get_pid)
+static inline _syscall2(SYS_GETATTR_PATH, int, sys_getattr_path, const char*, path, fs_stat*, st)
+
+static inline uint64_t rdtsc()
+{
+    uint64_t ret;
+    asm volatile ( "rdtsc" : "=A"(ret) );
+    return ret;
+}
+
+static uint64_t cycles2ns(uint64_t cycles)
+{
+    uint64_t tsc_hz = VDSO_CLOCK->tsc_hz;
+    if(tsc_hz == 0) {
+        return 0;
+    }
+    return cycles * 1000000000ULL / tsc_hz;
+}
+
+// Legacy entry, arguments on stack
+static inline int sys_get_pid_int88()
+{
+    int ret_code;
+    asm volatile ("push $0; int $88; pop %%ebx"
+    :"=a"(ret_code)
+    :"a"(SYS_GET_PID)
+    :"ebx", "memory", "cc");
+    return ret_code;
+}
+
+static void report(const char* name, uint64_t cycles, uint n)
+{
+    printf("%-24s %8llu cycles/op %8llu ns/op\n", name, cycles / n, cycles2ns(cycles) / n);
+}
+
+// Per-call overhead of a syscall doing (almost) nothing
+static void bench_syscall()
+{
+    uint64_t t0 = rdtsc();
+    for(uint i=0; i<N_ITERATION; i++) {
+        sys_get_pid_int88();
+    }
+    uint64_t t1 = rdtsc();
+    report("null syscall (int 88)", t1 - t0, N_ITERATION);
+
+    t0 = rdtsc();
+    for(uint i=0; i<N_ITERATION; i++) {
+        sys_get_pid();
+    }
+    t1 = rdtsc();
+    report("null syscall (vsyscall)", t1 - t0, N_ITERATION);
+
+    t0 = rdtsc();
+    for(uint i=0; i<N_ITERATION; i++) {
+        asm volatile("" :: "r"(VDSO_PROC->pid));
+    }
+    t1 = rdtsc();
+    report("getpid (vDSO)", t1 - t0, N_ITERATION);
+}
+
+#define N_SPAWN_ITERATION 100
+
+// argv[0] of this program, re-launched as the child in bench_spawn
+static char* self_path;
+extern char** environ;
+
+// Command launch latency, child exits immediately
+static void bench_spawn()
+{
+    char* child_argv[] = {self_path, "--exit", NULL};
+    int status;
+
+    uint64_t t0 = rdtsc();
+    for(uint i=0; i<N_SPAWN_ITERATION; i++) {
+        int pid = fork();
+        if(pid == 0) {
+            execve(self_path, child_argv, environ);
+            exit(1);
+        }
+        wait(&status);
+    }
+    uint64_t t1 = rdtsc();
+    report("launch (fork + exec)", t1 - t0, N_SPAWN_ITERATION);
+
+    t0 = rdtsc();
+    for(uint i=0; i<N_SPAWN_ITERATION; i++) {
+        if(syscall_spawn(self_path, child_argv, environ, NULL, 0) > 0) {
+            wait(&status);
+        }
+    }
+    t1 = rdtsc();
+    report("launch (spawn)", t1 - t0, N_SPAWN_ITERATION);
+}
+
+#define URING_ENTRIES 64
+#define N_URING_ITERATION 10000
+
+// Same stat calls, one syscall each vs batched through the ring
+static void bench_uring()
+{
+    fs_stat st;
+    uint64_t t0 = rdtsc();
+    for(uint i=0; i<N_URING_ITERATION; i++) {
+        sys_getattr_path("/", &st);
+    }
+    uint64_t t1 = rdtsc();
+    report("getattr (syscall)", t1 - t0, N_URING_ITERATION);
+
+    struct uring ring = {
+        .sq_entries = URING_ENTRIES,
+        .cq_entries = URING_ENTRIES,
+        .sqes = malloc(URING_ENTRIES*sizeof(struct uring_sqe)),
+        .cqes = malloc(URING_ENTRIES*sizeof(struct uring_cqe))
+    };
+    uint done = 0, failed = 0;
+    t0 = rdtsc();
+    while(done < N_URING_ITERATION) {
+        struct uring_sqe* sqe;
+        uint queued = 0;
+        while(done + queued < N_URING_ITERATION && (sqe = uring_get_sqe(&ring)) != NULL) {
+            sqe->opcode = URING_OP_GETATTR;
+            sqe->path = "/";
+            sqe->addr = &st;
+            uring_commit_sqe(&ring);
+            queued++;
+        }
+        uring_submit(&ring);
+        struct uring_cqe* cqe;
+        while((cqe = uring_peek_cqe(&ring)) != NULL) {
+            if(cqe->res < 0) {
+                failed++;
+            }
+            uring_cqe_seen(&ring);
+            done++;
+        }
+    }
+    t1 = rdtsc();
+    report("getattr (uring batch 64)", t1 - t0, N_URING_ITERATION);
+    if(failed) {
+        printf("uring: %u operations failed\n", failed);
+    }
+    free(ring.sqes);
+    free(ring.cqes);
+}
+
+#define MAX_BENCH_THREADS 4
+#define BENCH_THREAD_STACK_SIZE 4096
+#define N_THREAD_WORK 40000000
+
+static struct bench_thread {
+    volatile int tid;
+    uint from, to;
+    volatile uint32_t result;
+    uint32_t stack[BENCH_THREAD_STACK_SIZE / sizeof(uint32_t)] __attribute__((aligned(16)));
+} bench_threads[MAX_BENCH_THREADS];
+
+// CPU bound work, shared by nothing
+static void bench_thread_main(struct bench_thread* t)
+{
+    uint32_t x = 0;
+    for(uint i=t->from; i<t->to; i++) {
+        x = x * 31 + i;
+    }
+    t->result = x;
+    syscall_thread_exit();
+}
+
+// The same amount of work split over 1 to MAX_BENCH_THREADS threads, scales with CPUs
+static void bench_threads_run()
+{
+    for(uint n=1; n<=MAX_BENCH_THREADS; n*=2) {
+        uint64_t t0 = rdtsc();
+        for(uint i=0; i<n; i++) {
+            struct bench_thread* t = &bench_threads[i];
+            t->from = N_THREAD_WORK / n * i;
+            t->to = N_THREAD_WORK / n * (i + 1);
+            // mimic a call to bench_thread_main(t)
+            uint32_t* sp = &t->stack[sizeof(t->stack) / sizeof(uint32_t)];
+            *--sp = (uint32_t) t;
+            *--sp = 0;
+            if(syscall_clone(bench_thread_main, sp, &t->tid) < 0) {
+                printf("threads: clone failed\n");
+                return;
+            }
+        }
+        for(uint i=0; i<n; i++) {
+            int tid;
+            while((tid = bench_threads[i].tid) != 0) {
+                syscall_futex(&bench_threads[i].tid, FUTEX_WAIT, tid);
+            }
+        }
+        uint64_t t1 = rdtsc();
+        char name[32];
+        snprintf(name, sizeof(name), "work (%u threads)", n);
+        report(name, t1 - t0, 1);
+    }
+}
+
+#define N_STAT_ITERATION 1000
+
+// Path lookups read the same directory blocks over and over, mostly from the block cache
+static void bench_stat()
+{
+    fs_stat st;
+    bcache_stat s0, s1;
+    syscall_bcache_stat(&s0);
+    uint64_t t0 = rdtsc();
+    for(uint i=0; i<N_STAT_ITERATION; i++) {
+        sys_getattr_path(self_path, &st);
+    }
+    uint64_t t1 = rdtsc();
+    syscall_bcache_stat(&s1);
+    report("stat", t1 - t0, N_STAT_ITERATION);
+    uint64_t hits = s1.hits - s0.hits;
+    uint64_t misses = s1.misses - s0.misses;
+    printf("bcache: %llu hits, %llu misses (%llu%%), %u blocks cached, %u dirty\n",
+        hits, misses, hits + misses ? hits * 100 / (hits + misses) : 0ULL, s1.n_buf, s1.n_dirty);
+}
+
+#define READ_CHUNK_SIZE (64*1024)
+#define N_READ_ITERATION 10
+
+// Large sequential reads, these bypass the block cache and go to the disk
+static void bench_read()
+{
+    static char buf[READ_CHUNK_SIZE];
+    uint64_t n_bytes = 0;
+    uint n_chunk = 0;
+    uint64_t t0 = rdtsc();
+    for(uint i=0; i<N_READ_ITERATION; i++) {
+        int fd = open(self_path, O_RDONLY);
+        if(fd < 0) {
+            printf("read: cannot open %s\n", self_path);
+            return;
+        }
+        int r;
+        while((r = read(fd, buf, sizeof(buf))) > 0) {
+            n_bytes += r;
+            n_chunk++;
+        }
+        close(fd);
+    }
+    uint64_t t1 = rdtsc();
+    report("read 64KiB", t1 - t0, n_chunk);
+    uint64_t ns = cycles2ns(t1 - t0);
+    printf("read: %llu KiB/s\n", ns ? n_bytes * 1000000000ULL / 1024 / ns : 0ULL);
+}
+
+#define FS_FILE_SIZE (1024*1024)
+#define FS_CHUNK_SIZE (4*1024)
+
+// Write then read back a file, in chunks smaller than what bypasses the block cache
+// On the RAM disk at /tmp this is the cost of the file system alone
+static void bench_fs_dir(const char* dir)
+{
+    static char buf[FS_CHUNK_SIZE];
+    char path[64];
+    snprintf(path, sizeof(path), "%s/bench.tmp", dir);
+    unlink(path);
+    memset(buf, 'x', sizeof(buf));
+
+    uint64_t t0 = rdtsc();
+    int fd = open(path, O_WRONLY | O_CREAT, 0666);
+    if(fd < 0) {
+        printf("fs: cannot create %s\n", path);
+        return;
+    }
+    for(uint i=0; i<FS_FILE_SIZE/FS_CHUNK_SIZE; i++) {
+        write(fd, buf, sizeof(buf));
+    }
+    close(fd);
+    uint64_t t1 = rdtsc();
+    fd = open(path, O_RDONLY);
+    while(read(fd, buf, sizeof(buf)) > 0);
+    close(fd);
+    uint64_t t2 = rdtsc();
+    unlink(path);
+
+    uint64_t w_ns = cycles2ns(t1 - t0), r_ns = cycles2ns(t2 - t1);
+    printf("fs %s: write %llu KiB/s, read %llu KiB/s\n", dir,
+        w_ns ? (uint64_t) FS_FILE_SIZE * 1000000000ULL / 1024 / w_ns : 0ULL,
+        r_ns ? (uint64_t) FS_FILE_SIZE * 1000000000ULL / 1024 / r_ns : 0ULL);
+}
+
+static void bench_fs()
+{
+    bench_fs_dir("/tmp");
+    bench_fs_dir("/home");
+}
+
+static const char* softirq_names[N_SOFTIRQ] = {
+    [SOFTIRQ_TIMER] = "timer",
+    [SOFTIRQ_NET_RX] = "net_rx",
+};
+
+// Time spent in the kernel's bottom halves since boot
+static void bench_softirq()
+{
+    for(uint nr=0; nr<N_SOFTIRQ; nr++) {
+        softirq_stat st;
+        if(syscall_softirq_stat(nr, &st) < 0) {
+            printf("softirq: no stats for %s\n", softirq_names[nr]);
+            continue;
+        }
+        printf("softirq %s: %llu runs (%llu by ksoftirqd), avg %llu ns, max %llu ns\n", softirq_names[nr],
+            st.count, st.thread_count, st.count ? st.total_ns / st.count : 0ULL, st.max_ns);
+    }
+}
+
+// Scheduling latency of each CPU since boot, the worst case being the longest non-preemptible stretch
+static void bench_preempt()
+{
+    preempt_stat st;
+    for(uint cpu=0; syscall_preempt_stat(cpu, &st) == 0; cpu++) {
+        printf("preempt cpu %u: %llu preempted, %llu resched, latency avg %llu ns, max %llu ns\n", cpu,
+            st.n_preempt, st.n_resched, st.n_resched ? st.total_latency_ns / st.n_resched : 0ULL, st.max_latency_ns);
+        printf("preempt cpu %u: non-preemptible for at most %llu ns, ending at 0x%x\n", cpu, st.max_off_ns, st.max_off_ip);
+    }
+}
+
+static struct {
+    const char* name;
+    void (*run)();
+} benchmarks[] = {
+    {"syscall", bench_syscall},
+    {"uring", bench_uring},
+    {"spawn", bench_spawn},
+    {"threads", bench_threads_run},
+    {"stat", bench_stat},
+    {"read", bench_read},
+    {"fs", bench_fs},
+    {"softirq", bench_softirq},
+    {"preempt", bench_preempt},
+};
+
+int main(int argc, char* argv[]) {
+    self_path = argv[0];
+    if(argc >= 2 && strcmp(argv[1], "--exit") == 0) {
+        // child of bench_spawn
+        exit(0);
+    }
+    int found = 0;
+    for(uint i=0; i<sizeof(benchmarks)/sizeof(benchmarks[0]); i++) {
+        if(argc < 2 || strcmp(argv[1], benchmarks[i].name) == 0) {
+            benchmarks[i].run();
+            found = 1;
+        }
+    }
+    if(!found) {
+        printf("bench: unknown benchmark %s\n", argv[1]);
+        exit(1);
+    }
+    exit(0);
+}
@@ -8,6 +8,8 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <procspawn.h>
+#include <bcache.h>
 
 _syscall0(SYS_TEST, int, sys_test)
 
@@ -195,6 +197,7 @@ int main(int argc, char* argv[]) {
         if(strcmp(part, "help") == 0) {
             printf("Supported commands:\n");
             printf("cd: changing current dir\n");
+            printf("sync: write cached disk blocks back\n");
             printf("{program name}: Run program named {program name}.elf.\n  Seaching the following paths:\n");
             char** p = PATH;
             while(*p) {
@@ -215,6 +218,8 @@ int main(int argc, char* argv[]) {
                 printf("cd error(%d): %s\n", r, strerror(-r));
             }
 
+        } else if(strcmp(part, "sync") == 0) {
+            syscall_sync();
         } else if(strcmp(part, "systest") == 0) {
             sys_test();
         } else {
@@ -266,11 +271,13 @@ int main(int argc, char* argv[]) {
               program_argv[i] = arg;
             }
 
-            int fork_ret = fork();
+            // create the child and load the program in one go, no fork + exec
+            int spawn_ret = syscall_spawn(program_argv[0], program_argv, environ, NULL, 0);
             int child_exit_status;
 
-            if(fork_ret) {
-                // parent
+            if(spawn_ret < 0) {
+                printf("shell exec error(%d)\n", spawn_ret);
+            } else {
                 while(1) {
                   int wait_ret = wait(&child_exit_status);
                   if(wait_ret < 0) {
@@ -283,11 +290,6 @@ int main(int argc, char* argv[]) {
                       break;
                   }
                 }
-            } else {
-                // child
-                int ret = execve(program_argv[0], program_argv, environ);
-                printf("shell exec error(%d)\n", ret);
-                exit(ret);
             }
             
         }
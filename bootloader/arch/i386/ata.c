@@ -4,57 +4,72 @@ static void ATA_wait_BSY();
 static void ATA_wait_DRQ();
 static void ATA_delay_400ns();
 
-// Read sectors from the primary ATA device using 28bit PIO method 
+#define ATA_CMD_READ_SECTORS 0x20
+#define ATA_CMD_READ_SECTORS_EXT 0x24
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
+#define ATA_CMD_READ_MULTIPLE 0xC4
+#define ATA_CMD_SET_MULTIPLE_MODE 0xC6
+
+// Set up by get_total_sectors()
+static struct {
+    bool identified;
+    bool lba48;
+    uint8_t multiple;       // sectors per DRQ block of READ MULTIPLE, 0 if not enabled
+    uint32_t total_sectors;
+} drive;
+
+// Read sectors from the primary ATA device using PIO method
+// With READ MULTIPLE, each DRQ block moves drive.multiple sectors
 //
 // target: a buffer at least sector_count*512 bytes long 
-// LBA: 0-based Linear Block Address, 28bit LBA shall be between 0 to 0x0FFFFFFF
-// sector_count: How many sectors you want to read. A sectorcount of 0 means 256 sectors = 128K
+// LBA: 0-based Linear Block Address
+// sector_count: How many sectors you want to read, 1 to 256 (LBA28) or 65536 (LBA48)
 //
-static void read_sectors_ATA_28bit_PIO(uint16_t* target, uint32_t LBA, uint8_t sector_count) {
+static void read_sectors_ATA_PIO_cmd(uint16_t* target, uint32_t LBA, uint32_t sector_count) {
     ATA_wait_BSY();
-    // Send 0xE0 for the "master" or 0xF0 for the "slave", ORed with the highest 4 bits of the LBA to port 0x1F6: outb(0x1F6, 0xE0 | (slavebit << 4) | ((LBA >> 24) & 0x0F))
-    outb(0x1F6, 0xE0 | ((LBA >> 24) & 0xF));
-    // Send the sectorcount to port 0x1F2: outb(0x1F2, (unsigned char) count)
-    outb(0x1F2, sector_count);
-    // Send the low 8 bits of the LBA to port 0x1F3: outb(0x1F3, (unsigned char) LBA))
+    if(drive.lba48) {
+        // The high bytes first, each register is a 2 bytes FIFO
+        outb(0x1F6, 0x40);
+        outb(0x1F2, (uint8_t)(sector_count >> 8));
+        outb(0x1F3, (uint8_t)(LBA >> 24));
+        outb(0x1F4, 0);
+        outb(0x1F5, 0);
+    } else {
+        // Send 0xE0 for the "master" ORed with the highest 4 bits of the LBA to port 0x1F6
+        outb(0x1F6, 0xE0 | ((LBA >> 24) & 0xF));
+    }
+    // The maximum sector count wraps to 0
+    outb(0x1F2, (uint8_t) sector_count);
     outb(0x1F3, (uint8_t)LBA);
-    // Send the next 8 bits of the LBA to port 0x1F4: outb(0x1F4, (unsigned char)(LBA >> 8))
     outb(0x1F4, (uint8_t)(LBA >> 8));
-    // Send the next 8 bits of the LBA to port 0x1F5: outb(0x1F5, (unsigned char)(LBA >> 16))
     outb(0x1F5, (uint8_t)(LBA >> 16));
-    // Send the "READ SECTORS" command (0x20) to port 0x1F7: outb(0x1F7, 0x20)
-    outb(0x1F7, 0x20); //Send the read command
-    int count;
-    if(sector_count == 0) {
-        count = 256;
+    if(drive.lba48) {
+        outb(0x1F7, drive.multiple ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_SECTORS_EXT);
     } else {
-        count = sector_count;
+        outb(0x1F7, drive.multiple ? ATA_CMD_READ_MULTIPLE : ATA_CMD_READ_SECTORS);
     }
-    for (int j = 0;j < count;j++) {
+    uint32_t block = drive.multiple ? drive.multiple : 1;
+    for (uint32_t j = 0;j < sector_count;j += block) {
         // Poll for status
         ATA_delay_400ns();
         ATA_wait_BSY();
         ATA_wait_DRQ();
-        // Transfer 256 16-bit values, a uint16_t at a time, into your buffer from I/O port 0x1F0. (In assembler, REP INSW works well for this.)
-        for (int i = 0;i < 256;i++)
-            target[i] = inw(0x1F0);
-        target += 256;
+        uint32_t n = sector_count - j < block ? sector_count - j : block;
+        insw(0x1F0, target, n*256);
+        target += n*256;
     }
 }
 
 void read_sectors_ATA_PIO(void* buf, uint32_t LBA, uint32_t sector_count)
 {
+    get_total_sectors();
+    uint32_t max_count = drive.lba48 ? 65536 : 256;
     while(sector_count) {
-        if(sector_count < 256) {
-            read_sectors_ATA_28bit_PIO((uint16_t*) buf, LBA, sector_count);
-            return;
-        } else {
-            // read 256 sectors
-            read_sectors_ATA_28bit_PIO((uint16_t*) buf, LBA, 0);
-            LBA += 256;
-            sector_count -= 256;
-            buf += 256*512;
-        }
+        uint32_t n = sector_count < max_count ? sector_count : max_count;
+        read_sectors_ATA_PIO_cmd((uint16_t*) buf, LBA, n);
+        LBA += n;
+        sector_count -= n;
+        buf += n*512;
     }
 }
 
@@ -95,25 +110,46 @@ static int8_t ATA_Identify(uint16_t* target) {
 
     // At that point, if ERR is clear, the data is ready to read from the Data port (0x1F0). Read 256 16-bit values, and store them.
     if ((inb(0x1F7) & STATUS_ERR)) return 3;
-    for (int i = 0;i < 256;i++) {
-        target[i] = inw(0x1F0);
-    }
+    insw(0x1F0, target, 256);
     return 0;
 }
 
-// Get count of all sectors available to address using a 28bit LBA
+// Identify the drive once, set up LBA48 and READ MULTIPLE if supported
+// and get count of all sectors available to address
 //
-// return: number of 28bit LBA available
-uint32_t get_total_28bit_sectors() {
+// return: number of sectors, capped to 32 bit LBA
+uint32_t get_total_sectors() {
+    if(drive.identified) {
+        return drive.total_sectors;
+    }
     uint16_t identifier[256];
-    uint8_t ret = ATA_Identify(identifier);
+    int8_t ret = ATA_Identify(identifier);
     if (ret != 0) {
         return ret;
     }
+    drive.identified = true;
     // uint16_t 60 & 61 taken as a uint32_t contain the total number of 28 bit LBA addressable sectors on the drive. (If non-zero, the drive supports LBA28.)
     // uint16_t 100 through 103 taken as a uint64_t contain the total number of 48 bit addressable sectors on the drive. (Probably also proof that LBA48 is supported.)
-    uint32_t max_sector_28bit_lba = (((uint32_t)identifier[61]) << 16) + identifier[60];
-    return max_sector_28bit_lba;
+    drive.total_sectors = (((uint32_t)identifier[61]) << 16) + identifier[60];
+    // uint16_t 83 bit 10: LBA48 supported
+    if((identifier[83] & (1 << 10)) && (identifier[100] || identifier[101] || identifier[102] || identifier[103])) {
+        drive.lba48 = true;
+        drive.total_sectors = (identifier[102] || identifier[103]) ? 0xFFFFFFFF : (((uint32_t)identifier[101]) << 16) + identifier[100];
+    }
+    // uint16_t 47 low byte: max sectors per DRQ block of READ MULTIPLE, 0 if not supported
+    uint8_t max_multiple = identifier[47] & 0xFF;
+    if(max_multiple > 1) {
+        ATA_wait_BSY();
+        outb(0x1F6, 0xA0);
+        outb(0x1F2, max_multiple);
+        outb(0x1F7, ATA_CMD_SET_MULTIPLE_MODE);
+        ATA_delay_400ns();
+        ATA_wait_BSY();
+        if(!(inb(0x1F7) & (STATUS_ERR | STATUS_DF))) {
+            drive.multiple = max_multiple;
+        }
+    }
+    return drive.total_sectors;
 }
 
 
@@ -137,5 +173,5 @@ static void ATA_wait_BSY() {
 }
 static void ATA_wait_DRQ() {
     //Wait fot DRQ or ERR to be 1
-    while (!(inb(0x1F7) & (STATUS_RDY | STATUS_ERR)));
+    while (!(inb(0x1F7) & (STATUS_DRQ | STATUS_ERR)));
 }
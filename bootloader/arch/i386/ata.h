@@ -4,7 +4,7 @@
 #include<stdint.h>
 #include "port_io.h"
 
-// 28 bit ATA PIO disk driver
+// ATA PIO disk driver, 28 or 48 bit LBA
 // From http://learnitonweb.com/2020/05/22/12-developing-an-operating-system-tutorial-episode-6-ata-pio-driver-osdev/
 // Source - https://wiki.osdev.org/ATA_PIO_Mode#x86_Directions
 
@@ -26,6 +26,7 @@ ERR: a 1 indicates that an error occured. An error code has been placed in the e
 #define STATUS_ERR 0x01
 
 void read_sectors_ATA_PIO(void* buf, uint32_t LBA, uint32_t sector_count);
-uint32_t get_total_28bit_sectors();
+// Sectors addressable by a 32 bit LBA, the drive is identified once
+uint32_t get_total_sectors();
 
 #endif
\ No newline at end of file
@@ -53,6 +53,15 @@ static inline uint32_t inl(uint16_t port)
     return ret;
 }
 
+// String I/O of count 16-bit words, REP INSW
+static inline void insw(uint16_t port, void* addr, uint32_t count)
+{
+    asm volatile ( "cld; rep insw"
+                   : "+D"(addr), "+c"(count)
+                   : "d"(port)
+                   : "memory" );
+}
+
 static inline void io_wait(void)
 {
     /* Port 0x80 is used for 'checkpoints' during POST. */
@@ -16,6 +16,8 @@
 // must be in sync of BOOTLOADER_MAX_SIZE in Makefile
 #define BOOTLOADER_SECTORS 32
 #define KERNEL_BOOT_IMG "/boot/simple_os.kernel"
+// Archive of /usr/bin, see initrd.tar in Makefile
+#define INITRD_BOOT_IMG "/boot/initrd.tar"
 
 // Defined in memory.asm
 extern uint16_t MMAP_COUNT;
@@ -23,6 +25,8 @@ extern multiboot_memory_map_t MMAP[];
 
 
 static const char* VGA_FONT_MODULE_CMDLINE = "VGA FONT";
+// must be in sync with INITRD_MODULE_CMDLINE in kernel/include/kernel/ramdisk.h
+static const char* INITRD_MODULE_CMDLINE = "INITRD";
 
 // Load a file from the tar file system
 //
@@ -32,7 +36,7 @@ static const char* VGA_FONT_MODULE_CMDLINE = "VGA FONT";
 //
 // return: file size of the loaded file
 int tar_loopup_lazy(uint32_t LBA, char* filename, unsigned char* buffer) {
-    uint32_t max_lba = get_total_28bit_sectors();
+    uint32_t max_lba = get_total_sectors();
     if (LBA >= max_lba) {
         return TAR_ERR_LBA_GT_MAX_SECTOR;
     }
@@ -127,6 +131,21 @@ void bootloader_main(void) {
     print_memory_hex((char*)&kernel_buffer, sizeof(kernel_buffer), console_print_row++);
     print_str("Kernel size (Little Endian Hex):", console_print_row++, 0);
     print_memory_hex((char*)&kernel_size, sizeof(int), console_print_row++);
+
+    // Load the initial ramdisk right after the kernel image, and pass it as a boot module
+    // The kernel then runs the programs in it without going to the disk
+    uint32_t initrd_addr = ((uint32_t) kernel_buffer + kernel_size + MULTIBOOT_MOD_ALIGN - 1) & ~(MULTIBOOT_MOD_ALIGN - 1);
+    int initrd_size = tar_loopup_lazy(BOOTLOADER_SECTORS, INITRD_BOOT_IMG, (unsigned char*)initrd_addr);
+    if (initrd_size > 0) {
+        ptr_multiboot_info->mods_count++;
+        ptr_multiboot_info->mods_addr -= sizeof(struct multiboot_mod_list);
+        struct multiboot_mod_list* mod = (struct multiboot_mod_list*) ptr_multiboot_info->mods_addr;
+        mod->mod_start = initrd_addr;
+        mod->mod_end = initrd_addr + initrd_size;
+        mod->cmdline = (uint32_t) INITRD_MODULE_CMDLINE;
+        print_str("Initial ramdisk loaded at (Little Endian Hex):", console_print_row++, 0);
+        print_memory_hex((char*)&initrd_addr, sizeof(initrd_addr), console_print_row++);
+    }
     // print_str("First 32 bytes of kernel:", console_print_row++, 0);
     // print_memory(kernel_buffer, 32, console_print_row++, 0);
 
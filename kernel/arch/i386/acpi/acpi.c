@@ -0,0 +1,246 @@
+#include <arch/i386/kernel/acpi.h>
+#include <kernel/paging.h>
+#include <kernel/panic.h>
+#include <string.h>
+#include <stdio.h>
+
+// Ref: ACPI Specification 6.4, Section 5.2
+// Ref: https://wiki.osdev.org/RSDP
+// Ref: https://wiki.osdev.org/MADT
+
+// Root System Description Pointer (ACPI 1.0 part)
+typedef struct rsdp {
+    char signature[8];      // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_paddr;
+} __attribute__((packed)) rsdp;
+
+typedef struct sdt_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) sdt_header;
+
+typedef struct madt {
+    sdt_header header;
+    uint32_t lapic_paddr;
+    uint32_t flags;
+    uint8_t entries[];
+} __attribute__((packed)) madt;
+
+#define MADT_FLAG_PCAT_COMPAT 0x1
+
+enum madt_entry_type {
+    MADT_LAPIC = 0,
+    MADT_IOAPIC = 1,
+    MADT_IRQ_OVERRIDE = 2,
+    MADT_LAPIC_ADDR_OVERRIDE = 5,
+};
+
+typedef struct madt_entry_header {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) madt_entry_header;
+
+typedef struct madt_lapic {
+    madt_entry_header h;
+    uint8_t acpi_processor_id;
+    uint8_t apic_id;
+    uint32_t flags;         // bit 0: enabled, bit 1: online capable
+} __attribute__((packed)) madt_lapic;
+
+typedef struct madt_ioapic {
+    madt_entry_header h;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t paddr;
+    uint32_t gsi_base;
+} __attribute__((packed)) madt_ioapic;
+
+typedef struct madt_irq_override {
+    madt_entry_header h;
+    uint8_t bus;            // always 0 (ISA)
+    uint8_t irq;
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed)) madt_irq_override;
+
+typedef struct madt_lapic_addr_override {
+    madt_entry_header h;
+    uint16_t reserved;
+    uint64_t paddr;
+} __attribute__((packed)) madt_lapic_addr_override;
+
+#define MADT_LAPIC_ENABLED 0x1
+#define MADT_LAPIC_ONLINE_CAPABLE 0x2
+
+// BIOS data area holds the real mode segment of the extended BIOS data area
+#define BDA_EBDA_SEGMENT 0x40E
+
+static struct {
+    bool found;
+    acpi_madt_info info;
+} acpi;
+
+static uint8_t checksum(const void* p, uint size)
+{
+    uint8_t sum = 0;
+    for(uint i = 0; i < size; i++) {
+        sum += ((const uint8_t*) p)[i];
+    }
+    return sum;
+}
+
+// Low memory is always mapped to MAP_MEM_PA_ZERO_TO
+static void* low_memory(uint32_t paddr)
+{
+    return (void*) (paddr + (uint32_t) MAP_MEM_PA_ZERO_TO);
+}
+
+// "The RSDP structure is located by searching on 16-byte boundaries for a valid signature and checksum"
+static rsdp* search_rsdp(uint32_t paddr, uint32_t size)
+{
+    for(uint32_t p = paddr; p + sizeof(rsdp) <= paddr + size; p += 16) {
+        rsdp* r = low_memory(p);
+        if(memcmp(r->signature, "RSD PTR ", 8) == 0 && checksum(r, sizeof(rsdp)) == 0) {
+            return r;
+        }
+    }
+    return NULL;
+}
+
+static rsdp* find_rsdp()
+{
+    // 1. The first 1 KB of the Extended BIOS Data Area
+    uint32_t ebda = (uint32_t) (*(uint16_t*) low_memory(BDA_EBDA_SEGMENT)) << 4;
+    if(ebda) {
+        rsdp* r = search_rsdp(ebda, 1024);
+        if(r) {
+            return r;
+        }
+    }
+    // 2. The BIOS read-only memory space between 0E0000h and 0FFFFFh
+    return search_rsdp(0xE0000, 0x20000);
+}
+
+// Map a whole table into kernel space, the mapping is kept since tables are small and few
+static sdt_header* map_table(uint32_t paddr)
+{
+    sdt_header* h = (sdt_header*) map_physical_memory(paddr, sizeof(sdt_header), false);
+    uint32_t length = h->length;
+    unmap_pages(curr_page_dir(), (uint32_t) h, sizeof(sdt_header));
+    if(length < sizeof(sdt_header)) {
+        return NULL;
+    }
+    h = (sdt_header*) map_physical_memory(paddr, length, false);
+    if(checksum(h, length) != 0) {
+        printf("ACPI: bad checksum for table at 0x%x\n", paddr);
+        unmap_pages(curr_page_dir(), (uint32_t) h, length);
+        return NULL;
+    }
+    return h;
+}
+
+static void parse_madt(madt* m)
+{
+    acpi_madt_info* info = &acpi.info;
+    info->lapic_paddr = m->lapic_paddr;
+    info->has_8259 = m->flags & MADT_FLAG_PCAT_COMPAT;
+
+    uint8_t* p = m->entries;
+    uint8_t* end = (uint8_t*) m + m->header.length;
+    while(p + sizeof(madt_entry_header) <= end) {
+        madt_entry_header* e = (madt_entry_header*) p;
+        if(e->length < sizeof(madt_entry_header) || p + e->length > end) {
+            break;
+        }
+        switch(e->type) {
+        case MADT_LAPIC: {
+            madt_lapic* l = (madt_lapic*) e;
+            if((l->flags & (MADT_LAPIC_ENABLED|MADT_LAPIC_ONLINE_CAPABLE)) && info->n_cpu < ACPI_MAX_CPU) {
+                info->cpu_apic_ids[info->n_cpu++] = l->apic_id;
+            }
+            break;
+        }
+        case MADT_IOAPIC: {
+            madt_ioapic* io = (madt_ioapic*) e;
+            if(info->n_ioapic < ACPI_MAX_IOAPIC) {
+                info->ioapics[info->n_ioapic++] = (acpi_ioapic) {
+                    .id = io->id, .paddr = io->paddr, .gsi_base = io->gsi_base
+                };
+            }
+            break;
+        }
+        case MADT_IRQ_OVERRIDE: {
+            madt_irq_override* o = (madt_irq_override*) e;
+            if(info->n_irq_override < ACPI_MAX_IRQ_OVERRIDE) {
+                info->irq_overrides[info->n_irq_override++] = (acpi_irq_override) {
+                    .irq = o->irq, .gsi = o->gsi, .flags = o->flags
+                };
+            }
+            break;
+        }
+        case MADT_LAPIC_ADDR_OVERRIDE: {
+            madt_lapic_addr_override* o = (madt_lapic_addr_override*) e;
+            if(o->paddr < 0x100000000ULL) {
+                info->lapic_paddr = (uint32_t) o->paddr;
+            }
+            break;
+        }
+        default:
+            break;
+        }
+        p += e->length;
+    }
+}
+
+// Find and parse the MADT
+//@return 0 on success, -1 if ACPI or the MADT is not available
+int init_acpi()
+{
+    rsdp* r = find_rsdp();
+    if(r == NULL) {
+        printf("ACPI: RSDP not found\n");
+        return -1;
+    }
+    sdt_header* rsdt = map_table(r->rsdt_paddr);
+    if(rsdt == NULL || memcmp(rsdt->signature, "RSDT", 4) != 0) {
+        printf("ACPI: RSDT not found\n");
+        return -1;
+    }
+
+    uint n_entries = (rsdt->length - sizeof(sdt_header)) / sizeof(uint32_t);
+    uint32_t* entries = (uint32_t*) (rsdt + 1);
+    for(uint i = 0; i < n_entries; i++) {
+        sdt_header* h = map_table(entries[i]);
+        if(h == NULL) {
+            continue;
+        }
+        if(memcmp(h->signature, "APIC", 4) == 0) {
+            parse_madt((madt*) h);
+            acpi.found = true;
+            break;
+        }
+        unmap_pages(curr_page_dir(), (uint32_t) h, h->length);
+    }
+
+    if(!acpi.found) {
+        printf("ACPI: MADT not found\n");
+        return -1;
+    }
+    printf("ACPI: %u CPU, %u IOAPIC, LAPIC at 0x%x\n", acpi.info.n_cpu, acpi.info.n_ioapic, acpi.info.lapic_paddr);
+    return 0;
+}
+
+const acpi_madt_info* acpi_madt()
+{
+    return acpi.found ? &acpi.info : NULL;
+}
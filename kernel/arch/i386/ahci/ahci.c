@@ -0,0 +1,399 @@
+#include <kernel/ahci.h>
+#include <kernel/block_io.h>
+#include <kernel/heap.h>
+#include <kernel/lock.h>
+#include <kernel/paging.h>
+#include <kernel/panic.h>
+#include <kernel/pci.h>
+#include <kernel/process.h>
+#include <arch/i386/kernel/isr.h>
+#include <arch/i386/kernel/irq.h>
+#include <stdio.h>
+#include <string.h>
+
+#define AHCI_MAX_PORTS 32
+#define AHCI_MAX_SLOTS 32
+// Sectors per command, bigger requests are split into commands in flight together
+#define AHCI_MAX_SECTORS_PER_CMD 128
+// One PRD per page touched, the sectors of an unaligned buffer span one more page
+// Scattered buffers may need more, the command then carries fewer sectors
+#define AHCI_MAX_PRDT (AHCI_MAX_SECTORS_PER_CMD*512/PAGE_SIZE + 1)
+// Requests taken at once from the block request queue
+#define AHCI_QUEUE_DEPTH 8
+
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_DMA_FUA_EXT 0x3D
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+#define ATA_CMD_IDENTIFY 0xEC
+
+#define ATA_DEVICE_LBA 0x40
+#define ATA_DEVICE_FUA 0x80 // NCQ write goes to the media before completion
+
+typedef struct hba_cmd_table {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t rsv[48];
+    hba_prdt_entry prdt[AHCI_MAX_PRDT];
+} __attribute__ ((packed)) hba_cmd_table;
+
+// Command tables shall be 128 bytes aligned
+#define AHCI_CMD_TABLE_SIZE ((sizeof(hba_cmd_table) + 127) & ~127)
+
+typedef struct ahci_port {
+    hba_port* regs;
+    uint port_no;
+    bool ncq;
+    uint n_slot;                        // Commands in flight at most
+    uint64_t n_sectors;
+    hba_cmd_header* cmd_list;
+    hba_cmd_table* cmd_tables[AHCI_MAX_SLOTS];
+    spinlock lk;                        // Guards the fields below
+    uint32_t busy;                      // Slots owned by a request
+    uint32_t issued;                    // Slots issued and not completed
+    uint32_t failed;                    // Slots completed with an error
+} ahci_port;
+
+static struct {
+    hba_mem* abar;
+    ahci_port* ports[AHCI_MAX_PORTS];
+} ahci;
+
+static void port_stop(hba_port* p)
+{
+    p->cmd &= ~(AHCI_PxCMD_ST | AHCI_PxCMD_FRE);
+    // the HBA has 500ms for each, there is no timer to rely on here
+    while(p->cmd & (AHCI_PxCMD_CR | AHCI_PxCMD_FR));
+}
+
+static void port_start(hba_port* p)
+{
+    while(p->cmd & AHCI_PxCMD_CR);
+    p->cmd |= AHCI_PxCMD_FRE;
+    p->cmd |= AHCI_PxCMD_ST;
+}
+
+// Note which commands the HBA is done with, caller shall hold port->lk
+static void port_complete(ahci_port* port)
+{
+    hba_port* p = port->regs;
+    uint32_t is = p->is;
+    p->is = is;
+    if(is & AHCI_PxIS_ERROR) {
+        // the failed command can't be told apart from the other queued ones,
+        // so fail all of them and restart the port, which also clears SACT and CI
+        printf("AHCI: port %u error, IS 0x%x TFD 0x%x SERR 0x%x\n", port->port_no, is, p->tfd, p->serr);
+        port->failed |= port->issued;
+        port->issued = 0;
+        port_stop(p);
+        p->serr = p->serr;
+        p->is = p->is;
+        port_start(p);
+        return;
+    }
+    port->issued &= p->sact | p->ci;
+}
+
+static void ahci_irq_handler(trapframe* tf)
+{
+    UNUSED_ARG(tf);
+    uint32_t is = ahci.abar->is;
+    for(uint i=0; i<AHCI_MAX_PORTS; i++) {
+        ahci_port* port = ahci.ports[i];
+        if(!(is & (1u << i)) || port == NULL) {
+            continue;
+        }
+        spin_lock(&port->lk);
+        port_complete(port);
+        wakeup(port);
+        spin_unlock(&port->lk);
+    }
+    // port interrupt status first, then the HBA one
+    ahci.abar->is = is;
+}
+
+// Fill the command table of the slot, return false if DMA can't reach the fragments
+static bool build_command(ahci_port* port, uint slot, uint8_t command, const blk_frag* frags, uint32_t n_frag, uint64_t LBA, uint32_t sector_count, bool write)
+{
+    hba_cmd_table* t = port->cmd_tables[slot];
+    memset(t, 0, sizeof(hba_cmd_table));
+
+    for(uint32_t i=0; i<n_frag; i++) {
+        // PRD addresses and byte counts shall be even
+        if((frags[i].paddr | frags[i].len) & 1) {
+            return false;
+        }
+        t->prdt[i].dba = frags[i].paddr;
+        t->prdt[i].dbc = frags[i].len - 1;
+    }
+
+    fis_reg_h2d* fis = (fis_reg_h2d*) t->cfis;
+    fis->fis_type = FIS_TYPE_REG_H2D;
+    fis->pmport_c = FIS_H2D_COMMAND;
+    fis->command = command;
+    if(command == ATA_CMD_READ_FPDMA_QUEUED || command == ATA_CMD_WRITE_FPDMA_QUEUED) {
+        // the sector count goes to the features, the count register holds the tag
+        fis->featurel = (uint8_t) sector_count;
+        fis->featureh = (uint8_t) (sector_count >> 8);
+        fis->countl = slot << 3;
+        fis->device = ATA_DEVICE_LBA | (write ? ATA_DEVICE_FUA : 0);
+    } else if(command != ATA_CMD_IDENTIFY) {
+        fis->countl = (uint8_t) sector_count;
+        fis->counth = (uint8_t) (sector_count >> 8);
+        fis->device = ATA_DEVICE_LBA;
+    }
+    fis->lba0 = (uint8_t) LBA;
+    fis->lba1 = (uint8_t) (LBA >> 8);
+    fis->lba2 = (uint8_t) (LBA >> 16);
+    fis->lba3 = (uint8_t) (LBA >> 24);
+    fis->lba4 = (uint8_t) (LBA >> 32);
+    fis->lba5 = (uint8_t) (LBA >> 40);
+
+    hba_cmd_header* h = &port->cmd_list[slot];
+    h->flags = sizeof(fis_reg_h2d) / sizeof(uint32_t) | (write ? AHCI_CMD_HEADER_WRITE : 0);
+    h->prdtl = n_frag;
+    h->prdbc = 0;
+    return true;
+}
+
+// Caller shall hold port->lk
+static void issue(ahci_port* port, uint slot)
+{
+    uint32_t bit = 1u << slot;
+    port->issued |= bit;
+    if(port->ncq) {
+        port->regs->sact = bit;
+    }
+    port->regs->ci = bit;
+}
+
+// Split the request into commands, keep as many as possible in flight,
+// and return once all of them completed
+static int64_t ahci_transfer(block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA, bool write)
+{
+    ahci_port* port = (ahci_port*) storage->internal_info;
+    uint32_t block_count = blk_seg_bytes(segs, n_seg) / 512;
+    if(LBA >= storage->block_count || LBA + block_count > storage->block_count) {
+        return -1;
+    }
+    blk_seg_iter it;
+    blk_seg_iter_init(&it, segs, n_seg);
+    int64_t bytes = 512 * block_count;
+    uint8_t command;
+    if(port->ncq) {
+        command = write ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_READ_FPDMA_QUEUED;
+    } else {
+        command = write ? ATA_CMD_WRITE_DMA_FUA_EXT : ATA_CMD_READ_DMA_EXT;
+    }
+    // at boot, before any process exists, poll
+    bool polling = curr_proc() == NULL;
+    uint32_t mine = 0;
+    bool ok = true;
+
+    spin_lock(&port->lk);
+    while(block_count > 0 || mine != 0) {
+        uint32_t done = mine & ~port->issued;
+        if(done) {
+            if(port->failed & done) {
+                ok = false;
+            }
+            port->failed &= ~done;
+            port->busy &= ~done;
+            mine &= ~done;
+            // someone may be waiting for a free slot
+            wakeup(port);
+            continue;
+        }
+        uint32_t free_slots = ~port->busy & (port->n_slot == AHCI_MAX_SLOTS ? 0xFFFFFFFF : (1u << port->n_slot) - 1);
+        if(block_count > 0 && free_slots) {
+            uint slot = __builtin_ctz(free_slots);
+            port->busy |= 1u << slot;
+            // page tables may be mapped in, not with the spinlock held
+            spin_unlock(&port->lk);
+            blk_frag frags[AHCI_MAX_PRDT];
+            uint32_t n_frag;
+            uint32_t n = blk_seg_iter_map(&it, 512, AHCI_MAX_SECTORS_PER_CMD, frags, AHCI_MAX_PRDT, &n_frag);
+            bool built = n > 0 && build_command(port, slot, command, frags, n_frag, LBA, n, write);
+            spin_lock(&port->lk);
+            if(!built) {
+                port->busy &= ~(1u << slot);
+                wakeup(port);
+                ok = false;
+                block_count = 0;
+                continue;
+            }
+            issue(port, slot);
+            mine |= 1u << slot;
+            LBA += n;
+            block_count -= n;
+            continue;
+        }
+        // wait for one of ours to complete, or for a free slot
+        if(polling) {
+            port_complete(port);
+        } else {
+            sleep(port, &port->lk);
+        }
+    }
+    spin_unlock(&port->lk);
+    return ok ? bytes : -1;
+}
+
+static int64_t ahci_readv_blocks(block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA)
+{
+    return ahci_transfer(storage, segs, n_seg, LBA, false);
+}
+
+static int64_t ahci_writev_blocks(block_storage* storage, uint32_t LBA, const blk_seg* segs, uint32_t n_seg)
+{
+    return ahci_transfer(storage, segs, n_seg, LBA, true);
+}
+
+// Execute IDENTIFY with slot 0 by polling, before interrupts are enabled
+static bool port_identify(ahci_port* port, uint16_t* identifier)
+{
+    blk_seg seg = {.buff = identifier, .len = 512};
+    blk_seg_iter it;
+    blk_seg_iter_init(&it, &seg, 1);
+    blk_frag frags[2];
+    uint32_t n_frag;
+    blk_seg_iter_map(&it, 512, 1, frags, 2, &n_frag);
+    if(!build_command(port, 0, ATA_CMD_IDENTIFY, frags, n_frag, 0, 1, false)) {
+        return false;
+    }
+    hba_port* p = port->regs;
+    while(p->tfd & (AHCI_PxTFD_BSY | AHCI_PxTFD_DRQ));
+    p->ci = 1;
+    while((p->ci & 1) && !(p->is & AHCI_PxIS_ERROR));
+    bool ok = !(p->is & AHCI_PxIS_ERROR) && !(p->tfd & AHCI_PxTFD_ERR);
+    p->is = p->is;
+    return ok;
+}
+
+static void init_port(uint port_no, bool hba_ncq, uint hba_n_slot)
+{
+    hba_port* p = &ahci.abar->ports[port_no];
+    uint32_t ssts = p->ssts;
+    if((ssts & 0xF) != AHCI_PxSSTS_DET_PRESENT || ((ssts >> 8) & 0xF) != AHCI_PxSSTS_IPM_ACTIVE) {
+        return;
+    }
+    if(p->sig != AHCI_SIG_ATA) {
+        // e.g. ATAPI, port multiplier
+        return;
+    }
+
+    ahci_port* port = kmalloc(sizeof(ahci_port));
+    memset(port, 0, sizeof(ahci_port));
+    port->regs = p;
+    port->port_no = port_no;
+
+    port_stop(p);
+    // 1KiB command list followed by the 256 bytes FIS receive area in one page
+    uint32_t paddr;
+    uint8_t* page = (uint8_t*) alloc_pages_consecutive_frames(curr_page_dir(), 1, true, &paddr);
+    memset(page, 0, PAGE_SIZE);
+    port->cmd_list = (hba_cmd_header*) page;
+    p->clb = paddr;
+    p->clbu = 0;
+    p->fb = paddr + 1024;
+    p->fbu = 0;
+    uint table_pages = PAGE_COUNT_FROM_BYTES(AHCI_CMD_TABLE_SIZE * AHCI_MAX_SLOTS);
+    uint8_t* tables = (uint8_t*) alloc_pages_consecutive_frames(curr_page_dir(), table_pages, true, &paddr);
+    for(uint i=0; i<AHCI_MAX_SLOTS; i++) {
+        port->cmd_tables[i] = (hba_cmd_table*) (tables + i * AHCI_CMD_TABLE_SIZE);
+        port->cmd_list[i].ctba = paddr + i * AHCI_CMD_TABLE_SIZE;
+        port->cmd_list[i].ctbau = 0;
+    }
+    p->serr = p->serr;
+    p->is = p->is;
+    port_start(p);
+
+    uint16_t* identifier = kmalloc(512);
+    if(!port_identify(port, identifier)) {
+        printf("AHCI: port %u IDENTIFY failed\n", port_no);
+        kfree(identifier);
+        port_stop(p);
+        kfree(port);
+        return;
+    }
+    // uint16_t 100 through 103: number of 48 bit addressable sectors
+    port->n_sectors = ((uint64_t) identifier[103] << 48) | ((uint64_t) identifier[102] << 32)
+        | ((uint64_t) identifier[101] << 16) | identifier[100];
+    if(port->n_sectors == 0) {
+        port->n_sectors = (((uint32_t)identifier[61]) << 16) + identifier[60];
+    }
+    // uint16_t 76 bit 8: NCQ supported, uint16_t 75: queue depth - 1
+    port->ncq = hba_ncq && (identifier[76] & (1 << 8));
+    port->n_slot = 1;
+    if(port->ncq) {
+        uint depth = (identifier[75] & 0x1F) + 1;
+        port->n_slot = depth < hba_n_slot ? depth : hba_n_slot;
+    }
+    kfree(identifier);
+
+    p->ie = AHCI_PxIS_DHRS | AHCI_PxIS_PSS | AHCI_PxIS_SDBS | AHCI_PxIS_ERROR;
+    ahci.ports[port_no] = port;
+    printf("AHCI: port %u, %llu sectors, %s, %u commands in flight\n", port_no, port->n_sectors,
+        port->ncq ? "NCQ" : "no NCQ", port->n_slot);
+}
+
+void init_ahci(uint8_t bus, uint8_t device, uint8_t function)
+{
+    // only support one AHCI controller
+    if(ahci.abar != NULL) {
+        return;
+    }
+    uint16_t command = PCI_COMMAND(bus, device, function);
+    command |= PCI_COMMAND_MEMORY | PCI_COMMAND_BUS_MASTER;
+    command &= ~PCI_COMMAND_INT_DISABLE;
+    PCI_W_COMMAND(bus, device, function, command);
+
+    uint32_t bar5 = PCI_BAR_5(bus, device, function);
+    // Make sure BAR5 is memory space address
+    PANIC_ASSERT(!(bar5 & 1));
+    ahci.abar = (hba_mem*) map_physical_memory(bar5 & ~0xF, sizeof(hba_mem), true);
+    printf("AHCI ABAR: 0x%x\n", bar5 & ~0xF);
+
+    hba_mem* hba = ahci.abar;
+    hba->ghc |= AHCI_GHC_AE;
+    uint32_t cap = hba->cap;
+    uint32_t pi = hba->pi;
+    for(uint i=0; i<AHCI_MAX_PORTS; i++) {
+        if(pi & (1u << i)) {
+            init_port(i, (cap & AHCI_CAP_SNCQ) != 0, AHCI_CAP_NCS(cap));
+        }
+    }
+
+    // Prefer MSI, otherwise use the interrupt line
+    int msi_vector = pci_enable_msi(bus, device, function, ahci_irq_handler);
+    if(msi_vector >= 0) {
+        printf("AHCI is using MSI vector %u\n", msi_vector);
+    } else {
+        uint8_t irq = PCI_INT_LINE(bus,device,function);
+        printf("AHCI is using IRQ(%u)\n", irq);
+        register_interrupt_handler(IRQ_TO_INTERRUPT(irq), ahci_irq_handler);
+        irq_enable_pci(irq);
+    }
+    hba->is = hba->is;
+    hba->ghc |= AHCI_GHC_IE;
+}
+
+void ahci_add_block_storage()
+{
+    for(uint i=0; i<AHCI_MAX_PORTS; i++) {
+        ahci_port* port = ahci.ports[i];
+        if(port == NULL) {
+            continue;
+        }
+        block_storage storage = (block_storage) {
+            .type=BLK_STORAGE_TYP_AHCI_SATA,
+            .block_size=512,
+            .block_count=port->n_sectors > UINT32_MAX ? UINT32_MAX : (uint32_t) port->n_sectors,
+            .dev_readv_blocks=ahci_readv_blocks,
+            .dev_writev_blocks=ahci_writev_blocks,
+            .queue_depth=AHCI_QUEUE_DEPTH,
+            .internal_info=port
+        };
+        add_block_storage(&storage);
+    }
+}
@@ -0,0 +1,106 @@
+#include <arch/i386/kernel/ioapic.h>
+#include <kernel/paging.h>
+#include <kernel/lock.h>
+#include <stdio.h>
+
+// Ref: Intel 82093AA I/O Advanced Programmable Interrupt Controller datasheet
+// Ref: xv6/ioapic.c
+
+// Memory mapped registers, select a register by writing its index to IOREGSEL
+// then read/write it through IOWIN
+#define IOREGSEL (0x00/4)
+#define IOWIN    (0x10/4)
+
+#define REG_ID     0x00
+#define REG_VER    0x01
+#define REG_TABLE  0x10  // Redirection table base, two registers per entry
+
+// Redirection table entry, low 32 bits
+#define INT_MASKED    0x00010000  // Interrupt disabled
+#define INT_LEVEL     0x00008000  // Level-triggered (vs edge-)
+#define INT_ACTIVELOW 0x00002000  // Active low (vs high)
+// high 32 bits
+#define INT_DEST_SHIFT 24
+
+typedef struct ioapic {
+    volatile uint32_t* regs;
+    uint32_t gsi_base;
+    uint32_t n_pins;
+} ioapic;
+
+static struct {
+    ioapic ioapics[ACPI_MAX_IOAPIC];
+    uint n_ioapic;
+    spinlock lk;    // IOREGSEL/IOWIN pair is not atomic
+} ioapic_state;
+
+static uint32_t ioapic_read(ioapic* io, uint32_t reg)
+{
+    io->regs[IOREGSEL] = reg;
+    return io->regs[IOWIN];
+}
+
+static void ioapic_write(ioapic* io, uint32_t reg, uint32_t value)
+{
+    io->regs[IOREGSEL] = reg;
+    io->regs[IOWIN] = value;
+}
+
+static ioapic* ioapic_of_gsi(uint32_t gsi)
+{
+    for(uint i = 0; i < ioapic_state.n_ioapic; i++) {
+        ioapic* io = &ioapic_state.ioapics[i];
+        if(gsi >= io->gsi_base && gsi < io->gsi_base + io->n_pins) {
+            return io;
+        }
+    }
+    return NULL;
+}
+
+// Map all IOAPICs described by the MADT and mask all their pins
+//@return number of IOAPICs initialized
+int init_ioapic(const acpi_madt_info* madt)
+{
+    for(uint i = 0; i < madt->n_ioapic; i++) {
+        ioapic* io = &ioapic_state.ioapics[ioapic_state.n_ioapic];
+        io->regs = (volatile uint32_t*) map_physical_memory(madt->ioapics[i].paddr, PAGE_SIZE, true);
+        io->gsi_base = madt->ioapics[i].gsi_base;
+        io->n_pins = ((ioapic_read(io, REG_VER) >> 16) & 0xFF) + 1;
+        for(uint32_t pin = 0; pin < io->n_pins; pin++) {
+            ioapic_write(io, REG_TABLE + 2*pin, INT_MASKED);
+            ioapic_write(io, REG_TABLE + 2*pin + 1, 0);
+        }
+        printf("IOAPIC: ID %u at 0x%x, GSI %u-%u\n", madt->ioapics[i].id, madt->ioapics[i].paddr,
+            io->gsi_base, io->gsi_base + io->n_pins - 1);
+        ioapic_state.n_ioapic++;
+    }
+    return ioapic_state.n_ioapic;
+}
+
+// Deliver global system interrupt gsi as vector to the local APIC apic_id
+//@return 0 on success, -1 if no IOAPIC handles gsi
+int ioapic_route(uint32_t gsi, uint8_t vector, uint8_t apic_id, bool level_triggered, bool active_low, bool masked)
+{
+    ioapic* io = ioapic_of_gsi(gsi);
+    if(io == NULL) {
+        return -1;
+    }
+    uint32_t pin = gsi - io->gsi_base;
+    uint32_t low = vector;
+    if(level_triggered) {
+        low |= INT_LEVEL;
+    }
+    if(active_low) {
+        low |= INT_ACTIVELOW;
+    }
+    if(masked) {
+        low |= INT_MASKED;
+    }
+    spin_lock(&ioapic_state.lk);
+    // mask while changing the destination, then write the low half last
+    ioapic_write(io, REG_TABLE + 2*pin, INT_MASKED);
+    ioapic_write(io, REG_TABLE + 2*pin + 1, (uint32_t) apic_id << INT_DEST_SHIFT);
+    ioapic_write(io, REG_TABLE + 2*pin, low);
+    spin_unlock(&ioapic_state.lk);
+    return 0;
+}
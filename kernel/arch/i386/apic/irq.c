@@ -0,0 +1,176 @@
+#include <arch/i386/kernel/irq.h>
+#include <arch/i386/kernel/isr.h>
+#include <arch/i386/kernel/pic.h>
+#include <arch/i386/kernel/acpi.h>
+#include <arch/i386/kernel/lapic.h>
+#include <arch/i386/kernel/ioapic.h>
+#include <arch/i386/kernel/cpu.h>
+#include <kernel/lock.h>
+#include <stdio.h>
+
+// Route legacy IRQ lines through the IOAPIC if there is one, otherwise through the 8259 PIC
+// Ref: https://wiki.osdev.org/APIC
+// Ref: https://wiki.osdev.org/IOAPIC
+
+enum irq_mode {
+    IRQ_MODE_PIC = 0,
+    IRQ_MODE_IOAPIC
+};
+
+typedef struct irq_line {
+    bool enabled;
+    bool level_triggered;
+    bool active_low;
+    uint32_t gsi;           // IOAPIC input
+    uint cpu_id;            // index into cpus[] receiving the interrupt
+} irq_line;
+
+static struct {
+    enum irq_mode mode;
+    irq_line lines[N_IRQ];
+    uint n_msi_vector;
+    spinlock lk;
+} irq;
+
+static void apply_ioapic_route(uint8_t irq_no)
+{
+    irq_line* l = &irq.lines[irq_no];
+    ioapic_route(l->gsi, IRQ_TO_INTERRUPT(irq_no), cpus[l->cpu_id].apic_id, l->level_triggered, l->active_low, !l->enabled);
+}
+
+// ISA IRQs are edge triggered and active high, unless the MADT says otherwise
+static void init_isa_lines(const acpi_madt_info* madt)
+{
+    for(uint i = 0; i < N_IRQ; i++) {
+        irq.lines[i].gsi = i;
+    }
+    for(uint i = 0; i < madt->n_irq_override; i++) {
+        const acpi_irq_override* o = &madt->irq_overrides[i];
+        if(o->irq >= N_IRQ) {
+            continue;
+        }
+        irq_line* l = &irq.lines[o->irq];
+        l->gsi = o->gsi;
+        l->active_low = (o->flags & ACPI_INTI_POLARITY_MASK) == ACPI_INTI_POLARITY_LOW;
+        l->level_triggered = (o->flags & ACPI_INTI_TRIGGER_MASK) == ACPI_INTI_TRIGGER_LEVEL;
+    }
+}
+
+// Discover the local APIC and IOAPICs from ACPI, switch IRQ delivery to the IOAPIC when found
+// The PIC (already remapped by isr_install) stays in use if anything is missing
+void init_irq()
+{
+    if(init_acpi() < 0) {
+        printf("IRQ: no ACPI MADT, using PIC\n");
+        return;
+    }
+    const acpi_madt_info* madt = acpi_madt();
+    init_lapic(madt->lapic_paddr);
+    for(uint i = 0; i < madt->n_cpu; i++) {
+        register_cpu(madt->cpu_apic_ids[i]);
+    }
+    lapic_init_cpu();
+
+    if(init_ioapic(madt) == 0) {
+        printf("IRQ: no IOAPIC, using PIC\n");
+        return;
+    }
+    init_isa_lines(madt);
+
+    // Keep IRQs enabled so far (e.g. by drivers initialized earlier) working
+    for(uint8_t i = 0; i < N_IRQ; i++) {
+        if(irq.lines[i].enabled) {
+            apply_ioapic_route(i);
+        }
+    }
+    PIC_disable();
+    irq.mode = IRQ_MODE_IOAPIC;
+    printf("IRQ: using IOAPIC\n");
+}
+
+bool irq_uses_apic()
+{
+    return irq.mode == IRQ_MODE_IOAPIC;
+}
+
+static void set_enabled(uint8_t irq_no, bool enabled)
+{
+    if(irq_no >= N_IRQ) {
+        return;
+    }
+    spin_lock(&irq.lk);
+    irq.lines[irq_no].enabled = enabled;
+    if(irq.mode == IRQ_MODE_IOAPIC) {
+        apply_ioapic_route(irq_no);
+    } else if(enabled) {
+        IRQ_clear_mask(irq_no);
+    } else {
+        IRQ_set_mask(irq_no);
+    }
+    spin_unlock(&irq.lk);
+}
+
+void irq_enable(uint8_t irq_no)
+{
+    set_enabled(irq_no, true);
+}
+
+// PCI INTx lines are level triggered and shared.
+// Polarity comes from the ACPI _PRT which needs an AML interpreter, assume active high
+// as the link devices of QEMU (and most emulators) declare
+void irq_enable_pci(uint8_t irq_no)
+{
+    if(irq_no >= N_IRQ) {
+        return;
+    }
+    spin_lock(&irq.lk);
+    irq.lines[irq_no].level_triggered = true;
+    irq.lines[irq_no].active_low = false;
+    spin_unlock(&irq.lk);
+    set_enabled(irq_no, true);
+}
+
+void irq_disable(uint8_t irq_no)
+{
+    set_enabled(irq_no, false);
+}
+
+// Deliver irq to CPU cpu_id, only possible with the IOAPIC
+//@return 0 on success, -1 if not supported
+int irq_set_affinity(uint8_t irq_no, uint cpu_id)
+{
+    if(irq_no >= N_IRQ || cpu_id >= n_cpu || irq.mode != IRQ_MODE_IOAPIC) {
+        return -1;
+    }
+    spin_lock(&irq.lk);
+    irq.lines[irq_no].cpu_id = cpu_id;
+    apply_ioapic_route(irq_no);
+    spin_unlock(&irq.lk);
+    return 0;
+}
+
+// Acknowledge irq, so that the same line can interrupt again
+void irq_eoi(uint8_t irq_no)
+{
+    if(irq.mode == IRQ_MODE_IOAPIC) {
+        lapic_eoi();
+    } else {
+        PIC_sendEOI(irq_no);
+    }
+}
+
+// Reserve an interrupt vector for MSI
+//@return the vector, or -1 if MSI is not available or all vectors are used
+int alloc_msi_vector()
+{
+    if(!lapic_available()) {
+        return -1;
+    }
+    spin_lock(&irq.lk);
+    int vector = -1;
+    if(irq.n_msi_vector < N_MSI_VECTOR) {
+        vector = MSI_VECTOR_BASE + irq.n_msi_vector++;
+    }
+    spin_unlock(&irq.lk);
+    return vector;
+}
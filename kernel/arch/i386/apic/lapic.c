@@ -0,0 +1,210 @@
+#include <arch/i386/kernel/lapic.h>
+#include <arch/i386/kernel/cpu.h>
+#include <arch/i386/kernel/isr.h>
+#include <arch/i386/kernel/port_io.h>
+#include <kernel/paging.h>
+#include <kernel/time.h>
+#include <kernel/panic.h>
+#include <kernel/cpu.h>
+#include <stdio.h>
+
+// Ref: xv6/lapic.c
+// Ref: Intel SDM Vol. 3A, Chapter 10 Advanced Programmable Interrupt Controller
+
+// Local APIC registers, divided by 4 for use as uint32_t[] indices
+#define ID      (0x0020/4)   // ID
+#define VER     (0x0030/4)   // Version
+#define TPR     (0x0080/4)   // Task Priority
+#define EOI     (0x00B0/4)   // EOI
+#define SVR     (0x00F0/4)   // Spurious Interrupt Vector
+    #define ENABLE     0x00000100   // Unit Enable
+#define ESR     (0x0280/4)   // Error Status
+#define ICRLO   (0x0300/4)   // Interrupt Command
+    #define INIT       0x00000500   // INIT/RESET
+    #define STARTUP    0x00000600   // Startup IPI
+    #define DELIVS     0x00001000   // Delivery status
+    #define ASSERT     0x00004000   // Assert interrupt (vs deassert)
+    #define DEASSERT   0x00000000
+    #define LEVEL      0x00008000   // Level triggered
+#define ICRHI   (0x0310/4)   // Interrupt Command [63:32]
+#define TIMER   (0x0320/4)   // Local Vector Table 0 (TIMER)
+    #define PERIODIC   0x00020000   // Periodic
+    #define ONESHOT    0x00000000
+#define PCINT   (0x0340/4)   // Performance Counter LVT
+#define LINT0   (0x0350/4)   // Local Vector Table 1 (LINT0)
+#define LINT1   (0x0360/4)   // Local Vector Table 2 (LINT1)
+#define ERROR   (0x0370/4)   // Local Vector Table 3 (ERROR)
+    #define MASKED     0x00010000   // Interrupt masked
+#define TICR    (0x0380/4)   // Timer Initial Count
+#define TCCR    (0x0390/4)   // Timer Current Count
+#define TDCR    (0x03E0/4)   // Timer Divide Configuration
+    #define DIVIDE_16  0x3
+
+// CMOS ports and the warm reset vector (40:67) used by the universal startup algorithm
+#define CMOS_PORT 0x70
+#define CMOS_RETURN 0x71
+#define WARM_RESET_VECTOR (0x467 + (uint32_t) MAP_MEM_PA_ZERO_TO)
+
+static struct {
+    volatile uint32_t* regs;
+    uint32_t timer_ticks_per_ms;   // LAPIC timer ticks (divided by 16) per millisecond
+} lapic;
+
+static inline uint32_t lapic_read(uint index)
+{
+    return lapic.regs[index];
+}
+
+static inline void lapic_write(uint index, uint32_t value)
+{
+    lapic.regs[index] = value;
+    lapic.regs[ID]; // wait for write to finish, by reading
+}
+
+// Busy wait using the TSC
+void udelay(uint32_t us)
+{
+    uint64_t cycles = (uint64_t) cpu_freq() / 1000000 * us;
+    uint64_t t0 = rdtsc();
+    while(rdtsc() - t0 < cycles) {
+        asm volatile("pause");
+    }
+}
+
+static void reschedule_callback(trapframe* r)
+{
+    // Nothing to do, the IPI is only used to wake a halting CPU
+    UNUSED_ARG(r);
+}
+
+// Map the local APIC registers, shared by all CPUs at the same physical address
+void init_lapic(uint32_t lapic_paddr)
+{
+    lapic.regs = (volatile uint32_t*) map_physical_memory(lapic_paddr, PAGE_SIZE, true);
+    register_interrupt_handler(IPI_RESCHEDULE_VECTOR, reschedule_callback);
+    printf("LAPIC: mapped at 0x%x, version 0x%x\n", lapic_paddr, lapic_read(VER) & 0xFF);
+}
+
+int lapic_available()
+{
+    return lapic.regs != NULL;
+}
+
+uint lapic_id()
+{
+    return lapic_read(ID) >> 24;
+}
+
+// Enable the local APIC of the calling CPU
+void lapic_init_cpu()
+{
+    // Enable local APIC; set spurious interrupt vector.
+    lapic_write(SVR, ENABLE | LAPIC_SPURIOUS_VECTOR);
+
+    // The BSP keeps LINT0/LINT1 as configured by the firmware (virtual wire mode),
+    // so the legacy PIC can still deliver through it
+    if(curr_cpu()->id != 0) {
+        lapic_write(LINT0, MASKED);
+        lapic_write(LINT1, MASKED);
+    }
+
+    // Disable performance counter overflow interrupts
+    // on machines that provide that interrupt entry.
+    if(((lapic_read(VER)>>16) & 0xFF) >= 4) {
+        lapic_write(PCINT, MASKED);
+    }
+
+    // Map error interrupt to the spurious vector, we don't act on it
+    lapic_write(ERROR, LAPIC_SPURIOUS_VECTOR);
+
+    // Clear error status register (requires back-to-back writes).
+    lapic_write(ESR, 0);
+    lapic_write(ESR, 0);
+
+    // Ack any outstanding interrupts.
+    lapic_write(EOI, 0);
+
+    // Enable interrupts on the APIC (but not on the processor).
+    lapic_write(TPR, 0);
+}
+
+void lapic_eoi()
+{
+    lapic_write(EOI, 0);
+}
+
+static void lapic_wait_icr()
+{
+    while(lapic_read(ICRLO) & DELIVS) {
+        asm volatile("pause");
+    }
+}
+
+void lapic_send_ipi(uint apic_id, uint8_t vector)
+{
+    push_cli();
+    lapic_write(ICRHI, apic_id << 24);
+    lapic_write(ICRLO, vector);
+    lapic_wait_icr();
+    pop_cli();
+}
+
+// Start an application processor running at trampoline_paddr (in real mode)
+// with the INIT-SIPI-SIPI sequence
+// Ref: Intel MultiProcessor Specification, Appendix B.4
+void lapic_start_ap(uint apic_id, uint32_t trampoline_paddr)
+{
+    PANIC_ASSERT(trampoline_paddr % PAGE_SIZE == 0 && trampoline_paddr < 0x100000);
+
+    // "The BSP must initialize CMOS shutdown code to 0AH
+    // and the warm reset vector (DWORD based at 40:67) to point at
+    // the AP startup code prior to the [universal startup algorithm]."
+    outb(CMOS_PORT, 0xF);  // offset 0xF is shutdown code
+    outb(CMOS_RETURN, 0x0A);
+    volatile uint16_t* wrv = (volatile uint16_t*) WARM_RESET_VECTOR;
+    wrv[0] = 0;
+    wrv[1] = trampoline_paddr >> 4;
+
+    // "Universal startup algorithm."
+    // Send INIT (level-triggered) interrupt to reset other CPU.
+    lapic_write(ICRHI, apic_id << 24);
+    lapic_write(ICRLO, INIT | LEVEL | ASSERT);
+    udelay(200);
+    lapic_write(ICRLO, INIT | LEVEL | DEASSERT);
+    udelay(10000);
+
+    // Send startup IPI (twice!) to enter code.
+    // Regular hardware is supposed to only accept a STARTUP
+    // when it is in the halted state due to an INIT.  So the second
+    // should be ignored, but it is part of the official Intel algorithm.
+    for(int i = 0; i < 2; i++){
+        lapic_write(ICRHI, apic_id << 24);
+        lapic_write(ICRLO, STARTUP | (trampoline_paddr >> 12));
+        udelay(200);
+    }
+}
+
+// Measure the timer rate against the TSC once, on the BSP
+static void lapic_timer_calibrate()
+{
+    lapic_write(TDCR, DIVIDE_16);
+    lapic_write(TIMER, MASKED | ONESHOT | LAPIC_TIMER_VECTOR);
+    lapic_write(TICR, 0xFFFFFFFF);
+    udelay(10000);
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(TCCR);
+    lapic_write(TICR, 0);
+    lapic.timer_ticks_per_ms = elapsed / 10;
+    printf("LAPIC: timer %u ticks/ms\n", lapic.timer_ticks_per_ms);
+}
+
+// Start the periodic local APIC timer of the calling CPU
+void lapic_timer_start(uint32_t hz)
+{
+    PANIC_ASSERT(hz > 0);
+    if(lapic.timer_ticks_per_ms == 0) {
+        lapic_timer_calibrate();
+    }
+    lapic_write(TDCR, DIVIDE_16);
+    lapic_write(TIMER, PERIODIC | LAPIC_TIMER_VECTOR);
+    lapic_write(TICR, lapic.timer_ticks_per_ms * 1000 / hz);
+}
@@ -7,9 +7,16 @@
 #include <kernel/pci.h>
 #include <kernel/cpu.h>
 #include <arch/i386/kernel/isr.h>
+#include <arch/i386/kernel/irq.h>
 #include <kernel/timer.h>
+#include <kernel/time.h>
+#include <kernel/vdso.h>
+#include <kernel/syscall.h>
 #include <kernel/keyboard.h>
 #include <kernel/video.h>
+#include <kernel/smp.h>
+#include <kernel/ata.h>
+#include <kernel/ramdisk.h>
 
 
 // x86-32 architecture specific initialization sequence
@@ -30,6 +37,9 @@ void initialize_architecture(uint32_t mbt_physical_addr) {
     // Initialize VESA/VGA video driver
     init_video(mbt_physical_addr);
 
+    // Find the initial ramdisk among the boot modules, it is mounted by init_vfs()
+    find_initrd(mbt_physical_addr);
+
     // Initialize terminal cursor and global variables like default color
     terminal_initialize(mbt_physical_addr);
 
@@ -37,17 +47,39 @@ void initialize_architecture(uint32_t mbt_physical_addr) {
     // Including remapping the IRQs
     isr_install();
 
+    // Find local APICs and IOAPICs in ACPI tables, route IRQs through the IOAPIC if present
+    // otherwise keep using the PIC
+    init_irq();
+
+    // Setup SYSENTER/SYSEXIT MSRs for the fast syscall path
+    init_sysenter();
+
     // Initialize a heap for kmalloc and kfree
     initialize_kernel_heap();
 
     // Enumerate and initialize PCI devices
     init_pci();
 
+    // Complete ATA requests by interrupt instead of polling
+    init_ata();
+
     // Set up system timer using PIT(Programmable Interval Timer)
     // Set freq = 50 (i.e. 50 tick per seconds)
     // and set tick_between_process_switch to 10, basically switch process every 0.2 second
     init_timer(50, 10);
 
+    // Sample RTC once and calibrate TSC, wall clock is then derived from TSC
+    init_clocksource();
+
+    // Replace the PIT by the local APIC timer if available
+    start_cpu_timer();
+
+    // Allocate the vDSO clock page mapped read-only into every process
+    init_vdso();
+
+    // Start the other CPUs found by init_irq(), they wait in the scheduler for processes to run
+    init_smp();
+
     // initialize keyboard interrupt handler
     init_keyboard();
 
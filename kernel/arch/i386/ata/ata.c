@@ -1,9 +1,15 @@
 #include <kernel/ata.h>
 #include <kernel/lock.h>
 #include <kernel/process.h>
+#include <kernel/paging.h>
+#include <kernel/panic.h>
+#include <kernel/pci.h>
 #include <arch/i386/kernel/port_io.h>
+#include <arch/i386/kernel/isr.h>
+#include <arch/i386/kernel/irq.h>
+#include <stdio.h>
 
-// 28 bit ATA PIO disk driver
+// ATA disk driver, 28 or 48 bit LBA, PCI IDE bus-master DMA if available, PIO otherwise
 // From http://learnitonweb.com/2020/05/22/12-developing-an-operating-system-tutorial-episode-6-ata-pio-driver-osdev/
 // Source - https://wiki.osdev.org/ATA_PIO_Mode#x86_Directions
 
@@ -24,130 +30,451 @@ ERR: a 1 indicates that an error occured. An error code has been placed in the e
 #define STATUS_DF 0x20
 #define STATUS_ERR 0x01
 
+#define ATA_IRQ 14
+#define ATA_DEVICE_CONTROL 0x3F6
+
 static yield_lock ata_lock;
 
+// PCI IDE bus-master DMA
+// Ref: https://wiki.osdev.org/ATA/ATAPI_using_DMA
+//      https://wiki.osdev.org/PCI_IDE_Controller
+
+// Bus master registers of the primary channel, relative to BAR4
+#define BM_COMMAND 0x0
+#define BM_STATUS 0x2
+#define BM_PRDT 0x4
+
+#define BM_COMMAND_START 0x01
+#define BM_COMMAND_READ 0x08 // device to memory
+#define BM_STATUS_ACTIVE 0x01
+#define BM_STATUS_ERR 0x02
+#define BM_STATUS_IRQ 0x04
+#define BM_STATUS_DRV0_DMA 0x20
+#define BM_STATUS_DRV1_DMA 0x40
+
+#define ATA_CMD_READ_SECTORS 0x20
+#define ATA_CMD_READ_SECTORS_EXT 0x24
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
+#define ATA_CMD_WRITE_SECTORS 0x30
+#define ATA_CMD_WRITE_SECTORS_EXT 0x34
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_READ_MULTIPLE 0xC4
+#define ATA_CMD_WRITE_MULTIPLE 0xC5
+#define ATA_CMD_SET_MULTIPLE_MODE 0xC6
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_FLUSH_CACHE 0xE7
+#define ATA_CMD_FLUSH_CACHE_EXT 0xEA
+
+// Sectors per command, a sector count of 0 means 256 for LBA28 and 65536 for LBA48
+// LBA48 commands are capped so that a DMA transfer fits in the PRD table
+#define MAX_SECTORS_LBA28 256
+#define MAX_SECTORS_LBA48 2048
+
+// Physical Region Descriptor, a physically contiguous chunk not crossing a 64KiB boundary
+typedef struct prd {
+    uint32_t paddr;
+    uint16_t byte_count; // 0 means 64KiB
+    uint16_t flags;
+} __attribute__ ((packed)) prd;
+
+#define PRD_END_OF_TABLE 0x8000
+// One PRD per page touched, the sectors of an unaligned buffer span one more page
+#define MAX_PRD (MAX_SECTORS_LBA48*512/PAGE_SIZE + 1)
+
+static struct {
+    uint16_t bm_base;       // 0 if no bus-master IDE controller is found
+    prd* prdt;
+    uint32_t prdt_paddr;
+    blk_frag frags[MAX_PRD]; // Guarded by ata_lock
+} dma;
+
+// What the master/slave drive supports, from IDENTIFY
+static struct ata_drive {
+    bool lba48;
+    bool dma;
+    uint8_t multiple;       // sectors per DRQ block of READ/WRITE MULTIPLE, 0 if not enabled
+} drives[2];
+
+// Completion of the command in flight, signaled by IRQ14
+// Requests are serialized by ata_lock, so there is at most one waiter
+static struct {
+    spinlock lk;
+    bool enabled;           // the interrupt handler is installed
+    bool pending;           // armed and the interrupt not arrived yet
+    uint8_t status;         // of the drive, read by the interrupt handler
+} ata_irq;
+
 static void ATA_wait_BSY();
 static void ATA_wait_DRQ();
 static void ATA_delay_400ns();
 
-// Read sectors from the primary ATA device using 28bit PIO method 
-//
-// target: a buffer at least sector_count*512 bytes long 
-// LBA: 0-based Linear Block Address, 28bit LBA shall be between 0 to 0x0FFFFFFF
-// sector_count: How many sectors you want to read. A sectorcount of 0 means 256 sectors = 128K
-//
-static void read_sectors_ATA_28bit_PIO(bool slave, uint16_t* target, uint32_t LBA, uint8_t sector_count) {
-    acquire(&ata_lock);
+static void ata_irq_handler(trapframe* tf)
+{
+    UNUSED_ARG(tf);
+    spin_lock(&ata_irq.lk);
+    // reading the status also acknowledges the drive interrupt
+    ata_irq.status = inb(0x1F7);
+    if(dma.bm_base != 0) {
+        // clear the bus master interrupt bit, the error bit is left for the request
+        uint8_t bm_status = inb(dma.bm_base + BM_STATUS);
+        outb(dma.bm_base + BM_STATUS, (bm_status & ~BM_STATUS_ERR) | BM_STATUS_IRQ);
+    }
+    ata_irq.pending = false;
+    wakeup(&ata_irq);
+    spin_unlock(&ata_irq.lk);
+}
+
+void init_ata()
+{
+    register_interrupt_handler(IRQ_TO_INTERRUPT(ATA_IRQ), ata_irq_handler);
+    // clear nIEN so that the drive raises interrupts
+    outb(ATA_DEVICE_CONTROL, 0);
+    irq_enable(ATA_IRQ);
+    ata_irq.enabled = true;
+}
+
+// Shall be called before the command (or the data transfer) whose interrupt is waited for
+static void ata_irq_arm()
+{
+    spin_lock(&ata_irq.lk);
+    ata_irq.pending = true;
+    spin_unlock(&ata_irq.lk);
+}
+
+// Sleep until the interrupt armed by ata_irq_arm(), other processes run meanwhile
+// return: the drive status
+static uint8_t ata_irq_wait()
+{
+    if(!ata_irq.enabled || curr_proc() == NULL) {
+        // at boot, before any process exists, poll
+        ATA_delay_400ns();
+        ATA_wait_BSY();
+        return inb(0x1F7);
+    }
+    spin_lock(&ata_irq.lk);
+    while(ata_irq.pending) {
+        sleep(&ata_irq, &ata_irq.lk);
+    }
+    uint8_t status = ata_irq.status;
+    spin_unlock(&ata_irq.lk);
+    return status;
+}
+
+static uint32_t max_sectors(bool slave)
+{
+    return drives[slave].lba48 ? MAX_SECTORS_LBA48 : MAX_SECTORS_LBA28;
+}
 
+// Select the drive and send the address and sector count of the next command
+// sector_count: 1 to max_sectors(slave)
+// Ref: https://wiki.osdev.org/ATA_PIO_Mode#48_bit_PIO
+static void ATA_setup_LBA(bool slave, uint32_t LBA, uint32_t sector_count)
+{
     ATA_wait_BSY();
-    // Send 0xE0 for the "master" or 0xF0 for the "slave", ORed with the highest 4 bits of the LBA to port 0x1F6: outb(0x1F6, 0xE0 | (slavebit << 4) | ((LBA >> 24) & 0x0F))
-    outb(0x1F6, 0xE0 | (slave << 4) | ((LBA >> 24) & 0xF));
-    // Send the sectorcount to port 0x1F2: outb(0x1F2, (unsigned char) count)
-    outb(0x1F2, sector_count);
-    // Send the low 8 bits of the LBA to port 0x1F3: outb(0x1F3, (unsigned char) LBA))
+    if(drives[slave].lba48) {
+        // The high bytes first, each register is a 2 bytes FIFO
+        outb(0x1F6, 0x40 | (slave << 4));
+        outb(0x1F2, (uint8_t)(sector_count >> 8));
+        outb(0x1F3, (uint8_t)(LBA >> 24));
+        outb(0x1F4, 0);
+        outb(0x1F5, 0);
+    } else {
+        // Send 0xE0 for the "master" or 0xF0 for the "slave", ORed with the highest 4 bits of the LBA to port 0x1F6
+        outb(0x1F6, 0xE0 | (slave << 4) | ((LBA >> 24) & 0xF));
+    }
+    // 256 (LBA28) and 65536 (LBA48) wrap to 0, which means the maximum
+    outb(0x1F2, (uint8_t) sector_count);
     outb(0x1F3, (uint8_t)LBA);
-    // Send the next 8 bits of the LBA to port 0x1F4: outb(0x1F4, (unsigned char)(LBA >> 8))
     outb(0x1F4, (uint8_t)(LBA >> 8));
-    // Send the next 8 bits of the LBA to port 0x1F5: outb(0x1F5, (unsigned char)(LBA >> 16))
     outb(0x1F5, (uint8_t)(LBA >> 16));
-    // Send the "READ SECTORS" command (0x20) to port 0x1F7: outb(0x1F7, 0x20)
-    outb(0x1F7, 0x20); //Send the read command
-    
-    int count;
-    if(sector_count == 0) {
-        count = 256;
+}
+
+// Read sectors from the primary ATA device using PIO method
+// The drive interrupts once per DRQ block, i.e. per sector or per drives[slave].multiple sectors
+//
+// target: a buffer at least sector_count*512 bytes long 
+// LBA: 0-based Linear Block Address
+// sector_count: 1 to max_sectors(slave)
+//
+// return: 0 on success, -1 if the drive reported an error
+//
+static int read_sectors_ATA_PIO_cmd(bool slave, uint16_t* target, uint32_t LBA, uint32_t sector_count) {
+    int res = 0;
+    acquire(&ata_lock);
+
+    ATA_setup_LBA(slave, LBA, sector_count);
+    uint32_t block = drives[slave].multiple ? drives[slave].multiple : 1;
+    uint8_t cmd;
+    if(drives[slave].lba48) {
+        cmd = drives[slave].multiple ? ATA_CMD_READ_MULTIPLE_EXT : ATA_CMD_READ_SECTORS_EXT;
     } else {
-        count = sector_count;
+        cmd = drives[slave].multiple ? ATA_CMD_READ_MULTIPLE : ATA_CMD_READ_SECTORS;
     }
+    ata_irq_arm();
+    outb(0x1F7, cmd);
 
-    for (int j = 0;j < count;j++) {
-        // Poll for status
-        ATA_delay_400ns();
-        ATA_wait_BSY();
-        ATA_wait_DRQ();
-        // Transfer 256 16-bit values, a uint16_t at a time, into your buffer from I/O port 0x1F0. (In assembler, REP INSW works well for this.)
-        for (int i = 0;i < 256;i++)
-            target[i] = inw(0x1F0);
-        target += 256;
+    for (uint32_t j = 0;j < sector_count;j += block) {
+        // The drive interrupts once each block is ready
+        uint8_t status = ata_irq_wait();
+        if(status & (STATUS_ERR | STATUS_DF)) {
+            printf("ATA: read error (status 0x%x) at LBA %u\n", status, LBA + j);
+            res = -1;
+            break;
+        }
+        uint32_t n = sector_count - j < block ? sector_count - j : block;
+        // The next interrupt may come as soon as the last word is read
+        if(j + n < sector_count) {
+            ata_irq_arm();
+        }
+        insw(0x1F0, target, n*256);
+        target += n*256;
     }
 
     release(&ata_lock);
+    return res;
 }
 
-void read_sectors_ATA_PIO(bool slave, void* buf, uint32_t LBA, uint32_t sector_count)
+int read_sectors_ATA_PIO(bool slave, void* buf, uint32_t LBA, uint32_t sector_count)
 {
     while(sector_count) {
-        if(sector_count < 256) {
-            read_sectors_ATA_28bit_PIO(slave, (uint16_t*) buf, LBA, sector_count);
-            return;
-        } else {
-            // read 256 sectors
-            read_sectors_ATA_28bit_PIO(slave, (uint16_t*) buf, LBA, 0);
-            LBA += 256;
-            sector_count -= 256;
-            buf += 256*512;
+        uint32_t n = sector_count < max_sectors(slave) ? sector_count : max_sectors(slave);
+        if(read_sectors_ATA_PIO_cmd(slave, (uint16_t*) buf, LBA, n) < 0) {
+            return -1;
         }
+        LBA += n;
+        sector_count -= n;
+        buf += n*512;
     }
+    return 0;
 }
 
-// Write sectors to the primary ATA device using 28bit PIO method 
+// Write sectors to the primary ATA device using PIO method
 // 
-// LBA: 0-based Linear Block Address, 28bit LBA shall be between 0 to 0x0FFFFFFF
-// sector_count: How many sectors you want to write
+// LBA: 0-based Linear Block Address
+// sector_count: 1 to max_sectors(slave)
 // source: a buffer whose length is sector_count*512 bytes 
 //
-static void write_sectors_ATA_28bit_PIO(bool slave, uint32_t LBA, uint8_t sector_count, uint16_t* source) {
+// return: 0 on success, -1 if the drive reported an error
+//
+static int write_sectors_ATA_PIO_cmd(bool slave, uint32_t LBA, uint32_t sector_count, const uint16_t* source) {
     acquire(&ata_lock);
 
-    ATA_wait_BSY();
-    outb(0x1F6, 0xE0 | (slave << 4) | ((LBA >> 24) & 0xF));
-    outb(0x1F2, sector_count);
-    outb(0x1F3, (uint8_t)LBA);
-    outb(0x1F4, (uint8_t)(LBA >> 8));
-    outb(0x1F5, (uint8_t)(LBA >> 16));
-    // To write sectors in 28 bit PIO mode, send command "WRITE SECTORS" (0x30) to the Command port
-    outb(0x1F7, 0x30); //Send the write command
-
-    int count;
-    if(sector_count == 0) {
-        count = 256;
+    ATA_setup_LBA(slave, LBA, sector_count);
+    uint32_t block = drives[slave].multiple ? drives[slave].multiple : 1;
+    uint8_t cmd;
+    if(drives[slave].lba48) {
+        cmd = drives[slave].multiple ? ATA_CMD_WRITE_MULTIPLE_EXT : ATA_CMD_WRITE_SECTORS_EXT;
     } else {
-        count = sector_count;
+        cmd = drives[slave].multiple ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_WRITE_SECTORS;
     }
+    outb(0x1F7, cmd);
 
-    for (int j = 0;j < count;j++) {
-        ATA_wait_BSY();
-        ATA_wait_DRQ();
-        for (int i = 0;i < 256;i++) {
-            // Do not use REP OUTSW to transfer data. There must be a tiny delay between each OUTSW output uint16_t. A jmp $+2 size of delay
-            outw(0x1F0, source[i]);
-            io_wait();
+    // The first block is asked for right away, without an interrupt
+    ATA_delay_400ns();
+    ATA_wait_BSY();
+    ATA_wait_DRQ();
+    for (uint32_t j = 0;j < sector_count;j += block) {
+        uint32_t n = sector_count - j < block ? sector_count - j : block;
+        // The drive interrupts once each block is written
+        ata_irq_arm();
+        outsw(0x1F0, source, n*256);
+        source += n*256;
+        uint8_t status = ata_irq_wait();
+        if(status & (STATUS_ERR | STATUS_DF)) {
+            printf("ATA: write error (status 0x%x) at LBA %u\n", status, LBA + j);
+            release(&ata_lock);
+            return -1;
         }
-        source += 256;
     }
 
-    // Make sure to do a Cache Flush (ATA command 0xE7) after each write command completes.
-    outb(0x1F7, 0xE7);
+    // Make sure to do a Cache Flush after each write command completes.
+    ata_irq_arm();
+    outb(0x1F7, drives[slave].lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE);
+    uint8_t status = ata_irq_wait();
+    int res = 0;
+    if(status & (STATUS_ERR | STATUS_DF)) {
+        printf("ATA: cache flush error (status 0x%x)\n", status);
+        res = -1;
+    }
 
     release(&ata_lock);
+    return res;
 }
 
-void write_sectors_ATA_PIO(bool slave, const void* buf, uint32_t LBA, uint32_t sector_count)
+int write_sectors_ATA_PIO(bool slave, const void* buf, uint32_t LBA, uint32_t sector_count)
 {
     while(sector_count) {
-        if(sector_count < 256) {
-            write_sectors_ATA_28bit_PIO(slave, LBA, sector_count, (uint16_t*) buf);
-            return;
+        uint32_t n = sector_count < max_sectors(slave) ? sector_count : max_sectors(slave);
+        if(write_sectors_ATA_PIO_cmd(slave, LBA, n, (const uint16_t*) buf) < 0) {
+            return -1;
+        }
+        LBA += n;
+        sector_count -= n;
+        buf += n*512;
+    }
+    return 0;
+}
+
+// PCI IDE bus-master DMA
+// Ref: https://wiki.osdev.org/ATA/ATAPI_using_DMA
+//      https://wiki.osdev.org/PCI_IDE_Controller
+
+void init_ata_dma(uint8_t bus, uint8_t device, uint8_t function)
+{
+    // only the primary channel is used
+    if(dma.bm_base != 0) {
+        return;
+    }
+    uint32_t bar4 = PCI_BAR_4(bus, device, function);
+    if(!(bar4 & 1) || (bar4 & ~0x3) == 0) {
+        return;
+    }
+    PCI_W_COMMAND(bus, device, function, PCI_COMMAND(bus, device, function) | PCI_COMMAND_BUS_MASTER);
+
+    // the PRD table shall be 4 bytes aligned and not cross a 64KiB boundary, a page is both
+    dma.prdt = (prd*) alloc_pages_consecutive_frames(curr_page_dir(), 1, true, &dma.prdt_paddr);
+    dma.bm_base = (bar4 & ~0x3) & 0xFFFF;
+    printf("ATA bus master base I/O port: 0x%x\n", dma.bm_base);
+}
+
+static bool dma_usable(bool slave)
+{
+    return dma.bm_base != 0 && drives[slave].dma;
+}
+
+// Describe the fragments in the PRD table, return false if DMA can't reach them
+static bool build_prdt(const blk_frag* frags, uint32_t n_frag)
+{
+    for(uint32_t i=0; i<n_frag; i++) {
+        // PRD addresses and byte counts shall be even
+        if((frags[i].paddr | frags[i].len) & 1) {
+            return false;
+        }
+        // fragments do not cross a page, nor then a 64KiB boundary
+        dma.prdt[i].paddr = frags[i].paddr;
+        dma.prdt[i].byte_count = frags[i].len;
+        dma.prdt[i].flags = 0;
+    }
+    dma.prdt[n_frag-1].flags = PRD_END_OF_TABLE;
+    return true;
+}
+
+// Transfer the next sectors of the segments without the CPU moving the data,
+// as many as a command and the PRD table take, *sector_count tells how many, 0 at the end
+// return: false if DMA can't be used or failed, PIO shall be used instead for those sectors
+static bool ATA_DMA(bool slave, blk_seg_iter* it, uint32_t LBA, bool write, uint32_t* sector_count_out)
+{
+    uint8_t direction = write ? 0 : BM_COMMAND_READ;
+
+    acquire(&ata_lock);
+    uint32_t n_frag;
+    uint32_t sector_count = blk_seg_iter_map(it, 512, max_sectors(slave), dma.frags, MAX_PRD, &n_frag);
+    *sector_count_out = sector_count;
+    if(sector_count == 0) {
+        release(&ata_lock);
+        return true;
+    }
+    if(!build_prdt(dma.frags, n_frag)) {
+        release(&ata_lock);
+        return false;
+    }
+    outl(dma.bm_base + BM_PRDT, dma.prdt_paddr);
+    outb(dma.bm_base + BM_COMMAND, direction);
+    // the error and interrupt bits are cleared by writing 1
+    outb(dma.bm_base + BM_STATUS, inb(dma.bm_base + BM_STATUS) | BM_STATUS_ERR | BM_STATUS_IRQ);
+
+    ATA_setup_LBA(slave, LBA, sector_count);
+    uint8_t cmd;
+    if(drives[slave].lba48) {
+        cmd = write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT;
+    } else {
+        cmd = write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+    }
+    ata_irq_arm();
+    outb(0x1F7, cmd);
+    outb(dma.bm_base + BM_COMMAND, direction | BM_COMMAND_START);
+
+    // Other processes run while the controller moves the data
+    uint8_t status = ata_irq_wait();
+    outb(dma.bm_base + BM_COMMAND, direction);
+    uint8_t bm_status = inb(dma.bm_base + BM_STATUS);
+    outb(dma.bm_base + BM_STATUS, bm_status | BM_STATUS_ERR | BM_STATUS_IRQ);
+    bool ok = !(bm_status & BM_STATUS_ERR) && !(status & (STATUS_ERR | STATUS_DF));
+    if(ok && write) {
+        ata_irq_arm();
+        outb(0x1F7, drives[slave].lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE);
+        status = ata_irq_wait();
+        ok = !(status & (STATUS_ERR | STATUS_DF));
+    }
+    if(!ok) {
+        printf("ATA: DMA failed (status 0x%x, bus master 0x%x), using PIO\n", status, bm_status);
+        drives[slave].dma = false;
+    }
+
+    release(&ata_lock);
+    return ok;
+}
+
+// A failed DMA command is retried by PIO, the transfer fails if PIO does too
+static int transfer_sectors_ATA(bool slave, const blk_seg* segs, uint32_t n_seg, uint32_t LBA, bool write)
+{
+    blk_seg_iter it;
+    blk_seg_iter_init(&it, segs, n_seg);
+    while(1) {
+        blk_seg_iter start = it;
+        uint32_t n;
+        if(dma_usable(slave) && ATA_DMA(slave, &it, LBA, write, &n)) {
+            if(n == 0) {
+                return 0;
+            }
+            LBA += n;
+            continue;
+        }
+        // the sectors DMA did not transfer, a segment at a time
+        it = start;
+        void* buf;
+        n = blk_seg_iter_run(&it, 512, max_sectors(slave), &buf);
+        if(n == 0) {
+            return 0;
+        }
+        int res;
+        if(write) {
+            res = write_sectors_ATA_PIO(slave, buf, LBA, n);
         } else {
-            // read 256 sectors
-            write_sectors_ATA_28bit_PIO(slave, LBA, 0, (uint16_t*) buf);
-            LBA += 256;
-            sector_count -= 256;
-            buf += 256*512;
+            res = read_sectors_ATA_PIO(slave, buf, LBA, n);
+        }
+        if(res < 0) {
+            return res;
         }
+        LBA += n;
     }
 }
 
+int readv_sectors_ATA(bool slave, const blk_seg* segs, uint32_t n_seg, uint32_t LBA)
+{
+    return transfer_sectors_ATA(slave, segs, n_seg, LBA, false);
+}
+
+int writev_sectors_ATA(bool slave, const blk_seg* segs, uint32_t n_seg, uint32_t LBA)
+{
+    return transfer_sectors_ATA(slave, segs, n_seg, LBA, true);
+}
+
+int read_sectors_ATA(bool slave, void* buf, uint32_t LBA, uint32_t sector_count)
+{
+    blk_seg seg = {.buff = buf, .len = sector_count * 512};
+    return transfer_sectors_ATA(slave, &seg, 1, LBA, false);
+}
+
+int write_sectors_ATA(bool slave, const void* buf, uint32_t LBA, uint32_t sector_count)
+{
+    blk_seg seg = {.buff = (void*) buf, .len = sector_count * 512};
+    return transfer_sectors_ATA(slave, &seg, 1, LBA, true);
+}
+
 // Execute ATA PIO IDENTIFY command
 // Ref: https://wiki.osdev.org/ATA_PIO_Mode#IDENTIFY_command
 // 
@@ -196,9 +523,7 @@ int8_t ATA_Identify(bool slave, uint16_t* target) {
         return_val = -3;
         goto ret;
     };
-    for (int i = 0;i < 256;i++) {
-        target[i] = inw(0x1F0);
-    }
+    insw(0x1F0, target, 256);
     
     return_val = 0;
 
@@ -207,19 +532,63 @@ ret:
     return return_val;
 }
 
-// Get count of all sectors available to address using a 28bit LBA
+// Set the number of sectors per DRQ block of READ/WRITE MULTIPLE
+//
+// return: zero = success, otherwise failed
+static int8_t ATA_set_multiple_mode(bool slave, uint8_t sectors_per_block)
+{
+    acquire(&ata_lock);
+    ATA_wait_BSY();
+    outb(0x1F6, 0xA0 | (slave << 4));
+    outb(0x1F2, sectors_per_block);
+    ata_irq_arm();
+    outb(0x1F7, ATA_CMD_SET_MULTIPLE_MODE);
+    uint8_t status = ata_irq_wait();
+    release(&ata_lock);
+    return (status & (STATUS_ERR | STATUS_DF)) ? -1 : 0;
+}
+
+// Identify the drive, set up LBA48, READ/WRITE MULTIPLE and DMA if supported
+// and get count of all sectors available to address
 //
-// return: number of 28bit LBA available
-int32_t get_total_28bit_sectors(bool slave) {
+// return: number of sectors, negative if failed
+int64_t get_total_sectors(bool slave) {
     uint16_t identifier[256];
     int8_t ret = ATA_Identify(slave, identifier);
     if (ret != 0) {
         return ret;
     }
+    struct ata_drive* drive = &drives[slave];
     // uint16_t 60 & 61 taken as a uint32_t contain the total number of 28 bit LBA addressable sectors on the drive. (If non-zero, the drive supports LBA28.)
     // uint16_t 100 through 103 taken as a uint64_t contain the total number of 48 bit addressable sectors on the drive. (Probably also proof that LBA48 is supported.)
-    uint32_t max_sector_28bit_lba = (((uint32_t)identifier[61]) << 16) + identifier[60];
-    return (int32_t) max_sector_28bit_lba;
+    uint64_t total_sectors = (((uint32_t)identifier[61]) << 16) + identifier[60];
+    // uint16_t 83 bit 10: LBA48 supported
+    if(identifier[83] & (1 << 10)) {
+        uint64_t total_48bit = ((uint64_t) identifier[103] << 48) | ((uint64_t) identifier[102] << 32)
+            | ((uint64_t) identifier[101] << 16) | identifier[100];
+        if(total_48bit > 0) {
+            drive->lba48 = true;
+            total_sectors = total_48bit;
+        }
+    }
+
+    // uint16_t 47 low byte: max sectors per DRQ block of READ/WRITE MULTIPLE, 0 if not supported
+    uint8_t max_multiple = identifier[47] & 0xFF;
+    drive->multiple = 0;
+    if(max_multiple > 1 && ATA_set_multiple_mode(slave, max_multiple) == 0) {
+        drive->multiple = max_multiple;
+    }
+
+    // uint16_t 49 bit 8: DMA supported
+    drive->dma = (identifier[49] & (1 << 8)) != 0;
+    if(dma.bm_base != 0 && drive->dma) {
+        // tell the controller the drive has been set up for DMA
+        uint8_t drv_dma = slave ? BM_STATUS_DRV1_DMA : BM_STATUS_DRV0_DMA;
+        outb(dma.bm_base + BM_STATUS, (inb(dma.bm_base + BM_STATUS) & ~(BM_STATUS_ERR | BM_STATUS_IRQ)) | drv_dma);
+    }
+    printf("ATA %s: %llu sectors, LBA%u, %u sectors per block%s\n", slave ? "slave" : "master", total_sectors,
+        drive->lba48 ? 48 : 28, drive->multiple ? drive->multiple : 1, dma_usable(slave) ? ", DMA" : "");
+    return (int64_t) total_sectors;
 }
 
 
@@ -245,7 +614,7 @@ static void ATA_wait_BSY() {
 }
 static void ATA_wait_DRQ() {
     //Wait fot DRQ or ERR to be 1
-    while (!(inb(0x1F7) & (STATUS_RDY | STATUS_ERR))) {
+    while (!(inb(0x1F7) & (STATUS_DRQ | STATUS_ERR))) {
         yield();
     };
 }
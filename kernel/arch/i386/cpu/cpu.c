@@ -1,6 +1,8 @@
 #include <kernel/cpu.h>
 #include <kernel/panic.h>
 #include <arch/i386/kernel/cpu.h>
+#include <arch/i386/kernel/lapic.h>
+#include <arch/i386/kernel/fpu.h>
 #include <cpuid.h>
 
 enum {
@@ -65,7 +67,10 @@ enum {
 
 extern int check_cpuid(void);
 
-cpu current_cpu;
+cpu cpus[MAX_CPU];
+uint n_cpu = 1;
+// Local APIC ID => index into cpus[]
+static uint8_t cpu_index_of_apic[256];
 
 static int check_tsc() {
     unsigned int eax, unused, edx;
@@ -73,18 +78,86 @@ static int check_tsc() {
     return edx & CPUID_FEAT_EDX_TSC;
 }
 
-void init_cpu()
+static int check_sep() {
+    unsigned int eax, unused, edx;
+    if(!__get_cpuid(1, &eax, &unused, &unused, &edx)) {
+        return 0;
+    }
+    // Pentium Pro (family 6, model < 3, stepping < 3) reports SEP without supporting it
+    // Ref: Intel SDM Vol. 2B, SYSENTER
+    uint family = (eax >> 8) & 0xF, model = (eax >> 4) & 0xF, stepping = eax & 0xF;
+    if(family == 6 && model < 3 && stepping < 3) {
+        return 0;
+    }
+    return edx & CPUID_FEAT_EDX_SEP;
+}
+
+// FXSAVE/FXRSTOR and SSE, used for lazy FPU switching
+static int check_fxsr() {
+    unsigned int eax, unused, edx;
+    if(!__get_cpuid(1, &eax, &unused, &unused, &edx)) {
+        return 0;
+    }
+    return (edx & CPUID_FEAT_EDX_FXSR) && (edx & CPUID_FEAT_EDX_SSE);
+}
+
+// Detect features of the CPU executing this code
+static void identify_cpu(cpu* c)
 {
     // make sure CPU supprot CPUID
     PANIC_ASSERT(check_cpuid()!=0);
     // make sure the CPU support TSC
     PANIC_ASSERT(check_tsc());
-    current_cpu = (cpu) {0};
+    // make sure the CPU support FXSAVE and SSE
+    PANIC_ASSERT(check_fxsr());
+    c->has_sysenter = check_sep() != 0;
+}
+
+// Initialize the bootstrap processor (BSP), as cpus[0]
+void init_cpu()
+{
+    cpus[0] = (cpu) {0};
+    identify_cpu(&cpus[0]);
+    init_fpu(&cpus[0]);
+}
+
+// Called on each application processor (AP) once it can find itself by local APIC ID
+void init_ap_cpu()
+{
+    identify_cpu(curr_cpu());
+    init_fpu(curr_cpu());
 }
 
+// Add a CPU discovered from firmware tables, the BSP is always cpus[0]
+void register_cpu(uint apic_id)
+{
+    PANIC_ASSERT(apic_id < 256);
+    if(lapic_available() && apic_id == lapic_id()) {
+        cpus[0].apic_id = apic_id;
+        cpu_index_of_apic[apic_id] = 0;
+        return;
+    }
+    if(n_cpu >= MAX_CPU) {
+        return;
+    }
+    cpus[n_cpu] = (cpu) {.id = n_cpu, .apic_id = apic_id};
+    cpu_index_of_apic[apic_id] = n_cpu;
+    n_cpu++;
+}
+
+int cpu_has_sysenter()
+{
+    return curr_cpu()->has_sysenter;
+}
+
+// Shall be called with interrupt disabled, otherwise we may be rescheduled
+// to another CPU right after reading the APIC ID
 cpu* curr_cpu()
 {
-    return &current_cpu;
+    if(n_cpu == 1 || !lapic_available()) {
+        return &cpus[0];
+    }
+    return &cpus[cpu_index_of_apic[lapic_id()]];
 }
 
 uint read_cpu_eflags()
@@ -122,10 +195,8 @@ void push_cli()
     // between above and below an interruption can happen (including timer int for scheduling)
     // but since iret always restore the CPU eflags, so the info retrieve above is still valid
     // what ever the interrupt handler do
-    // However, this is not true if we switch to multi-CPU scenario in which this process
-    // can be scheduled to another CPU, with completely different eflags and thus
-    // different interrupt enabled/disabled status
-    // so as long as we are in single CPU world, we are safe here
+    // This also holds with multiple CPUs: the process may migrate to another CPU
+    // in between, but its own eflags travel with it
     if(int_enabled) {
         disable_interrupt();
     }
@@ -167,4 +238,17 @@ uint64_t rdtsc()
     uint64_t ret;
     asm volatile ( "rdtsc" : "=A"(ret) );
     return ret;
+}
+
+// Ref: https://wiki.osdev.org/Model_Specific_Registers
+uint64_t rdmsr(uint32_t msr)
+{
+    uint64_t ret;
+    asm volatile ( "rdmsr" : "=A"(ret) : "c"(msr) );
+    return ret;
+}
+
+void wrmsr(uint32_t msr, uint64_t value)
+{
+    asm volatile ( "wrmsr" : : "c"(msr), "A"(value) );
 }
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include <string.h>
+#include <kernel/panic.h>
+#include <kernel/cpu.h>
+#include <arch/i386/kernel/fpu.h>
+
+#define CR0_MP (1 << 1) // WAIT/FWAIT honour TS
+#define CR0_EM (1 << 2) // emulate x87, shall be clear to use it
+#define CR0_TS (1 << 3) // task switched, the next FPU/SSE instruction traps with #NM
+#define CR0_NE (1 << 5) // report x87 errors as #MF instead of through the PIC
+#define CR4_OSFXSR (1 << 9) // FXSAVE/FXRSTOR and SSE instructions enabled
+#define CR4_OSXMMEXCPT (1 << 10) // unmasked SSE exceptions raise #XM
+
+// Power-up MXCSR, all SIMD exceptions masked
+#define MXCSR_DEFAULT 0x1F80
+
+static inline uint32_t read_cr0()
+{
+    uint32_t cr0;
+    asm volatile("movl %%cr0, %0" : "=r" (cr0));
+    return cr0;
+}
+
+static inline void write_cr0(uint32_t cr0)
+{
+    asm volatile("movl %0, %%cr0" : : "r" (cr0));
+}
+
+static inline uint32_t read_cr4()
+{
+    uint32_t cr4;
+    asm volatile("movl %%cr4, %0" : "=r" (cr4));
+    return cr4;
+}
+
+static inline void write_cr4(uint32_t cr4)
+{
+    asm volatile("movl %0, %%cr4" : : "r" (cr4));
+}
+
+static inline void clts()
+{
+    asm volatile("clts");
+}
+
+static inline void stts()
+{
+    write_cr0(read_cr0() | CR0_TS);
+}
+
+// FXSAVE/FXRSTOR require a 16-byte aligned area, which the process cache does not guarantee
+static void* fpu_area(proc* p)
+{
+    return (void*) (((uint32_t) p->fpu_state + 15) & ~15u);
+}
+
+static inline void fxsave(void* area)
+{
+    asm volatile("fxsave (%0)" : : "r" (area) : "memory");
+}
+
+static inline void fxrstor(void* area)
+{
+    asm volatile("fxrstor (%0)" : : "r" (area) : "memory");
+}
+
+// Shall be called on every CPU before it runs any process
+void init_fpu(cpu* c)
+{
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP | CR0_NE);
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+    clts();
+    asm volatile("fninit");
+    // no process owns the registers yet
+    c->fpu_owner = NULL;
+    stts();
+}
+
+// Called by the scheduler right before switching to p
+// The registers of this CPU still hold p's state if p was the last one using them here
+// and has not run on another CPU since, then p can use them without trapping
+void fpu_switch_in(cpu* c, proc* p)
+{
+    uint32_t cr0 = read_cr0();
+    if(c->fpu_owner == p && p->fpu_cpu == c) {
+        if(cr0 & CR0_TS) clts();
+    } else if(!(cr0 & CR0_TS)) {
+        write_cr0(cr0 | CR0_TS);
+    }
+}
+
+// Called by the scheduler once p is switched out
+// TS is still clear only if p used the FPU in this time slice, so processes
+// not using it pay nothing. Saving here rather than when the next owner traps
+// lets p be resumed on any CPU
+void fpu_switch_out(cpu* c, proc* p)
+{
+    if(c->fpu_owner == p && !(read_cr0() & CR0_TS)) {
+        fxsave(fpu_area(p));
+    }
+}
+
+// Device-not-available (#NM), the current process tries to use the FPU with TS set
+// The previous owner has been saved on its switch out
+void fpu_handle_nm()
+{
+    PANIC_ASSERT(!is_interrupt_enabled());
+    cpu* c = curr_cpu();
+    proc* p = c->current_process;
+    PANIC_ASSERT(p != NULL);
+    clts();
+    if(p->fpu_used) {
+        fxrstor(fpu_area(p));
+    } else {
+        // first use, start from the power-up state
+        uint32_t mxcsr = MXCSR_DEFAULT;
+        asm volatile("fninit; ldmxcsr %0" : : "m" (mxcsr));
+        p->fpu_used = 1;
+    }
+    c->fpu_owner = p;
+    p->fpu_cpu = c;
+}
+
+// The forked child starts with the parent's FPU state, as any other register
+void fpu_fork(proc* from, proc* to)
+{
+    push_cli();
+    cpu* c = curr_cpu();
+    // the latest state may only be in the registers
+    if(c->fpu_owner == from && from->fpu_cpu == c && !(read_cr0() & CR0_TS)) {
+        fxsave(fpu_area(from));
+    }
+    pop_cli();
+    if(from->fpu_used) {
+        memmove(fpu_area(to), fpu_area(from), FPU_STATE_SIZE);
+        to->fpu_used = 1;
+    }
+}
+
+// Discard the FPU state of the current process p, e.g. on exec
+void fpu_reset(proc* p)
+{
+    push_cli();
+    p->fpu_used = 0;
+    p->fpu_cpu = NULL;
+    stts();
+    pop_cli();
+}
@@ -106,6 +106,19 @@ global irq14
 global irq15
 ; Syscall
 global int88
+; Local APIC
+global int_lapic_timer
+global int_ipi_reschedule
+global int_lapic_spurious
+; MSI
+global int_msi0
+global int_msi1
+global int_msi2
+global int_msi3
+global int_msi4
+global int_msi5
+global int_msi6
+global int_msi7
 
 ; More on CPU exceptions: https://wiki.osdev.org/Exceptions
 ; 0: Divide By Zero Exception
@@ -378,4 +391,61 @@ irq15:
 int88:
 	push byte 0
 	push byte 88
-	jmp common_stub
\ No newline at end of file
+	jmp common_stub
+
+; Vectors must be in sync with lapic.h
+int_lapic_timer:
+	push byte 0
+	push byte 64
+	jmp common_stub
+
+int_ipi_reschedule:
+	push byte 0
+	push byte 65
+	jmp common_stub
+
+int_lapic_spurious:
+	push byte 0
+	push dword 255
+	jmp common_stub
+
+; Vectors must be in sync with irq.h (MSI_VECTOR_BASE)
+int_msi0:
+	push byte 0
+	push byte 66
+	jmp common_stub
+
+int_msi1:
+	push byte 0
+	push byte 67
+	jmp common_stub
+
+int_msi2:
+	push byte 0
+	push byte 68
+	jmp common_stub
+
+int_msi3:
+	push byte 0
+	push byte 69
+	jmp common_stub
+
+int_msi4:
+	push byte 0
+	push byte 70
+	jmp common_stub
+
+int_msi5:
+	push byte 0
+	push byte 71
+	jmp common_stub
+
+int_msi6:
+	push byte 0
+	push byte 72
+	jmp common_stub
+
+int_msi7:
+	push byte 0
+	push byte 73
+	jmp common_stub
@@ -7,7 +7,13 @@
 #include <arch/i386/kernel/idt.h>
 #include <arch/i386/kernel/port_io.h>
 #include <arch/i386/kernel/pic.h>
+#include <arch/i386/kernel/lapic.h>
+#include <arch/i386/kernel/irq.h>
+#include <arch/i386/kernel/fpu.h>
 #include <kernel/cpu.h>
+#include <kernel/softirq.h>
+#include <kernel/preempt.h>
+#include <kernel/process.h>
 
 
 // Ref: https://github.com/cfenollosa/os-tutorial/blob/master/23-fixes
@@ -84,6 +90,21 @@ void isr_install() {
     // Need to protect cirtical kernel code with locks in such case
     set_idt_gate(INT_SYSCALL, (uint32_t)int88, IDT_GATE_TYPE_TRAP, DPL_USER);
 
+    // Local APIC timer, inter-processor interrupts and spurious interrupt
+    set_idt_gate(LAPIC_TIMER_VECTOR, (uint32_t)int_lapic_timer, IDT_GATE_TYPE_INT, DPL_KERNEL);
+    set_idt_gate(IPI_RESCHEDULE_VECTOR, (uint32_t)int_ipi_reschedule, IDT_GATE_TYPE_INT, DPL_KERNEL);
+    set_idt_gate(LAPIC_SPURIOUS_VECTOR, (uint32_t)int_lapic_spurious, IDT_GATE_TYPE_INT, DPL_KERNEL);
+
+    // Message signaled interrupts from PCI devices
+    set_idt_gate(MSI_VECTOR_BASE + 0, (uint32_t)int_msi0, IDT_GATE_TYPE_INT, DPL_KERNEL);
+    set_idt_gate(MSI_VECTOR_BASE + 1, (uint32_t)int_msi1, IDT_GATE_TYPE_INT, DPL_KERNEL);
+    set_idt_gate(MSI_VECTOR_BASE + 2, (uint32_t)int_msi2, IDT_GATE_TYPE_INT, DPL_KERNEL);
+    set_idt_gate(MSI_VECTOR_BASE + 3, (uint32_t)int_msi3, IDT_GATE_TYPE_INT, DPL_KERNEL);
+    set_idt_gate(MSI_VECTOR_BASE + 4, (uint32_t)int_msi4, IDT_GATE_TYPE_INT, DPL_KERNEL);
+    set_idt_gate(MSI_VECTOR_BASE + 5, (uint32_t)int_msi5, IDT_GATE_TYPE_INT, DPL_KERNEL);
+    set_idt_gate(MSI_VECTOR_BASE + 6, (uint32_t)int_msi6, IDT_GATE_TYPE_INT, DPL_KERNEL);
+    set_idt_gate(MSI_VECTOR_BASE + 7, (uint32_t)int_msi7, IDT_GATE_TYPE_INT, DPL_KERNEL);
+
     set_idt(); // Load with ASM
 }
 
@@ -141,9 +162,10 @@ void register_interrupt_handler(uint8_t n, interrupt_handler handler) {
 
 void irq_handler(trapframe* r) {
     uint8_t irq_no = (uint8_t)r->err; // err_code is the IRQ number for IRQs, see interrupt.asm
-    /* After every interrupt we need to send an EOI to the PICs
+    /* After every interrupt we need to send an EOI to the PICs (or the local APIC)
      * or they will not send another interrupt again */
-    bool is_spurious = PIC_is_spurious_irq(irq_no);
+    // Only the PIC raises spurious IRQ 7/15, with the IOAPIC the masked PIC would report real ones as spurious
+    bool is_spurious = !irq_uses_apic() && PIC_is_spurious_irq(irq_no);
 
     // printf("IRQ %d\n", irq_no);
 
@@ -154,7 +176,7 @@ void irq_handler(trapframe* r) {
             handler(r);
         }
 
-        PIC_sendEOI(irq_no);
+        irq_eoi(irq_no);
     } else {
         // Track of the number of spurious IRQs
         spurious_irq_counter[irq_no]++;
@@ -162,13 +184,43 @@ void irq_handler(trapframe* r) {
 
 }
 
+// Interrupts from the local APIC, including MSI
+void lapic_int_handler(trapframe* r) {
+    // Spurious interrupts shall not be acknowledged
+    if (r->trapno == LAPIC_SPURIOUS_VECTOR) {
+        return;
+    }
+    // Acknowledge before the handler, since it may yield to another process (e.g. timer)
+    lapic_eoi();
+    if (interrupt_handlers[r->trapno] != 0) {
+        interrupt_handler handler = interrupt_handlers[r->trapno];
+        handler(r);
+    }
+}
+
 void int_handler(trapframe* r)
 {
-    if(r->trapno < N_CPU_EXCEPTION_INT) {
+    if(r->trapno == INT_DEVICE_NOT_AVAILABLE) {
+        // First FPU/SSE instruction since the process was switched in
+        fpu_handle_nm();
+        return;
+    } else if(r->trapno < N_CPU_EXCEPTION_INT) {
         return isr_handler(r);
-    } else if(r->trapno == INT_SYSCALL) {
-        return syscall_handler(r);
+    } else if(r->trapno == INT_SYSCALL || r->trapno == TRAPNO_SYSENTER) {
+        syscall_handler(r);
+        exit_if_killed();
+        return;
+    } else if(r->trapno >= LAPIC_TIMER_VECTOR) {
+        lapic_int_handler(r);
     } else {
-        return irq_handler(r);
+        irq_handler(r);
+    }
+    // Bottom halves raised by the handler above
+    softirq_irq_exit();
+    // Time slice used up (timer) while the interrupted code is preemptible
+    preempt_irq_exit();
+    // A thread of an exiting process shall not run user code again
+    if((r->cs & 3) == DPL_USER) {
+        exit_if_killed();
     }
 }
\ No newline at end of file
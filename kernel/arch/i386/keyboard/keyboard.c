@@ -8,6 +8,7 @@
 #include <kernel/lock.h>
 #include <arch/i386/kernel/port_io.h>
 #include <arch/i386/kernel/isr.h>
+#include <arch/i386/kernel/irq.h>
 
 // Ref: xv6/kdb.c
 // Ref: https://www.win.tue.nl/~aeb/linux/kbd/scancodes-1.html
@@ -243,6 +244,7 @@ key read_key_buffer() {
 
 void init_keyboard() {
     register_interrupt_handler(IRQ_TO_INTERRUPT(1), keyboard_callback);
+    irq_enable(1);
     // Set LED status, set num lock ON by default
     outb(KDB_DATA_PORT, 0xED);
     kbd_ack();
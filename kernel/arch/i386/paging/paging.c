@@ -9,15 +9,18 @@
 #include <arch/i386/kernel/isr.h>
 #include <arch/i386/kernel/segmentation.h>
 #include <arch/i386/kernel/cpu.h>
+#include <kernel/lock.h>
+#include <kernel/cpu.h>
 
 // Ref: https://blog.inlow.online/2019/01/21/Paging/
 // Ref: http://www.jamesmolloy.co.uk/tutorial_html/6.-Paging.html
 
 // NOTE:
 // We are assuming there is no dynamic memory allocation/mapping/deallocation
-// in interrupt handlers except syscall handler, so we don't need to insert any
-// lock to the paging, since the page table/dir is per process
-// no cross-process accessible global variables here 
+// in interrupt handlers except syscall handler.
+// User space page tables are per process, but the kernel space page tables are shared
+// by every page dir and every CPU, so searching and claiming kernel virtual space
+// is guarded by kernel_vm.lk
 
 // Entries per page directory
 #define PAGE_DIR_SIZE 1024
@@ -33,7 +36,9 @@ typedef struct page
    uint32_t user       : 1;   // Supervisor level only if clear
    uint32_t accessed   : 1;   // Has the page been accessed since last refresh?
    uint32_t dirty      : 1;   // Has the page been written to since last refresh?
-   uint32_t unused     : 7;   // Amalgamation of unused and reserved bits
+   uint32_t unused     : 4;   // Amalgamation of unused and reserved bits
+   uint32_t shared     : 1;   // (OS available bit) Frame owned by kernel, not copied by fork nor freed with user space
+   uint32_t available  : 2;   // Available to OS
    uint32_t frame      : 20;  // Frame address (shifted right 12 bits)
 } __attribute__((packed)) page_t;
 
@@ -63,6 +68,13 @@ typedef struct page_directory_entry
 #define PAGE_DIR_PHYSICAL_ADDR (((pde*) 0xFFFFF000)[1023].page_table_frame << 12)
 
 
+static struct {
+    spinlock lk;
+    // Bumped whenever a kernel space mapping is removed or downgraded,
+    // CPUs compare it with their own copy in sync_kernel_tlb()
+    volatile uint tlb_generation;
+} kernel_vm;
+
 // Declare internal utility functions
 static uint32_t find_contiguous_free_pages(pde* page_dir, size_t page_count, bool is_kernel);
 static uint unmap_pages_from(pde* page_dir, uint page_index, uint page_count, bool free_frame, bool skip_unmapped);
@@ -87,7 +99,7 @@ static inline void ltr(uint16_t sel)
 }
 
 // Initialize GDT with user space entries and a slot for TSS
-static void init_gdt()
+void init_gdt()
 {
     cpu* cpu = curr_cpu();
     cpu->gdt[SEG_NULL] = (segdesc) {0};
@@ -106,6 +118,33 @@ static inline void flush_tlb(uint32_t addr) {
     asm volatile("invlpg (%0)" ::"r" (addr) : "memory");
 }
 
+static bool is_kernel_page_index(uint page_index)
+{
+    return page_index >= PAGE_INDEX_FROM_VADDR((uint32_t) MAP_MEM_PA_ZERO_TO);
+}
+
+// invlpg only flushes the TLB of the calling CPU, other CPUs may still cache
+// the old translation of a kernel page. Instead of shooting down with IPIs,
+// they catch up lazily by flushing the whole TLB the next time they take a lock,
+// which is when they could start using the reused address
+static void kernel_tlb_changed()
+{
+    __sync_fetch_and_add(&kernel_vm.tlb_generation, 1);
+}
+
+// Flush the TLB of the calling CPU if the kernel mapping changed since its last flush
+void sync_kernel_tlb()
+{
+    push_cli();
+    cpu* cpu = curr_cpu();
+    uint generation = kernel_vm.tlb_generation;
+    if(cpu->tlb_generation != generation) {
+        cpu->tlb_generation = generation;
+        switch_page_directory(PAGE_DIR_PHYSICAL_ADDR);
+    }
+    pop_cli();
+}
+
 // Switch page directory
 // When page directory entries have been changed, can switch to oneself to flush the cache
 inline void switch_page_directory(uint32_t physical_addr) {
@@ -176,8 +215,10 @@ static page_t* get_page_table(pde* page_dir, uint32_t page_dir_idx, bool allow_a
         page_table = PAGE_TABLE_PTR(page_dir_idx);
     } else {
         uint32_t page_table_frame = page_dir[page_dir_idx].page_table_frame;
+        spin_lock(&kernel_vm.lk);
         uint32_t page_table_page_index = find_contiguous_free_pages(curr_page_dir(), 1, true);
         map_pages_at(curr_page_dir(), page_table_page_index, 1, &page_table_frame, true, true, false);
+        spin_unlock(&kernel_vm.lk);
         page_table = (page_t*) VADDR_FROM_PAGE_INDEX(page_table_page_index);
     }
 
@@ -263,7 +304,7 @@ uint map_pages_at(pde* page_dir, uint page_index, uint page_count, uint32_t* fra
     PANIC_ASSERT((page_dir_idx < kernel_page_dir_idx) ^ is_kernel);
     page_t* page_table = get_page_table(page_dir, page_dir_idx, true);
     
-    uint frame_index;
+    uint frame_index = 0;
     if(frames == NULL && consecutive_frame) {
         frame_index = n_free_frames(page_count);
     }
@@ -317,6 +358,22 @@ uint map_pages_at(pde* page_dir, uint page_index, uint page_count, uint32_t* fra
     return page_allocated;
 }
 
+// Map kernel owned frames to user space pages
+// These pages are skipped by copy_user_space() and their frames are not freed by free_user_space()
+//@return number of frames mapped
+uint map_shared_pages_at(pde* page_dir, uint page_index, uint page_count, uint32_t* frames, bool is_writeable)
+{
+    uint mapped = map_pages_at(page_dir, page_index, page_count, frames, false, is_writeable, false);
+    for(uint i = 0; i < mapped; i++) {
+        uint page_dir_idx = (page_index + i) / PAGE_TABLE_SIZE;
+        uint page_table_idx = (page_index + i) % PAGE_TABLE_SIZE;
+        page_t* page_table = get_page_table(page_dir, page_dir_idx, false);
+        page_table[page_table_idx].shared = 1;
+        return_page_table(page_dir, page_table);
+    }
+    return mapped;
+}
+
 // Unmap/Deallocate pages
 //@param free_frame if true, deallocate physical frames, otherwise unmap only
 //@param skip_unmapped if false, kernel panic if trying to unmap page not present
@@ -340,7 +397,7 @@ static uint unmap_pages_from(pde* page_dir, uint page_index, uint page_count, bo
         PANIC_ASSERT(skip_unmapped || page_table[page_table_idx].present);
 
         if(page_table[page_table_idx].present) {
-            if(free_frame) {
+            if(free_frame && !page_table[page_table_idx].shared) {
                 clear_frame(page_table[page_table_idx].frame);
             }
             memset(&page_table[page_table_idx], 0, sizeof(*page_table));
@@ -365,6 +422,10 @@ static uint unmap_pages_from(pde* page_dir, uint page_index, uint page_count, bo
         }
     }
 
+    if(is_kernel_page_index(page_index)) {
+        kernel_tlb_changed();
+    }
+
     return page_deallocated;
 }
 
@@ -474,6 +535,9 @@ uint32_t change_page_rw_attr(pde* page_dir, uint32_t page_index, bool is_writeab
     if(is_curr_page_dir(page_dir)) {
         flush_tlb(VADDR_FROM_PAGE_INDEX(page_index));
     }
+    if(is_kernel_page_index(page_index) && !is_writeable) {
+        kernel_tlb_changed();
+    }
 
     return VADDR_FROM_PAGE_INDEX(page_index);
 }
@@ -512,8 +576,14 @@ uint32_t alloc_pages(pde* page_dir, size_t page_count, bool is_kernel, bool is_w
     if (page_count == 0) {
         return 0;
     }
+    if(is_kernel) {
+        spin_lock(&kernel_vm.lk);
+    }
     uint32_t page_index = find_contiguous_free_pages(page_dir, page_count, is_kernel);
     map_pages_at(page_dir, page_index, page_count, NULL, is_kernel, is_writeable, false);
+    if(is_kernel) {
+        spin_unlock(&kernel_vm.lk);
+    }
     return VADDR_FROM_PAGE_INDEX(page_index);
 }
 
@@ -522,8 +592,10 @@ uint32_t alloc_pages_consecutive_frames(pde* page_dir, size_t page_count, bool i
     if (page_count == 0) {
         return 0;
     }
+    spin_lock(&kernel_vm.lk);
     uint32_t page_index = find_contiguous_free_pages(page_dir, page_count, true);
     map_pages_at(page_dir, page_index, page_count, NULL, true, is_writeable, true);
+    spin_unlock(&kernel_vm.lk);
     uint32_t vaddr = VADDR_FROM_PAGE_INDEX(page_index);
     if(physical_addr != NULL) {
         *physical_addr = vaddr2paddr(page_dir, vaddr);
@@ -531,6 +603,21 @@ uint32_t alloc_pages_consecutive_frames(pde* page_dir, size_t page_count, bool i
     return vaddr;
 }
 
+// Map a physical memory range (e.g. memory mapped device registers) into kernel space
+//@return vaddr corresponding to paddr
+uint32_t map_physical_memory(uint32_t paddr, uint32_t size, bool is_writeable)
+{
+    PANIC_ASSERT(size > 0);
+    uint32_t frame_index = FRAME_INDEX_FROM_ADDR(paddr);
+    uint32_t offset = paddr - ADDR_FROM_FRAME_INDEX(frame_index);
+    uint32_t page_count = PAGE_COUNT_FROM_BYTES(offset + size);
+    spin_lock(&kernel_vm.lk);
+    uint32_t page_index = find_contiguous_free_pages(curr_page_dir(), page_count, true);
+    map_pages_at(curr_page_dir(), page_index, page_count, &frame_index, true, is_writeable, true);
+    spin_unlock(&kernel_vm.lk);
+    return VADDR_FROM_PAGE_INDEX(page_index) + offset;
+}
+
 bool is_vaddr_accessible(pde* page_dir, uint32_t vaddr, bool is_from_kernel_code, bool is_writing) {
     UNUSED_ARG(is_from_kernel_code);
 
@@ -586,6 +673,10 @@ void set_tss(uint32_t kernel_stack_esp)
     // forbids I/O instructions (e.g., inb and outb) from user space
     cpu->ts.iomb = (uint16_t) 0xFFFF;
     ltr(SEG_SELECTOR(SEG_TSS, DPL_KERNEL));
+    // SYSENTER does not consult the TSS, keep its stack in sync
+    if(cpu->has_sysenter) {
+        wrmsr(MSR_IA32_SYSENTER_ESP, kernel_stack_esp);
+    }
 }
 
 // copy all kernel space page dir entries from current dir to page_dir 
@@ -641,7 +732,8 @@ pde* copy_user_space(pde* page_dir)
             page_t* page_table = get_page_table(page_dir, i, false);
             
             for(int j=0;j<PAGE_TABLE_SIZE;j++) {
-                if(page_table[j].present) {
+                // shared pages are mapped by their owner, e.g. vDSO pages
+                if(page_table[j].present && !page_table[j].shared) {
                     // copy frame content
                     uint32_t page_idx = i*PAGE_TABLE_SIZE + j;
                     uint32_t src;
@@ -686,4 +778,15 @@ void initialize_paging()
     printf("vaddr2paddr: page_dir is mapped to: %u, PHY=%u\n", vaddr2paddr(curr_dir, (uint32_t) curr_dir), PAGE_DIR_PHYSICAL_ADDR);
     PANIC_ASSERT((uint32_t) PAGE_DIR_PHYSICAL_ADDR == vaddr2paddr(curr_page_dir(), (uint32_t) curr_page_dir()));
 
+    // Allocate every kernel space page table upfront, so kernel page dir entries never change
+    // and stay identical in all page dirs created by copy_kernel_space_mapping(),
+    // no matter which page dir (or CPU) maps new kernel pages later
+    uint32_t kernel_page_dir_idx = PAGE_INDEX_FROM_VADDR((uint32_t) MAP_MEM_PA_ZERO_TO) / PAGE_TABLE_SIZE;
+    for(uint32_t i = kernel_page_dir_idx; i < PAGE_DIR_SIZE - 1; i++) {
+        if(!curr_dir[i].present) {
+            page_t* page_table = get_page_table(curr_dir, i, true);
+            return_page_table(curr_dir, page_table);
+        }
+    }
+
 }
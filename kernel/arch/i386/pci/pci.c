@@ -3,7 +3,13 @@
 #include <kernel/panic.h>
 #include <kernel/pci.h>
 #include <arch/i386/kernel/port_io.h>
+#include <arch/i386/kernel/isr.h>
+#include <arch/i386/kernel/irq.h>
+#include <arch/i386/kernel/cpu.h>
 #include <kernel/rtl8139.h>
+#include <kernel/ata.h>
+#include <kernel/ahci.h>
+#include <kernel/virtio_blk.h>
 
 // Ref: https://wiki.osdev.org/PCI
 
@@ -13,6 +19,25 @@
 #define PCI_CONFIG_ADDRESS_PORT 0xCF8
 #define PCI_CONFIG_DATA_PORT 0xCFC
 
+// Capability IDs
+#define PCI_CAP_ID_MSI 0x05
+
+// MSI capability layout
+// Ref: PCI Local Bus Specification 3.0, Section 6.8.1
+#define MSI_CONTROL 0x02
+    #define MSI_CONTROL_ENABLE (1 << 0)
+    #define MSI_CONTROL_MULTI_ENABLE_MASK (0x7 << 4)
+    #define MSI_CONTROL_64BIT (1 << 7)
+#define MSI_ADDRESS_LO 0x04
+#define MSI_ADDRESS_HI 0x08
+#define MSI_DATA_32 0x08
+#define MSI_DATA_64 0x0C
+
+// Message address targeting a local APIC, physical destination mode
+// Ref: Intel SDM Vol. 3A, 10.11.1 Message Address Register Format
+#define MSI_ADDRESS_BASE 0xFEE00000
+#define MSI_ADDRESS_DEST_SHIFT 12
+
 static void pci_check_bus(uint8_t bus);
 
 
@@ -77,6 +102,56 @@ void pci_write_reg(uint8_t bus, uint8_t device, uint8_t function, uint8_t offset
     
 }
 
+// Walk the capability list
+//@return config space offset of the capability, 0 if not found
+uint8_t pci_find_capability(uint8_t bus, uint8_t device, uint8_t function, uint8_t cap_id)
+{
+    if(!(PCI_STATUS(bus, device, function) & PCI_STATUS_CAP_LIST)) {
+        return 0;
+    }
+    uint8_t offset = PCI_CAP_PTR(bus, device, function) & ~0x3;
+    // 48 = max number of capabilities fitting in the config space, guard against loops
+    for(int i = 0; offset != 0 && i < 48; i++) {
+        if(pci_read_reg(bus, device, function, offset, 1) == cap_id) {
+            return offset;
+        }
+        offset = pci_read_reg(bus, device, function, offset + 1, 1) & ~0x3;
+    }
+    return 0;
+}
+
+// Switch the device from INTx to a message signaled interrupt delivered to the bootstrap processor
+//@return the interrupt vector, or -1 if the device or the system does not support MSI
+int pci_enable_msi(uint8_t bus, uint8_t device, uint8_t function, void (*handler)(struct trapframe*))
+{
+    uint8_t cap = pci_find_capability(bus, device, function, PCI_CAP_ID_MSI);
+    if(cap == 0) {
+        return -1;
+    }
+    int vector = alloc_msi_vector();
+    if(vector < 0) {
+        return -1;
+    }
+    register_interrupt_handler(vector, handler);
+
+    uint16_t control = pci_read_reg(bus, device, function, cap + MSI_CONTROL, 2);
+    uint32_t address = MSI_ADDRESS_BASE | (cpus[0].apic_id << MSI_ADDRESS_DEST_SHIFT);
+    pci_write_reg(bus, device, function, cap + MSI_ADDRESS_LO, 4, address);
+    if(control & MSI_CONTROL_64BIT) {
+        pci_write_reg(bus, device, function, cap + MSI_ADDRESS_HI, 4, 0);
+        pci_write_reg(bus, device, function, cap + MSI_DATA_64, 2, vector);
+    } else {
+        pci_write_reg(bus, device, function, cap + MSI_DATA_32, 2, vector);
+    }
+    // a single message, edge triggered
+    control &= ~MSI_CONTROL_MULTI_ENABLE_MASK;
+    control |= MSI_CONTROL_ENABLE;
+    pci_write_reg(bus, device, function, cap + MSI_CONTROL, 2, control);
+
+    PCI_W_COMMAND(bus, device, function, PCI_COMMAND(bus, device, function) | PCI_COMMAND_INT_DISABLE);
+    return vector;
+}
+
 static void init_pci_device(uint8_t bus, uint8_t device, uint8_t function)
 {
     uint16_t vendor_id = PCI_VENDER_ID(bus, device, function);
@@ -91,6 +166,19 @@ static void init_pci_device(uint8_t bus, uint8_t device, uint8_t function)
     if(vendor_id == 0x10EC && PCI_DEVICE_ID == 0x8139) {
         init_rtl8139(bus, device, function);
     }
+    // IDE controller capable of bus mastering, e.g. PIIX3/PIIX4
+    if(PCI_BASE_CLASS(bus, device, function) == 0x01 && PCI_SUB_CLASS(bus, device, function) == 0x01
+        && (PCI_PROG_IF(bus, device, function) & 0x80)) {
+        init_ata_dma(bus, device, function);
+    }
+    // SATA controller in AHCI mode, e.g. ICH9
+    if(PCI_BASE_CLASS(bus, device, function) == 0x01 && PCI_SUB_CLASS(bus, device, function) == 0x06
+        && PCI_PROG_IF(bus, device, function) == 0x01) {
+        init_ahci(bus, device, function);
+    }
+    if(vendor_id == VIRTIO_VENDOR_ID && PCI_DEVICE_ID == VIRTIO_BLK_DEVICE_ID) {
+        init_virtio_blk(bus, device, function);
+    }
 }
 
 static void pci_check_function(uint8_t bus, uint8_t device, uint8_t function) {
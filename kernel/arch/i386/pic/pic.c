@@ -45,6 +45,13 @@ void PIC_remap(int offset1, int offset2) {
     outb(PIC2_DATA, a2);
 }
 
+// Mask every IRQ line, used when the IOAPIC takes over
+// Spurious IRQ 7/15 can still arrive, so keep the remapping
+void PIC_disable() {
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
 bool PIC_is_spurious_irq(unsigned char irq)
 {
     if (irq == 7 || irq == 15) {
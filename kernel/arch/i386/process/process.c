@@ -11,6 +11,13 @@
 #include <kernel/elf.h>
 #include <kernel/cpu.h>
 #include <kernel/lock.h>
+#include <kernel/vdso.h>
+#include <kernel/softirq.h>
+#include <kernel/futex.h>
+#include <kernel/preempt.h>
+#include <kernel/heap.h>
+#include <arch/i386/kernel/lapic.h>
+#include <arch/i386/kernel/fpu.h>
 #include <stddef.h>
 #include <string.h>
 #include <stdio.h>
@@ -48,12 +55,20 @@ extern char START_INIT_PHY_BEGIN[], START_INIT_VIRTUAL_BEGIN[], START_INIT_RELOC
 // defined in switch_kernel_context.asm
 extern void switch_kernel_context(struct context **old, struct context *new);
 
+// Processes are allocated from a cache of proc structs, grown PROC_SLAB_SIZE at a time
+// and never given back to the heap. Each struct owns a slot number for life,
+// pid = generation << PID_GENERATION_SHIFT | slot, the generation starts at 0 and is bumped
+// when the struct is freed, so early pids stay small and a stale pid never refers to a new process
+// The lock also guards the per-CPU run queues
 struct {
-  proc proc[N_PROCESS];
-  yield_lock lk;
+  proc* all;                        // Every process in use, doubly linked
+  proc* free;                       // Cached unused proc structs
+  uint n_slot;                      // Slots handed out to proc structs
+  uint n_proc;                      // Processes in use
+  spinlock lk;
 } process_table;
 
-static uint32_t next_pid = 1;
+#define for_each_proc(q) for(proc* q = process_table.all; q != NULL; q = q->all_next)
 static int scheduler_available = 0;
 proc* init_process = NULL;
 
@@ -66,32 +81,89 @@ void initialize_process()
     // Any new process will be scheduled with process table locked
     // because it is scheduled from another process's yield
     // also the scheduler will ensure any process is scheduled to in locked state
-    release(&process_table.lk);
+    spin_unlock(&process_table.lk);
 
     scheduler_available = 1;
 }
 
+// Add PROC_SLAB_SIZE proc structs to the cache
+static void grow_proc_cache()
+{
+    proc* slab = kmalloc(sizeof(proc)*PROC_SLAB_SIZE);
+    if(slab == NULL) {
+        return;
+    }
+    memset(slab, 0, sizeof(proc)*PROC_SLAB_SIZE);
+    spin_lock(&process_table.lk);
+    uint n = PID_MAX_SLOT - process_table.n_slot;
+    n = n < PROC_SLAB_SIZE ? n : PROC_SLAB_SIZE;
+    // push the highest slot first, so that the lowest is handed out first
+    for(uint i=n; i-- > 0; ) {
+        proc* p = &slab[i];
+        p->slot = process_table.n_slot + i + 1;
+        p->all_next = process_table.free;
+        process_table.free = p;
+    }
+    process_table.n_slot += n;
+    spin_unlock(&process_table.lk);
+}
+
+// Return p to the cache, caller shall hold the process table lock
+static void free_proc(proc* p)
+{
+    PANIC_ASSERT(spin_holding(&process_table.lk));
+    if(p->all_prev != NULL) {
+        p->all_prev->all_next = p->all_next;
+    } else {
+        process_table.all = p->all_next;
+    }
+    if(p->all_next != NULL) {
+        p->all_next->all_prev = p->all_prev;
+    }
+    process_table.n_proc--;
+
+    uint slot = p->slot;
+    uint generation = p->generation;
+    *p = (proc) {0};
+    p->state = PROC_STATE_UNUSED;
+    p->slot = slot;
+    // the next process in this struct gets a new pid
+    p->generation = (generation + 1) & PID_MAX_GENERATION;
+    p->all_next = process_table.free;
+    process_table.free = p;
+}
+
 // Ref: xv6/proc.c
-// Allocate a new process
+// Allocate a new process, return NULL if out of memory
 proc* create_process()
 {
-    acquire(&process_table.lk);
-    proc* p = NULL;
-    for(int i=0;i<N_PROCESS;i++) {
-        if(process_table.proc[i].state == PROC_STATE_UNUSED) {
-            p = &process_table.proc[i];
-            p->state = PROC_STATE_EMBRYO;
-            release(&process_table.lk);
-            break;
-        }
-        if(i==N_PROCESS-1) {
-            release(&process_table.lk);
-            PANIC("Too many processes");
+    spin_lock(&process_table.lk);
+    if(process_table.free == NULL) {
+        // the heap lock may yield, so grow the cache unlocked
+        spin_unlock(&process_table.lk);
+        grow_proc_cache();
+        spin_lock(&process_table.lk);
+        if(process_table.free == NULL) {
+            spin_unlock(&process_table.lk);
+            printf("create_process: out of memory\n");
+            return NULL;
         }
     }
+    proc* p = process_table.free;
+    process_table.free = p->all_next;
+    p->all_next = NULL;
+    p->state = PROC_STATE_EMBRYO;
+    p->pid = (int32_t) (p->generation << PID_GENERATION_SHIFT | p->slot);
+    p->n_threads = 1;
+
+    p->all_next = process_table.all;
+    if(p->all_next != NULL) {
+        p->all_next->all_prev = p;
+    }
+    process_table.all = p;
+    process_table.n_proc++;
+    spin_unlock(&process_table.lk);
 
-    memset(p, 0, sizeof(*p));
-    p->pid = next_pid++;
     // allocate process's kernel stack
     // allocate one additional read-only page and change it to read-only to detect stack overflow
     uint32_t kernel_stack_addr = alloc_pages(curr_page_dir(), N_KERNEL_STACK_PAGE_SIZE + 1, true, true);
@@ -125,6 +197,7 @@ void init_first_process()
 
     // allocate page dir
     p->page_dir = alloc_page_dir();
+    vdso_map(p, p->page_dir);
 
     // allocate/map user space page for the start_init routine
     PANIC_ASSERT((uint32_t)START_INIT_RELOC_BEGIN % 0x1000 == 0);
@@ -152,7 +225,38 @@ void init_first_process()
 
     p->cwd = strdup("/");
 
-    p->state = PROC_STATE_RUNNABLE;
+    make_runnable(p);
+}
+
+// First code run by a kernel thread, switched to from the scheduler
+static void kernel_thread_entry()
+{
+    // same as initialize_process
+    spin_unlock(&process_table.lk);
+    scheduler_available = 1;
+    enable_interrupt();
+
+    proc* p = curr_proc();
+    p->kthread_entry(p->kthread_arg);
+    exit(0);
+}
+
+// Create a thread running entry(arg) in kernel space
+// It has no user space program, its page dir only holds the kernel mapping
+// If entry returns, the thread exits and is reaped by init
+proc* create_kernel_thread(void (*entry)(void*), void* arg)
+{
+    proc* p = create_process();
+    PANIC_ASSERT(p != NULL);
+    p->page_dir = alloc_page_dir();
+    p->is_kernel_thread = 1;
+    p->kthread_entry = entry;
+    p->kthread_arg = arg;
+    p->cwd = strdup("/");
+    // start from kernel_thread_entry instead of returning to user space through int_ret
+    p->context->eip = (uint32_t) kernel_thread_entry;
+    make_runnable(p);
+    return p;
 }
 
 void switch_process_memory_mapping(proc* p)
@@ -164,57 +268,235 @@ void switch_process_memory_mapping(proc* p)
     switch_page_directory(page_dir_paddr);
 }
 
+static void runq_push(cpu* c, proc* p)
+{
+    p->runq_next = NULL;
+    if(c->runq_tail) {
+        c->runq_tail->runq_next = p;
+    } else {
+        c->runq_head = p;
+    }
+    c->runq_tail = p;
+    c->runq_len++;
+}
+
+static proc* runq_pop(cpu* c)
+{
+    proc* p = c->runq_head;
+    if(p == NULL) {
+        return NULL;
+    }
+    c->runq_head = p->runq_next;
+    if(c->runq_head == NULL) {
+        c->runq_tail = NULL;
+    }
+    c->runq_len--;
+    p->runq_next = NULL;
+    return p;
+}
+
+// Take a process from the busiest other CPU when our own queue is empty
+static proc* runq_steal(cpu* c)
+{
+    cpu* busiest = NULL;
+    for(uint i = 0; i < n_cpu; i++) {
+        if(&cpus[i] != c && cpus[i].runq_len > 0 && (busiest == NULL || cpus[i].runq_len > busiest->runq_len)) {
+            busiest = &cpus[i];
+        }
+    }
+    return busiest ? runq_pop(busiest) : NULL;
+}
+
+// Mark a process RUNNABLE and queue it on the least loaded CPU
+// Caller shall hold the process table lock
+static void enqueue_runnable(proc* p)
+{
+    PANIC_ASSERT(spin_holding(&process_table.lk));
+    cpu* target = &cpus[0];
+    for(uint i = 1; i < n_cpu; i++) {
+        if(cpus[i].started && cpus[i].runq_len < target->runq_len) {
+            target = &cpus[i];
+        }
+    }
+    p->state = PROC_STATE_RUNNABLE;
+    runq_push(target, p);
+    // wake it up if it is halting in the scheduler
+    if(target->idle && target != curr_cpu()) {
+        lapic_send_ipi(target->apic_id, IPI_RESCHEDULE_VECTOR);
+    }
+}
+
+// Mark a new process RUNNABLE and queue it on the least loaded CPU
+void make_runnable(proc* p)
+{
+    spin_lock(&process_table.lk);
+    enqueue_runnable(p);
+    spin_unlock(&process_table.lk);
+}
+
+// Switch from the current process p to the scheduler of this CPU
+// Caller shall hold the process table lock and have changed p->state
+static void sched(proc* p)
+{
+    PANIC_ASSERT(spin_holding(&process_table.lk));
+    // The interrupt nesting belongs to this process, not the CPU,
+    // since we may be switched back on another CPU
+    cpu* c = curr_cpu();
+    int cli_count = c->cli_count;
+    int orig_if_flag = c->orig_if_flag;
+    uint preempt_count = c->preempt_count;
+    switch_kernel_context(&p->context, c->scheduler_context);
+    c = curr_cpu();
+    c->cli_count = cli_count;
+    c->orig_if_flag = orig_if_flag;
+    c->preempt_count = preempt_count;
+}
+
+// Free the kernel stack allocated by create_process(), with its guard page below it
+static void free_kernel_stack(proc* p)
+{
+    dealloc_pages(curr_page_dir(), PAGE_INDEX_FROM_VADDR((uint32_t) p->kernel_stack) - 1, N_KERNEL_STACK_PAGE_SIZE + 1);
+}
+
+// Free an exited or never started thread, which shares everything but the kernel stack
+// Caller shall hold the process table lock
+static void reap_thread(proc* p)
+{
+    PANIC_ASSERT(spin_holding(&process_table.lk));
+    PANIC_ASSERT(p->leader != NULL);
+    p->leader->n_unreaped_threads--;
+    free_kernel_stack(p);
+    free_proc(p);
+}
+
+// Per-CPU scheduler, never returns
+// Each CPU runs processes from its own run queue, and steals from others when it runs dry
 void scheduler()
 {
-    proc* p;
+    cpu* c = curr_cpu();
     // acquire lock for the first process
     // pretend it was yielded from another process
-    acquire(&process_table.lk);
+    spin_lock(&process_table.lk);
+    c->started = 1;
     while(1) {
-        for(p = process_table.proc; p < &process_table.proc[N_PROCESS]; p++){
-            if(p->state != PROC_STATE_RUNNABLE)
-                continue;
-
-            // Holding the process table lock when leaving and entering the scheduler
-            // Enter with lock because we are entering scheduler's loop of process_table
-            // Leave with lock because we use the p->context to do switching
-
-            PANIC_ASSERT(!is_interrupt_enabled());
-            PANIC_ASSERT(holding(&process_table.lk));
-
-            // printf("Scheduling to process %u\n", p->pid);
-            cpu* cpu = curr_cpu();
-            cpu->current_process = p;
-            switch_process_memory_mapping(p);
-            p->state = PROC_STATE_RUNNING;
-            switch_kernel_context(&cpu->scheduler_context, p->context);
-
-            PANIC_ASSERT(holding(&process_table.lk));
-            
-            // printf("Switched back from process %u\n", p->pid);
-            cpu->current_process = NULL;
+        proc* p = runq_pop(c);
+        if(p == NULL) {
+            p = runq_steal(c);
+        }
+        if(p == NULL) {
+            // Nothing to run, halt until an interrupt (timer or a reschedule IPI) arrives
+            c->idle = 1;
+            spin_unlock(&process_table.lk);
+            asm volatile("sti; hlt; cli");
+            spin_lock(&process_table.lk);
+            c->idle = 0;
+            continue;
+        }
+        PANIC_ASSERT(p->state == PROC_STATE_RUNNABLE);
+
+        // Holding the process table lock when leaving and entering the scheduler
+        // Enter with lock because we are entering scheduler's loop of process_table
+        // Leave with lock because we use the p->context to do switching
+
+        PANIC_ASSERT(!is_interrupt_enabled());
+        PANIC_ASSERT(spin_holding(&process_table.lk));
+
+        // printf("Scheduling to process %u\n", p->pid);
+        c->current_process = p;
+        switch_process_memory_mapping(p);
+        p->state = PROC_STATE_RUNNING;
+        fpu_switch_in(c, p);
+        switch_kernel_context(&c->scheduler_context, p->context);
+
+        PANIC_ASSERT(spin_holding(&process_table.lk));
+        // The process left with its own cli nesting, which it restores when switched back
+        // to, the scheduler itself only holds the process table lock
+        c->cli_count = 1;
+        c->orig_if_flag = 0;
+        c->preempt_count = 1;
+        fpu_switch_out(c, p);
+        preempt_sched_out(c);
+
+        // printf("Switched back from process %u\n", p->pid);
+        c->current_process = NULL;
+        if(p->state == PROC_STATE_RUNNABLE) {
+            runq_push(c, p);
+        } else if(p->state == PROC_STATE_ZOMBIE && p->leader != NULL) {
+            // No one waits for a thread, reap it now that it is off its kernel stack
+            reap_thread(p);
         }
     }
 }
 
 proc* curr_proc()
 {
-    return curr_cpu()->current_process;
+    // do not migrate between reading the CPU and its current process
+    push_cli();
+    proc* p = curr_cpu()->current_process;
+    pop_cli();
+    return p;
+}
+
+// Return the slot of handle in p's table, NULL if its chunk is not allocated
+static struct handle_map* proc_handle(proc* p, int handle)
+{
+    if(handle < 0 || handle >= MAX_HANDLE_PER_PROCESS) return NULL;
+    struct handle_chunk* chunk = p->handles[handle / HANDLE_CHUNK_SIZE];
+    if(chunk == NULL) return NULL;
+    return &chunk->map[handle % HANDLE_CHUNK_SIZE];
+}
+
+// Put pmap at the given slot, allocating its chunk if needed
+// Caller shall hold p's group_lk and the slot shall be unused
+static int install_handle(proc* p, int handle, const struct handle_map* pmap)
+{
+    uint c = handle / HANDLE_CHUNK_SIZE;
+    uint i = handle % HANDLE_CHUNK_SIZE;
+    if(p->handles[c] == NULL) {
+        struct handle_chunk* chunk = kmalloc(sizeof(struct handle_chunk));
+        if(chunk == NULL) return -ENOMEM;
+        memset(chunk, 0, sizeof(struct handle_chunk));
+        p->handles[c] = chunk;
+    }
+    struct handle_chunk* chunk = p->handles[c];
+    chunk->map[i] = *pmap;
+    chunk->used |= 1u << i;
+    if(chunk->used == 0xFFFFFFFF) {
+        p->full_handle_chunks |= 1u << c;
+    }
+    return 0;
+}
+
+// Mark the slot unused, caller shall hold p's group_lk
+static void uninstall_handle(proc* p, int handle)
+{
+    uint c = handle / HANDLE_CHUNK_SIZE;
+    uint i = handle % HANDLE_CHUNK_SIZE;
+    struct handle_chunk* chunk = p->handles[c];
+    chunk->map[i].type = HANDLE_TYPE_UNUSED;
+    chunk->used &= ~(1u << i);
+    p->full_handle_chunks &= ~(1u << c);
 }
 
 int alloc_handle(struct handle_map* pmap)
 {
     if(pmap == NULL) return -1;
-    // handle is the index into (a process's) struct handle_storage
-    proc* p = curr_proc();
-    for(int handle=0; handle<MAX_HANDLE_PER_PROCESS;handle++) {
-        if(p->handles[handle].type == HANDLE_TYPE_UNUSED) {
-            p->handles[handle] = *pmap;
-            return handle;
-        }
+    // handle is the index into (a process's) handle table
+    // the table is shared by all threads of the process
+    proc* p = proc_leader(curr_proc());
+    acquire(&p->group_lk);
+    if(p->full_handle_chunks == 0xFFFFFFFF) {
+        release(&p->group_lk);
+        // too many opended files
+        return -EMFILE;
     }
-    // too many opended files
-    return -EMFILE;
+    // lowest numbered unused handle, as POSIX requires for open() and dup()
+    uint c = __builtin_ctz(~p->full_handle_chunks);
+    uint i = p->handles[c] == NULL ? 0 : __builtin_ctz(~p->handles[c]->used);
+    int handle = c*HANDLE_CHUNK_SIZE + i;
+    int r = install_handle(p, handle, pmap);
+    release(&p->group_lk);
+    return r < 0 ? r : handle;
 }
 
 int dup_grd(struct handle_map* pmap)
@@ -225,80 +507,218 @@ int dup_grd(struct handle_map* pmap)
     return 0;
 }
 
+static int release_grd(struct handle_map* pmap)
+{
+    if(pmap->type == HANDLE_TYPE_FILE) {
+        return fs_release(pmap->grd);
+    } else if(pmap->type == HANDLE_TYPE_SOCKET) {
+        return close_socket(pmap->grd);
+    }
+    return 0;
+}
+
 int dup_handle(int handle)
 {
-    if(handle >= MAX_HANDLE_PER_PROCESS) return -1;
     struct handle_map* pmap = get_handle(handle);
     if(pmap == NULL) return -1;
     int dup = alloc_handle(pmap);
     if(dup < 0) return dup; 
     int r = dup_grd(pmap);
     if(r < 0) {
-        struct handle_map* pmap = get_handle(dup);
-        pmap->type = HANDLE_TYPE_UNUSED;
+        proc* p = proc_leader(curr_proc());
+        acquire(&p->group_lk);
+        uninstall_handle(p, dup);
+        release(&p->group_lk);
         return r;
     }
     return dup;
 }
 
-void dup_handles_to(proc* from, proc* to)
+// Copy the handles of from into to, both then refer to the same resources
+int dup_handles_to(proc* from, proc* to)
 {
-    for(int handle=0;handle<MAX_HANDLE_PER_PROCESS;handle++) {
-        struct handle_map* pmap = &from->handles[handle];
-        if(pmap->type == HANDLE_TYPE_UNUSED) continue;
-        int r = dup_grd(pmap);
-        if(r == 0) to->handles[handle] = *pmap;
+    for(uint c=0; c<MAX_HANDLE_CHUNK; c++) {
+        struct handle_chunk* chunk = from->handles[c];
+        if(chunk == NULL) continue;
+        for(uint32_t used = chunk->used; used != 0; used &= used - 1) {
+            uint i = __builtin_ctz(used);
+            struct handle_map* pmap = &chunk->map[i];
+            if(dup_grd(pmap) < 0) continue;
+            acquire(&to->group_lk);
+            int r = install_handle(to, c*HANDLE_CHUNK_SIZE + i, pmap);
+            release(&to->group_lk);
+            if(r < 0) {
+                release_grd(pmap);
+                return r;
+            }
+        }
+    }
+    return 0;
+}
+
+static int release_proc_handle(proc* p, int handle)
+{
+    acquire(&p->group_lk);
+    struct handle_map* pmap = proc_handle(p, handle);
+    int r = 0;
+    if(pmap == NULL || pmap->type == HANDLE_TYPE_UNUSED) {
+        r = -1;
+    } else {
+        r = release_grd(pmap);
     }
+    if(r == 0) {
+        uninstall_handle(p, handle);
+    }
+    release(&p->group_lk);
+    return r;
 }
 
 int release_handle(int handle)
 {
-    if(handle >= MAX_HANDLE_PER_PROCESS) return -1;
-    struct handle_map* pmap = get_handle(handle);
-    if(pmap == NULL) return -1;
-    if(pmap->type == HANDLE_TYPE_FILE) {
-        int r = fs_release(pmap->grd);
-        if(r < 0) return r;
-    } else if(pmap->type == HANDLE_TYPE_SOCKET) {
-        int r = close_socket(pmap->grd);
+    return release_proc_handle(proc_leader(curr_proc()), handle);
+}
+
+static void release_all_handles(proc* p)
+{
+    for(uint c=0; c<MAX_HANDLE_CHUNK; c++) {
+        if(p->handles[c] == NULL) continue;
+        for(uint i=0; i<HANDLE_CHUNK_SIZE; i++) {
+            release_proc_handle(p, c*HANDLE_CHUNK_SIZE + i);
+        }
+    }
+}
+
+// Free the handle table itself, once no thread of p can use it
+static void free_handle_table(proc* p)
+{
+    for(uint c=0; c<MAX_HANDLE_CHUNK; c++) {
+        if(p->handles[c] != NULL) {
+            kfree(p->handles[c]);
+            p->handles[c] = NULL;
+        }
+    }
+    p->full_handle_chunks = 0;
+}
+
+// Apply one posix_spawn style file action to the (not yet running) process p
+static int apply_spawn_file_action(proc* p, const struct spawn_file_action* action)
+{
+    int fd = action->fd;
+    if(fd < 0 || fd >= MAX_HANDLE_PER_PROCESS) return -EBADF;
+    if(action->type == SPAWN_FILE_ACTION_CLOSE) {
+        release_proc_handle(p, fd);
+        return 0;
+    } else if(action->type == SPAWN_FILE_ACTION_DUP2) {
+        int new_fd = action->new_fd;
+        if(new_fd < 0 || new_fd >= MAX_HANDLE_PER_PROCESS) return -EBADF;
+        struct handle_map* pmap = proc_handle(p, fd);
+        if(pmap == NULL || pmap->type == HANDLE_TYPE_UNUSED) return -EBADF;
+        if(fd == new_fd) return 0;
+        int r = dup_grd(pmap);
         if(r < 0) return r;
+        release_proc_handle(p, new_fd);
+        acquire(&p->group_lk);
+        r = install_handle(p, new_fd, pmap);
+        release(&p->group_lk);
+        if(r < 0) {
+            release_grd(pmap);
+            return r;
+        }
+        return 0;
     }
-    pmap->type = HANDLE_TYPE_UNUSED;
-    return 0;
+    return -EINVAL;
 }
 
 struct handle_map* get_handle(int handle)
 {
-    if(handle >= MAX_HANDLE_PER_PROCESS) return NULL;
-    proc* p = curr_proc();
-    struct handle_map* pmap = &p->handles[handle];
-    if(pmap->type == HANDLE_TYPE_UNUSED) return NULL;
+    proc* p = proc_leader(curr_proc());
+    struct handle_map* pmap = proc_handle(p, handle);
+    if(pmap == NULL || pmap->type == HANDLE_TYPE_UNUSED) return NULL;
     return pmap;
 }
 
-void exit(int exit_code)
+// Make every thread of the group except the caller exit when it returns to user space
+// Caller shall hold the process table lock
+static void kill_thread_group(proc* leader, proc* except)
+{
+    PANIC_ASSERT(spin_holding(&process_table.lk));
+    leader->killed = 1;
+    for_each_proc(q) {
+        if(q == except || q->state == PROC_STATE_UNUSED || q->state == PROC_STATE_ZOMBIE) continue;
+        if(proc_leader(q) != leader) continue;
+        q->killed = 1;
+        // e.g. waiting on a futex
+        if(q->state == PROC_STATE_SLEEPING) {
+            enqueue_runnable(q);
+        }
+    }
+}
+
+// Terminate the calling thread
+// The shared handles are released by the last thread of the group, and the
+// leader is only reaped by its parent after all its threads are gone
+void thread_exit()
 {
     proc* p = curr_proc();
+    proc* leader = proc_leader(p);
 
-    for(int handle=0; handle<MAX_HANDLE_PER_PROCESS; handle++) {
-        release_handle(handle);
+    // let the joining thread know
+    if(p->clear_tid != NULL && is_vaddr_accessible(p->page_dir, (uint32_t) p->clear_tid, false, true)) {
+        *p->clear_tid = 0;
+        futex_wake(p->clear_tid, 1);
     }
 
-    acquire(&process_table.lk);
-    // pass children to init
-    for(int i=0; i<N_PROCESS; i++) {
-        if(process_table.proc[i].parent == p) {
-            process_table.proc[i].parent = init_process;
+    spin_lock(&process_table.lk);
+    uint live_threads = --leader->n_threads;
+    spin_unlock(&process_table.lk);
+
+    if(live_threads == 0) {
+        release_all_handles(leader);
+    }
+
+    spin_lock(&process_table.lk);
+    // kernel threads may be created before init
+    if(p->is_kernel_thread) {
+        p->parent = init_process;
+    }
+    if(live_threads == 0) {
+        // pass children to init
+        for_each_proc(q) {
+            if(q->parent == leader) {
+                q->parent = init_process;
+            }
         }
     }
     p->state = PROC_STATE_ZOMBIE;
-    p->exit_code = exit_code;
     
     switch_kernel_context(&p->context, curr_cpu()->scheduler_context);
 
     PANIC("Return from scheduler after exiting");
 }
 
+// Terminate the process, i.e. all threads of the calling thread's group
+void exit(int exit_code)
+{
+    proc* p = curr_proc();
+    proc* leader = proc_leader(p);
+
+    spin_lock(&process_table.lk);
+    leader->exit_code = exit_code;
+    kill_thread_group(leader, p);
+    spin_unlock(&process_table.lk);
+
+    thread_exit();
+}
+
+// Called before returning to user space, so a killed thread never runs user code again
+void exit_if_killed()
+{
+    proc* p = curr_proc();
+    if(p != NULL && p->killed) {
+        thread_exit();
+    }
+}
+
 // void process_IRQ(uint no_schedule)
 // {
 //     PANIC_ASSERT(!is_interrupt_enabled());
@@ -325,19 +745,66 @@ void yield()
     // PANIC_ASSERT(!is_interrupt_enabled());
 
     proc* p = curr_proc();
+    // e.g. an interrupt arrived while the scheduler is idle
+    if(p == NULL) {
+        return;
+    }
+    // Softirqs run on the stack of the interrupted process and must finish on this CPU
+    if(in_softirq()) {
+        return;
+    }
 
     if(!p->no_schedule) {
-        acquire(&process_table.lk);
+        spin_lock(&process_table.lk);
         // printf("PID %u yield\n", p->pid);
         p->state = PROC_STATE_RUNNABLE;
-        switch_kernel_context(&p->context, curr_cpu()->scheduler_context);
+        sched(p);
         // printf("PID %u back from yield\n", p->pid);
-        release(&process_table.lk);
+        spin_unlock(&process_table.lk);
     }
 
 
 }
 
+// Atomically release lk and sleep on chan, lk is held again when returning
+// Unlike yield(), the process is not scheduled until someone calls wakeup(chan)
+// Ref: xv6/proc.c
+void sleep(void* chan, spinlock* lk)
+{
+    proc* p = curr_proc();
+    PANIC_ASSERT(p != NULL);
+    PANIC_ASSERT(lk != NULL);
+    PANIC_ASSERT(!in_softirq());
+
+    // Once we hold the process table lock, we won't miss any wakeup
+    // since wakeup() runs with it locked
+    if(lk != &process_table.lk) {
+        spin_lock(&process_table.lk);
+        spin_unlock(lk);
+    }
+    p->chan = chan;
+    p->state = PROC_STATE_SLEEPING;
+    sched(p);
+    p->chan = NULL;
+
+    if(lk != &process_table.lk) {
+        spin_unlock(&process_table.lk);
+        spin_lock(lk);
+    }
+}
+
+// Wake up all processes sleeping on chan
+void wakeup(void* chan)
+{
+    spin_lock(&process_table.lk);
+    for_each_proc(p) {
+        if(p->state == PROC_STATE_SLEEPING && p->chan == chan) {
+            enqueue_runnable(p);
+        }
+    }
+    spin_unlock(&process_table.lk);
+}
+
 // From Newlib sys/wait.h
 /* A status looks like:
     <1 byte info> <1 byte code>
@@ -349,29 +816,43 @@ void yield()
 */
 int wait(int* wait_status)
 {
-    proc* p = curr_proc();
+    // children belong to the process, not to the thread that created them
+    proc* p = proc_leader(curr_proc());
     // printf("PID %u waiting\n", curr_proc()->pid);
     bool no_child = true;
     while(1) {
-        for(int i=0; i<N_PROCESS; i++) {
-            proc* child = &process_table.proc[i];
+        // The zombie may still be switching away on another CPU until the lock is released
+        proc* zombie = NULL;
+        spin_lock(&process_table.lk);
+        for_each_proc(child) {
             if(child->parent == p) {
                 no_child = false;
-                if(child->state == PROC_STATE_ZOMBIE) {
-                    uint32_t child_pid = child->pid;
-                    if(wait_status != NULL) {
-                        // currently only support normal exit with exit code given
-                        *wait_status = (0xFF & child->exit_code) << 8;
-                    }
-                    dealloc_pages(curr_page_dir(), PAGE_INDEX_FROM_VADDR((uint32_t) child->kernel_stack), 1);
-                    free_user_space(child->page_dir);
-                    *child = (proc) {0};
-                    child->state = PROC_STATE_UNUSED;
-                    // printf("PID %u waiting: zombie child (PID %u) found\n", curr_proc()->pid, child_pid);
-                    return child_pid;
+                if(child->state == PROC_STATE_ZOMBIE && child->n_unreaped_threads == 0) {
+                    // claim it, so that no one else reaps or reuses it
+                    child->state = PROC_STATE_EMBRYO;
+                    zombie = child;
+                    break;
                 }
             }
         }
+        spin_unlock(&process_table.lk);
+
+        if(zombie != NULL) {
+            uint32_t child_pid = zombie->pid;
+            if(wait_status != NULL) {
+                // currently only support normal exit with exit code given
+                *wait_status = (0xFF & zombie->exit_code) << 8;
+            }
+            free_kernel_stack(zombie);
+            free_user_space(zombie->page_dir);
+            free_handle_table(zombie);
+            vdso_release(zombie);
+            spin_lock(&process_table.lk);
+            free_proc(zombie);
+            spin_unlock(&process_table.lk);
+            // printf("PID %u waiting: zombie child (PID %u) found\n", curr_proc()->pid, child_pid);
+            return child_pid;
+        }
         if(no_child) {
             printf("PID %u waiting: child not found\n", curr_proc()->pid);
             return -1;
@@ -380,16 +861,35 @@ int wait(int* wait_status)
     }
 }
 
+// Release everything held by a process that has never been scheduled
+static void free_embryo(proc* p)
+{
+    release_all_handles(p);
+    free_handle_table(p);
+    if(p->page_dir != NULL) {
+        free_user_space(p->page_dir);
+    }
+    vdso_release(p);
+    free_kernel_stack(p);
+    spin_lock(&process_table.lk);
+    free_proc(p);
+    spin_unlock(&process_table.lk);
+}
+
 int fork()
 {
     proc* p_new = create_process();
+    if(p_new == NULL) return -EAGAIN;
     proc* p_curr = curr_proc();
+    // only the calling thread is duplicated, the rest is owned by its process
+    proc* leader = proc_leader(p_curr);
     // printf("Forking from PID: %d\n", p_curr->pid);
     // Duplicate user space content, kernel space will be mapped in scheduler
     p_new->page_dir = copy_user_space(p_curr->page_dir);
-    p_new->parent = p_curr;
-    p_new->size = p_curr->size;
-    p_new->orig_size = p_curr->orig_size;
+    vdso_map(p_new, p_new->page_dir);
+    p_new->parent = leader;
+    p_new->size = leader->size;
+    p_new->orig_size = leader->orig_size;
     *p_new->tf = *p_curr->tf;
 
     // PANIC_ASSERT(p_curr->tf != p_new->tf);
@@ -409,18 +909,65 @@ int fork()
     //     p_new->page_dir, p_new->tf->esp, MAP_MEM_PA_ZERO_TO - p_new->tf->esp, curr_page_dir(), false, false, false);
     // unmap_pages(curr_page_dir(), new_esp, MAP_MEM_PA_ZERO_TO - p_new->tf->esp);
 
-    dup_handles_to(p_curr, p_new);
+    if(dup_handles_to(leader, p_new) < 0) {
+        free_embryo(p_new);
+        return -ENOMEM;
+    }
 
     // child process uses the same working directory
-    p_new->cwd = strdup(p_curr->cwd);
+    p_new->cwd = strdup(leader->cwd);
+
+    fpu_fork(p_curr, p_new);
 
     // child process will have return value zero from fork
     p_new->tf->eax = 0;
-    p_new->state = PROC_STATE_RUNNABLE;
+    make_runnable(p_new);
     // return to parent process with child's pid
     return p_new->pid;
 }
 
+// Create a thread in the calling process, sharing its user space, handles and cwd
+// The thread starts at entry with stack as esp, its own kernel stack is switched to
+// through the TSS like any other process
+// The thread ID is stored to *tid before the thread runs, and *tid is zeroed and
+// futex woken when the thread exits
+int clone(uint32_t entry, uint32_t stack, uint32_t* tid)
+{
+    proc* p_curr = curr_proc();
+    proc* leader = proc_leader(p_curr);
+    if(p_curr->is_kernel_thread) return -EINVAL;
+    if(entry >= (uint32_t) MAP_MEM_PA_ZERO_TO || stack >= (uint32_t) MAP_MEM_PA_ZERO_TO) return -EINVAL;
+    if(tid != NULL && !is_vaddr_accessible(leader->page_dir, (uint32_t) tid, false, true)) return -EFAULT;
+
+    proc* p_new = create_process();
+    if(p_new == NULL) return -EAGAIN;
+    p_new->leader = leader;
+    p_new->page_dir = leader->page_dir;
+    p_new->user_stack = (void*) stack;
+    *p_new->tf = *p_curr->tf;
+    p_new->tf->eip = entry;
+    p_new->tf->esp = stack;
+    p_new->tf->eax = 0;
+    p_new->clear_tid = tid;
+    if(tid != NULL) {
+        *tid = p_new->pid;
+    }
+
+    spin_lock(&process_table.lk);
+    leader->n_unreaped_threads++;
+    if(leader->killed) {
+        // the process is exiting
+        reap_thread(p_new);
+        spin_unlock(&process_table.lk);
+        return -EAGAIN;
+    }
+    leader->n_threads++;
+    spin_unlock(&process_table.lk);
+
+    make_runnable(p_new);
+    return p_new->pid;
+}
+
 // Get absolute path from (potentially) relative path
 // Also normalizing out consecutive slash and the trailing slash
 // return: malloced string containing the absolute path
@@ -433,7 +980,7 @@ char* get_abs_path(const char* path)
     proc* p = curr_proc();
     char* cwd;
     if(p) {
-        cwd = p->cwd;
+        cwd = proc_leader(p)->cwd;
     } else {
         // default to root dir before entering the first process
         cwd = "/";
@@ -511,7 +1058,7 @@ char* get_abs_path(const char* path)
 int chdir(const char* path)
 {
     char* abs_path = get_abs_path(path);
-    proc* p = curr_proc();
+    proc* p = proc_leader(curr_proc());
     fs_stat st = {0};
     int r = fs_getattr(abs_path, &st, -1);
     if(r < 0) {
@@ -529,7 +1076,7 @@ int chdir(const char* path)
 
 int getcwd(char* buf, size_t buf_size)
 {
-    proc* p = curr_proc();
+    proc* p = proc_leader(curr_proc());
     size_t len = strlen(p->cwd);
     if(buf_size < len + 1) {
         return -1;
@@ -555,30 +1102,38 @@ static void* read_file(const char* path)
     return file_buffer;
 }
 
-int exec(const char* path, char* const * argv, char* const* envp) 
+// Read an ELF executable into a kernel buffer, return NULL if not found or invalid
+static char* read_program(const char* path, char* const * argv, char* const* envp)
 {
     if(!argv || !argv[0] || !envp) {
         printf("exec error: illegal argv or envp\n");
-        return -1;
+        return NULL;
     }
 
     // Load executable from file system
     char* file_buffer = read_file(path);
-    if(file_buffer == NULL) return -1;
+    if(file_buffer == NULL) return NULL;
 
     if (!is_elf(file_buffer)) {
         printf("exec: Invalid program\n");
         free(file_buffer);
-        return -1;
+        return NULL;
     }
+    return file_buffer;
+}
 
+// Build a fresh user space for process p from the ELF image in file_buffer,
+// set up its stack with argv/envp and point its trapframe to the entry point
+// The new page dir is returned and the caller decides when to switch to it
+static pde* load_program(proc* p, char* file_buffer, char* const * argv, char* const* envp)
+{
     // allocate page dir
     pde* page_dir = alloc_page_dir();
+    vdso_map(p, page_dir);
 
     // parse and load ELF binary
     uint32_t vaddr_ub = 0;
     uint32_t entry_point = load_elf(page_dir, file_buffer, &vaddr_ub);
-    free(file_buffer);
 
     // allocate stack to just below the higher half kernel mapping
     uint32_t esp = (uint32_t) MAP_MEM_PA_ZERO_TO;
@@ -621,7 +1176,7 @@ int exec(const char* path, char* const * argv, char* const* envp)
             printf("exec error: args too long\n");
             unmap_pages(curr_page_dir(), ustack_start_linked, PAGE_SIZE*USER_STACK_PAGE_SIZE);
             free_user_space(page_dir);
-            return -1;
+            return NULL;
         }
         memmove((char*)esp_linked, arg, size);
 
@@ -646,7 +1201,6 @@ int exec(const char* path, char* const * argv, char* const* envp)
     unmap_pages(curr_page_dir(), ustack_start_linked, PAGE_SIZE*USER_STACK_PAGE_SIZE);
 
     // maintain trapframe
-    proc* p = curr_proc();
     p->tf->esp = esp;
     p->tf->eip = entry_point;
     p->user_stack = (void*) ustack_start;
@@ -655,11 +1209,28 @@ int exec(const char* path, char* const * argv, char* const* envp)
     p->size = vaddr_ub;
     p->orig_size = p->size;
 
+    return page_dir;
+}
+
+int exec(const char* path, char* const * argv, char* const* envp) 
+{
+    proc* p = curr_proc();
+    // the other threads would be left running in the old user space
+    if(p->leader != NULL || p->n_threads > 1) return -EBUSY;
+
+    char* file_buffer = read_program(path, argv, envp);
+    if(file_buffer == NULL) return -1;
+
+    pde* page_dir = load_program(p, file_buffer, argv, envp);
+    free(file_buffer);
+    if(page_dir == NULL) return -1;
+
     // switch to new page dir
     pde* old_page_dir = p->page_dir;
     p->page_dir = page_dir;
     switch_process_memory_mapping(p);
     free_user_space(old_page_dir); // free frames occupied by the old page dir
+    fpu_reset(p);
 
     PANIC_ASSERT(p->page_dir != old_page_dir);
     PANIC_ASSERT((uint32_t) vaddr2paddr(curr_page_dir(), (uint32_t) curr_page_dir()) != vaddr2paddr(curr_page_dir(), (uint32_t) old_page_dir));
@@ -669,3 +1240,48 @@ int exec(const char* path, char* const * argv, char* const* envp)
     
     return 0;
 }
+
+// Create a child process running the program at path directly, without
+// copying the parent's user space first like fork + exec would do
+// The child inherits the parent's handles, then file actions are applied in order
+// Ref: https://pubs.opengroup.org/onlinepubs/9699919799/functions/posix_spawn.html
+int spawn(const char* path, char* const * argv, char* const* envp, const struct spawn_file_action* actions, uint n_actions)
+{
+    if(n_actions > MAX_SPAWN_FILE_ACTIONS) return -EINVAL;
+    char* file_buffer = read_program(path, argv, envp);
+    if(file_buffer == NULL) return -ENOENT;
+
+    proc* p_curr = curr_proc();
+    proc* p_new = create_process();
+    if(p_new == NULL) {
+        free(file_buffer);
+        return -EAGAIN;
+    }
+    // start from the parent's registers (user segments, eflags),
+    // eip/esp are then replaced by load_program
+    *p_new->tf = *p_curr->tf;
+    p_new->page_dir = load_program(p_new, file_buffer, argv, envp);
+    free(file_buffer);
+    if(p_new->page_dir == NULL) {
+        free_embryo(p_new);
+        return -E2BIG;
+    }
+    proc* leader = proc_leader(p_curr);
+    p_new->parent = leader;
+
+    if(dup_handles_to(leader, p_new) < 0) {
+        free_embryo(p_new);
+        return -ENOMEM;
+    }
+    for(uint i=0; i<n_actions; i++) {
+        int r = apply_spawn_file_action(p_new, &actions[i]);
+        if(r < 0) {
+            free_embryo(p_new);
+            return r;
+        }
+    }
+
+    p_new->cwd = strdup(leader->cwd);
+    make_runnable(p_new);
+    return p_new->pid;
+}
@@ -8,8 +8,10 @@
 #include <arch/i386/kernel/port_io.h>
 #include <kernel/paging.h>
 #include <kernel/lock.h>
+#include <kernel/softirq.h>
+#include <kernel/cpu.h>
 #include <arch/i386/kernel/isr.h>
-#include <arch/i386/kernel/pic.h>
+#include <arch/i386/kernel/irq.h>
 
 // Ref: https://wiki.osdev.org/RTL8139
 // Ref: https://www.cs.usfca.edu/~cruse/cs326f04/RTL8139D_DataSheet.pdf
@@ -26,6 +28,8 @@ typedef struct rtl8139 {
     void* send_buff;
     uint32_t send_buff_phy_addr;
     yield_lock lk;
+    yield_lock rx_lk;           // Serializes draining the receive ring
+    volatile uint int_status;   // Interrupt status acknowledged but not handled yet
 } rtl8139;
 
 typedef struct rtl18139_packet_header {
@@ -63,57 +67,70 @@ static bool packet_ok(rtl18139_packet_header* header) {
      return !bad_packet && header->packet_status.status_detail.ROK;
 }
 
-static void rtl8139_irq_handler(trapframe* tf)
+// Drain the receive ring
+// dev.lk is not held here since replies are sent through rtl8139_send_packet()
+static void rtl8139_receive()
 {
-    UNUSED_ARG(tf);
-
-    acquire(&dev.lk);
+    acquire(&dev.rx_lk);
+    while(!(inb(dev.io_base + RTL8139_CR) & RTL8139_CR_RXEMPTY)) {
+        rtl18139_packet_header* header = dev.receive_buff + dev.rx_offset;
+        printf("RTL8139 RX: Receive Status[0x%x], Len[%u], Content:\n", 
+            header->packet_status.status,
+            header->packet_len
+            );
+        if(!packet_ok(header)) {
+            printf("RTL8139 RX: Packet status not valid, dropped\n");
+        } else {
+            char* buf = dev.receive_buff + dev.rx_offset + sizeof(rtl18139_packet_header);
+            // there is a 4 bytes CRC trailing the packet data
+            process_ethernet_packet(buf, header->packet_len - 4, *(uint32_t*) &buf[header->packet_len - 4]);
+        }
 
-    uint16_t int_reg = inw(dev.io_base + RTL8139_ISR);
-    printf("RTL8139 IRQ: Int reg 0x%x\n", int_reg);
+        // +3 and then &~3 to align with dword boundary
+        dev.rx_offset = (dev.rx_offset + header->packet_len + sizeof(rtl18139_packet_header) + 3) & ~3;
+        if(dev.rx_offset >= RTL8139_RECEIVE_BUF_SIZE) {
+            dev.rx_offset -= RTL8139_RECEIVE_BUF_SIZE;
+        }
+        outw(dev.io_base + RTL8139_CAPR, dev.rx_offset - 0x10); //-0x10 to avoid overflow 
+    }
+    release(&dev.rx_lk);
+}
 
-    // Acknowledge IRQ
-    outw(dev.io_base + RTL8139_ISR, int_reg);
+// Bottom half, handles the interrupts acknowledged by rtl8139_irq_handler()
+static void rtl8139_softirq()
+{
+    uint int_reg = xchg(&dev.int_status, 0);
 
     if(int_reg & RTL8139_IxR_TOK) {
+        acquire(&dev.lk);
         // Transmit Status of descriptor
         for(;dev.packet_sent < dev.packet_to_send;dev.packet_sent++) {
             uint32_t tsd = inl(dev.io_base + RTL8139_TSD_n(dev.packet_sent % 4));
             if(tsd & (RTL8139_TSD_OWN | RTL8139_TSD_TOK)) {
-                printf("RTL8139 IRQ: Transmit OK (TOK), TSD[0x%x]\n", tsd);
+                printf("RTL8139: Transmit OK (TOK), TSD[0x%x]\n", tsd);
             } else {
-                printf("RTL8139 IRQ: Transmit Error, TSD[0x%x]\n", tsd);
+                printf("RTL8139: Transmit Error, TSD[0x%x]\n", tsd);
             }
         }
+        release(&dev.lk);
     }
 
     if(int_reg & RTL8139_IxR_ROK) {
-        printf("RTL8139 IRQ: Receive OK (ROK)\n");
-
-        while(!(inb(dev.io_base + RTL8139_CR) & RTL8139_CR_RXEMPTY)) {
-            rtl18139_packet_header* header = dev.receive_buff + dev.rx_offset;
-            printf("RTL8139 IRQ: Receive Status[0x%x], Len[%u], Content:\n", 
-                header->packet_status.status,
-                header->packet_len
-                );
-            if(!packet_ok(header)) {
-                printf("RTL8139 IRQ: Packet status not valid, dropped\n");
-            } else {
-                char* buf = dev.receive_buff + dev.rx_offset + sizeof(rtl18139_packet_header);
-                // there is a 4 bytes CRC trailing the packet data
-                process_ethernet_packet(buf, header->packet_len - 4, *(uint32_t*) &buf[header->packet_len - 4]);
-            }
-
-            // +3 and then &~3 to align with dword boundary
-            dev.rx_offset = (dev.rx_offset + header->packet_len + sizeof(rtl18139_packet_header) + 3) & ~3;
-            if(dev.rx_offset >= RTL8139_RECEIVE_BUF_SIZE) {
-                dev.rx_offset -= RTL8139_RECEIVE_BUF_SIZE;
-            }
-            outw(dev.io_base + RTL8139_CAPR, dev.rx_offset - 0x10); //-0x10 to avoid overflow 
-        }
+        rtl8139_receive();
     }
+}
 
-    release(&dev.lk);
+// Top half, only acknowledges the device and leaves the rest to the softirq
+static void rtl8139_irq_handler(trapframe* tf)
+{
+    UNUSED_ARG(tf);
+
+    uint16_t int_reg = inw(dev.io_base + RTL8139_ISR);
+    // Acknowledge IRQ
+    outw(dev.io_base + RTL8139_ISR, int_reg);
+
+    __sync_fetch_and_or(&dev.int_status, int_reg);
+    raise_softirq(SOFTIRQ_NET_RX);
 }
 
 void init_rtl8139(uint8_t bus, uint8_t device, uint8_t function)
@@ -163,11 +180,17 @@ void init_rtl8139(uint8_t bus, uint8_t device, uint8_t function)
     dev.send_buff = (void*) alloc_pages_consecutive_frames(curr_page_dir(), page_count, true, &dev.send_buff_phy_addr);
     memset(dev.send_buff, 0, page_count*PAGE_SIZE);
 
-    // Get interrupt line
-    uint8_t irq = PCI_INT_LINE(bus,device,function);
-    printf("RTL8139 is using IRQ(%u)\n", irq);
-    register_interrupt_handler(IRQ_TO_INTERRUPT(irq), rtl8139_irq_handler);
-    IRQ_clear_mask(irq);
+    open_softirq(SOFTIRQ_NET_RX, rtl8139_softirq);
+    // Prefer MSI, otherwise use the interrupt line
+    int msi_vector = pci_enable_msi(bus, device, function, rtl8139_irq_handler);
+    if(msi_vector >= 0) {
+        printf("RTL8139 is using MSI vector %u\n", msi_vector);
+    } else {
+        uint8_t irq = PCI_INT_LINE(bus,device,function);
+        printf("RTL8139 is using IRQ(%u)\n", irq);
+        register_interrupt_handler(IRQ_TO_INTERRUPT(irq), rtl8139_irq_handler);
+        irq_enable_pci(irq);
+    }
 
     // Enable Receive and Transmitter
     outb(dev.io_base + RTL8139_CR, RTL8139_CR_RXEN | RTL8139_CR_TXEN); // Sets the RE (Receiver Enabled) and the TE (Transmitter Enabled) bits high
@@ -0,0 +1,93 @@
+; Entry code of application processors (AP)
+; An AP starts in real mode at the page given by the startup IPI, so this code
+; is copied to AP_TRAMPOLINE_PADDR below 1MiB and must not use absolute addresses
+; other than through AP_ADDR()
+; Ref: xv6/entryother.S
+; Ref: https://wiki.osdev.org/SMP
+
+; must be in sync with smp.c
+AP_TRAMPOLINE_PADDR equ 0x8000
+
+KERNEL_CODE_SEG equ 0x08
+KERNEL_DATA_SEG equ 0x10
+
+CR0_PE equ 0x00000001
+CR0_WP equ 0x00010000
+CR0_NW equ 0x20000000
+CR0_CD equ 0x40000000
+CR0_PG equ 0x80000000
+
+; physical address of a label after the trampoline is copied
+%define AP_ADDR(label) ((label - ap_trampoline_begin) + AP_TRAMPOLINE_PADDR)
+
+global ap_trampoline_begin
+global ap_trampoline_end
+global ap_trampoline_cr3
+global ap_trampoline_stack
+global ap_trampoline_entry
+
+bits 16
+ap_trampoline_begin:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+
+    lgdt [AP_ADDR(ap_gdt_descriptor)]
+    mov eax, cr0
+    or eax, CR0_PE
+    mov cr0, eax
+    jmp dword KERNEL_CODE_SEG:AP_ADDR(ap_protected_mode)
+
+bits 32
+ap_protected_mode:
+    mov ax, KERNEL_DATA_SEG
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov fs, ax
+    mov gs, ax
+
+    ; the page dir identity maps this page, so we can keep running after enabling paging
+    mov eax, [AP_ADDR(ap_trampoline_cr3)]
+    mov cr3, eax
+    mov eax, cr0
+    or eax, CR0_PG | CR0_WP
+    and eax, ~(CR0_CD | CR0_NW)
+    mov cr0, eax
+
+    mov esp, [AP_ADDR(ap_trampoline_stack)]
+    mov eax, [AP_ADDR(ap_trampoline_entry)]
+    call eax
+.hang:
+    hlt
+    jmp .hang
+
+; Flat code and data segments, same layout as the kernel GDT
+align 8
+ap_gdt:
+    dq 0
+    ; code: base 0, limit 4GiB, 32 bit, ring 0, execute/read
+    dw 0xFFFF, 0x0000
+    db 0x00, 10011010b, 11001111b, 0x00
+    ; data: base 0, limit 4GiB, 32 bit, ring 0, read/write
+    dw 0xFFFF, 0x0000
+    db 0x00, 10010010b, 11001111b, 0x00
+ap_gdt_end:
+
+ap_gdt_descriptor:
+    dw ap_gdt_end - ap_gdt - 1
+    dd AP_ADDR(ap_gdt)
+
+; Filled by smp.c before each startup IPI
+align 4
+ap_trampoline_cr3:
+    dd 0
+ap_trampoline_stack:
+    dd 0
+ap_trampoline_entry:
+    dd 0
+
+ap_trampoline_end:
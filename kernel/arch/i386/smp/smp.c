@@ -0,0 +1,110 @@
+#include <kernel/smp.h>
+#include <kernel/paging.h>
+#include <kernel/memory_bitmap.h>
+#include <kernel/process.h>
+#include <kernel/syscall.h>
+#include <kernel/timer.h>
+#include <kernel/panic.h>
+#include <arch/i386/kernel/cpu.h>
+#include <arch/i386/kernel/idt.h>
+#include <arch/i386/kernel/lapic.h>
+#include <string.h>
+#include <stdio.h>
+
+// Ref: xv6/main.c
+// Ref: Intel MultiProcessor Specification, Appendix B.4
+// Ref: https://wiki.osdev.org/SMP
+
+// Physical address the AP trampoline is copied to, must be page aligned,
+// below 1MiB and in sync with ap_trampoline.asm
+#define AP_TRAMPOLINE_PADDR 0x8000
+#define AP_TRAMPOLINE_VADDR (AP_TRAMPOLINE_PADDR + (uint32_t) MAP_MEM_PA_ZERO_TO)
+// Stack used by the scheduler (and interrupts arriving while idle) of an AP
+#define AP_STACK_PAGE_SIZE 16
+// How long to wait for an AP to check in
+#define AP_START_TIMEOUT_MS 1000
+
+// defined in ap_trampoline.asm
+extern char ap_trampoline_begin[], ap_trampoline_end[];
+extern char ap_trampoline_cr3[], ap_trampoline_stack[], ap_trampoline_entry[];
+
+static struct {
+    volatile uint ap_ready;
+} smp;
+
+// Address of a variable in the copy of the trampoline
+static uint32_t* trampoline_slot(char* label)
+{
+    return (uint32_t*) (AP_TRAMPOLINE_VADDR + (label - ap_trampoline_begin));
+}
+
+// C entry of application processors, running on the stack given by the trampoline
+static void ap_main()
+{
+    init_ap_cpu();
+    init_gdt();
+    set_idt();
+    init_sysenter();
+    lapic_init_cpu();
+    start_cpu_timer();
+    asm volatile("fninit");
+    printf("SMP: CPU %u (APIC ID %u) started\n", curr_cpu()->id, curr_cpu()->apic_id);
+    smp.ap_ready = 1;
+    scheduler();
+}
+
+// Page dir for the trampoline to enable paging with:
+// all kernel space plus an identity mapping of the trampoline page
+static uint32_t alloc_ap_page_dir()
+{
+    pde* page_dir = alloc_page_dir();
+    copy_kernel_space_mapping(page_dir);
+    uint32_t frame = FRAME_INDEX_FROM_ADDR(AP_TRAMPOLINE_PADDR);
+    map_pages_at(page_dir, PAGE_INDEX_FROM_VADDR(AP_TRAMPOLINE_PADDR), 1, &frame, false, false, false);
+    return vaddr2paddr(curr_page_dir(), (uint32_t) page_dir);
+}
+
+static bool start_ap(cpu* c, uint32_t page_dir_paddr)
+{
+    uint32_t stack = alloc_pages(curr_page_dir(), AP_STACK_PAGE_SIZE, true, true);
+    *trampoline_slot(ap_trampoline_cr3) = page_dir_paddr;
+    *trampoline_slot(ap_trampoline_stack) = stack + AP_STACK_PAGE_SIZE*PAGE_SIZE;
+    *trampoline_slot(ap_trampoline_entry) = (uint32_t) ap_main;
+    smp.ap_ready = 0;
+    __sync_synchronize();
+
+    lapic_start_ap(c->apic_id, AP_TRAMPOLINE_PADDR);
+    for(uint ms = 0; ms < AP_START_TIMEOUT_MS && !smp.ap_ready; ms++) {
+        udelay(1000);
+    }
+    if(!smp.ap_ready) {
+        printf("SMP: CPU %u (APIC ID %u) failed to start\n", c->id, c->apic_id);
+        dealloc_pages(curr_page_dir(), PAGE_INDEX_FROM_VADDR(stack), AP_STACK_PAGE_SIZE);
+        return false;
+    }
+    return true;
+}
+
+// Start all application processors (AP) registered by init_irq()
+// The bootstrap processor (BSP) keeps running as cpus[0]
+// Shall be called after the clocksource is ready, since the startup sequence needs delays
+void init_smp()
+{
+    if(!lapic_available() || n_cpu == 1) {
+        printf("SMP: running with a single CPU\n");
+        return;
+    }
+
+    uint32_t trampoline_size = ap_trampoline_end - ap_trampoline_begin;
+    PANIC_ASSERT(trampoline_size <= PAGE_SIZE);
+    memmove((void*) AP_TRAMPOLINE_VADDR, ap_trampoline_begin, trampoline_size);
+    uint32_t page_dir_paddr = alloc_ap_page_dir();
+
+    uint n_started = 1;
+    for(uint i = 1; i < n_cpu; i++) {
+        if(start_ap(&cpus[i], page_dir_paddr)) {
+            n_started++;
+        }
+    }
+    printf("SMP: %u of %u CPU started\n", n_started, n_cpu);
+}
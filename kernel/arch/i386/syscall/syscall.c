@@ -1,5 +1,9 @@
 #include <syscall.h>
+#include <vdso.h>
+#include <kernel/syscall.h>
 #include <arch/i386/kernel/isr.h>
+#include <arch/i386/kernel/cpu.h>
+#include <arch/i386/kernel/segmentation.h>
 #include <kernel/errno.h>
 #include <kernel/panic.h>
 #include <kernel/vfs.h>
@@ -11,42 +15,117 @@
 #include <kernel/cpu.h>
 #include <kernel/video.h>
 #include <kernel/socket.h>
+#include <kernel/futex.h>
+#include <kernel/bcache.h>
+#include <kernel/softirq.h>
+#include <kernel/preempt.h>
 #include <network.h>
+#include <uring.h>
+#include <procthread.h>
 #include <common.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
+// User space address SYSEXIT returns to, i.e. vsyscall_ret in the vDSO page
+uint32_t sysenter_user_eip;
+
+// Setup SYSENTER MSRs, SYSENTER_ESP is updated by set_tss() on every process switch
+// SYSEXIT derives user cs/ss from SYSENTER_CS + 16/24, matching SEG_UCODE/SEG_UDATA in GDT
+void init_sysenter()
+{
+    if(!cpu_has_sysenter()) {
+        printf("SYSENTER not supported, fall back to int 88\n");
+        return;
+    }
+    PANIC_ASSERT(SEG_UCODE == SEG_KCODE + 2 && SEG_UDATA == SEG_KCODE + 3);
+    sysenter_user_eip = VDSO_VSYSCALL_VADDR + (vsyscall_ret - vsyscall_begin);
+    wrmsr(MSR_IA32_SYSENTER_CS, SEG_SELECTOR(SEG_KCODE, DPL_KERNEL));
+    wrmsr(MSR_IA32_SYSENTER_ESP, 0);
+    wrmsr(MSR_IA32_SYSENTER_EIP, (uint32_t) sysenter_entry);
+}
+
+// Get the n-th (0-based) argument of the current syscall
+// int 88 (legacy): arguments are pushed on the user stack, after a fake return address
+// SYSENTER: arguments are in ebx, ecx, edx, esi, edi, and the 6th one (ebp) is pushed
+//  onto the user stack by the vsyscall trampoline, which then saves user esp to ebp
+static uint32_t syscall_arg(trapframe* r, int n)
+{
+    if(r->trapno == INT_SYSCALL) {
+        return *(uint32_t*) (r->esp + 4*(n + 1));
+    }
+    switch (n)
+    {
+    case 0:
+        return r->ebx;
+    case 1:
+        return r->ecx;
+    case 2:
+        return r->edx;
+    case 3:
+        return r->esi;
+    case 4:
+        return r->edi;
+    case 5:
+        return *(uint32_t*) r->esp;
+    default:
+        PANIC("Syscall argument index out of range");
+        return 0;
+    }
+}
+
 int sys_exec(trapframe* r)
 {
     // TODO: parameter security check
     // uint32_t num = *(uint32_t*) r->esp;
-    char* path = (char*) *(uint32_t*) (r->esp + 4);
-    char** argv = (char**) *(uint32_t*) (r->esp + 8);
-    char** envp = (char**) *(uint32_t*) (r->esp + 12);
+    char* path = (char*) syscall_arg(r, 0);
+    char** argv = (char**) syscall_arg(r, 1);
+    char** envp = (char**) syscall_arg(r, 2);
     return exec(path, argv, envp);
 }
 
+int sys_spawn(trapframe* r)
+{
+    char* path = (char*) syscall_arg(r, 0);
+    char** argv = (char**) syscall_arg(r, 1);
+    char** envp = (char**) syscall_arg(r, 2);
+    struct spawn_file_action* actions = (struct spawn_file_action*) syscall_arg(r, 3);
+    uint n_actions = (uint) syscall_arg(r, 4);
+    return spawn(path, argv, envp, actions, n_actions);
+}
+
+// Map or unmap heap pages after the process size changed from old_size to new_size
+static void resize_user_heap(proc* p, uint32_t old_size, uint32_t new_size)
+{
+    uint32_t old_last_pg_idx = PAGE_INDEX_FROM_VADDR(old_size - 1);
+    uint32_t new_last_pg_idx =  PAGE_INDEX_FROM_VADDR(new_size - 1);
+    if(new_last_pg_idx > old_last_pg_idx) {
+        alloc_pages_at(p->page_dir, old_last_pg_idx + 1, new_last_pg_idx - old_last_pg_idx, false, true);
+    } else if(new_last_pg_idx < old_last_pg_idx && p->n_threads == 1) {
+        // Other threads may be running on other CPUs with the pages still in their TLB,
+        // so a shrinking heap is kept mapped in a multithreaded process
+        dealloc_pages(p->page_dir, new_last_pg_idx + 1, old_last_pg_idx - new_last_pg_idx); 
+    }
+}
+
 int sys_brk(trapframe* r)
 {
-    uint32_t new_size = *(uint32_t*) (r->esp + 4);
+    uint32_t new_size = (uint32_t) syscall_arg(r, 0);
 
-    proc* p = curr_proc();
+    // the heap is shared by all threads of the process
+    proc* p = proc_leader(curr_proc());
+    acquire(&p->group_lk);
     uint32_t old_size = p->size;
     if(new_size < p->orig_size) {
         // mimic Linux syscall, return current break if invalid new break specified
         // capturing brk(0) calls
+        release(&p->group_lk);
         return old_size;
     }
     
     p->size = new_size;
-    uint32_t old_last_pg_idx = PAGE_INDEX_FROM_VADDR(old_size - 1);
-    uint32_t new_last_pg_idx =  PAGE_INDEX_FROM_VADDR(new_size - 1);
-    if(new_last_pg_idx > old_last_pg_idx) {
-        alloc_pages_at(p->page_dir, old_last_pg_idx + 1, new_last_pg_idx - old_last_pg_idx, false, true);
-    } else if(new_last_pg_idx < old_last_pg_idx) {
-        dealloc_pages(p->page_dir, new_last_pg_idx + 1, old_last_pg_idx - new_last_pg_idx); 
-    }
+    resize_user_heap(p, old_size, new_size);
+    release(&p->group_lk);
 
     return new_size;
 }
@@ -54,22 +133,19 @@ int sys_brk(trapframe* r)
 // increase/decrease process image size
 int sys_sbrk(trapframe* r)
 {
-    int32_t delta = *(int32_t*) (r->esp + 4);
+    int32_t delta = (int32_t) syscall_arg(r, 0);
     
-    proc* p = curr_proc();
+    proc* p = proc_leader(curr_proc());
+    acquire(&p->group_lk);
     uint32_t old_size = p->size;
     uint32_t new_size = p->size + delta;
     if(new_size < p->orig_size) {
+        release(&p->group_lk);
         return -EINVAL;
     } 
     p->size = new_size;
-    uint32_t old_last_pg_idx = PAGE_INDEX_FROM_VADDR(old_size - 1);
-    uint32_t new_last_pg_idx =  PAGE_INDEX_FROM_VADDR(new_size - 1);
-    if(new_last_pg_idx > old_last_pg_idx) {
-        alloc_pages_at(p->page_dir, old_last_pg_idx + 1, new_last_pg_idx - old_last_pg_idx, false, true);
-    } else if(new_last_pg_idx < old_last_pg_idx) {
-        dealloc_pages(p->page_dir, new_last_pg_idx + 1, old_last_pg_idx - new_last_pg_idx); 
-    }
+    resize_user_heap(p, old_size, new_size);
+    release(&p->group_lk);
     // if(delta > 0) {
     //     memset((void*) old_size, 0, delta);
     // }
@@ -91,7 +167,7 @@ int sys_sbrk(trapframe* r)
 
 int sys_print(trapframe* r)
 {
-    char* str = (char*) *(uint32_t*) (r->esp + 4);
+    char* str = (char*) syscall_arg(r, 0);
     printf("%s", str);
     return 0;
 }
@@ -109,23 +185,23 @@ int sys_fork(trapframe* r)
     return fork();
 }
 
-void sys_exit(trapframe* r)
+int sys_exit(trapframe* r)
 {
-    int32_t exit_code = *(int32_t*) (r->esp + 4);
+    int32_t exit_code = (int32_t) syscall_arg(r, 0);
     // printf("PID %u exiting with code %d\n", curr_proc()->pid, exit_code);
-    exit(exit_code);
+    exit(exit_code); // SYS_EXIT shall not return
+    PANIC("Returned to exited process\n");
+    return -1;
 }
 
 int sys_wait(trapframe* r)
 {
-    int* wait_status =  *(int**) (r->esp + 4);
+    int* wait_status =  (int*) syscall_arg(r, 0);
     return wait(wait_status);
 }
 
-int sys_open(trapframe* r)
+static int do_open(const char* path, int32_t flags)
 {
-    char* path = *(char**) (r->esp + 4);
-    int32_t flags = *(int*) (r->esp + 8);
     char* abs_path = get_abs_path(path);
     if(abs_path == NULL) {
         return -ENOENT;
@@ -138,11 +214,18 @@ int sys_open(trapframe* r)
     return handle;
 }
 
+int sys_open(trapframe* r)
+{
+    char* path = (char*) syscall_arg(r, 0);
+    int32_t flags = (int) syscall_arg(r, 1);
+    return do_open(path, flags);
+}
+
 int sys_socket_open(trapframe* r)
 {
-    int domain = *(int*) (r->esp + 4);
-    int type = *(int*) (r->esp + 8);
-    int protocol = *(int*) (r->esp + 12);
+    int domain = (int) syscall_arg(r, 0);
+    int type = (int) syscall_arg(r, 1);
+    int protocol = (int) syscall_arg(r, 2);
     int socket_idx = socket(domain, type, protocol);
     if(socket_idx < 0) return -1;
     struct handle_map map = (struct handle_map) {.type = HANDLE_TYPE_SOCKET, .grd = socket_idx};
@@ -152,11 +235,11 @@ int sys_socket_open(trapframe* r)
 
 int sys_socket_setopt(trapframe* r)
 {
-    int socket_handle = *(int*) (r->esp + 4);
-    int level = *(int*) (r->esp + 8);
-    int option_name = *(int*) (r->esp + 12);
-    void* option_value = *(void**) (r->esp + 16);
-    int option_len = *(int*) (r->esp + 20);
+    int socket_handle = (int) syscall_arg(r, 0);
+    int level = (int) syscall_arg(r, 1);
+    int option_name = (int) syscall_arg(r, 2);
+    void* option_value = (void*) syscall_arg(r, 3);
+    int option_len = (int) syscall_arg(r, 4);
     struct handle_map* map = get_handle(socket_handle);
     if(map == NULL || map->type != HANDLE_TYPE_SOCKET) return -1;
     int res  = setsockopt(map->grd, level, option_name, option_value, option_len);
@@ -165,12 +248,12 @@ int sys_socket_setopt(trapframe* r)
 
 int sys_socket_sendto(trapframe* r)
 {
-    int socket_handle = *(int*) (r->esp + 4);
-    void* message = *(void**) (r->esp + 8);
-    size_t length = *(int*) (r->esp + 12);
-    int flags = *(int*) (r->esp + 16);
-    struct sockaddr* dest_addr = *(struct sockaddr**) (r->esp + 20);
-    socklen_t dest_len = *(int*) (r->esp + 24);
+    int socket_handle = (int) syscall_arg(r, 0);
+    void* message = (void*) syscall_arg(r, 1);
+    size_t length = (int) syscall_arg(r, 2);
+    int flags = (int) syscall_arg(r, 3);
+    struct sockaddr* dest_addr = (struct sockaddr*) syscall_arg(r, 4);
+    socklen_t dest_len = (int) syscall_arg(r, 5);
     struct handle_map* map = get_handle(socket_handle);
     if(map == NULL || map->type != HANDLE_TYPE_SOCKET) return -1;
     int res  = sendto(map->grd, message, length, flags, dest_addr, dest_len);
@@ -179,32 +262,34 @@ int sys_socket_sendto(trapframe* r)
 
 int sys_socket_recvfrom(trapframe* r)
 {
-    int socket_handle = *(int*) (r->esp + 4);
-    void* buffer = *(void**) (r->esp + 8);
-    size_t length = *(int*) (r->esp + 12);
-    int flags = *(int*) (r->esp + 16);
-    struct sockaddr* address = *(struct sockaddr**) (r->esp + 20);
-    socklen_t* address_len = *(socklen_t**) (r->esp + 24);
+    int socket_handle = (int) syscall_arg(r, 0);
+    void* buffer = (void*) syscall_arg(r, 1);
+    size_t length = (int) syscall_arg(r, 2);
+    int flags = (int) syscall_arg(r, 3);
+    struct sockaddr* address = (struct sockaddr*) syscall_arg(r, 4);
+    socklen_t* address_len = (socklen_t*) syscall_arg(r, 5);
     struct handle_map* map = get_handle(socket_handle);
     if(map == NULL || map->type != HANDLE_TYPE_SOCKET) return -1;
     int res = recvfrom(map->grd, buffer, length, flags, address, address_len);
     return res;
 }
 
-int sys_close(trapframe* r)
+static int do_close(int32_t handle)
 {
-    int32_t handle = *(int*) (r->esp + 4);
     struct handle_map* pmap = get_handle(handle);
     if(pmap == NULL) return -1;
     int res = release_handle(handle);
     return res;
 }
 
-int sys_read(trapframe* r)
+int sys_close(trapframe* r)
+{
+    int32_t handle = (int) syscall_arg(r, 0);
+    return do_close(handle);
+}
+
+static int do_read(int32_t handle, void* buf, uint32_t size)
 {
-    int32_t handle = *(int*) (r->esp + 4);
-    void* buf = *(void**) (r->esp + 8);
-    uint32_t size = *(uint32_t*) (r->esp + 12);
     struct handle_map* pmap = get_handle(handle);
     if(pmap == NULL) return -1;
     if(pmap->type == HANDLE_TYPE_FILE) {
@@ -214,11 +299,16 @@ int sys_read(trapframe* r)
     }
 }
 
-int sys_write(trapframe* r)
+int sys_read(trapframe* r)
+{
+    int32_t handle = (int) syscall_arg(r, 0);
+    void* buf = (void*) syscall_arg(r, 1);
+    uint32_t size = (uint32_t) syscall_arg(r, 2);
+    return do_read(handle, buf, size);
+}
+
+static int do_write(int32_t handle, void* buf, uint32_t size)
 {
-    int32_t handle = *(int*) (r->esp + 4);
-    void* buf = *(void**) (r->esp + 8);
-    uint32_t size = *(uint32_t*) (r->esp + 12);
     struct handle_map* pmap = get_handle(handle);
     if(pmap == NULL) return -1;
     if(pmap->type == HANDLE_TYPE_FILE) {
@@ -228,11 +318,19 @@ int sys_write(trapframe* r)
     }
 }
 
+int sys_write(trapframe* r)
+{
+    int32_t handle = (int) syscall_arg(r, 0);
+    void* buf = (void*) syscall_arg(r, 1);
+    uint32_t size = (uint32_t) syscall_arg(r, 2);
+    return do_write(handle, buf, size);
+}
+
 int sys_seek(trapframe* r)
 {
-    int32_t handle = *(int*) (r->esp + 4);
-    int32_t offset = *(int32_t*) (r->esp + 8);
-    int32_t whence = *(int32_t*) (r->esp + 12);
+    int32_t handle = (int) syscall_arg(r, 0);
+    int32_t offset = (int32_t) syscall_arg(r, 1);
+    int32_t whence = (int32_t) syscall_arg(r, 2);
     struct handle_map* pmap = get_handle(handle);
     if(pmap == NULL) return -1;
     if(pmap->type == HANDLE_TYPE_FILE) {
@@ -244,7 +342,7 @@ int sys_seek(trapframe* r)
 
 int sys_get_file_offset(trapframe* r)
 {
-    int32_t handle = *(int*) (r->esp + 4);
+    int32_t handle = (int) syscall_arg(r, 0);
     struct handle_map* pmap = get_handle(handle);
     if(pmap == NULL) return -1;
     if(pmap->type == HANDLE_TYPE_FILE) {
@@ -261,17 +359,15 @@ int sys_get_file_offset(trapframe* r)
 
 int sys_dup(trapframe* r)
 {
-    int32_t handle = *(int*) (r->esp + 4);
+    int32_t handle = (int) syscall_arg(r, 0);
     struct handle_map* pmap = get_handle(handle);
     if(pmap == NULL) return -1;
     int new_handle = dup_handle(handle);
     return new_handle;
 }
 
-int sys_getattr_path(trapframe* r)
+static int do_getattr_path(const char* path, struct fs_stat* st)
 {
-    char* path = *(char**) (r->esp + 4);
-    struct fs_stat* st = *(struct fs_stat**) (r->esp + 8);
     char* abs_path = get_abs_path(path);
     if(abs_path == NULL) {
         return -ENOENT;
@@ -281,10 +377,15 @@ int sys_getattr_path(trapframe* r)
     return res;
 }
 
-int sys_getattr_fd(trapframe* r)
+int sys_getattr_path(trapframe* r)
+{
+    char* path = (char*) syscall_arg(r, 0);
+    struct fs_stat* st = (struct fs_stat*) syscall_arg(r, 1);
+    return do_getattr_path(path, st);
+}
+
+static int do_getattr_fd(int handle, struct fs_stat* st)
 {
-    int handle = *(int*) (r->esp + 4);
-    struct fs_stat* st = *(struct fs_stat**) (r->esp + 8);
     struct handle_map* pmap = get_handle(handle);
     if(pmap == NULL) return -1;
     if(pmap->type == HANDLE_TYPE_FILE) {
@@ -294,10 +395,17 @@ int sys_getattr_fd(trapframe* r)
     }
 }
 
+int sys_getattr_fd(trapframe* r)
+{
+    int handle = (int) syscall_arg(r, 0);
+    struct fs_stat* st = (struct fs_stat*) syscall_arg(r, 1);
+    return do_getattr_fd(handle, st);
+}
+
 int sys_truncate_path(trapframe* r)
 {
-    char* path = *(char**) (r->esp + 4);
-    uint size = *(uint*) (r->esp + 8);
+    char* path = (char*) syscall_arg(r, 0);
+    uint size = (uint) syscall_arg(r, 1);
     char* abs_path = get_abs_path(path);
     if(abs_path == NULL) {
         return -ENOENT;
@@ -309,8 +417,8 @@ int sys_truncate_path(trapframe* r)
 
 int sys_truncate_fd(trapframe* r)
 {
-    int handle = *(int*) (r->esp + 4);
-    uint size = *(uint*) (r->esp + 8);
+    int handle = (int) syscall_arg(r, 0);
+    uint size = (uint) syscall_arg(r, 1);
     struct handle_map* pmap = get_handle(handle);
     if(pmap == NULL) return -1;
     if(pmap->type == HANDLE_TYPE_FILE) {
@@ -323,13 +431,99 @@ int sys_truncate_fd(trapframe* r)
 int sys_get_pid(trapframe* r)
 {
     UNUSED_ARG(r);
-    proc* p = curr_proc();
+    proc* p = proc_leader(curr_proc());
     return p->pid;
 }
 
+int sys_gettid(trapframe* r)
+{
+    UNUSED_ARG(r);
+    return curr_proc()->pid;
+}
+
+int sys_sync(trapframe* r)
+{
+    UNUSED_ARG(r);
+    bcache_sync();
+    return 0;
+}
+
+int sys_bcache_stat(trapframe* r)
+{
+    bcache_stat* stat = (bcache_stat*) syscall_arg(r, 0);
+    bcache_get_stat(stat);
+    return 0;
+}
+
+int sys_softirq_stat(trapframe* r)
+{
+    uint32_t nr = syscall_arg(r, 0);
+    softirq_stat* stat = (softirq_stat*) syscall_arg(r, 1);
+    if(nr >= N_SOFTIRQ) {
+        return -EINVAL;
+    }
+    softirq_get_stat(nr, stat);
+    return 0;
+}
+
+int sys_preempt_stat(trapframe* r)
+{
+    uint32_t cpu_id = syscall_arg(r, 0);
+    preempt_stat* stat = (preempt_stat*) syscall_arg(r, 1);
+    if(cpu_id >= n_cpu) {
+        return -EINVAL;
+    }
+    preempt_get_stat(cpu_id, stat);
+    return 0;
+}
+
+int sys_ramdisk(trapframe* r)
+{
+    const char* path = (const char*) syscall_arg(r, 0);
+    uint32_t size = (uint32_t) syscall_arg(r, 1);
+    char* abs_path = get_abs_path(path);
+    if(abs_path == NULL) {
+        return -ENOENT;
+    }
+    int res = fs_mount_ramdisk(abs_path, size);
+    free(abs_path);
+    return res;
+}
+
+int sys_clone(trapframe* r)
+{
+    uint32_t entry = (uint32_t) syscall_arg(r, 0);
+    uint32_t stack = (uint32_t) syscall_arg(r, 1);
+    uint32_t* tid = (uint32_t*) syscall_arg(r, 2);
+    return clone(entry, stack, tid);
+}
+
+int sys_futex(trapframe* r)
+{
+    uint32_t* uaddr = (uint32_t*) syscall_arg(r, 0);
+    int op = (int) syscall_arg(r, 1);
+    uint32_t val = (uint32_t) syscall_arg(r, 2);
+    switch(op) {
+    case FUTEX_WAIT:
+        return futex_wait(uaddr, val);
+    case FUTEX_WAKE:
+        return futex_wake(uaddr, val);
+    default:
+        return -EINVAL;
+    }
+}
+
+int sys_thread_exit(trapframe* r)
+{
+    UNUSED_ARG(r);
+    thread_exit(); // shall not return
+    PANIC("Returned to exited thread\n");
+    return -1;
+}
+
 int sys_curr_date_time(trapframe* r)
 {
-    date_time* dt = *(date_time**) (r->esp + 4);
+    date_time* dt = (date_time*) syscall_arg(r, 0);
     *dt = current_datetime();
     return 0;
 }
@@ -337,13 +531,23 @@ int sys_curr_date_time(trapframe* r)
 int sys_curr_time_epoch(trapframe* r)
 {
     UNUSED_ARG(r);
-    date_time dt = current_datetime();
-    return datetime2epoch(&dt);
+    return current_epoch();
+}
+
+int sys_clock_gettime(trapframe* r)
+{
+    int clk_id = (int) syscall_arg(r, 0);
+    uint64_t* ns = (uint64_t*) syscall_arg(r, 1);
+    if(clk_id != CLOCK_ID_REALTIME && clk_id != CLOCK_ID_MONOTONIC) {
+        return -EINVAL;
+    }
+    *ns = clock_gettime_ns(clk_id);
+    return 0;
 }
 
 int sys_unlink(trapframe* r)
 {
-    char* path = *(char**) (r->esp + 4);
+    char* path = (char*) syscall_arg(r, 0);
     char* abs_path = get_abs_path(path);
     if(abs_path == NULL) {
         return -ENOENT;
@@ -355,8 +559,8 @@ int sys_unlink(trapframe* r)
 
 int sys_link(trapframe* r)
 {
-    char* old_path = *(char**) (r->esp + 4);
-    char* new_path = *(char**) (r->esp + 8);
+    char* old_path = (char*) syscall_arg(r, 0);
+    char* new_path = (char*) syscall_arg(r, 1);
 
     char* old_abs_path = get_abs_path(old_path);
     if(old_abs_path == NULL) {
@@ -377,8 +581,8 @@ int sys_link(trapframe* r)
 
 int sys_rename(trapframe* r)
 {
-    char* old_path = *(char**) (r->esp + 4);
-    char* new_path = *(char**) (r->esp + 8);
+    char* old_path = (char*) syscall_arg(r, 0);
+    char* new_path = (char*) syscall_arg(r, 1);
 
     char* old_abs_path = get_abs_path(old_path);
     if(old_abs_path == NULL) {
@@ -389,7 +593,7 @@ int sys_rename(trapframe* r)
         return -ENOENT;
     }
 
-    uint flags = *(uint*) (r->esp + 12);
+    uint flags = (uint) syscall_arg(r, 2);
     int res = fs_rename(old_abs_path, new_abs_path, flags);
 
     free(old_abs_path);
@@ -398,13 +602,8 @@ int sys_rename(trapframe* r)
     return res;
 }
 
-int sys_readdir(trapframe* r)
+static int do_readdir(const char * path, uint entry_offset, fs_dirent* buf, uint buf_size)
 {
-    const char * path = *(const char**) (r->esp + 4);
-    uint entry_offset = *(uint*) (r->esp + 8);
-    fs_dirent* buf = *(fs_dirent**) (r->esp + 12);
-    uint buf_size = *(uint *) (r->esp + 16);
-
     char* abs_path = get_abs_path(path);
     if(abs_path == NULL) {
         return -ENOENT;
@@ -416,28 +615,102 @@ int sys_readdir(trapframe* r)
     return res;
 }
 
+int sys_readdir(trapframe* r)
+{
+    const char * path = (const char*) syscall_arg(r, 0);
+    uint entry_offset = (uint) syscall_arg(r, 1);
+    fs_dirent* buf = (fs_dirent*) syscall_arg(r, 2);
+    uint buf_size = (uint) syscall_arg(r, 3);
+    return do_readdir(path, entry_offset, buf, buf_size);
+}
+
+static int uring_exec_sqe(struct uring_sqe* sqe, int prev_res)
+{
+    int fd = (sqe->flags & URING_SQE_FD_FROM_PREV) ? prev_res : sqe->fd;
+    switch(sqe->opcode) {
+    case URING_OP_NOP:
+        return 0;
+    case URING_OP_OPEN:
+        return do_open(sqe->path, sqe->len);
+    case URING_OP_READ:
+        return do_read(fd, sqe->addr, sqe->len);
+    case URING_OP_WRITE:
+        return do_write(fd, sqe->addr, sqe->len);
+    case URING_OP_GETATTR:
+        if(sqe->path != NULL) {
+            return do_getattr_path(sqe->path, sqe->addr);
+        }
+        return do_getattr_fd(fd, sqe->addr);
+    case URING_OP_READDIR:
+        return do_readdir(sqe->path, sqe->offset, sqe->addr, sqe->len);
+    case URING_OP_CLOSE:
+        return do_close(fd);
+    default:
+        return -EINVAL;
+    }
+}
+
+// Consume up to to_submit SQEs, stop early if the completion queue is full
+// Operations run synchronously in the calling process context, so all
+// completions are posted by the time this returns
+int sys_uring_enter(trapframe* r)
+{
+    struct uring* ring = (struct uring*) syscall_arg(r, 0);
+    uint32_t to_submit = (uint32_t) syscall_arg(r, 1);
+    if(ring == NULL || ring->sqes == NULL || ring->cqes == NULL) {
+        return -EINVAL;
+    }
+    uint32_t sq_entries = ring->sq_entries;
+    uint32_t cq_entries = ring->cq_entries;
+    if(sq_entries == 0 || (sq_entries & (sq_entries - 1)) != 0 ||
+        cq_entries == 0 || (cq_entries & (cq_entries - 1)) != 0) {
+        return -EINVAL;
+    }
+
+    uint32_t head = ring->sq_head;
+    uint32_t pending = ring->sq_tail - head;
+    if(to_submit > pending) {
+        to_submit = pending;
+    }
+
+    int prev_res = -1;
+    uint32_t n = 0;
+    while(n < to_submit && ring->cq_tail - ring->cq_head < cq_entries) {
+        // Copy the SQE so user space can't change it under us
+        struct uring_sqe sqe = ring->sqes[(head + n) & (sq_entries - 1)];
+        prev_res = uring_exec_sqe(&sqe, prev_res);
+
+        struct uring_cqe* cqe = &ring->cqes[ring->cq_tail & (cq_entries - 1)];
+        cqe->user_data = sqe.user_data;
+        cqe->res = prev_res;
+        ring->cq_tail++;
+        n++;
+        ring->sq_head = head + n;
+    }
+    return n;
+}
+
 int sys_chdir(trapframe* r)
 {
-    const char * path = *(const char**) (r->esp + 4);
+    const char * path = (const char*) syscall_arg(r, 0);
     return chdir(path);
 }
 
 int sys_getcwd(trapframe* r)
 {
-    char * buf = *(char**) (r->esp + 4);
-    size_t buf_size = *(size_t *) (r->esp + 8);
+    char * buf = (char*) syscall_arg(r, 0);
+    size_t buf_size = (size_t) syscall_arg(r, 1);
     return getcwd(buf, buf_size);
 }
 
 int sys_test(trapframe* r)
 {
-    int arg0 = *(int*) (r->esp + 0);
-    int arg1 = *(int*) (r->esp + 4);
-    int arg2 = *(int*) (r->esp + 8);
-    int arg3 = *(int*) (r->esp + 12);
-    int arg4 = *(int*) (r->esp + 16);
+    int arg1 = (int) syscall_arg(r, 0);
+    int arg2 = (int) syscall_arg(r, 1);
+    int arg3 = (int) syscall_arg(r, 2);
+    int arg4 = (int) syscall_arg(r, 3);
 
-    printf("SYS_TEST triggered with arguments: %d (skip), %d, %d, %d, %d\n", arg0, arg1, arg2, arg3, arg4);
+    printf("SYS_TEST triggered with arguments: %d, %d, %d, %d\n", arg1, arg2, arg3, arg4);
 
     // UNUSED_ARG(r);
 
@@ -454,18 +727,18 @@ int sys_test(trapframe* r)
 
 int sys_mkdir(trapframe* r)
 {
-    const char* path = *(const char**) (r->esp + 4);
+    const char* path = (const char*) syscall_arg(r, 0);
     char* abs_path = get_abs_path(path);
     if(abs_path == NULL) {
         return -ENOENT;
     }
-    uint mode = *(uint*) (r->esp + 8);
+    uint mode = (uint) syscall_arg(r, 1);
     return fs_mkdir(abs_path, mode);
 }
 
 int sys_rmdir(trapframe* r)
 {
-    const char* path = *(const char**) (r->esp + 4);
+    const char* path = (const char*) syscall_arg(r, 0);
     char* abs_path = get_abs_path(path);
     if(abs_path == NULL) {
         return -ENOENT;
@@ -475,43 +748,43 @@ int sys_rmdir(trapframe* r)
 
 int sys_network_receive_ipv4_pkt(trapframe* r)
 {
-    char * buf = *(char**) (r->esp + 4);
-    uint buf_size = *(uint *) (r->esp + 8);
-    uint time_out_sec = *(uint *) (r->esp + 12);
+    char * buf = (char*) syscall_arg(r, 0);
+    uint buf_size = (uint) syscall_arg(r, 1);
+    uint time_out_sec = (uint) syscall_arg(r, 2);
     int res = ipv4_wait_for_next_packet(buf, buf_size, time_out_sec);
     return res;
 }
 
 int sys_prep_icmp_pkt(trapframe* r) 
 {
-    icmp_opt * opt = *(icmp_opt**) (r->esp + 4);
-    char * buf = *(char**) (r->esp + 8);
-    uint buf_size = *(uint *) (r->esp + 12);
+    icmp_opt * opt = (icmp_opt*) syscall_arg(r, 0);
+    char * buf = (char*) syscall_arg(r, 1);
+    uint buf_size = (uint) syscall_arg(r, 2);
     int res = icmp_prep_pkt(opt, buf, buf_size);
     return res;
 }
 
 int sys_finalize_icmp_pkt(trapframe* r)
 {
-    icmp_header * hdr = *(icmp_header**) (r->esp + 4);
-    uint pkt_len = *(uint *) (r->esp + 8);
+    icmp_header * hdr = (icmp_header*) syscall_arg(r, 0);
+    uint pkt_len = (uint) syscall_arg(r, 1);
     int res = icmp_finalize_pkt(hdr, pkt_len);
     return res;
 }
 
 int sys_prep_ipv4_pkt(trapframe* r)
 {
-    ipv4_opt * opt = *(ipv4_opt**) (r->esp + 4);
-    char * buf = *(char**) (r->esp + 8);
-    uint buf_len = *(uint *) (r->esp + 12);
+    ipv4_opt * opt = (ipv4_opt*) syscall_arg(r, 0);
+    char * buf = (char*) syscall_arg(r, 1);
+    uint buf_len = (uint) syscall_arg(r, 2);
     int res = ipv4_prep_pkt(opt, buf, buf_len);
     return res;
 }
 
 int sys_send_ipv4_pkt(trapframe* r)
 {
-    char * buf = *(char**) (r->esp + 4);
-    uint pkt_len = *(uint *) (r->esp + 8);
+    char * buf = (char*) syscall_arg(r, 0);
+    uint pkt_len = (uint) syscall_arg(r, 1);
     int res = ipv4_send_pkt(buf, pkt_len);
     return res;
 }
@@ -525,158 +798,92 @@ int sys_refresh_screen(trapframe* r)
 
 int sys_draw_picture(trapframe* r)
 {
-    uint32_t* buf = *(uint32_t**) (r->esp + 4);
-    int x = *(int *) (r->esp + 8);
-    int y = *(int *) (r->esp + 12);
-    int w = *(int *) (r->esp + 16);
-    int h = *(int *) (r->esp + 20);
+    uint32_t* buf = (uint32_t*) syscall_arg(r, 0);
+    int x = (int) syscall_arg(r, 1);
+    int y = (int) syscall_arg(r, 2);
+    int w = (int) syscall_arg(r, 3);
+    int h = (int) syscall_arg(r, 4);
     drawpic(buf, x, y, w, h);
     return 0;
 }
 
+typedef int (*syscall_func)(trapframe* r);
+
+// Syscall dispatch table, indexed by syscall number
+static syscall_func syscall_table[] = {
+    [SYS_TEST] = sys_test,
+    [SYS_EXEC] = sys_exec,
+    [SYS_PRINT] = sys_print,
+    [SYS_YIELD] = sys_yield,
+    [SYS_FORK] = sys_fork,
+    [SYS_EXIT] = sys_exit,
+    [SYS_WAIT] = sys_wait,
+    [SYS_SBRK] = sys_sbrk,
+    [SYS_OPEN] = sys_open,
+    [SYS_CLOSE] = sys_close,
+    [SYS_READ] = sys_read,
+    [SYS_WRITE] = sys_write,
+    [SYS_SEEK] = sys_seek,
+    [SYS_DUP] = sys_dup,
+    [SYS_GETATTR_PATH] = sys_getattr_path,
+    [SYS_GETATTR_FD] = sys_getattr_fd,
+    [SYS_GET_PID] = sys_get_pid,
+    [SYS_CURR_DATE_TIME] = sys_curr_date_time,
+    [SYS_UNLINK] = sys_unlink,
+    [SYS_LINK] = sys_link,
+    [SYS_RENAME] = sys_rename,
+    [SYS_READDIR] = sys_readdir,
+    [SYS_CHDIR] = sys_chdir,
+    [SYS_GETCWD] = sys_getcwd,
+    [SYS_TRUNCATE_PATH] = sys_truncate_path,
+    [SYS_TRUNCATE_FD] = sys_truncate_fd,
+    [SYS_MKDIR] = sys_mkdir,
+    [SYS_RMDIR] = sys_rmdir,
+    [SYS_REFRESH_SCREEN] = sys_refresh_screen,
+    [SYS_DRAW_PICTURE] = sys_draw_picture,
+    [SYS_NETWORK_RECEIVE_IPv4_PKT] = sys_network_receive_ipv4_pkt,
+    [SYS_PREP_IPV4_PKT] = sys_prep_ipv4_pkt,
+    [SYS_SEND_IPV4_PKT] = sys_send_ipv4_pkt,
+    [SYS_PREP_ICMP_PKT] = sys_prep_icmp_pkt,
+    [SYS_FINALIZE_ICMP_PKT] = sys_finalize_icmp_pkt,
+    [SYS_SOCKET_OPEN] = sys_socket_open,
+    [SYS_SOCKET_SETOPT] = sys_socket_setopt,
+    [SYS_SOCKET_SENDTO] = sys_socket_sendto,
+    [SYS_SOCKET_RECVFROM] = sys_socket_recvfrom,
+    [SYS_URING_ENTER] = sys_uring_enter,
+    [SYS_SPAWN] = sys_spawn,
+    [SYS_CLONE] = sys_clone,
+    [SYS_FUTEX] = sys_futex,
+    [SYS_THREAD_EXIT] = sys_thread_exit,
+    [SYS_GETTID] = sys_gettid,
+    [SYS_SYNC] = sys_sync,
+    [SYS_BCACHE_STAT] = sys_bcache_stat,
+    [SYS_RAMDISK] = sys_ramdisk,
+    [SYS_SOFTIRQ_STAT] = sys_softirq_stat,
+    [SYS_PREEMPT_STAT] = sys_preempt_stat,
+    [SYS_CURR_TIME_EPOCH] = sys_curr_time_epoch,
+    [SYS_CLOCK_GETTIME] = sys_clock_gettime,
+    [SYS_GET_FILE_OFFSET] = sys_get_file_offset,
+    [SYS_BRK] = sys_brk,
+};
+
+#define N_SYSCALL (sizeof(syscall_table)/sizeof(syscall_table[0]))
+
 void syscall_handler(trapframe* r)
 {
     // Avoid scheduling when in syscall/kernel space
     // => no longer needed, after implementing locks
     // disable_interrupt();
-    
 
-    // trapframe r will be pop when returning to user space
-    // so r->eax will be the return value of the syscall  
-    switch (r->eax)
-    {
-    case SYS_TEST:
-        r->eax = sys_test(r);
-        break;
-    case SYS_EXEC:
-        r->eax = sys_exec(r);
-        break;
-    case SYS_PRINT:
-        r->eax = sys_print(r);
-        break;
-    case SYS_YIELD:
-        r->eax = sys_yield(r);
-        break;
-    case SYS_FORK:
-        r->eax = sys_fork(r);
-        break;
-    case SYS_EXIT:
-        sys_exit(r); // SYS_EXIT shall not return
-        PANIC("Returned to exited process\n");
-        break;
-    case SYS_WAIT:
-        r->eax = sys_wait(r);
-        break;
-    case SYS_SBRK:
-        r->eax = sys_sbrk(r);
-        break;
-    case SYS_OPEN:
-        r->eax = sys_open(r);
-        break;
-    case SYS_CLOSE:
-        r->eax = sys_close(r);
-        break;
-    case SYS_READ:
-        r->eax = sys_read(r);
-        break;
-    case SYS_WRITE:
-        r->eax = sys_write(r);
-        break;
-    case SYS_SEEK:
-        r->eax = sys_seek(r);
-        break;
-    case SYS_DUP:
-        r->eax = sys_dup(r);
-        break;
-    case SYS_GETATTR_PATH:
-        r->eax = sys_getattr_path(r);
-        break;
-    case SYS_GETATTR_FD:
-        r->eax = sys_getattr_fd(r);
-        break;
-    case SYS_GET_PID:
-        r->eax = sys_get_pid(r);
-        break;
-    case SYS_CURR_DATE_TIME:
-        r->eax = sys_curr_date_time(r);
-        break;
-    case SYS_UNLINK:
-        r->eax = sys_unlink(r);
-        break;
-    case SYS_LINK:
-        r->eax = sys_link(r);
-        break;
-    case SYS_RENAME:
-        r->eax = sys_rename(r);
-        break;
-    case SYS_READDIR:
-        r->eax = sys_readdir(r);
-        break;
-    case SYS_CHDIR:
-        r->eax = sys_chdir(r);
-        break;
-    case SYS_GETCWD:
-        r->eax = sys_getcwd(r);
-        break;
-    case SYS_TRUNCATE_PATH:
-        r->eax = sys_truncate_path(r);
-        break;
-    case SYS_TRUNCATE_FD:
-        r->eax = sys_truncate_fd(r);
-        break;
-    case SYS_MKDIR:
-        r->eax = sys_mkdir(r);
-        break;
-    case SYS_RMDIR:
-        r->eax = sys_rmdir(r);
-        break;
-    case SYS_REFRESH_SCREEN:
-        r->eax = sys_refresh_screen(r);
-        break;
-    case SYS_DRAW_PICTURE:
-        r->eax = sys_draw_picture(r);
-        break;
-    case SYS_NETWORK_RECEIVE_IPv4_PKT:
-        r->eax = sys_network_receive_ipv4_pkt(r);
-        break;
-    case SYS_PREP_IPV4_PKT:
-        r->eax = sys_prep_ipv4_pkt(r);
-        break;
-    case SYS_SEND_IPV4_PKT:
-        r->eax = sys_send_ipv4_pkt(r);
-        break;
-    case SYS_PREP_ICMP_PKT:
-        r->eax = sys_prep_icmp_pkt(r);
-        break;
-    case SYS_FINALIZE_ICMP_PKT:
-        r->eax = sys_finalize_icmp_pkt(r);
-        break;
-    case SYS_SOCKET_OPEN:
-        r->eax = sys_socket_open(r);
-        break;
-    case SYS_SOCKET_SETOPT:
-        r->eax = sys_socket_setopt(r);
-        break;
-    case SYS_SOCKET_SENDTO:
-        r->eax = sys_socket_sendto(r);
-        break;
-    case SYS_SOCKET_RECVFROM:
-        r->eax = sys_socket_recvfrom(r);
-        break;
-    case SYS_CURR_TIME_EPOCH:
-        r->eax = sys_curr_time_epoch(r);
-        break;
-    case SYS_GET_FILE_OFFSET:
-        r->eax = sys_get_file_offset(r);
-        break;
-    case SYS_BRK:
-        r->eax = sys_brk(r);
-        break;
-    default:
+    uint32_t num = r->eax;
+    if(num >= N_SYSCALL || syscall_table[num] == NULL) {
         printf("Unrecognized Syscall: %d\n", r->eax);
         PANIC("Unrecognized Syscall");
         r->eax = -1;
-        break;
+        return;
     }
-}
 
+    // trapframe r will be pop when returning to user space
+    // so r->eax will be the return value of the syscall
+    r->eax = syscall_table[num](r);
+}
@@ -0,0 +1,108 @@
+; SYSENTER/SYSEXIT fast system call entry
+; Ref: https://wiki.osdev.org/SYSENTER
+; Ref: Intel SDM Vol. 2B, SYSENTER and SYSEXIT
+
+; Defined in isr.c
+[extern int_handler]
+; Defined in syscall.c, user space address of vsyscall_ret
+[extern sysenter_user_eip]
+
+; kernel data segment descriptor in flat mode
+KERNEL_DATA_SEG equ 0000000000010_0_00b
+; user code/data segment descriptor in flat mode, with RPL 3
+USER_CODE_SEG equ 0000000000011_0_11b
+USER_DATA_SEG equ 0000000000100_0_11b
+
+; must be in sync with kernel/syscall.h
+TRAPNO_SYSENTER equ 256
+FL_IF equ 0x00000200
+
+global sysenter_entry
+global vsyscall_begin
+global vsyscall_ret
+global vsyscall_end
+global vsyscall_int88_begin
+global vsyscall_int88_end
+
+; SYSENTER has loaded cs, eip, ss and esp from the MSRs and cleared IF
+; ebp holds the user esp, set by the vsyscall trampoline
+; Build the same trapframe an int 88 would have, so that fork/exec and int_ret work as usual
+sysenter_entry:
+    push dword USER_DATA_SEG        ; ss
+    push ebp                        ; esp
+    pushfd                          ; eflags
+    or dword [esp], FL_IF
+    push dword USER_CODE_SEG        ; cs
+    push dword [sysenter_user_eip]  ; eip
+    push dword 0                    ; err
+    push dword TRAPNO_SYSENTER      ; trapno
+
+    push ds
+    push es
+    push fs
+    push gs
+    pusha
+
+    mov ax, KERNEL_DATA_SEG
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+
+    ; same as the int 88 trap gate, allow interrupts during syscall
+    sti
+
+    push esp ; trapframe *r
+    cld
+    call int_handler
+    add esp, 4
+
+    cli
+    popa
+    pop gs
+    pop fs
+    pop es
+    pop ds
+    add esp, 8 ; trapno and err
+
+    ; stack: eip, cs, eflags, esp, ss
+    ; SYSEXIT jumps to edx with esp = ecx, trampoline restores user ecx/edx
+    mov edx, [esp]
+    mov ecx, [esp + 12]
+    ; restore eflags but keep interrupt disabled until SYSEXIT
+    and dword [esp + 8], ~FL_IF
+    push dword [esp + 8]
+    popfd
+    sti ; takes effect after the next instruction
+    sysexit
+
+; vsyscall trampoline, copied to the vDSO page VDSO_VSYSCALL_VADDR, must be position independent
+; eax: syscall number, ebx, ecx, edx, esi, edi, ebp: arguments
+; returns value in eax, preserves all other registers
+vsyscall_begin:
+    push ecx
+    push edx
+    push ebp
+    mov ebp, esp
+    sysenter
+vsyscall_ret:
+    pop ebp
+    pop edx
+    pop ecx
+    ret
+vsyscall_end:
+
+; Fallback trampoline for CPUs without SYSENTER,
+; re-push register arguments in the legacy int 88 stack layout
+vsyscall_int88_begin:
+    push ebp
+    push edi
+    push esi
+    push edx
+    push ecx
+    push ebx
+    push dword 0 ; fake return address
+    int 88
+    add esp, 28
+    ret
+vsyscall_int88_end:
@@ -3,6 +3,9 @@
 #include <arch/i386/kernel/port_io.h>
 #include <kernel/timer.h>
 #include <kernel/lock.h>
+#include <kernel/panic.h>
+#include <vdso.h>
+#include <stdio.h>
 #include <string.h>
 #include <common.h>
 
@@ -194,21 +197,114 @@ time_t datetime2epoch(date_time* tim_p) {
     return tim;
 }
 
-// Estimate CPU frequency
-int64_t cpu_freq()
+#define NSEC_PER_SEC 1000000000ULL
+
+// TSC based clock source
+// The RTC is only sampled at boot, after that wall clock and monotonic time are
+// derived from the TSC: ns = (cycles * mult) >> shift, which needs no division
+// Ref: https://www.kernel.org/doc/html/latest/timers/timekeeping.html
+static struct {
+    uint64_t tsc_hz;            // calibrated TSC frequency
+    uint64_t boot_tsc;          // TSC value sampled exactly at an RTC second boundary
+    time_t boot_epoch;          // UNIX epoch of the same RTC second boundary
+    uint32_t mult;
+    uint32_t shift;
+    int initialized;
+} clocksource;
+
+// Wait for the next RTC second boundary, return the epoch just started
+static time_t wait_rtc_second_boundary()
 {
-    date_time dt0 = current_datetime() , dt;
-    time_t ts0 = datetime2epoch(&dt0), ts;
+    date_time dt = current_datetime();
+    time_t ts0 = datetime2epoch(&dt), ts;
     do {
         dt = current_datetime();
         ts = datetime2epoch(&dt);
     } while(ts == ts0);
+    return ts;
+}
+
+// Measure TSC cycles between two RTC second boundaries
+static void calibrate_tsc(uint64_t* cycle_per_second, uint64_t* boundary_tsc, time_t* boundary_epoch)
+{
+    wait_rtc_second_boundary();
     uint64_t cycle0 = rdtsc();
-    do {
-        dt0 = current_datetime();
-        ts0 = datetime2epoch(&dt0);
-    } while(ts0 == ts);
+    time_t ts = wait_rtc_second_boundary();
     uint64_t cycle1 = rdtsc();
-    int64_t cycle_per_second = cycle1 - cycle0;
+    *cycle_per_second = cycle1 - cycle0;
+    *boundary_tsc = cycle1;
+    *boundary_epoch = ts;
+}
+
+// Estimate CPU frequency
+int64_t cpu_freq()
+{
+    if(clocksource.initialized) {
+        return clocksource.tsc_hz;
+    }
+    uint64_t cycle_per_second, boundary_tsc;
+    time_t boundary_epoch;
+    calibrate_tsc(&cycle_per_second, &boundary_tsc, &boundary_epoch);
     return cycle_per_second;
 }
+
+// Sample the RTC once and calibrate the TSC against it,
+// must be called before interrupts are enabled
+void init_clocksource()
+{
+    uint64_t tsc_hz, boot_tsc;
+    time_t boot_epoch;
+    calibrate_tsc(&tsc_hz, &boot_tsc, &boot_epoch);
+    PANIC_ASSERT(tsc_hz > 0);
+
+    // Pick the largest shift that keeps mult in 32 bits
+    uint32_t shift = 32;
+    while(shift > 0 && ((NSEC_PER_SEC << shift) / tsc_hz) > UINT32_MAX) {
+        shift--;
+    }
+
+    clocksource.tsc_hz = tsc_hz;
+    clocksource.boot_tsc = boot_tsc;
+    clocksource.boot_epoch = boot_epoch;
+    clocksource.shift = shift;
+    clocksource.mult = (NSEC_PER_SEC << shift) / tsc_hz;
+    clocksource.initialized = 1;
+    printf("Clocksource: TSC %llu Hz, mult %u, shift %u, boot epoch %d\n",
+        tsc_hz, clocksource.mult, clocksource.shift, boot_epoch);
+}
+
+// Convert TSC cycles to nanoseconds, 64bit * 32bit multiplication split in two halves
+static uint64_t cycles2ns(uint64_t cycles)
+{
+    uint64_t hi = (cycles >> 32) * clocksource.mult;
+    uint64_t lo = (cycles & 0xFFFFFFFF) * clocksource.mult;
+    return (hi << (32 - clocksource.shift)) + (lo >> clocksource.shift);
+}
+
+// Nanoseconds of the given clock, CMOS is never touched here
+uint64_t clock_gettime_ns(int clk_id)
+{
+    PANIC_ASSERT(clocksource.initialized);
+    uint64_t ns = cycles2ns(rdtsc() - clocksource.boot_tsc);
+    if(clk_id == CLOCK_ID_REALTIME) {
+        ns += (uint64_t) clocksource.boot_epoch * NSEC_PER_SEC;
+    }
+    return ns;
+}
+
+// Copy TSC conversion parameters for user space clock reading (vDSO)
+void clocksource_snapshot(struct vdso_clock* vc)
+{
+    PANIC_ASSERT(clocksource.initialized);
+    vc->mult = clocksource.mult;
+    vc->shift = clocksource.shift;
+    vc->boot_tsc = clocksource.boot_tsc;
+    vc->boot_epoch = clocksource.boot_epoch;
+    vc->tsc_hz = clocksource.tsc_hz;
+}
+
+// Current UNIX epoch timestamp
+time_t current_epoch()
+{
+    return clock_gettime_ns(CLOCK_ID_REALTIME) / NSEC_PER_SEC;
+}
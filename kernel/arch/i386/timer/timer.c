@@ -5,6 +5,10 @@
 #include <arch/i386/kernel/cpu.h>
 #include <arch/i386/kernel/isr.h>
 #include <arch/i386/kernel/port_io.h>
+#include <arch/i386/kernel/lapic.h>
+#include <arch/i386/kernel/irq.h>
+#include <kernel/softirq.h>
+#include <kernel/preempt.h>
 #include <stdio.h>
 #include <common.h>
 
@@ -15,36 +19,46 @@
 static uint32_t tick_between_call_to_scheduler = 0;
 static uint32_t timer_freq = 0;
 static uint64_t tick = 0;
-static time_t init_ts;
+// Local APIC timer ticks of each application processor
+static uint32_t cpu_ticks[MAX_CPU];
 
 static void timer_callback(trapframe *regs) {
     UNUSED_ARG(regs);
 
     tick++;
+    raise_softirq(SOFTIRQ_TIMER);
     
     if(tick_between_call_to_scheduler > 0 && tick % tick_between_call_to_scheduler == 0) {
-        yield();
+        // switched out on interrupt return, or once it releases its locks
+        resched_curr();
     }
 
-    // Calibrate tick at second precision
+    // Calibrate tick at second precision against the TSC clocksource
     if(tick % (timer_freq) == 0) {
-        if(!init_ts) {
-                date_time init_dt = current_datetime();
-                init_ts = datetime2epoch(&init_dt);
-        } else {
-            date_time dt =  current_datetime();
-            time_t ts = datetime2epoch(&dt);
-            int64_t sec_elapsed = ts - init_ts;
-            uint64_t tick_est = sec_elapsed * timer_freq;
-            if(tick_est > tick) {
-                printf("Timer: Calibrating tick, %llu => %llu\n", tick, tick_est);
-                tick = tick_est;
-            }
+        uint64_t sec_elapsed = clock_gettime_ns(CLOCK_ID_MONOTONIC) / 1000000000ULL;
+        uint64_t tick_est = sec_elapsed * timer_freq;
+        if(tick_est > tick) {
+            printf("Timer: Calibrating tick, %llu => %llu\n", tick, tick_est);
+            tick = tick_est;
         }
     }
 }
 
 
+// Every CPU using its local APIC timer gets here
+static void lapic_timer_callback(trapframe *regs) {
+    cpu* c = curr_cpu();
+    if(c->id == 0) {
+        // The bootstrap processor also keeps the system tick
+        timer_callback(regs);
+        return;
+    }
+    cpu_ticks[c->id]++;
+    if(tick_between_call_to_scheduler > 0 && cpu_ticks[c->id] % tick_between_call_to_scheduler == 0) {
+        resched_curr();
+    }
+}
+
 /*
 Programmable Interval Timer Spec (https://wiki.osdev.org/PIT)
 
@@ -98,4 +112,19 @@ void init_timer(uint32_t freq, uint32_t tick_between_process_switch) {
 
     timer_freq = freq;
     tick_between_call_to_scheduler = tick_between_process_switch;
+    irq_enable(0);
+}
+
+// Drive the calling CPU's tick by its local APIC timer, at the same frequency as the PIT
+// On the bootstrap processor this replaces the PIT, which is then masked
+// Shall be called after init_timer() and init_clocksource(), used for calibration
+void start_cpu_timer() {
+    if(!lapic_available()) {
+        return;
+    }
+    if(curr_cpu()->id == 0) {
+        register_interrupt_handler(LAPIC_TIMER_VECTOR, lapic_timer_callback);
+        irq_disable(0);
+    }
+    lapic_timer_start(timer_freq);
 }
@@ -0,0 +1,84 @@
+#include <kernel/vdso.h>
+#include <kernel/paging.h>
+#include <kernel/panic.h>
+#include <kernel/time.h>
+#include <kernel/syscall.h>
+#include <arch/i386/kernel/cpu.h>
+#include <vdso.h>
+#include <string.h>
+#include <common.h>
+
+// Ref: https://man7.org/linux/man-pages/man7/vdso.7.html
+
+static struct {
+    struct vdso_clock* clock;       // kernel side (writable) address of the shared clock page
+    uint32_t clock_frame;
+    uint32_t vsyscall_frame;
+} vdso;
+
+static uint32_t frame_of(void* vaddr)
+{
+    return vaddr2paddr(curr_page_dir(), (uint32_t) vaddr) >> 12;
+}
+
+// Publish the current clocksource parameters under the sequence lock
+void vdso_update_clock()
+{
+    struct vdso_clock snapshot = {0};
+    clocksource_snapshot(&snapshot);
+
+    volatile struct vdso_clock* c = vdso.clock;
+    c->seq++;
+    asm volatile("" ::: "memory");
+    c->mult = snapshot.mult;
+    c->shift = snapshot.shift;
+    c->boot_tsc = snapshot.boot_tsc;
+    c->boot_epoch = snapshot.boot_epoch;
+    c->tsc_hz = snapshot.tsc_hz;
+    asm volatile("" ::: "memory");
+    c->seq++;
+}
+
+// Allocate the clock and vsyscall pages shared by all processes, must be called after init_clocksource()
+void init_vdso()
+{
+    vdso.clock = (struct vdso_clock*) alloc_pages(curr_page_dir(), 1, true, true);
+    memset(vdso.clock, 0, PAGE_SIZE);
+    vdso.clock_frame = frame_of(vdso.clock);
+    vdso_update_clock();
+
+    // Copy the vsyscall trampoline, SYSENTER based if supported, int 88 otherwise
+    char* vsyscall = (char*) alloc_pages(curr_page_dir(), 1, true, true);
+    memset(vsyscall, 0, PAGE_SIZE);
+    if(cpu_has_sysenter()) {
+        memmove(vsyscall, vsyscall_begin, vsyscall_end - vsyscall_begin);
+    } else {
+        memmove(vsyscall, vsyscall_int88_begin, vsyscall_int88_end - vsyscall_int88_begin);
+    }
+    vdso.vsyscall_frame = frame_of(vsyscall);
+}
+
+// Map vDSO pages read-only into page_dir, which is either p's current page dir,
+// or the one it is going to switch to (fork/exec)
+// The per-process page is allocated on first call and kept across exec
+void vdso_map(proc* p, pde* page_dir)
+{
+    PANIC_ASSERT(vdso.clock != NULL);
+    if(p->vdso == NULL) {
+        p->vdso = (struct vdso_proc*) alloc_pages(curr_page_dir(), 1, true, true);
+        memset(p->vdso, 0, PAGE_SIZE);
+    }
+    p->vdso->pid = p->pid;
+
+    uint32_t frames[VDSO_PAGE_COUNT] = {vdso.clock_frame, frame_of(p->vdso), vdso.vsyscall_frame};
+    map_shared_pages_at(page_dir, PAGE_INDEX_FROM_VADDR(VDSO_VADDR), VDSO_PAGE_COUNT, frames, false);
+}
+
+// Free the per-process page, the user space mapping is dropped by free_user_space()
+void vdso_release(proc* p)
+{
+    if(p->vdso != NULL) {
+        dealloc_pages(curr_page_dir(), PAGE_INDEX_FROM_VADDR((uint32_t) p->vdso), 1);
+        p->vdso = NULL;
+    }
+}
@@ -0,0 +1,360 @@
+#include <kernel/virtio_blk.h>
+#include <kernel/block_io.h>
+#include <kernel/heap.h>
+#include <kernel/lock.h>
+#include <kernel/paging.h>
+#include <kernel/panic.h>
+#include <kernel/pci.h>
+#include <kernel/process.h>
+#include <arch/i386/kernel/isr.h>
+#include <arch/i386/kernel/irq.h>
+#include <arch/i386/kernel/port_io.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#define VIRTIO_BLK_MAX_DEVICES 4
+// Requests in flight at most, each one takes a single descriptor of the queue
+#define VIRTIO_BLK_MAX_SLOTS 64
+// Sectors per request, bigger ones are split into requests in flight together
+#define VIRTIO_BLK_MAX_SECTORS 256
+// One segment per page touched, the sectors of an unaligned buffer span one more page
+// Scattered buffers may need more, the request then carries fewer sectors
+#define VIRTIO_BLK_MAX_SEGS (VIRTIO_BLK_MAX_SECTORS*512/PAGE_SIZE + 1)
+// Requests taken at once from the block request queue
+#define VIRTIO_BLK_QUEUE_DEPTH 8
+
+// Indirect descriptor table of a request, with its header and status
+// The header and the status are part of it, so that the device reads one table per request
+typedef struct virtio_blk_slot {
+    virtio_blk_req_hdr hdr;
+    vring_desc indirect[VIRTIO_BLK_MAX_SEGS + 2];
+    volatile uint8_t status;
+} virtio_blk_slot;
+
+#define VIRTIO_BLK_SLOT_SIZE 1024
+_Static_assert(sizeof(virtio_blk_slot) <= VIRTIO_BLK_SLOT_SIZE, "virtio_blk_slot too big");
+
+typedef struct virtio_blk {
+    uint16_t io_base;
+    uint8_t irq;
+    uint16_t queue_size;
+    uint n_slot;
+    bool event_idx;
+    uint64_t capacity;
+    vring_desc* desc;
+    volatile vring_avail* avail;
+    volatile vring_used* used;
+    volatile uint16_t* used_event;      // in the avail ring, the device interrupts once it uses this entry
+    volatile uint16_t* avail_event;     // in the used ring, the driver notifies once it makes this entry available
+    uint8_t* slots;
+    uint32_t slots_paddr;
+    spinlock lk;                        // Guards the fields below and the rings
+    uint64_t busy;                      // Slots owned by a request
+    uint64_t inflight;                  // Slots made available and not used yet
+    uint64_t failed;                    // Slots used with an error status
+    uint16_t last_used;                 // Next used ring entry to look at
+    uint16_t notified_avail;            // avail->idx when the device was last notified
+} virtio_blk;
+
+static struct {
+    virtio_blk* devs[VIRTIO_BLK_MAX_DEVICES];
+    uint n_dev;
+} vblk;
+
+static virtio_blk_slot* slot_ptr(virtio_blk* dev, uint slot)
+{
+    return (virtio_blk_slot*) (dev->slots + slot * VIRTIO_BLK_SLOT_SIZE);
+}
+
+static uint32_t slot_paddr(virtio_blk* dev, uint slot)
+{
+    return dev->slots_paddr + slot * VIRTIO_BLK_SLOT_SIZE;
+}
+
+// Collect the requests the device is done with, caller shall hold dev->lk
+static void reap(virtio_blk* dev)
+{
+    while(1) {
+        while(dev->last_used != dev->used->idx) {
+            // read the entry only after seeing the index
+            __sync_synchronize();
+            uint slot = dev->used->ring[dev->last_used % dev->queue_size].id;
+            uint64_t bit = 1ULL << slot;
+            if(slot_ptr(dev, slot)->status != VIRTIO_BLK_S_OK) {
+                dev->failed |= bit;
+            }
+            dev->inflight &= ~bit;
+            dev->last_used++;
+        }
+        if(!dev->event_idx) {
+            return;
+        }
+        // no interrupt until the next entry is used
+        *dev->used_event = dev->last_used;
+        // an entry used before the device saw the store raises no interrupt, collect it now
+        // Ref: Linux drivers/virtio/virtio_ring.c (virtqueue_enable_cb_prepare, more_used)
+        __sync_synchronize();
+        if(dev->used->idx == dev->last_used) {
+            return;
+        }
+    }
+}
+
+static void virtio_blk_irq_handler(trapframe* tf)
+{
+    UNUSED_ARG(tf);
+    // the interrupt line may be shared
+    for(uint i=0; i<vblk.n_dev; i++) {
+        virtio_blk* dev = vblk.devs[i];
+        if(!(inb(dev->io_base + VIRTIO_REG_ISR_STATUS) & VIRTIO_ISR_QUEUE)) {
+            continue;
+        }
+        spin_lock(&dev->lk);
+        reap(dev);
+        wakeup(dev);
+        spin_unlock(&dev->lk);
+    }
+}
+
+// Tell the device about the requests made available since the last time,
+// unless it asked not to be notified, caller shall hold dev->lk
+static void kick(virtio_blk* dev)
+{
+    uint16_t new_idx = dev->avail->idx;
+    uint16_t old_idx = dev->notified_avail;
+    if(new_idx == old_idx) {
+        return;
+    }
+    // the device shall see the new index before we look at what it wants
+    __sync_synchronize();
+    bool notify;
+    if(dev->event_idx) {
+        uint16_t event = *dev->avail_event;
+        notify = (uint16_t) (new_idx - event - 1) < (uint16_t) (new_idx - old_idx);
+    } else {
+        notify = !(dev->used->flags & VRING_USED_F_NO_NOTIFY);
+    }
+    dev->notified_avail = new_idx;
+    if(notify) {
+        outw(dev->io_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+    }
+}
+
+// Fill the indirect descriptor table of the slot
+static void build_request(virtio_blk* dev, uint slot, const blk_frag* frags, uint32_t n_frag, uint32_t LBA, bool write)
+{
+    virtio_blk_slot* s = slot_ptr(dev, slot);
+    uint32_t paddr = slot_paddr(dev, slot);
+    s->hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+    s->hdr.reserved = 0;
+    s->hdr.sector = LBA;
+    s->status = 0xFF;
+
+    uint n = 0;
+    s->indirect[n++] = (vring_desc) {.addr = paddr + offsetof(virtio_blk_slot, hdr), .len = sizeof(virtio_blk_req_hdr)};
+    for(uint32_t i=0; i<n_frag; i++) {
+        s->indirect[n++] = (vring_desc) {
+            .addr = frags[i].paddr,
+            .len = frags[i].len,
+            .flags = write ? 0 : VRING_DESC_F_WRITE
+        };
+    }
+    s->indirect[n++] = (vring_desc) {
+        .addr = paddr + offsetof(virtio_blk_slot, status),
+        .len = 1,
+        .flags = VRING_DESC_F_WRITE
+    };
+    for(uint i=0; i+1<n; i++) {
+        s->indirect[i].flags |= VRING_DESC_F_NEXT;
+        s->indirect[i].next = i + 1;
+    }
+    dev->desc[slot].len = n * sizeof(vring_desc);
+}
+
+// Caller shall hold dev->lk
+static void make_available(virtio_blk* dev, uint slot)
+{
+    dev->inflight |= 1ULL << slot;
+    dev->avail->ring[dev->avail->idx % dev->queue_size] = slot;
+    // the entry shall be visible before the index
+    __sync_synchronize();
+    dev->avail->idx++;
+}
+
+// Split the request, make all of it available with a single notification,
+// and return once the device used all of it
+static int64_t virtio_blk_transfer(block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA, bool write)
+{
+    virtio_blk* dev = (virtio_blk*) storage->internal_info;
+    uint32_t block_count = blk_seg_bytes(segs, n_seg) / 512;
+    if(LBA >= storage->block_count || LBA + block_count > storage->block_count) {
+        return -1;
+    }
+    blk_seg_iter it;
+    blk_seg_iter_init(&it, segs, n_seg);
+    int64_t bytes = 512 * block_count;
+    uint64_t all_slots = dev->n_slot == 64 ? ~0ULL : (1ULL << dev->n_slot) - 1;
+    // at boot, before any process exists, poll
+    bool polling = curr_proc() == NULL;
+    uint64_t mine = 0;
+    bool ok = true;
+
+    spin_lock(&dev->lk);
+    while(block_count > 0 || mine != 0) {
+        uint64_t done = mine & ~dev->inflight;
+        if(done) {
+            if(dev->failed & done) {
+                ok = false;
+            }
+            dev->failed &= ~done;
+            dev->busy &= ~done;
+            mine &= ~done;
+            // someone may be waiting for a free slot
+            wakeup(dev);
+            continue;
+        }
+        uint64_t free_slots = ~dev->busy & all_slots;
+        if(block_count > 0 && free_slots) {
+            uint slot = __builtin_ctzll(free_slots);
+            dev->busy |= 1ULL << slot;
+            // page tables may be mapped in, not with the spinlock held
+            spin_unlock(&dev->lk);
+            blk_frag frags[VIRTIO_BLK_MAX_SEGS];
+            uint32_t n_frag;
+            uint32_t n = blk_seg_iter_map(&it, 512, VIRTIO_BLK_MAX_SECTORS, frags, VIRTIO_BLK_MAX_SEGS, &n_frag);
+            PANIC_ASSERT(n > 0);
+            build_request(dev, slot, frags, n_frag, LBA, write);
+            spin_lock(&dev->lk);
+            make_available(dev, slot);
+            mine |= 1ULL << slot;
+            LBA += n;
+            block_count -= n;
+            continue;
+        }
+        kick(dev);
+        // wait for one of ours to be used, or for a free slot
+        if(polling) {
+            reap(dev);
+        } else {
+            sleep(dev, &dev->lk);
+        }
+    }
+    spin_unlock(&dev->lk);
+    return ok ? bytes : -1;
+}
+
+static int64_t virtio_blk_readv_blocks(block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA)
+{
+    return virtio_blk_transfer(storage, segs, n_seg, LBA, false);
+}
+
+static int64_t virtio_blk_writev_blocks(block_storage* storage, uint32_t LBA, const blk_seg* segs, uint32_t n_seg)
+{
+    return virtio_blk_transfer(storage, segs, n_seg, LBA, true);
+}
+
+void init_virtio_blk(uint8_t bus, uint8_t device, uint8_t function)
+{
+    if(vblk.n_dev >= VIRTIO_BLK_MAX_DEVICES) {
+        return;
+    }
+    uint16_t command = PCI_COMMAND(bus, device, function);
+    command |= PCI_COMMAND_BUS_MASTER;
+    command &= ~PCI_COMMAND_INT_DISABLE;
+    PCI_W_COMMAND(bus, device, function, command);
+
+    uint32_t bar0 = PCI_BAR_0(bus, device, function);
+    // Make sure BAR0 is I/O space address
+    PANIC_ASSERT(bar0 & 1);
+    uint16_t io_base = (bar0 & ~0x3) & 0xFFFF;
+
+    // Reset, then tell the device it has been found and can be driven
+    outb(io_base + VIRTIO_REG_DEVICE_STATUS, 0);
+    outb(io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    // Without VIRTIO_BLK_F_FLUSH the device writes through its cache
+    uint32_t features = inl(io_base + VIRTIO_REG_DEVICE_FEATURES);
+    if(!(features & VIRTIO_RING_F_INDIRECT_DESC)) {
+        printf("virtio-blk: indirect descriptors not supported\n");
+        outb(io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+        return;
+    }
+    uint32_t guest_features = features & (VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_RING_F_EVENT_IDX);
+    outl(io_base + VIRTIO_REG_GUEST_FEATURES, guest_features);
+
+    outw(io_base + VIRTIO_REG_QUEUE_SELECT, 0);
+    uint16_t queue_size = inw(io_base + VIRTIO_REG_QUEUE_SIZE);
+    if(queue_size == 0) {
+        printf("virtio-blk: no request queue\n");
+        outb(io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_FAILED);
+        return;
+    }
+
+    virtio_blk* dev = kmalloc(sizeof(virtio_blk));
+    memset(dev, 0, sizeof(virtio_blk));
+    dev->io_base = io_base;
+    dev->queue_size = queue_size;
+    dev->n_slot = queue_size < VIRTIO_BLK_MAX_SLOTS ? queue_size : VIRTIO_BLK_MAX_SLOTS;
+    dev->event_idx = (guest_features & VIRTIO_RING_F_EVENT_IDX) != 0;
+    dev->capacity = inl(io_base + VIRTIO_REG_BLK_CAPACITY) | ((uint64_t) inl(io_base + VIRTIO_REG_BLK_CAPACITY + 4) << 32);
+
+    // Legacy layout: descriptors, avail ring, then the used ring at the next 4KiB
+    uint32_t avail_end = sizeof(vring_desc) * queue_size + sizeof(uint16_t) * (3 + queue_size);
+    uint32_t used_offset = (avail_end + VIRTIO_QUEUE_ALIGN - 1) & ~(VIRTIO_QUEUE_ALIGN - 1);
+    uint32_t used_size = sizeof(uint16_t) * 2 + sizeof(vring_used_elem) * queue_size;
+    uint queue_pages = PAGE_COUNT_FROM_BYTES(used_offset + used_size + sizeof(uint16_t));
+    uint32_t queue_paddr;
+    uint8_t* queue = (uint8_t*) alloc_pages_consecutive_frames(curr_page_dir(), queue_pages, true, &queue_paddr);
+    memset(queue, 0, queue_pages * PAGE_SIZE);
+    dev->desc = (vring_desc*) queue;
+    dev->avail = (vring_avail*) (queue + sizeof(vring_desc) * queue_size);
+    dev->used = (vring_used*) (queue + used_offset);
+    // right after the rings
+    dev->used_event = (volatile uint16_t*) (queue + avail_end - sizeof(uint16_t));
+    dev->avail_event = (volatile uint16_t*) (queue + used_offset + used_size);
+
+    // Descriptor i always points to the indirect table of slot i
+    uint slot_pages = PAGE_COUNT_FROM_BYTES(VIRTIO_BLK_SLOT_SIZE * dev->n_slot);
+    dev->slots = (uint8_t*) alloc_pages_consecutive_frames(curr_page_dir(), slot_pages, true, &dev->slots_paddr);
+    memset(dev->slots, 0, slot_pages * PAGE_SIZE);
+    for(uint i=0; i<dev->n_slot; i++) {
+        dev->desc[i].addr = slot_paddr(dev, i);
+        dev->desc[i].flags = VRING_DESC_F_INDIRECT;
+    }
+    outl(io_base + VIRTIO_REG_QUEUE_ADDRESS, queue_paddr / VIRTIO_QUEUE_ALIGN);
+
+    // the handler looks at every device, hook each line once
+    dev->irq = PCI_INT_LINE(bus,device,function);
+    printf("virtio-blk is using IRQ(%u)\n", dev->irq);
+    bool hooked = false;
+    for(uint i=0; i<vblk.n_dev; i++) {
+        hooked |= vblk.devs[i]->irq == dev->irq;
+    }
+    vblk.devs[vblk.n_dev++] = dev;
+    if(!hooked) {
+        register_interrupt_handler(IRQ_TO_INTERRUPT(dev->irq), virtio_blk_irq_handler);
+        irq_enable_pci(dev->irq);
+    }
+    outb(io_base + VIRTIO_REG_DEVICE_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    printf("virtio-blk: I/O port 0x%x, %llu sectors, queue size %u%s\n", io_base, dev->capacity,
+        queue_size, dev->event_idx ? ", event index" : "");
+}
+
+void virtio_blk_add_block_storage()
+{
+    for(uint i=0; i<vblk.n_dev; i++) {
+        virtio_blk* dev = vblk.devs[i];
+        block_storage storage = (block_storage) {
+            .type=BLK_STORAGE_TYP_VIRTIO_BLK,
+            .block_size=512,
+            .block_count=dev->capacity > UINT32_MAX ? UINT32_MAX : (uint32_t) dev->capacity,
+            .dev_readv_blocks=virtio_blk_readv_blocks,
+            .dev_writev_blocks=virtio_blk_writev_blocks,
+            .queue_depth=VIRTIO_BLK_QUEUE_DEPTH,
+            .internal_info=dev
+        };
+        add_block_storage(&storage);
+    }
+}
@@ -0,0 +1,530 @@
+#include <kernel/bcache.h>
+#include <kernel/blk_queue.h>
+#include <kernel/heap.h>
+#include <kernel/lock.h>
+#include <kernel/panic.h>
+#include <kernel/process.h>
+#include <kernel/time.h>
+#include <kernel/workqueue.h>
+#include <stddef.h>
+#include <string.h>
+
+// Ref: xv6/bio.c
+
+#define BUF_VALID 1 // data has been read from the device
+#define BUF_DIRTY 2 // data has been changed, shall be written back
+
+typedef struct bcache_buf {
+    block_storage* storage;
+    uint32_t lba;
+    uint flags;
+    uint busy;                      // Claimed by a request or the flusher, others sleep on the buf
+    uint64_t dirty_ns;              // When it became dirty
+    struct bcache_buf* hash_next;
+    struct bcache_buf* lru_prev;    // Most recently used first
+    struct bcache_buf* lru_next;
+    blk_request req;                // Asynchronous write back
+    uint8_t data[BCACHE_BLOCK_SIZE];
+} bcache_buf;
+
+// Blocks read ahead with a single request, straight into the bufs
+typedef struct readahead {
+    blk_request req;
+    uint n_buf;
+    struct bcache_buf* bufs[BCACHE_READAHEAD_BLOCKS];
+    blk_seg segs[BCACHE_READAHEAD_BLOCKS];
+} readahead;
+
+static struct {
+    spinlock lk;                    // Guards everything but the data of a busy buf
+    bcache_buf* hash[BCACHE_HASH_SIZE];
+    bcache_buf* lru_head;
+    bcache_buf* lru_tail;
+    uint n_buf;
+    uint n_dirty;
+    uint waiting_for_buf;           // Sleeping until any buf is released
+    uint n_writeback;               // Asynchronous write backs in flight
+    block_storage* ra_storage;      // Last cached read, to detect sequential ones
+    uint32_t ra_next;
+    bcache_stat stat;
+    delayed_work flush_work;
+    uint flush_tick;
+} bcache;
+
+static bcache_buf** hash_bucket(block_storage* storage, uint32_t lba)
+{
+    return &bcache.hash[(storage->device_id * 31 + lba) % BCACHE_HASH_SIZE];
+}
+
+// Caller shall hold bcache.lk
+static bcache_buf* lookup(block_storage* storage, uint32_t lba)
+{
+    for(bcache_buf* b = *hash_bucket(storage, lba); b != NULL; b = b->hash_next) {
+        if(b->storage == storage && b->lba == lba) {
+            return b;
+        }
+    }
+    return NULL;
+}
+
+static void unhash(bcache_buf* b)
+{
+    for(bcache_buf** pp = hash_bucket(b->storage, b->lba); *pp != NULL; pp = &(*pp)->hash_next) {
+        if(*pp == b) {
+            *pp = b->hash_next;
+            return;
+        }
+    }
+}
+
+static void lru_remove(bcache_buf* b)
+{
+    if(b->lru_prev) b->lru_prev->lru_next = b->lru_next;
+    else bcache.lru_head = b->lru_next;
+    if(b->lru_next) b->lru_next->lru_prev = b->lru_prev;
+    else bcache.lru_tail = b->lru_prev;
+}
+
+static void lru_push_front(bcache_buf* b)
+{
+    b->lru_prev = NULL;
+    b->lru_next = bcache.lru_head;
+    if(bcache.lru_head) bcache.lru_head->lru_prev = b;
+    else bcache.lru_tail = b;
+    bcache.lru_head = b;
+}
+
+// Write a busy buf back, caller shall hold bcache.lk, which is released during the I/O
+static void write_back(bcache_buf* b)
+{
+    PANIC_ASSERT(b->busy && (b->flags & BUF_DIRTY));
+    spin_unlock(&bcache.lk);
+    int64_t r = blk_queue_write_blocks(b->storage, b->lba, 1, b->data);
+    spin_lock(&bcache.lk);
+    // on error, keep it dirty and retry later
+    if(r > 0) {
+        b->flags &= ~BUF_DIRTY;
+        bcache.n_dirty--;
+        bcache.stat.flushed++;
+    }
+}
+
+static void release_buf(bcache_buf* b)
+{
+    b->busy = 0;
+    wakeup(b);
+    if(bcache.waiting_for_buf) {
+        bcache.waiting_for_buf = 0;
+        wakeup(&bcache.waiting_for_buf);
+    }
+}
+
+// Claim the buf of (storage, lba), recycling the least recently used one if not cached
+// The returned buf is busy, and not BUF_VALID if newly recycled
+// If only_cached, return NULL instead of recycling
+static bcache_buf* bget(block_storage* storage, uint32_t lba, bool only_cached)
+{
+    bcache_buf* spare = NULL;
+    bcache_buf* b = NULL;
+    spin_lock(&bcache.lk);
+    while(1) {
+        b = lookup(storage, lba);
+        if(b != NULL) {
+            if(b->busy) {
+                sleep(b, &bcache.lk);
+                continue;
+            }
+            b->busy = 1;
+            lru_remove(b);
+            lru_push_front(b);
+            break;
+        }
+        if(only_cached) {
+            break;
+        }
+
+        if(spare == NULL && bcache.n_buf < BCACHE_MAX_BUF) {
+            // the heap may yield, so not with the spinlock held
+            spin_unlock(&bcache.lk);
+            spare = kmalloc(sizeof(bcache_buf));
+            spin_lock(&bcache.lk);
+            if(spare != NULL) {
+                // someone may have cached it in the meantime
+                continue;
+            }
+        }
+        if(spare != NULL && bcache.n_buf < BCACHE_MAX_BUF) {
+            b = spare;
+            spare = NULL;
+            bcache.n_buf++;
+        } else {
+            for(b = bcache.lru_tail; b != NULL && b->busy; b = b->lru_prev);
+            if(b == NULL) {
+                bcache.waiting_for_buf = 1;
+                sleep(&bcache.waiting_for_buf, &bcache.lk);
+                continue;
+            }
+            if(b->flags & BUF_DIRTY) {
+                // still hashed, so readers of it wait for the write instead of reading stale data
+                b->busy = 1;
+                write_back(b);
+                release_buf(b);
+                continue;
+            }
+            unhash(b);
+            lru_remove(b);
+            bcache.stat.evictions++;
+        }
+        b->storage = storage;
+        b->lba = lba;
+        b->flags = 0;
+        b->busy = 1;
+        bcache_buf** bucket = hash_bucket(storage, lba);
+        b->hash_next = *bucket;
+        *bucket = b;
+        lru_push_front(b);
+        break;
+    }
+    spin_unlock(&bcache.lk);
+    if(spare != NULL) {
+        kfree(spare);
+    }
+    return b;
+}
+
+static void brelse(bcache_buf* b)
+{
+    spin_lock(&bcache.lk);
+    release_buf(b);
+    spin_unlock(&bcache.lk);
+}
+
+// Mark a busy buf as changed
+static void mark_dirty(bcache_buf* b)
+{
+    spin_lock(&bcache.lk);
+    if(!(b->flags & BUF_DIRTY)) {
+        b->flags |= BUF_DIRTY;
+        b->dirty_ns = clock_gettime_ns(CLOCK_ID_MONOTONIC);
+        bcache.n_dirty++;
+    }
+    b->flags |= BUF_VALID;
+    bcache.stat.writes++;
+    release_buf(b);
+    spin_unlock(&bcache.lk);
+}
+
+static void end_readahead(blk_request* req, int64_t result)
+{
+    readahead* ra = (readahead*) req->private;
+    spin_lock(&bcache.lk);
+    for(uint i=0; i<ra->n_buf; i++) {
+        bcache_buf* b = ra->bufs[i];
+        // on error, left not valid to be read again on demand
+        if(result > 0) {
+            b->flags |= BUF_VALID;
+            bcache.stat.readahead++;
+        }
+        release_buf(b);
+    }
+    spin_unlock(&bcache.lk);
+    kfree(ra);
+}
+
+// Claim the uncached blocks from LBA on and read them with one request, not waiting for it
+// Readers of those blocks sleep on the bufs until the read is done
+static void start_readahead(block_storage* storage, uint32_t LBA)
+{
+    if(LBA >= storage->block_count) {
+        return;
+    }
+    uint32_t n = storage->block_count - LBA;
+    if(n > BCACHE_READAHEAD_BLOCKS) {
+        n = BCACHE_READAHEAD_BLOCKS;
+    }
+    spin_lock(&bcache.lk);
+    bool cached = lookup(storage, LBA) != NULL;
+    spin_unlock(&bcache.lk);
+    if(cached) {
+        return;
+    }
+    readahead* ra = kmalloc(sizeof(readahead));
+    if(ra == NULL) {
+        return;
+    }
+    ra->n_buf = 0;
+    for(uint32_t i=0; i<n; i++) {
+        spin_lock(&bcache.lk);
+        cached = lookup(storage, LBA + i) != NULL;
+        spin_unlock(&bcache.lk);
+        if(cached) {
+            break;
+        }
+        bcache_buf* b = bget(storage, LBA + i, false);
+        if(b->flags & BUF_VALID) {
+            // cached in the meantime
+            brelse(b);
+            break;
+        }
+        ra->segs[ra->n_buf] = (blk_seg) {.buff = b->data, .len = BCACHE_BLOCK_SIZE};
+        ra->bufs[ra->n_buf++] = b;
+    }
+    if(ra->n_buf == 0) {
+        kfree(ra);
+        return;
+    }
+    ra->req = (blk_request) {
+        .storage = storage,
+        .LBA = LBA,
+        .block_count = ra->n_buf,
+        .segs = ra->segs,
+        .n_seg = ra->n_buf,
+        .end_io = end_readahead,
+        .private = ra
+    };
+    blk_submit(&ra->req);
+}
+
+static void count(uint64_t* counter, uint n)
+{
+    spin_lock(&bcache.lk);
+    *counter += n;
+    spin_unlock(&bcache.lk);
+}
+
+static bool cacheable(block_storage* storage, uint32_t block_count)
+{
+    return storage->block_size == BCACHE_BLOCK_SIZE && block_count <= BCACHE_MAX_REQUEST_BLOCKS;
+}
+
+int64_t bcache_readv_blocks(block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA)
+{
+    uint bs = storage->block_size;
+    uint32_t block_count = blk_seg_bytes(segs, n_seg) / bs;
+    if(!cacheable(storage, block_count)) {
+        int64_t r = blk_queue_readv_blocks(storage, segs, n_seg, LBA);
+        if(r <= 0) return r;
+        // the cache is never older than the device
+        for(uint32_t i=0; i<block_count; i++) {
+            bcache_buf* b = bget(storage, LBA + i, true);
+            if(b == NULL) continue;
+            if(b->flags & BUF_VALID) {
+                blk_seg_copy_to(segs, n_seg, i*bs, b->data, bs);
+            }
+            brelse(b);
+        }
+        count(&bcache.stat.bypassed, block_count);
+        return r;
+    }
+
+    // claimed in LBA order, so overlapping requests cannot deadlock
+    bcache_buf* bufs[BCACHE_MAX_REQUEST_BLOCKS];
+    uint n_miss = 0;
+    for(uint32_t i=0; i<block_count; i++) {
+        bufs[i] = bget(storage, LBA + i, false);
+        n_miss += !(bufs[i]->flags & BUF_VALID);
+    }
+    int64_t r = bs * block_count;
+    if(n_miss > 0) {
+        // one device request for the whole range, then the cached blocks overwrite it
+        r = blk_queue_readv_blocks(storage, segs, n_seg, LBA);
+    }
+    for(uint32_t i=0; i<block_count; i++) {
+        bcache_buf* b = bufs[i];
+        if(b->flags & BUF_VALID) {
+            blk_seg_copy_to(segs, n_seg, i*bs, b->data, bs);
+        } else if(r > 0) {
+            blk_seg_copy_from(segs, n_seg, i*bs, b->data, bs);
+            b->flags |= BUF_VALID;
+        }
+        brelse(b);
+    }
+    spin_lock(&bcache.lk);
+    bcache.stat.hits += block_count - n_miss;
+    bcache.stat.misses += n_miss;
+    bool sequential = storage == bcache.ra_storage && LBA == bcache.ra_next;
+    bcache.ra_storage = storage;
+    bcache.ra_next = LBA + block_count;
+    spin_unlock(&bcache.lk);
+    if(sequential && r > 0) {
+        start_readahead(storage, LBA + block_count);
+    }
+    return r;
+}
+
+int64_t bcache_writev_blocks(block_storage* storage, uint32_t LBA, const blk_seg* segs, uint32_t n_seg)
+{
+    uint bs = storage->block_size;
+    uint32_t block_count = blk_seg_bytes(segs, n_seg) / bs;
+    if(!cacheable(storage, block_count)) {
+        // the cached copies get the new data and are no longer dirty,
+        // so that the flusher can't write older data over the new one
+        for(uint32_t i=0; i<block_count; i++) {
+            bcache_buf* b = bget(storage, LBA + i, true);
+            if(b == NULL) continue;
+            blk_seg_copy_from(segs, n_seg, i*bs, b->data, bs);
+            spin_lock(&bcache.lk);
+            if(b->flags & BUF_DIRTY) {
+                b->flags &= ~BUF_DIRTY;
+                bcache.n_dirty--;
+            }
+            b->flags |= BUF_VALID;
+            release_buf(b);
+            spin_unlock(&bcache.lk);
+        }
+        count(&bcache.stat.bypassed, block_count);
+        int64_t r = blk_queue_writev_blocks(storage, LBA, segs, n_seg);
+        if(r <= 0) {
+            // the device may not have the new data, keep the cached copies dirty and retry later
+            for(uint32_t i=0; i<block_count; i++) {
+                bcache_buf* b = bget(storage, LBA + i, true);
+                if(b == NULL) continue;
+                mark_dirty(b);
+            }
+        }
+        return r;
+    }
+    if(LBA >= storage->block_count || LBA + block_count > storage->block_count) {
+        return -1;
+    }
+
+    for(uint32_t i=0; i<block_count; i++) {
+        bcache_buf* b = bget(storage, LBA + i, false);
+        blk_seg_copy_from(segs, n_seg, i*bs, b->data, bs);
+        mark_dirty(b);
+    }
+    return bs * block_count;
+}
+
+int64_t bcache_read_blocks(block_storage* storage, void* buff, uint32_t LBA, uint32_t block_count)
+{
+    blk_seg seg = {.buff = buff, .len = block_count * storage->block_size};
+    return bcache_readv_blocks(storage, &seg, 1, LBA);
+}
+
+int64_t bcache_write_blocks(block_storage* storage, uint32_t LBA, uint32_t block_count, const void* buff)
+{
+    blk_seg seg = {.buff = (void*) buff, .len = block_count * storage->block_size};
+    return bcache_writev_blocks(storage, LBA, &seg, 1);
+}
+
+static void end_writeback(blk_request* req, int64_t result)
+{
+    bcache_buf* b = (bcache_buf*) req->private;
+    spin_lock(&bcache.lk);
+    // on error, keep it dirty and retry later
+    if(result > 0) {
+        b->flags &= ~BUF_DIRTY;
+        bcache.n_dirty--;
+        bcache.stat.flushed++;
+    }
+    release_buf(b);
+    if(--bcache.n_writeback == 0) {
+        wakeup(&bcache.n_writeback);
+    }
+    spin_unlock(&bcache.lk);
+}
+
+// Write back dirty blocks, only those dirty since before expire_ns if not zero
+// If wait, return once they are written, busy ones included
+// Otherwise busy ones are skipped and the writes are left in flight
+static void flush(uint64_t expire_ns, bool wait)
+{
+    spin_lock(&bcache.lk);
+    bcache.stat.flushes++;
+    while(1) {
+        // submitted together, for the request queue to sort them
+        blk_plug plug;
+        blk_start_plug(&plug);
+        bcache_buf* busy = NULL;
+        for(bcache_buf* b = bcache.lru_head; b != NULL; b = b->lru_next) {
+            if(!(b->flags & BUF_DIRTY) || (expire_ns && b->dirty_ns > expire_ns)) {
+                continue;
+            }
+            if(b->busy) {
+                busy = b;
+                continue;
+            }
+            b->busy = 1;
+            bcache.n_writeback++;
+            b->req = (blk_request) {
+                .storage = b->storage,
+                .write = true,
+                .LBA = b->lba,
+                .block_count = 1,
+                .buff = b->data,
+                .end_io = end_writeback,
+                .private = b
+            };
+            blk_plug_add(&plug, &b->req);
+        }
+        spin_unlock(&bcache.lk);
+        blk_finish_plug(&plug);
+        spin_lock(&bcache.lk);
+        if(!wait) {
+            break;
+        }
+        while(bcache.n_writeback > 0) {
+            sleep(&bcache.n_writeback, &bcache.lk);
+        }
+        if(busy == NULL) {
+            break;
+        }
+        // claimed by someone else, then look again
+        while(busy->busy) {
+            sleep(busy, &bcache.lk);
+        }
+    }
+    spin_unlock(&bcache.lk);
+}
+
+void bcache_sync()
+{
+    flush(0, true);
+}
+
+void bcache_get_stat(bcache_stat* stat)
+{
+    spin_lock(&bcache.lk);
+    *stat = bcache.stat;
+    stat->n_buf = bcache.n_buf;
+    stat->n_dirty = bcache.n_dirty;
+    spin_unlock(&bcache.lk);
+}
+
+static void flush_timer(void* arg)
+{
+    UNUSED_ARG(arg);
+    spin_lock(&bcache.lk);
+    bcache.flush_tick++;
+    wakeup(&bcache.flush_tick);
+    spin_unlock(&bcache.lk);
+}
+
+// Periodically write back blocks that have been dirty for a while
+static void flusher(void* arg)
+{
+    UNUSED_ARG(arg);
+    while(1) {
+        spin_lock(&bcache.lk);
+        uint tick = bcache.flush_tick;
+        spin_unlock(&bcache.lk);
+        queue_delayed_work(&bcache.flush_work, BCACHE_FLUSH_INTERVAL_MS);
+        spin_lock(&bcache.lk);
+        while(bcache.flush_tick == tick) {
+            sleep(&bcache.flush_tick, &bcache.lk);
+        }
+        spin_unlock(&bcache.lk);
+
+        uint64_t now = clock_gettime_ns(CLOCK_ID_MONOTONIC);
+        if(now > BCACHE_DIRTY_EXPIRE_NS) {
+            flush(now - BCACHE_DIRTY_EXPIRE_NS, false);
+        }
+    }
+}
+
+void init_bcache()
+{
+    init_delayed_work(&bcache.flush_work, flush_timer, NULL);
+    create_kernel_thread(flusher, NULL);
+}
@@ -0,0 +1,311 @@
+#include <kernel/blk_queue.h>
+#include <kernel/heap.h>
+#include <kernel/lock.h>
+#include <kernel/paging.h>
+#include <kernel/panic.h>
+#include <kernel/process.h>
+#include <kernel/time.h>
+#include <stddef.h>
+#include <string.h>
+
+// Ref: Linux block/mq-deadline.c
+
+struct blk_queue {
+    block_storage* storage;
+    // Driver entries
+    int64_t (*readv_blocks)(block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA);
+    int64_t (*writev_blocks)(block_storage* storage, uint32_t LBA, const blk_seg* segs, uint32_t n_seg);
+    uint depth;
+    spinlock lk;                        // Guards the fields below
+    blk_request* pending;               // In LBA order
+    uint32_t head_pos;                  // LBA after the last dispatched request
+};
+
+typedef struct blk_sync {
+    bool done;
+    int64_t result;
+} blk_sync;
+
+// Transfer the request and those merged into it with one driver call
+static int64_t dispatch(blk_queue* q, blk_request* req)
+{
+    const blk_seg* segs = req->segs;
+    blk_seg merged[BLK_QUEUE_MAX_MERGE_SEGS];
+    if(req->merged_next != NULL) {
+        uint32_t n = 0;
+        for(blk_request* r = req; r != NULL; r = r->merged_next) {
+            memmove(&merged[n], r->segs, r->n_seg * sizeof(blk_seg));
+            n += r->n_seg;
+        }
+        segs = merged;
+    }
+    if(req->write) {
+        return q->writev_blocks(q->storage, req->LBA, segs, req->total_segs);
+    }
+    return q->readv_blocks(q->storage, segs, req->total_segs, req->LBA);
+}
+
+// Call the callbacks of the request and of those merged into it
+static void complete(blk_request* req, int64_t result)
+{
+    uint32_t bs = req->storage->block_size;
+    while(req != NULL) {
+        // the callback may free the request
+        blk_request* next = req->merged_next;
+        req->end_io(req, result > 0 ? (int64_t) req->block_count * bs : result);
+        req = next;
+    }
+}
+
+static void prepare(blk_request* req)
+{
+    if(req->segs == NULL) {
+        req->seg = (blk_seg) {.buff = req->buff, .len = req->block_count * req->storage->block_size};
+        req->segs = &req->seg;
+        req->n_seg = 1;
+    }
+    req->total_count = req->block_count;
+    req->total_segs = req->n_seg;
+    req->merged_next = NULL;
+    req->merged_last = req;
+}
+
+static bool can_merge(blk_request* a, blk_request* b)
+{
+    return a->write == b->write
+        && a->LBA + a->total_count == b->LBA
+        && a->total_count + b->total_count <= BLK_QUEUE_MAX_MERGE_BLOCKS
+        && a->total_segs + b->total_segs <= BLK_QUEUE_MAX_MERGE_SEGS;
+}
+
+// Merge req into a neighbour or insert it in LBA order, caller shall hold q->lk
+static void insert(blk_queue* q, blk_request* req)
+{
+    req->deadline_ns = clock_gettime_ns(CLOCK_ID_MONOTONIC)
+        + (req->write ? BLK_QUEUE_WRITE_EXPIRE_NS : BLK_QUEUE_READ_EXPIRE_NS);
+
+    blk_request* prev = NULL;
+    blk_request** pp = &q->pending;
+    while(*pp != NULL && (*pp)->LBA < req->LBA) {
+        prev = *pp;
+        pp = &(*pp)->next;
+    }
+    blk_request* next = *pp;
+    if(prev != NULL && can_merge(prev, req)) {
+        prev->merged_last->merged_next = req;
+        prev->merged_last = req;
+        prev->total_count += req->total_count;
+        prev->total_segs += req->total_segs;
+        return;
+    }
+    if(next != NULL && can_merge(req, next)) {
+        // req takes the place of next
+        req->next = next->next;
+        *pp = req;
+        req->merged_next = next;
+        req->merged_last = next->merged_last;
+        req->total_count += next->total_count;
+        req->total_segs += next->total_segs;
+        if(next->deadline_ns < req->deadline_ns) {
+            req->deadline_ns = next->deadline_ns;
+        }
+        return;
+    }
+    req->next = next;
+    *pp = req;
+}
+
+// The oldest expired request, or else the next one in the sweep
+// Caller shall hold q->lk
+static blk_request* pick(blk_queue* q)
+{
+    if(q->pending == NULL) {
+        return NULL;
+    }
+    uint64_t now = clock_gettime_ns(CLOCK_ID_MONOTONIC);
+    blk_request* req = NULL;
+    for(blk_request* r = q->pending; r != NULL; r = r->next) {
+        if(r->deadline_ns <= now && (req == NULL || r->deadline_ns < req->deadline_ns)) {
+            req = r;
+        }
+    }
+    if(req == NULL) {
+        for(req = q->pending; req != NULL && req->LBA < q->head_pos; req = req->next);
+    }
+    if(req == NULL) {
+        // back to the lowest LBA
+        req = q->pending;
+    }
+    for(blk_request** pp = &q->pending; *pp != NULL; pp = &(*pp)->next) {
+        if(*pp == req) {
+            *pp = req->next;
+            break;
+        }
+    }
+    q->head_pos = req->LBA + req->total_count;
+    return req;
+}
+
+static void dispatcher(void* arg)
+{
+    blk_queue* q = (blk_queue*) arg;
+    spin_lock(&q->lk);
+    while(1) {
+        blk_request* req = pick(q);
+        if(req == NULL) {
+            sleep(q, &q->lk);
+            continue;
+        }
+        spin_unlock(&q->lk);
+        complete(req, dispatch(q, req));
+        spin_lock(&q->lk);
+    }
+}
+
+blk_queue* create_blk_queue(block_storage* storage)
+{
+    blk_queue* q = kmalloc(sizeof(blk_queue));
+    if(q == NULL) {
+        return NULL;
+    }
+    memset(q, 0, sizeof(blk_queue));
+    q->readv_blocks = storage->dev_readv_blocks;
+    q->writev_blocks = storage->dev_writev_blocks;
+    q->depth = storage->queue_depth > 0 ? storage->queue_depth : 1;
+    return q;
+}
+
+void start_blk_queue(blk_queue* q, block_storage* storage)
+{
+    q->storage = storage;
+    for(uint i=0; i<q->depth; i++) {
+        create_kernel_thread(dispatcher, q);
+    }
+}
+
+// The dispatcher threads only map kernel space
+static bool in_user_space(blk_request* req)
+{
+    for(uint32_t i=0; i<req->n_seg; i++) {
+        if((uint32_t) req->segs[i].buff < (uint32_t) MAP_MEM_PA_ZERO_TO) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Transfer it right away if the dispatchers can't, return false otherwise
+static bool dispatch_by_caller(blk_request* req)
+{
+    // at boot, before any process exists, the driver polls
+    if(curr_proc() == NULL || in_user_space(req)) {
+        complete(req, dispatch(req->storage->queue, req));
+        return true;
+    }
+    return false;
+}
+
+void blk_submit(blk_request* req)
+{
+    blk_queue* q = req->storage->queue;
+    prepare(req);
+    if(dispatch_by_caller(req)) {
+        return;
+    }
+    spin_lock(&q->lk);
+    insert(q, req);
+    wakeup(q);
+    spin_unlock(&q->lk);
+}
+
+void blk_start_plug(blk_plug* plug)
+{
+    plug->head = NULL;
+}
+
+void blk_plug_add(blk_plug* plug, blk_request* req)
+{
+    prepare(req);
+    if(dispatch_by_caller(req)) {
+        return;
+    }
+    req->next = plug->head;
+    plug->head = req;
+}
+
+void blk_finish_plug(blk_plug* plug)
+{
+    while(plug->head != NULL) {
+        blk_queue* q = plug->head->storage->queue;
+        // all the requests of a queue at once
+        spin_lock(&q->lk);
+        blk_request** pp = &plug->head;
+        while(*pp != NULL) {
+            blk_request* req = *pp;
+            if(req->storage->queue != q) {
+                pp = &req->next;
+                continue;
+            }
+            *pp = req->next;
+            insert(q, req);
+        }
+        wakeup(q);
+        spin_unlock(&q->lk);
+    }
+}
+
+static void end_sync(blk_request* req, int64_t result)
+{
+    blk_queue* q = req->storage->queue;
+    blk_sync* s = (blk_sync*) req->private;
+    spin_lock(&q->lk);
+    s->result = result;
+    s->done = true;
+    wakeup(s);
+    spin_unlock(&q->lk);
+}
+
+static int64_t submit_and_wait(block_storage* storage, bool write, const blk_seg* segs, uint32_t n_seg, uint32_t LBA)
+{
+    blk_queue* q = storage->queue;
+    blk_sync s = {0};
+    blk_request req = (blk_request) {
+        .storage = storage,
+        .write = write,
+        .LBA = LBA,
+        .block_count = blk_seg_bytes(segs, n_seg) / storage->block_size,
+        .segs = segs,
+        .n_seg = n_seg,
+        .end_io = end_sync,
+        .private = &s
+    };
+    blk_submit(&req);
+    spin_lock(&q->lk);
+    while(!s.done) {
+        sleep(&s, &q->lk);
+    }
+    spin_unlock(&q->lk);
+    return s.result;
+}
+
+int64_t blk_queue_read_blocks(block_storage* storage, void* buff, uint32_t LBA, uint32_t block_count)
+{
+    blk_seg seg = {.buff = buff, .len = block_count * storage->block_size};
+    return submit_and_wait(storage, false, &seg, 1, LBA);
+}
+
+int64_t blk_queue_write_blocks(block_storage* storage, uint32_t LBA, uint32_t block_count, const void* buff)
+{
+    blk_seg seg = {.buff = (void*) buff, .len = block_count * storage->block_size};
+    return submit_and_wait(storage, true, &seg, 1, LBA);
+}
+
+int64_t blk_queue_readv_blocks(block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA)
+{
+    return submit_and_wait(storage, false, segs, n_seg, LBA);
+}
+
+int64_t blk_queue_writev_blocks(block_storage* storage, uint32_t LBA, const blk_seg* segs, uint32_t n_seg)
+{
+    return submit_and_wait(storage, true, segs, n_seg, LBA);
+}
@@ -4,6 +4,12 @@
 #include <kernel/panic.h>
 #include <kernel/heap.h>
 #include <kernel/lock.h>
+#include <kernel/bcache.h>
+#include <kernel/blk_queue.h>
+#include <kernel/ahci.h>
+#include <kernel/virtio_blk.h>
+#include <kernel/paging.h>
+#include <string.h>
 
 #define MAX_STORAGE_DEV_COUNT 8
 
@@ -17,41 +23,94 @@ static struct {
     yield_lock lk;
 } blk;
 
-static int64_t read_blocks_ata(block_storage* storage, void* buff,  uint32_t LBA, uint32_t block_count)
+static int64_t readv_blocks_ata(block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA)
 {
     ata_storage_info* info = (ata_storage_info*) storage->internal_info;
     PANIC_ASSERT(storage->block_size == 512);
+    uint32_t block_count = blk_seg_bytes(segs, n_seg) / 512;
     if(LBA >= storage->block_count || LBA + block_count >= storage->block_count) {
         return -1;
     }
-    read_sectors_ATA_PIO(info->is_slave, buff, LBA, block_count);
+    if(readv_sectors_ATA(info->is_slave, segs, n_seg, LBA) < 0) {
+        return -1;
+    }
     return 512 * block_count;
 }
 
-static int64_t write_blocks_ata(block_storage* storage, uint32_t LBA, uint32_t block_count, const void* buff)
+static int64_t writev_blocks_ata(block_storage* storage, uint32_t LBA, const blk_seg* segs, uint32_t n_seg)
 {
     ata_storage_info* info = (ata_storage_info*) storage->internal_info;
     PANIC_ASSERT(storage->block_size == 512);
+    uint32_t block_count = blk_seg_bytes(segs, n_seg) / 512;
     if(LBA >= storage->block_count || LBA + block_count >= storage->block_count) {
         return -1;
     }
-    write_sectors_ATA_PIO(info->is_slave, buff, LBA, block_count);
+    if(writev_sectors_ATA(info->is_slave, segs, n_seg, LBA) < 0) {
+        return -1;
+    }
     return 512 * block_count;
 }
 
-static void add_block_storage(block_storage* storage)
+// LBA48 drives may have more sectors than a block_storage can address
+static uint32_t ata_block_count(int64_t total_sectors)
+{
+    return total_sectors > UINT32_MAX ? UINT32_MAX : (uint32_t) total_sectors;
+}
+
+int try_add_block_storage(block_storage* storage)
 {
     acquire(&blk.lk);
-    storage->device_id = blk.next_block_dev_id++;
     for(uint32_t i=0; i<MAX_STORAGE_DEV_COUNT; i++) {
         if(blk.storage_list[i].device_id == 0) {
             //id == 0 means unused slot
+            if(!storage->direct) {
+                // the file systems see the cached entries, the cache queues requests to the driver
+                storage->queue = create_blk_queue(storage);
+                if(storage->queue == NULL) {
+                    break;
+                }
+                storage->read_blocks = bcache_read_blocks;
+                storage->write_blocks = bcache_write_blocks;
+                storage->readv_blocks = bcache_readv_blocks;
+                storage->writev_blocks = bcache_writev_blocks;
+            }
+            storage->device_id = blk.next_block_dev_id++;
             blk.storage_list[i] = *storage;
             release(&blk.lk);
-            return;
+            if(!storage->direct) {
+                start_blk_queue(storage->queue, &blk.storage_list[i]);
+            }
+            return 0;
         }
     }
-    PANIC("Too many block storage devices!");
+    release(&blk.lk);
+    return -1;
+}
+
+void add_block_storage(block_storage* storage)
+{
+    if(try_add_block_storage(storage) < 0) {
+        PANIC("Cannot add block storage device");
+    }
+}
+
+void remove_block_storage(block_storage* storage)
+{
+    // a queued storage has dispatcher threads that can't be stopped
+    PANIC_ASSERT(storage->direct);
+    acquire(&blk.lk);
+    memset(storage, 0, sizeof(*storage));
+    release(&blk.lk);
+}
+
+block_storage* get_block_storage_by_type(block_storage_type type)
+{
+    for(uint32_t i=0; i<MAX_STORAGE_DEV_COUNT; i++) {
+        if(blk.storage_list[i].device_id != 0 && blk.storage_list[i].type == type) {
+            return &blk.storage_list[i];
+        }
+    }
+    return NULL;
 }
 
 block_storage* get_block_storage(uint32_t device_id)
@@ -70,7 +129,7 @@ void initialize_block_storage()
 
     // Add master/slave IDE devices
     
-    int32_t total_block_count = get_total_28bit_sectors(false);
+    int64_t total_block_count = get_total_sectors(false);
     PANIC_ASSERT(total_block_count > 0);
 
     ata_storage_info* master_info = kmalloc(sizeof(ata_storage_info));
@@ -78,15 +137,15 @@ void initialize_block_storage()
     block_storage master_storage = (block_storage) {
         .type=BLK_STORAGE_TYP_ATA_HARD_DRIVE, 
         .block_size=512, 
-        .block_count=total_block_count, 
-        .read_blocks=read_blocks_ata,
-        .write_blocks=write_blocks_ata,
+        .block_count=ata_block_count(total_block_count), 
+        .dev_readv_blocks=readv_blocks_ata,
+        .dev_writev_blocks=writev_blocks_ata,
         .internal_info=master_info
     };
     add_block_storage(&master_storage);
     assert(master_storage.device_id == IDE_MASTER_DRIVE);
 
-    int32_t slave_total_block_count = get_total_28bit_sectors(true);
+    int64_t slave_total_block_count = get_total_sectors(true);
     if(slave_total_block_count > 0) {
         // if slave IDE drive exist
         ata_storage_info* slave_info = kmalloc(sizeof(ata_storage_info));
@@ -94,13 +153,129 @@ void initialize_block_storage()
         block_storage slave_storage = (block_storage) {
             .type=BLK_STORAGE_TYP_ATA_HARD_DRIVE, 
             .block_size=512, 
-            .block_count=slave_total_block_count, 
-            .read_blocks=read_blocks_ata,
-            .write_blocks=write_blocks_ata,
+            .block_count=ata_block_count(slave_total_block_count), 
+            .dev_readv_blocks=readv_blocks_ata,
+            .dev_writev_blocks=writev_blocks_ata,
             .internal_info=slave_info
         };
         add_block_storage(&slave_storage);
         assert(slave_storage.device_id == IDE_SLAVE_DRIVE);
     }
 
-}
\ No newline at end of file
+    // SATA and virtio disks after the IDE ones, so that those keep their device_id
+    ahci_add_block_storage();
+    virtio_blk_add_block_storage();
+
+}
+
+uint32_t blk_seg_bytes(const blk_seg* segs, uint32_t n_seg)
+{
+    uint32_t n_bytes = 0;
+    for(uint32_t i=0; i<n_seg; i++) {
+        n_bytes += segs[i].len;
+    }
+    return n_bytes;
+}
+
+static void seg_copy(const blk_seg* segs, uint32_t n_seg, uint32_t offset, uint8_t* buff, uint32_t len, bool to_segs)
+{
+    for(uint32_t i=0; i<n_seg && len > 0; i++) {
+        if(offset >= segs[i].len) {
+            offset -= segs[i].len;
+            continue;
+        }
+        uint32_t n = segs[i].len - offset;
+        if(n > len) {
+            n = len;
+        }
+        uint8_t* p = (uint8_t*) segs[i].buff + offset;
+        if(to_segs) {
+            memmove(p, buff, n);
+        } else {
+            memmove(buff, p, n);
+        }
+        buff += n;
+        len -= n;
+        offset = 0;
+    }
+}
+
+void blk_seg_copy_from(const blk_seg* segs, uint32_t n_seg, uint32_t offset, void* dst, uint32_t len)
+{
+    seg_copy(segs, n_seg, offset, (uint8_t*) dst, len, false);
+}
+
+void blk_seg_copy_to(const blk_seg* segs, uint32_t n_seg, uint32_t offset, const void* src, uint32_t len)
+{
+    seg_copy(segs, n_seg, offset, (uint8_t*) src, len, true);
+}
+
+void blk_seg_iter_init(blk_seg_iter* it, const blk_seg* segs, uint32_t n_seg)
+{
+    *it = (blk_seg_iter) {.segs = segs, .n_seg = n_seg};
+}
+
+// Move past the walked segments, return false at the end
+static bool iter_next_seg(blk_seg_iter* it)
+{
+    while(it->idx < it->n_seg && it->off == it->segs[it->idx].len) {
+        it->idx++;
+        it->off = 0;
+    }
+    return it->idx < it->n_seg;
+}
+
+uint32_t blk_seg_iter_run(blk_seg_iter* it, uint32_t block_size, uint32_t max_blocks, void** vaddr)
+{
+    if(!iter_next_seg(it)) {
+        return 0;
+    }
+    const blk_seg* s = &it->segs[it->idx];
+    uint32_t n = (s->len - it->off) / block_size;
+    if(n > max_blocks) {
+        n = max_blocks;
+    }
+    *vaddr = (uint8_t*) s->buff + it->off;
+    it->off += n * block_size;
+    return n;
+}
+
+uint32_t blk_seg_iter_map(blk_seg_iter* it, uint32_t block_size, uint32_t max_blocks, blk_frag* frags, uint32_t max_frag, uint32_t* n_frag)
+{
+    // a block spans 2 pages at most
+    PANIC_ASSERT(max_frag >= 2 && block_size <= PAGE_SIZE);
+    pde* page_dir = curr_page_dir();
+    uint32_t max_bytes = max_blocks * block_size;
+    uint32_t n_bytes = 0;
+    uint32_t n = 0;
+    while(n_bytes < max_bytes && n < max_frag && iter_next_seg(it)) {
+        const blk_seg* s = &it->segs[it->idx];
+        uint32_t vaddr = (uint32_t) s->buff + it->off;
+        uint32_t len = PAGE_SIZE - vaddr % PAGE_SIZE;
+        if(len > s->len - it->off) {
+            len = s->len - it->off;
+        }
+        if(len > max_bytes - n_bytes) {
+            len = max_bytes - n_bytes;
+        }
+        frags[n++] = (blk_frag) {.paddr = vaddr2paddr(page_dir, vaddr), .len = len};
+        it->off += len;
+        n_bytes += len;
+    }
+    // out of fragments within a block, which is then left for the next call
+    // the block lies in the current segment, as segments hold whole blocks
+    uint32_t excess = n_bytes % block_size;
+    n_bytes -= excess;
+    it->off -= excess;
+    while(excess > 0) {
+        if(frags[n-1].len <= excess) {
+            excess -= frags[n-1].len;
+            n--;
+        } else {
+            frags[n-1].len -= excess;
+            excess = 0;
+        }
+    }
+    *n_frag = n;
+    return n_bytes / block_size;
+}
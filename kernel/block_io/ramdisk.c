@@ -0,0 +1,200 @@
+#include <kernel/ramdisk.h>
+#include <kernel/heap.h>
+#include <kernel/paging.h>
+#include <kernel/multiboot.h>
+#include <kernel/memory_bitmap.h>
+#include <kernel/lock.h>
+#include <kernel/errno.h>
+#include <kernel/panic.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+
+// Ref: Linux drivers/block/brd.c
+
+typedef struct ramdisk_info {
+    uint8_t* data;
+    uint32_t n_page;
+    bool read_only;
+} ramdisk_info;
+
+// Bytes taken by the RAM disks of ramdisk_create()
+static struct {
+    spinlock lk;
+    uint32_t total_size;
+} usage;
+
+// Boot module found by find_initrd()
+static struct {
+    uint32_t paddr;
+    uint32_t size;
+    block_storage* storage;
+} initrd;
+
+static bool in_range(block_storage* storage, uint32_t LBA, uint32_t block_count)
+{
+    return LBA < storage->block_count && block_count <= storage->block_count - LBA;
+}
+
+static uint8_t* block_addr(block_storage* storage, uint32_t LBA)
+{
+    ramdisk_info* info = (ramdisk_info*) storage->internal_info;
+    return info->data + LBA * RAM_DISK_BLOCK_SIZE;
+}
+
+static int64_t ramdisk_read_blocks(block_storage* storage, void* buff, uint32_t LBA, uint32_t block_count)
+{
+    if(!in_range(storage, LBA, block_count)) {
+        return -1;
+    }
+    uint32_t n_bytes = block_count * RAM_DISK_BLOCK_SIZE;
+    memmove(buff, block_addr(storage, LBA), n_bytes);
+    return n_bytes;
+}
+
+static bool is_read_only(block_storage* storage)
+{
+    return ((ramdisk_info*) storage->internal_info)->read_only;
+}
+
+static int64_t ramdisk_write_blocks(block_storage* storage, uint32_t LBA, uint32_t block_count, const void* buff)
+{
+    if(is_read_only(storage) || !in_range(storage, LBA, block_count)) {
+        return -1;
+    }
+    uint32_t n_bytes = block_count * RAM_DISK_BLOCK_SIZE;
+    memmove(block_addr(storage, LBA), buff, n_bytes);
+    return n_bytes;
+}
+
+static int64_t ramdisk_readv_blocks(block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA)
+{
+    uint32_t n_bytes = blk_seg_bytes(segs, n_seg);
+    if(!in_range(storage, LBA, n_bytes / RAM_DISK_BLOCK_SIZE)) {
+        return -1;
+    }
+    blk_seg_copy_to(segs, n_seg, 0, block_addr(storage, LBA), n_bytes);
+    return n_bytes;
+}
+
+static int64_t ramdisk_writev_blocks(block_storage* storage, uint32_t LBA, const blk_seg* segs, uint32_t n_seg)
+{
+    uint32_t n_bytes = blk_seg_bytes(segs, n_seg);
+    if(is_read_only(storage) || !in_range(storage, LBA, n_bytes / RAM_DISK_BLOCK_SIZE)) {
+        return -1;
+    }
+    blk_seg_copy_from(segs, n_seg, 0, block_addr(storage, LBA), n_bytes);
+    return n_bytes;
+}
+
+// Register size bytes at data as a RAM disk, return NULL if no slot is left
+static block_storage* add_ramdisk(ramdisk_info* info, uint32_t size)
+{
+    block_storage storage = (block_storage) {
+        .type = BLK_STORAGE_TYP_RAM_DISK,
+        .block_size = RAM_DISK_BLOCK_SIZE,
+        .block_count = size / RAM_DISK_BLOCK_SIZE,
+        .read_blocks = ramdisk_read_blocks,
+        .write_blocks = ramdisk_write_blocks,
+        .readv_blocks = ramdisk_readv_blocks,
+        .writev_blocks = ramdisk_writev_blocks,
+        .direct = true,
+        .internal_info = info
+    };
+    if(try_add_block_storage(&storage) < 0) {
+        return NULL;
+    }
+    return get_block_storage(storage.device_id);
+}
+
+static void release_usage(uint32_t n_page)
+{
+    spin_lock(&usage.lk);
+    usage.total_size -= n_page * PAGE_SIZE;
+    spin_unlock(&usage.lk);
+}
+
+int ramdisk_create(uint32_t size, block_storage** storage)
+{
+    if(size == 0 || size > RAM_DISK_MAX_SIZE) {
+        return -EINVAL;
+    }
+    uint32_t n_page = PAGE_COUNT_FROM_BYTES(size);
+    // the frame allocator panics when it runs out, so check before allocating
+    if(count_free_frames() < n_page + RAM_DISK_MIN_FREE_MEMORY / PAGE_SIZE) {
+        return -ENOMEM;
+    }
+    spin_lock(&usage.lk);
+    if(usage.total_size + n_page * PAGE_SIZE > RAM_DISK_MAX_TOTAL_SIZE) {
+        spin_unlock(&usage.lk);
+        return -ENOSPC;
+    }
+    usage.total_size += n_page * PAGE_SIZE;
+    spin_unlock(&usage.lk);
+
+    ramdisk_info* info = kmalloc(sizeof(ramdisk_info));
+    if(info == NULL) {
+        release_usage(n_page);
+        return -ENOMEM;
+    }
+    info->n_page = n_page;
+    info->read_only = false;
+    info->data = (uint8_t*) alloc_pages(curr_page_dir(), n_page, true, true);
+    memset(info->data, 0, n_page * PAGE_SIZE);
+
+    *storage = add_ramdisk(info, n_page * PAGE_SIZE);
+    if(*storage == NULL) {
+        dealloc_pages(curr_page_dir(), PAGE_INDEX_FROM_VADDR((uint32_t) info->data), n_page);
+        kfree(info);
+        release_usage(n_page);
+        return -ENOSPC;
+    }
+    return 0;
+}
+
+void ramdisk_destroy(block_storage* storage)
+{
+    ramdisk_info* info = (ramdisk_info*) storage->internal_info;
+    PANIC_ASSERT(storage->type == BLK_STORAGE_TYP_RAM_DISK && !info->read_only);
+    remove_block_storage(storage);
+    dealloc_pages(curr_page_dir(), PAGE_INDEX_FROM_VADDR((uint32_t) info->data), info->n_page);
+    release_usage(info->n_page);
+    kfree(info);
+}
+
+void find_initrd(uint32_t mbt_physical_addr)
+{
+    multiboot_info_t* mbt = (multiboot_info_t*) (mbt_physical_addr + 0xC0000000);
+    if(!(mbt->flags & MULTIBOOT_INFO_MODS)) {
+        return;
+    }
+    struct multiboot_mod_list* mods = (struct multiboot_mod_list*) (mbt->mods_addr + 0xC0000000);
+    for(uint32_t i=0; i<mbt->mods_count; i++) {
+        if(strcmp((char*) (mods[i].cmdline + 0xC0000000), INITRD_MODULE_CMDLINE) == 0 && mods[i].mod_end > mods[i].mod_start) {
+            initrd.paddr = mods[i].mod_start;
+            initrd.size = mods[i].mod_end - mods[i].mod_start;
+            printf("Initial ramdisk at 0x%x, %u bytes\n", initrd.paddr, initrd.size);
+            return;
+        }
+    }
+}
+
+block_storage* ramdisk_initrd()
+{
+    if(initrd.storage != NULL || initrd.size == 0) {
+        return initrd.storage;
+    }
+    // the frames were kept by the frame allocator, map them in place
+    ramdisk_info* info = kmalloc(sizeof(ramdisk_info));
+    info->n_page = PAGE_COUNT_FROM_BYTES(initrd.size);
+    info->read_only = true;
+    info->data = (uint8_t*) map_physical_memory(initrd.paddr, initrd.size, false);
+    // a partial last block is left out
+    initrd.storage = add_ramdisk(info, initrd.size);
+    if(initrd.storage == NULL) {
+        unmap_pages(curr_page_dir(), (uint32_t) info->data, initrd.size);
+        kfree(info);
+        initrd.size = 0;
+    }
+    return initrd.storage;
+}
@@ -432,6 +432,12 @@ static int fat32_free_cluster(fat32_meta* meta, uint prev_cluster_number, uint c
 
 }
 
+static uint32_t fat32_cluster_lba(fat32_meta* meta, uint32_t cluster_number)
+{
+    // the cluster 0 and 1 are not of size sectors_per_cluster
+    return meta->bootsector->hidden_sector_count + meta->bootsector->reserved_sector_count + meta->bootsector->table_sector_size_32*meta->bootsector->table_count + (cluster_number-2)*meta->bootsector->sectors_per_cluster;
+}
+
 static int64_t fat32_read_clusters(fat32_meta* meta, uint cluster_number, uint clusters_to_read, uint8_t* buff) 
 {
     assert(cluster_number >= 2);
@@ -443,8 +449,7 @@ static int64_t fat32_read_clusters(fat32_meta* meta, uint cluster_number, uint c
         assert(cluster.next != 0);
         fat_cluster_status status = fat32_get_cluster_info(meta, cluster.next, &cluster);
         assert(status == FAT_CLUSTER_USED || (status == FAT_CLUSTER_EOC && i == clusters_to_read-1));
-        // the cluster 0 and 1 are not of size sectors_per_cluster
-        uint lba = meta->bootsector->hidden_sector_count + meta->bootsector->reserved_sector_count + meta->bootsector->table_sector_size_32*meta->bootsector->table_count + (cluster.curr-2)*meta->bootsector->sectors_per_cluster;
+        uint lba = fat32_cluster_lba(meta, cluster.curr);
         int64_t bytes_read = meta->storage->read_blocks(meta->storage, buff, lba, meta->bootsector->sectors_per_cluster);
         if(bytes_read < 0) {
             return bytes_read;
@@ -468,8 +473,7 @@ static int64_t fat32_write_clusters(fat32_meta* meta, uint cluster_number, uint
         assert(cluster.next != 0);
         fat_cluster_status status = fat32_get_cluster_info(meta, cluster.next, &cluster);
         assert(status == FAT_CLUSTER_USED || (status == FAT_CLUSTER_EOC && i == clusters_to_write-1));
-        // the cluster 0 and 1 are not of size sectors_per_cluster
-        uint lba = meta->bootsector->hidden_sector_count + meta->bootsector->reserved_sector_count + meta->bootsector->table_sector_size_32*meta->bootsector->table_count + (cluster.curr-2)*meta->bootsector->sectors_per_cluster;
+        uint lba = fat32_cluster_lba(meta, cluster.curr);
         int64_t bytes_written = meta->storage->write_blocks(meta->storage, lba, meta->bootsector->sectors_per_cluster, buff);
         if(bytes_written < 0) {
             return bytes_written;
@@ -1253,6 +1257,59 @@ static int fat32_getattr(struct fs_mount_point* mount_point, const char * path,
     return 0;
 }
 
+// Read size bytes from offset on of the sectors from LBA on into buff, with one request
+// Whole sectors go straight into buff, partial ones at both ends through scratch, 2 sectors in size
+static int64_t fat32_read_run(fat32_meta* meta, uint32_t LBA, uint32_t offset, uint32_t size, uint8_t* buff, uint8_t* scratch)
+{
+    block_storage* storage = meta->storage;
+    uint bytes_per_sector = meta->bootsector->bytes_per_sector;
+    LBA += offset / bytes_per_sector;
+    offset %= bytes_per_sector;
+
+    blk_seg segs[3];
+    uint n_seg = 0;
+    uint32_t head = 0;
+    if(offset != 0 || size < bytes_per_sector) {
+        head = bytes_per_sector - offset < size ? bytes_per_sector - offset : size;
+        segs[n_seg++] = (blk_seg) {.buff = scratch, .len = bytes_per_sector};
+    }
+    uint32_t middle = (size - head) / bytes_per_sector * bytes_per_sector;
+    uint32_t tail = size - head - middle;
+    if(middle > 0 && ((uint32_t) (buff + head) & 1)) {
+        // DMA can't reach odd addresses, those go through the scratch a sector at a time
+        for(uint32_t i=0; i<size; ) {
+            uint32_t n = size - i;
+            uint32_t sector_offset = (offset + i) % bytes_per_sector;
+            if(n > bytes_per_sector - sector_offset) {
+                n = bytes_per_sector - sector_offset;
+            }
+            if(storage->read_blocks(storage, scratch, LBA + (offset + i) / bytes_per_sector, 1) <= 0) {
+                return -EIO;
+            }
+            memmove(buff + i, scratch + sector_offset, n);
+            i += n;
+        }
+        return size;
+    }
+    if(middle > 0) {
+        segs[n_seg++] = (blk_seg) {.buff = buff + head, .len = middle};
+    }
+    if(tail > 0) {
+        segs[n_seg++] = (blk_seg) {.buff = scratch + bytes_per_sector, .len = bytes_per_sector};
+    }
+
+    if(storage->readv_blocks(storage, segs, n_seg, LBA) <= 0) {
+        return -EIO;
+    }
+    if(head > 0) {
+        memmove(buff, scratch + offset, head);
+    }
+    if(tail > 0) {
+        memmove(buff + head + middle, scratch + bytes_per_sector, tail);
+    }
+    return size;
+}
+
 static int fat32_read(struct fs_mount_point* mount_point, const char * path, char *buf, uint size, uint offset, struct fs_file_info *fi)
 {
 
@@ -1293,50 +1350,64 @@ static int fat32_read(struct fs_mount_point* mount_point, const char * path, cha
         size = file_entry.direntry.size - offset;
     }
 
+    if(size == 0) {
+        return 0;
+    }
+
+    // Clusters consecutive on the disk are read with one request
     fat_cluster cluster;
     cluster.next = file_entry.direntry.cluster_lo + (file_entry.direntry.cluster_hi << 16);
-    uint bytes_per_cluster = meta->bootsector->sectors_per_cluster*meta->bootsector->bytes_per_sector;
-    uint8_t* cluster_buffer = malloc(bytes_per_cluster);
-    uint size_in_this_cluster;
+    uint bytes_per_sector = meta->bootsector->bytes_per_sector;
+    uint bytes_per_cluster = meta->bootsector->sectors_per_cluster*bytes_per_sector;
+    uint8_t* scratch = malloc(2*bytes_per_sector);
+    uint32_t run_lba = 0, run_offset = 0, run_size = 0;
     int64_t total_bytes_read = 0;
-    while(1) {
+    while(size > 0) {
         fat_cluster_status cluster_status = fat32_get_cluster_info(meta, cluster.next, &cluster);
 
         if(cluster_status == FAT_CLUSTER_BAD || cluster_status == FAT_CLUSTER_FREE || cluster_status == FAT_CLUSTER_RESERVED) {
-            free(cluster_buffer);
+            free(scratch);
             return -EIO;
         }
         assert(cluster_status == FAT_CLUSTER_USED || cluster_status == FAT_CLUSTER_EOC);
 
         if(offset < bytes_per_cluster) {
-            int64_t read_res = fat32_read_clusters(meta, cluster.curr, 1, cluster_buffer);
-            if(read_res < 0) {
-                free(cluster_buffer);
-                return read_res;
-            }
-            if(size <= bytes_per_cluster - offset) {
-                size_in_this_cluster = size;
+            uint size_in_this_cluster = size <= bytes_per_cluster - offset ? size : bytes_per_cluster - offset;
+            uint32_t lba = fat32_cluster_lba(meta, cluster.curr);
+            if(run_size > 0 && lba == run_lba + (run_offset + run_size) / bytes_per_sector) {
+                run_size += size_in_this_cluster;
             } else {
-                size_in_this_cluster = bytes_per_cluster - offset;
+                if(run_size > 0) {
+                    int64_t read_res = fat32_read_run(meta, run_lba, run_offset, run_size, (uint8_t*) buf, scratch);
+                    if(read_res < 0) {
+                        free(scratch);
+                        return read_res;
+                    }
+                    buf += run_size;
+                    total_bytes_read += run_size;
+                }
+                run_lba = lba;
+                run_offset = offset;
+                run_size = size_in_this_cluster;
             }
-            memmove(buf, cluster_buffer + offset, size_in_this_cluster);
-            buf += size_in_this_cluster;
             offset = 0;
             size -= size_in_this_cluster;
-            total_bytes_read += size_in_this_cluster;
         } else {
             offset -= bytes_per_cluster;
         }
 
-        if(size == 0) {
-            free(cluster_buffer);
-            return total_bytes_read;
-        }
-
-        if(cluster_status == FAT_CLUSTER_EOC) {
+        if(size > 0 && cluster_status == FAT_CLUSTER_EOC) {
+            free(scratch);
             return -EIO;
         }
     }
+    int64_t read_res = fat32_read_run(meta, run_lba, run_offset, run_size, (uint8_t*) buf, scratch);
+    free(scratch);
+    if(read_res < 0) {
+        return read_res;
+    }
+    total_bytes_read += run_size;
+    return total_bytes_read;
 }
 
 static int fat32_mknod(struct fs_mount_point* mount_point, const char * path, uint mode)
@@ -1966,6 +2037,105 @@ static int fat32_mount(fs_mount_point* mount_point, void* option)
     return 0;
 }
 
+static int fat32_write_zero_padded(block_storage* storage, uint32_t LBA, uint32_t block_count, const void* data, uint32_t size)
+{
+    uint32_t n_bytes = block_count * storage->block_size;
+    uint8_t* buff = malloc(n_bytes);
+    memset(buff, 0, n_bytes);
+    if(size > 0) {
+        memmove(buff, data, size);
+    }
+    int64_t bytes_written = storage->write_blocks(storage, LBA, block_count, buff);
+    free(buff);
+    return bytes_written == n_bytes ? 0 : -EIO;
+}
+
+int fat32_format(block_storage* storage, const char* label)
+{
+    // Ref: Microsoft FAT specification, 3.5 FAT Type Determination and 6.1 FSInfo
+    uint32_t bytes_per_sector = storage->block_size;
+    if(bytes_per_sector != 512 || storage->block_count <= FAT32_FORMAT_RESERVED_SECTORS) {
+        return -EINVAL;
+    }
+    uint32_t total_sectors = storage->block_count;
+    uint32_t entries_per_sector = bytes_per_sector / sizeof(uint32_t);
+    // big enough for an entry per cluster of what the tables leave
+    uint32_t n_entry = (total_sectors - FAT32_FORMAT_RESERVED_SECTORS) / FAT32_FORMAT_SECTORS_PER_CLUSTER + 2;
+    uint32_t fat_sectors = (n_entry + entries_per_sector - 1) / entries_per_sector;
+    if(FAT32_FORMAT_RESERVED_SECTORS + FAT32_FORMAT_TABLE_COUNT*fat_sectors >= total_sectors) {
+        return -EINVAL;
+    }
+    uint32_t n_cluster = (total_sectors - FAT32_FORMAT_RESERVED_SECTORS - FAT32_FORMAT_TABLE_COUNT*fat_sectors) / FAT32_FORMAT_SECTORS_PER_CLUSTER;
+    // fewer than 65525 clusters is fine for simple-os only, see fat.h
+    if(n_cluster < FAT32_FORMAT_MIN_CLUSTERS) {
+        return -EINVAL;
+    }
+
+    fat32_bootsector bs = {0};
+    memmove(bs.bootjmp, "\xEB\x58\x90", sizeof(bs.bootjmp));
+    memmove(bs.oem_name, "SIMPLEOS", sizeof(bs.oem_name));
+    bs.bytes_per_sector = bytes_per_sector;
+    bs.sectors_per_cluster = FAT32_FORMAT_SECTORS_PER_CLUSTER;
+    bs.reserved_sector_count = FAT32_FORMAT_RESERVED_SECTORS;
+    bs.table_count = FAT32_FORMAT_TABLE_COUNT;
+    bs.media_type = 0xF8;
+    bs.total_sectors_32 = total_sectors;
+    bs.table_sector_size_32 = fat_sectors;
+    bs.root_cluster = 2;
+    bs.fs_info_sector = 1;
+    bs.backup_BS_sector = 6;
+    bs.drive_number = 0x80;
+    bs.boot_signature = 0x29;
+    uint16_t date, time;
+    fat32_set_timestamp(&date, &time);
+    bs.volume_id = ((uint32_t) date << 16) | time;
+    memset(bs.volume_label, ' ', sizeof(bs.volume_label));
+    for(uint i=0; i<sizeof(bs.volume_label) && label[i] != 0; i++) {
+        bs.volume_label[i] = label[i];
+    }
+    memmove(bs.fat_type_label, "FAT32   ", sizeof(bs.fat_type_label));
+    bs.mbr_signature = 0xAA55;
+
+    fat32_fsinfo fsinfo = {0};
+    fsinfo.lead_signature = 0x41615252;
+    fsinfo.structure_signature = 0x61417272;
+    fsinfo.free_cluster_count = n_cluster - 1; // the root directory takes one
+    fsinfo.next_free_cluster = 3;
+    fsinfo.trailing_signature = 0xAA550000;
+
+    // Boot sector, FSInfo, and their backups
+    int res = fat32_write_zero_padded(storage, 0, 1, &bs, sizeof(bs));
+    if(res == 0) res = fat32_write_zero_padded(storage, bs.fs_info_sector, 1, &fsinfo, sizeof(fsinfo));
+    if(res == 0) res = fat32_write_zero_padded(storage, bs.backup_BS_sector, 1, &bs, sizeof(bs));
+    if(res == 0) res = fat32_write_zero_padded(storage, bs.backup_BS_sector + bs.fs_info_sector, 1, &fsinfo, sizeof(fsinfo));
+    if(res < 0) {
+        return res;
+    }
+
+    uint32_t fat_bytes = fat_sectors * bytes_per_sector;
+    uint32_t* fat = malloc(fat_bytes);
+    memset(fat, 0, fat_bytes);
+    fat[0] = 0x0FFFFF00 | bs.media_type;
+    fat[1] = 0x0FFFFFFF;
+    fat[bs.root_cluster] = FAT_CLUSTER_EOC & 0x0FFFFFFF;
+    // the entries past the last cluster only pad the last sector of the table,
+    // mark them bad so that they never get allocated
+    for(uint32_t i = n_cluster + 2; i < fat_bytes / sizeof(uint32_t); i++) {
+        fat[i] = 0x0FFFFFF7;
+    }
+    for(uint32_t i=0; i<bs.table_count && res == 0; i++) {
+        res = fat32_write_zero_padded(storage, bs.reserved_sector_count + i*fat_sectors, fat_sectors, fat, fat_bytes);
+    }
+    free(fat);
+    if(res < 0) {
+        return res;
+    }
+
+    // Empty root directory
+    uint32_t root_lba = bs.reserved_sector_count + bs.table_count*fat_sectors + (bs.root_cluster - 2)*bs.sectors_per_cluster;
+    return fat32_write_zero_padded(storage, root_lba, bs.sectors_per_cluster, NULL, 0);
+}
+
 static int fat32_unmount(fs_mount_point* mount_point)
 {
     free(mount_point->fs_meta);
@@ -0,0 +1,93 @@
+#include <kernel/futex.h>
+#include <kernel/process.h>
+#include <kernel/paging.h>
+#include <kernel/lock.h>
+#include <kernel/errno.h>
+#include <stddef.h>
+
+// Fast user space mutex: user space only enters the kernel on contention
+// Waiters are keyed by (page dir, user address), so the threads of a process
+// sharing a page dir meet on the same queue
+// Ref: https://man7.org/linux/man-pages/man2/futex.2.html
+
+typedef struct futex_waiter {
+    pde* page_dir;
+    uint32_t* uaddr;
+    volatile uint woken;
+    struct futex_waiter* next;
+} futex_waiter;
+
+static struct {
+    spinlock lk;
+    futex_waiter* buckets[FUTEX_HASH_SIZE];
+} futex;
+
+static futex_waiter** bucket_of(uint32_t* uaddr)
+{
+    return &futex.buckets[((uint32_t) uaddr >> 2) % FUTEX_HASH_SIZE];
+}
+
+static bool valid_uaddr(pde* page_dir, uint32_t* uaddr, bool is_writing)
+{
+    if((uint32_t) uaddr % sizeof(uint32_t) != 0) return false;
+    if((uint32_t) uaddr >= (uint32_t) MAP_MEM_PA_ZERO_TO) return false;
+    return is_vaddr_accessible(page_dir, (uint32_t) uaddr, false, is_writing);
+}
+
+int futex_wait(uint32_t* uaddr, uint32_t val)
+{
+    proc* p = curr_proc();
+    if(!valid_uaddr(p->page_dir, uaddr, false)) {
+        return -EFAULT;
+    }
+
+    spin_lock(&futex.lk);
+    // A waker changes *uaddr before futex_wake(), which has to take the lock,
+    // so the wake up can't be missed between the check and sleep()
+    if(*uaddr != val) {
+        spin_unlock(&futex.lk);
+        return -EAGAIN;
+    }
+    futex_waiter w = {.page_dir = p->page_dir, .uaddr = uaddr, .woken = 0, .next = NULL};
+    futex_waiter** pp = bucket_of(uaddr);
+    while(*pp != NULL) {
+        pp = &(*pp)->next;
+    }
+    *pp = &w;
+
+    while(!w.woken && !p->killed) {
+        sleep(&w, &futex.lk);
+    }
+    if(!w.woken) {
+        // killed, dequeue ourselves
+        for(pp = bucket_of(uaddr); *pp != NULL; pp = &(*pp)->next) {
+            if(*pp == &w) {
+                *pp = w.next;
+                break;
+            }
+        }
+    }
+    spin_unlock(&futex.lk);
+    return w.woken ? 0 : -EINTR;
+}
+
+int futex_wake(uint32_t* uaddr, uint n)
+{
+    proc* p = curr_proc();
+    int woken = 0;
+    spin_lock(&futex.lk);
+    futex_waiter** pp = bucket_of(uaddr);
+    while(*pp != NULL && (uint) woken < n) {
+        futex_waiter* w = *pp;
+        if(w->page_dir == p->page_dir && w->uaddr == uaddr) {
+            *pp = w->next;
+            w->woken = 1;
+            wakeup(w);
+            woken++;
+        } else {
+            pp = &w->next;
+        }
+    }
+    spin_unlock(&futex.lk);
+    return woken;
+}
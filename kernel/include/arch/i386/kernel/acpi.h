@@ -0,0 +1,50 @@
+#ifndef _ARCH_I386_KERNEL_ACPI_H
+#define _ARCH_I386_KERNEL_ACPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <common.h>
+
+// ACPI tables needed for multiprocessor and interrupt routing
+// Ref: ACPI Specification 6.4, Section 5.2
+// Ref: https://wiki.osdev.org/MADT
+
+#define ACPI_MAX_CPU 32
+#define ACPI_MAX_IOAPIC 4
+#define ACPI_MAX_IRQ_OVERRIDE 16
+
+typedef struct acpi_ioapic {
+    uint8_t id;
+    uint32_t paddr;
+    uint32_t gsi_base;      // first global system interrupt handled
+} acpi_ioapic;
+
+// ISA IRQ routed to a different global system interrupt
+typedef struct acpi_irq_override {
+    uint8_t irq;
+    uint32_t gsi;
+    uint16_t flags;         // MPS INTI flags (polarity and trigger mode)
+} acpi_irq_override;
+
+// Interrupt controllers described by the MADT
+typedef struct acpi_madt_info {
+    uint32_t lapic_paddr;
+    uint n_cpu;
+    uint8_t cpu_apic_ids[ACPI_MAX_CPU];
+    uint n_ioapic;
+    acpi_ioapic ioapics[ACPI_MAX_IOAPIC];
+    uint n_irq_override;
+    acpi_irq_override irq_overrides[ACPI_MAX_IRQ_OVERRIDE];
+    bool has_8259;          // PC-AT compatible dual 8259 PIC installed
+} acpi_madt_info;
+
+// MPS INTI flags
+#define ACPI_INTI_POLARITY_MASK 0x3
+#define ACPI_INTI_POLARITY_LOW 0x3
+#define ACPI_INTI_TRIGGER_MASK 0xC
+#define ACPI_INTI_TRIGGER_LEVEL 0xC
+
+int init_acpi();
+const acpi_madt_info* acpi_madt();
+
+#endif
@@ -4,6 +4,9 @@
 #include <kernel/process.h>
 #include <arch/i386/kernel/segmentation.h>
 
+// maximum number of CPUs supported
+#define MAX_CPU 8
+
 // Source: xv6/proc.c
 
 // Per-CPU state
@@ -14,10 +17,41 @@ typedef struct cpu {
   int cli_count;                        // Depth of pushcli nesting.
   int orig_if_flag;                     // Were interrupts enabled before pushcli?
   proc* current_process;                // The process running on this cpu or null
+  int has_sysenter;                     // SYSENTER/SYSEXIT supported
+  uint id;                              // Index into cpus[]
+  uint apic_id;                         // Local APIC ID
+  volatile uint started;                // Has entered the scheduler
+  volatile uint idle;                   // Halting in scheduler waiting for work
+  uint tlb_generation;                  // Last kernel TLB generation flushed by this CPU
+  proc* runq_head;                      // Run queue of RUNNABLE processes, guarded by the process table lock
+  proc* runq_tail;
+  uint runq_len;
+  volatile uint softirq_pending;        // Bitmap of raised softirqs
+  uint in_softirq;                      // Running softirqs on interrupt exit
+  volatile uint softirq_deferred;       // Pending softirqs are left to ksoftirqd
+  proc* fpu_owner;                      // Last process that loaded its FPU state into this CPU
+  uint preempt_count;                   // Locks held by the running process, preemptible if zero
+  volatile uint need_resched;           // The running process shall be switched out once preemptible
+  uint64_t resched_tsc;                 // When need_resched was set
+  uint64_t preempt_off_tsc;             // When preempt_count last left zero
 } cpu;
 
+extern cpu cpus[MAX_CPU];
+extern uint n_cpu;
+
+// Model specific registers
+// Ref: Intel SDM Vol. 4, Table 2-2
+#define MSR_IA32_SYSENTER_CS 0x174
+#define MSR_IA32_SYSENTER_ESP 0x175
+#define MSR_IA32_SYSENTER_EIP 0x176
+
 cpu* curr_cpu();
 uint read_cpu_eflags();
 uint64_t rdtsc();
+uint64_t rdmsr(uint32_t msr);
+void wrmsr(uint32_t msr, uint64_t value);
+int cpu_has_sysenter();
+void init_ap_cpu();
+void register_cpu(uint apic_id);
 
 #endif
\ No newline at end of file
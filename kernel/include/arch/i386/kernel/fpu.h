@@ -0,0 +1,22 @@
+#ifndef _ARCH_I386_KERNEL_FPU_H
+#define _ARCH_I386_KERNEL_FPU_H
+
+#include <kernel/process.h>
+#include <arch/i386/kernel/cpu.h>
+
+// x87/MMX/SSE state, switched lazily between processes
+// A process gets its state loaded only at its first FPU/SSE instruction after
+// being switched in, which traps with #NM since CR0.TS is set
+// Ref: Intel SDM Vol. 3A, 13.4 Designing OS Facilities for Saving x87 FPU, SSE and Extended States
+// Ref: https://wiki.osdev.org/SSE
+
+#define INT_DEVICE_NOT_AVAILABLE 7
+
+void init_fpu(cpu* c);
+void fpu_switch_in(cpu* c, proc* p);
+void fpu_switch_out(cpu* c, proc* p);
+void fpu_handle_nm();
+void fpu_fork(proc* from, proc* to);
+void fpu_reset(proc* p);
+
+#endif
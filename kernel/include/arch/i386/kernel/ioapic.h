@@ -0,0 +1,15 @@
+#ifndef _ARCH_I386_KERNEL_IOAPIC_H
+#define _ARCH_I386_KERNEL_IOAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <arch/i386/kernel/acpi.h>
+
+// I/O APIC, routes external interrupts (global system interrupts) to local APICs
+// Ref: Intel 82093AA I/O Advanced Programmable Interrupt Controller datasheet
+// Ref: https://wiki.osdev.org/IOAPIC
+
+int init_ioapic(const acpi_madt_info* madt);
+int ioapic_route(uint32_t gsi, uint8_t vector, uint8_t apic_id, bool level_triggered, bool active_low, bool masked);
+
+#endif
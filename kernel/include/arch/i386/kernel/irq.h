@@ -0,0 +1,26 @@
+#ifndef _ARCH_I386_KERNEL_IRQ_H
+#define _ARCH_I386_KERNEL_IRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <common.h>
+
+// Legacy (ISA/PCI INTx) IRQ lines, delivered as interrupt IRQ_TO_INTERRUPT(irq)
+// either by the 8259 PIC or by the IOAPIC when ACPI describes one
+#define N_IRQ 16
+
+// Vectors handed out to message signaled interrupts (MSI), delivered by the local APIC
+// must be in sync with interrupt.asm
+#define MSI_VECTOR_BASE 66
+#define N_MSI_VECTOR 8
+
+void init_irq();
+bool irq_uses_apic();
+void irq_enable(uint8_t irq);
+void irq_enable_pci(uint8_t irq);
+void irq_disable(uint8_t irq);
+int irq_set_affinity(uint8_t irq, uint cpu_id);
+void irq_eoi(uint8_t irq);
+int alloc_msi_vector();
+
+#endif
@@ -60,6 +60,21 @@ extern void irq13();
 extern void irq14();
 extern void irq15();
 
+/* ISR for local APIC interrupts */
+extern void int_lapic_timer();
+extern void int_ipi_reschedule();
+extern void int_lapic_spurious();
+
+/* ISR for message signaled interrupts */
+extern void int_msi0();
+extern void int_msi1();
+extern void int_msi2();
+extern void int_msi3();
+extern void int_msi4();
+extern void int_msi5();
+extern void int_msi6();
+extern void int_msi7();
+
 // First 32 interrupts are occupied by CPU exceptions
 #define N_CPU_EXCEPTION_INT 32
 
@@ -0,0 +1,27 @@
+#ifndef _ARCH_I386_KERNEL_LAPIC_H
+#define _ARCH_I386_KERNEL_LAPIC_H
+
+#include <stdint.h>
+#include <common.h>
+
+// Local APIC, one per CPU
+// Ref: Intel SDM Vol. 3A, Chapter 10 Advanced Programmable Interrupt Controller
+// Ref: https://wiki.osdev.org/APIC
+
+// Interrupt vectors delivered by the local APIC
+// (vectors 32-47 stay with the legacy PIC IRQs, 88 is the syscall)
+#define LAPIC_TIMER_VECTOR 64
+#define IPI_RESCHEDULE_VECTOR 65
+#define LAPIC_SPURIOUS_VECTOR 0xFF
+
+void init_lapic(uint32_t lapic_paddr);
+void lapic_init_cpu();
+int lapic_available();
+uint lapic_id();
+void lapic_eoi();
+void lapic_send_ipi(uint apic_id, uint8_t vector);
+void lapic_start_ap(uint apic_id, uint32_t trampoline_paddr);
+void lapic_timer_start(uint32_t hz);
+void udelay(uint32_t us);
+
+#endif
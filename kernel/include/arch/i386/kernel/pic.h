@@ -30,6 +30,7 @@
 #define PIC_READ_ISR    0x0b    /* OCW3 irq service next CMD read */
 
 void PIC_remap(int offset1, int offset2);
+void PIC_disable();
 bool PIC_is_spurious_irq(unsigned char irq);
 void PIC_sendEOI(unsigned char irq);
 void IRQ_set_mask(unsigned char IRQline);
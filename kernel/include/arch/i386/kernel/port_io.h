@@ -47,6 +47,21 @@ static inline uint32_t inl(uint16_t port) {
     return ret;
 }
 
+// String I/O of count 16-bit words, REP INSW/OUTSW
+static inline void insw(uint16_t port, void* addr, uint32_t count) {
+    asm volatile ("cld; rep insw"
+        : "+D"(addr), "+c"(count)
+        : "d"(port)
+        : "memory");
+}
+
+static inline void outsw(uint16_t port, const void* addr, uint32_t count) {
+    asm volatile ("cld; rep outsw"
+        : "+S"(addr), "+c"(count)
+        : "d"(port)
+        : "memory");
+}
+
 static inline void io_wait(void) {
     /* Port 0x80 is used for 'checkpoints' during POST. */
     /* The Linux kernel seems to think it is free for use :-/ */
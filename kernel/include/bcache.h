@@ -0,0 +1,25 @@
+#ifndef _BCACHE_H
+#define _BCACHE_H
+
+#include <stdint.h>
+#include <syscall.h>
+
+// Counters of the kernel block buffer cache, in blocks
+typedef struct bcache_stat {
+    uint64_t hits;              // Read from the cache
+    uint64_t misses;            // Read from the device into the cache
+    uint64_t bypassed;          // Read or written directly, the request being too big to cache
+    uint64_t writes;            // Written into the cache, to be written back later
+    uint64_t flushed;           // Dirty blocks written back to the device
+    uint64_t flushes;           // Flush rounds, by the flusher or sync
+    uint64_t evictions;         // Blocks dropped to make room
+    uint64_t readahead;         // Read from the device before being asked for
+    uint32_t n_buf;             // Blocks currently cached
+    uint32_t n_dirty;           // Cached blocks not written back yet
+} bcache_stat;
+
+// Write all dirty blocks back to their devices
+static inline _syscall0(SYS_SYNC, int, syscall_sync)
+static inline _syscall1(SYS_BCACHE_STAT, int, syscall_bcache_stat, bcache_stat*, stat)
+
+#endif
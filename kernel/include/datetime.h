@@ -1,6 +1,10 @@
 #ifndef _DATETIME_H
 #define _DATETIME_H
 
+// Clock IDs of SYS_CLOCK_GETTIME, values match Newlib's <time.h>
+#define CLOCK_ID_REALTIME 1
+#define CLOCK_ID_MONOTONIC 4
+
 // From Linux struct_tm.h
 /* ISO C `broken-down time' structure.  */
 typedef struct date_time
@@ -0,0 +1,126 @@
+#ifndef _KERNEL_AHCI_H
+#define _KERNEL_AHCI_H
+
+#include <stdint.h>
+#include <common.h>
+
+// AHCI SATA driver
+// Ref: https://wiki.osdev.org/AHCI
+//      Serial ATA AHCI 1.3.1 Specification
+
+void init_ahci(uint8_t bus, uint8_t device, uint8_t function);
+// Register the SATA disks found by init_ahci() as block storages
+void ahci_add_block_storage();
+
+// Generic host control registers (HBA memory registers at BAR5)
+typedef volatile struct hba_port {
+    uint32_t clb;       // command list base address, 1KiB aligned
+    uint32_t clbu;
+    uint32_t fb;        // FIS base address, 256 bytes aligned
+    uint32_t fbu;
+    uint32_t is;        // interrupt status
+    uint32_t ie;        // interrupt enable
+    uint32_t cmd;       // command and status
+    uint32_t rsv0;
+    uint32_t tfd;       // task file data
+    uint32_t sig;       // signature
+    uint32_t ssts;      // SATA status (SCR0:SStatus)
+    uint32_t sctl;      // SATA control (SCR2:SControl)
+    uint32_t serr;      // SATA error (SCR1:SError)
+    uint32_t sact;      // SATA active (SCR3:SActive), NCQ commands in flight
+    uint32_t ci;        // command issue
+    uint32_t sntf;
+    uint32_t fbs;
+    uint32_t rsv1[11];
+    uint32_t vendor[4];
+} hba_port;
+
+typedef volatile struct hba_mem {
+    uint32_t cap;       // host capability
+    uint32_t ghc;       // global host control
+    uint32_t is;        // interrupt status, one bit per port
+    uint32_t pi;        // ports implemented
+    uint32_t vs;
+    uint32_t ccc_ctl;
+    uint32_t ccc_pts;
+    uint32_t em_loc;
+    uint32_t em_ctl;
+    uint32_t cap2;
+    uint32_t bohc;
+    uint8_t rsv[0xA0-0x2C];
+    uint8_t vendor[0x100-0xA0];
+    hba_port ports[32];
+} hba_mem;
+
+#define AHCI_CAP_NCS(cap) ((((cap) >> 8) & 0x1F) + 1) // number of command slots
+#define AHCI_CAP_SNCQ (1u << 30)
+#define AHCI_GHC_IE (1u << 1)
+#define AHCI_GHC_AE (1u << 31)
+
+#define AHCI_PxCMD_ST (1 << 0)
+#define AHCI_PxCMD_FRE (1 << 4)
+#define AHCI_PxCMD_FR (1 << 14)
+#define AHCI_PxCMD_CR (1 << 15)
+
+#define AHCI_PxIS_DHRS (1 << 0)     // D2H register FIS, non-queued command done
+#define AHCI_PxIS_PSS (1 << 1)      // PIO setup FIS
+#define AHCI_PxIS_SDBS (1 << 3)     // set device bits FIS, NCQ command done
+#define AHCI_PxIS_IFS (1 << 27)
+#define AHCI_PxIS_HBDS (1 << 28)
+#define AHCI_PxIS_HBFS (1 << 29)
+#define AHCI_PxIS_TFES (1 << 30)    // task file error
+#define AHCI_PxIS_ERROR (AHCI_PxIS_IFS | AHCI_PxIS_HBDS | AHCI_PxIS_HBFS | AHCI_PxIS_TFES)
+
+#define AHCI_PxTFD_BSY 0x80
+#define AHCI_PxTFD_DRQ 0x08
+#define AHCI_PxTFD_ERR 0x01
+
+#define AHCI_PxSSTS_DET_PRESENT 3   // device present and phy communication established
+#define AHCI_PxSSTS_IPM_ACTIVE 1
+#define AHCI_SIG_ATA 0x00000101
+
+// Command list entry
+typedef struct hba_cmd_header {
+    uint16_t flags;     // bit 0-4: command FIS length in dwords, bit 6: write
+    uint16_t prdtl;     // PRDT entries
+    volatile uint32_t prdbc; // bytes transferred
+    uint32_t ctba;      // command table base address, 128 bytes aligned
+    uint32_t ctbau;
+    uint32_t rsv[4];
+} __attribute__ ((packed)) hba_cmd_header;
+
+#define AHCI_CMD_HEADER_WRITE (1 << 6)
+
+// Physical Region Descriptor, the byte count shall be even
+typedef struct hba_prdt_entry {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t rsv;
+    uint32_t dbc;       // bit 0-21: byte count - 1, bit 31: interrupt on completion
+} __attribute__ ((packed)) hba_prdt_entry;
+
+// Host to device register FIS
+typedef struct fis_reg_h2d {
+    uint8_t fis_type;
+    uint8_t pmport_c;   // bit 7: command (not control)
+    uint8_t command;
+    uint8_t featurel;
+    uint8_t lba0;
+    uint8_t lba1;
+    uint8_t lba2;
+    uint8_t device;
+    uint8_t lba3;
+    uint8_t lba4;
+    uint8_t lba5;
+    uint8_t featureh;
+    uint8_t countl;
+    uint8_t counth;
+    uint8_t icc;
+    uint8_t control;
+    uint8_t rsv[4];
+} __attribute__ ((packed)) fis_reg_h2d;
+
+#define FIS_TYPE_REG_H2D 0x27
+#define FIS_H2D_COMMAND 0x80
+
+#endif
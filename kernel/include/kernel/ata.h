@@ -3,9 +3,22 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <kernel/block_io.h>
 
-void read_sectors_ATA_PIO(bool slave, void* buf, uint32_t LBA, uint32_t sector_count);
-void write_sectors_ATA_PIO(bool slave, const void* buf, uint32_t LBA, uint32_t sector_count);
-int32_t get_total_28bit_sectors(bool slave);
+// DMA if the controller and the drive support it, PIO otherwise
+// The transfer functions return 0 on success, -1 if the drive reported an error
+int read_sectors_ATA(bool slave, void* buf, uint32_t LBA, uint32_t sector_count);
+int write_sectors_ATA(bool slave, const void* buf, uint32_t LBA, uint32_t sector_count);
+// Scatter-gather variants, the segments are mapped into the PRD table
+int readv_sectors_ATA(bool slave, const blk_seg* segs, uint32_t n_seg, uint32_t LBA);
+int writev_sectors_ATA(bool slave, const blk_seg* segs, uint32_t n_seg, uint32_t LBA);
+int read_sectors_ATA_PIO(bool slave, void* buf, uint32_t LBA, uint32_t sector_count);
+int write_sectors_ATA_PIO(bool slave, const void* buf, uint32_t LBA, uint32_t sector_count);
+// Also sets up LBA48, READ/WRITE MULTIPLE and DMA for the drive
+int64_t get_total_sectors(bool slave);
+// Install the IRQ14 handler, requests then sleep until their interrupt
+void init_ata();
+// Called by PCI scan for an IDE controller
+void init_ata_dma(uint8_t bus, uint8_t device, uint8_t function);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef _KERNEL_BCACHE_H
+#define _KERNEL_BCACHE_H
+
+#include <stdint.h>
+#include <common.h>
+#include <bcache.h>
+#include <kernel/block_io.h>
+
+// Block buffer cache between the file systems and the device drivers
+// Blocks are hashed by (device, LBA) and evicted in LRU order. Writes only
+// update the cache, dirty blocks are written back by the flusher thread,
+// on sync(), or when evicted. The flusher and sequential reads submit their
+// requests to the block request queue without waiting for them.
+// Requests bigger than BCACHE_MAX_REQUEST_BLOCKS go to the device directly,
+// so that e.g. reading a whole file does not wipe out the metadata.
+
+#define BCACHE_BLOCK_SIZE 512
+// 1 MiB of cached blocks
+#define BCACHE_MAX_BUF 2048
+#define BCACHE_HASH_SIZE 512
+#define BCACHE_MAX_REQUEST_BLOCKS 8
+// Read ahead of a sequential reader
+#define BCACHE_READAHEAD_BLOCKS 16
+// The flusher wakes up this often, and writes back blocks dirty for this long
+#define BCACHE_FLUSH_INTERVAL_MS 5000
+#define BCACHE_DIRTY_EXPIRE_NS 5000000000ULL
+
+// Same contract as block_storage read_blocks/write_blocks and their variants
+int64_t bcache_read_blocks(block_storage* storage, void* buff, uint32_t LBA, uint32_t block_count);
+int64_t bcache_write_blocks(block_storage* storage, uint32_t LBA, uint32_t block_count, const void* buff);
+int64_t bcache_readv_blocks(block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA);
+int64_t bcache_writev_blocks(block_storage* storage, uint32_t LBA, const blk_seg* segs, uint32_t n_seg);
+// Write back all dirty blocks
+void bcache_sync();
+void bcache_get_stat(bcache_stat* stat);
+// Start the flusher thread
+void init_bcache();
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef _KERNEL_BLK_QUEUE_H
+#define _KERNEL_BLK_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <common.h>
+#include <kernel/block_io.h>
+
+// Per device request queue between the buffer cache and the device drivers
+// Requests are submitted without blocking and completed by a callback.
+// Pending requests are kept in LBA order and dispatched in a one way
+// elevator sweep, unless one has waited past its deadline. A request
+// adjacent on the device to a pending one is merged into it, their segments
+// are then transferred by a single driver call.
+// queue_depth dispatcher threads per device call the driver, so drivers
+// that queue commands (AHCI, virtio) get that many requests in flight.
+
+// Merged requests do not grow beyond this
+#define BLK_QUEUE_MAX_MERGE_BLOCKS 256
+#define BLK_QUEUE_MAX_MERGE_SEGS 64
+// Pending requests older than this are dispatched first
+#define BLK_QUEUE_READ_EXPIRE_NS 500000000ULL
+#define BLK_QUEUE_WRITE_EXPIRE_NS 5000000000ULL
+
+typedef struct blk_request {
+    block_storage* storage;
+    bool write;
+    uint32_t LBA;
+    uint32_t block_count;
+    // The data, in segs if not NULL, otherwise in buff
+    void* buff;
+    const blk_seg* segs;
+    uint32_t n_seg;
+    // Called once done, from a dispatcher thread, with no lock held
+    // result is the bytes transferred, <= 0 on error
+    void (*end_io)(struct blk_request* req, int64_t result);
+    void* private;
+    // Internal to the queue
+    blk_seg seg;                        // buff as a segment
+    uint32_t total_count;               // Including the merged requests
+    uint32_t total_segs;
+    uint64_t deadline_ns;
+    struct blk_request* next;           // Pending list, in LBA order
+    struct blk_request* merged_next;    // Merged into this one, done together, in LBA order
+    struct blk_request* merged_last;
+} blk_request;
+
+// Requests collected by a plug are queued together when it is finished,
+// so that the dispatchers see the whole burst sorted and merged
+typedef struct blk_plug {
+    blk_request* head;
+} blk_plug;
+
+typedef struct blk_queue blk_queue;
+
+// Queue the requests of a storage to its dev_readv_blocks/dev_writev_blocks
+// Return NULL if out of memory
+blk_queue* create_blk_queue(block_storage* storage);
+// Start the dispatcher threads, storage shall be at its final address
+void start_blk_queue(blk_queue* q, block_storage* storage);
+
+void blk_submit(blk_request* req);
+void blk_start_plug(blk_plug* plug);
+void blk_plug_add(blk_plug* plug, blk_request* req);
+void blk_finish_plug(blk_plug* plug);
+
+// Submit and wait, same contract as block_storage read_blocks/write_blocks and their variants
+// Segments in user space are transferred by the caller, as only it maps them
+int64_t blk_queue_read_blocks(block_storage* storage, void* buff, uint32_t LBA, uint32_t block_count);
+int64_t blk_queue_write_blocks(block_storage* storage, uint32_t LBA, uint32_t block_count, const void* buff);
+int64_t blk_queue_readv_blocks(block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA);
+int64_t blk_queue_writev_blocks(block_storage* storage, uint32_t LBA, const blk_seg* segs, uint32_t n_seg);
+
+#endif
@@ -2,6 +2,7 @@
 #define _KERNEL_BLOCK_IO_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <assert.h>
 
 // device_id for IDE master/slave drives
@@ -9,9 +10,19 @@
 #define IDE_SLAVE_DRIVE 2
 
 typedef enum block_storage_type {
-    BLK_STORAGE_TYP_ATA_HARD_DRIVE
+    BLK_STORAGE_TYP_ATA_HARD_DRIVE,
+    BLK_STORAGE_TYP_AHCI_SATA,
+    BLK_STORAGE_TYP_VIRTIO_BLK,
+    BLK_STORAGE_TYP_RAM_DISK
 } block_storage_type;
 
+// A piece of a scatter-gather transfer, its length is a multiple of the block size
+// DMA capable drivers need it 2 bytes aligned, or fall back to PIO or fail
+typedef struct blk_seg {
+    void* buff;
+    uint32_t len;
+} blk_seg;
+
 typedef struct block_storage {
     uint32_t device_id; //id == 0 means unused slot
     block_storage_type type;
@@ -19,10 +30,53 @@ typedef struct block_storage {
     uint32_t block_count; // total number of blocks
     int64_t (*read_blocks)(struct block_storage* storage, void* buff, uint32_t LBA, uint32_t block_count); // return bytes read, 0 means error
     int64_t (*write_blocks)(struct block_storage* storage, uint32_t LBA, uint32_t block_count, const void* buff); // return bytes written,  0 means error
+    // Scatter-gather variants, the blocks from LBA on fill or come from the segments in order
+    int64_t (*readv_blocks)(struct block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA);
+    int64_t (*writev_blocks)(struct block_storage* storage, uint32_t LBA, const blk_seg* segs, uint32_t n_seg);
+    // Driver entries, the ones above go through the buffer cache and the request queue to these
+    int64_t (*dev_readv_blocks)(struct block_storage* storage, const blk_seg* segs, uint32_t n_seg, uint32_t LBA);
+    int64_t (*dev_writev_blocks)(struct block_storage* storage, uint32_t LBA, const blk_seg* segs, uint32_t n_seg);
+    struct blk_queue* queue;
+    uint32_t queue_depth; // requests the driver takes at once, 0 means 1
+    bool direct; // no buffer cache nor queue, the driver sets read_blocks and the others itself (e.g. RAM disk)
     void* internal_info; // internal data structure for the specfic storage type
 } block_storage;
 
 block_storage* get_block_storage(uint32_t device_id);
+// The first storage of the type, NULL if none
+block_storage* get_block_storage_by_type(block_storage_type type);
+// Register a storage found by a driver, device_id is assigned in order
+void add_block_storage(block_storage* storage);
+// Same, but return -1 instead of panicking when all slots are taken or out of memory
+int try_add_block_storage(block_storage* storage);
+// Unregister a direct storage, its device_id is not reused
+void remove_block_storage(block_storage* storage);
+
+// Walks a segment list for a driver, a block never spans two segments
+typedef struct blk_seg_iter {
+    const blk_seg* segs;
+    uint32_t n_seg;
+    uint32_t idx;       // Current segment
+    uint32_t off;       // Bytes of it walked
+} blk_seg_iter;
+
+// Physically contiguous piece of a segment, not crossing a page
+typedef struct blk_frag {
+    uint32_t paddr;
+    uint32_t len;
+} blk_frag;
+
+uint32_t blk_seg_bytes(const blk_seg* segs, uint32_t n_seg);
+// Copy between a buffer and the bytes of the segments from offset on
+void blk_seg_copy_from(const blk_seg* segs, uint32_t n_seg, uint32_t offset, void* dst, uint32_t len);
+void blk_seg_copy_to(const blk_seg* segs, uint32_t n_seg, uint32_t offset, const void* src, uint32_t len);
+void blk_seg_iter_init(blk_seg_iter* it, const blk_seg* segs, uint32_t n_seg);
+// The next blocks, at most max_blocks, contiguous in virtual memory at *vaddr, for PIO
+// Return the number of blocks, 0 at the end
+uint32_t blk_seg_iter_run(blk_seg_iter* it, uint32_t block_size, uint32_t max_blocks, void** vaddr);
+// The next blocks, at most max_blocks, as at most max_frag fragments of the current page directory, for DMA
+// max_frag shall be at least 2, return the number of blocks, 0 at the end
+uint32_t blk_seg_iter_map(blk_seg_iter* it, uint32_t block_size, uint32_t max_blocks, blk_frag* frags, uint32_t max_frag, uint32_t* n_frag);
 
 // Shall use the this signature when implementing in kernel
 void initialize_block_storage();
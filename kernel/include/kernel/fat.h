@@ -181,6 +181,19 @@ typedef struct fat_mount_option {
 
 int fat32_init(struct file_system* fs);
 
+// Layout written by fat32_format
+#define FAT32_FORMAT_RESERVED_SECTORS 32
+#define FAT32_FORMAT_TABLE_COUNT 2
+#define FAT32_FORMAT_SECTORS_PER_CLUSTER 1
+#define FAT32_FORMAT_MIN_CLUSTERS 16
+
+// Make an empty FAT32 file system, unpartitioned, over the whole storage
+// Volumes smaller than about 32MiB get fewer than the 65525 clusters FAT32 requires,
+// other implementations take them for FAT12/16. simple-os mounts them as FAT32 all the same,
+// which is enough for the RAM disk at /tmp, never seen by another system
+// Return 0 on success, -errno otherwise
+int fat32_format(block_storage* storage, const char* label);
+
 // Used by make_fs
 void fat32_set_timestamp(uint16_t* date_entry, uint16_t* time_entry);
 
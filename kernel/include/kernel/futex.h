@@ -0,0 +1,16 @@
+#ifndef _KERNEL_FUTEX_H
+#define _KERNEL_FUTEX_H
+
+#include <stdint.h>
+#include <common.h>
+
+// Number of wait queue buckets, keyed by user address
+#define FUTEX_HASH_SIZE 64
+
+// Sleep until woken if *uaddr still equals val, return -EAGAIN if not
+// uaddr is a user space address of the calling process
+int futex_wait(uint32_t* uaddr, uint32_t val);
+// Wake up at most n waiters of uaddr, return the number woken
+int futex_wake(uint32_t* uaddr, uint n);
+
+#endif
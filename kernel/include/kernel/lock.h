@@ -4,35 +4,70 @@
 #include <stdint.h>
 #include <common.h>
 
+struct cpu;
+
+// Busy waiting lock built on atomic xchg, interrupts are disabled while holding
+// Never yields while waiting, so it is safe to use inside the scheduler itself
+// Keep the critical region short and never yield while holding it
+typedef struct spinlock {
+    volatile uint locked;
+    struct cpu* cpu;        // holding CPU
+} spinlock;
+
 // Disabling interrupt when locked, strictest
-// When the lock is holding by other process, yield
+// When the lock is holding by other process, spin for a while then yield,
+//   since the holder may have yielded (e.g. waiting for disk) on this very CPU
 // When the lock is holding by the same process, panic
-// Under single-CPU setting, if no manual yielding in critical region,
-//   it is suffice to protect only the write operation
 typedef struct yield_lock {
-    uint locked;
+    volatile uint locked;
     int holding_pid;
 } yield_lock;
 
-// Does NOT disable interrupt when locked
-// Use this ONLY if the resoure will NOT be used in any interrupt handler
-// otherwise a deallock can happen, since the lock rely on yield() to wait
-// the writer to release the lock, but we cannot yield to the same process
-// from the interrupt handler
+// Serve all queued writers before letting waiting readers in
+#define RW_LOCK_PREFER_WRITER 1
+
+// Run-time counters of a rw_lock
+typedef struct rw_lock_stat {
+    uint64_t n_read;                // Times acquired for reading
+    uint64_t n_write;               // Times acquired for writing
+    uint64_t n_read_wait;           // Times a reader had to wait
+    uint64_t n_write_wait;          // Times a writer had to wait
+    uint64_t read_wait_cycles;      // TSC cycles spent waiting by readers
+    uint64_t write_wait_cycles;     // TSC cycles spent waiting by writers
+} rw_lock_stat;
+
+// Does NOT disable interrupt when locked, holders may yield (e.g. waiting for disk)
+// Use this ONLY if the resoure will NOT be used in any interrupt handler,
+// since waiters sleep until the holder wakes them up
+// Writers are served in FIFO order by tickets. New readers queue behind waiting writers,
+// and when a writer finishes, all readers waiting by then are let in together before
+// the next writer, so neither side starves (phase-fair)
+// A zeroed rw_lock is a valid unlocked phase-fair lock
 typedef struct rw_lock {
-    yield_lock lk;
-    int writing_pid;
-    uint reading;
+    spinlock lk;                    // Guards the fields below
+    uint flags;
+    int writing_pid;                // Active writer
+    uint reading;                   // Active readers, including the writer reading its own data
+    uint write_next;                // Next writer ticket to hand out
+    uint write_serving;             // Ticket of the active or next writer
+    uint waiting_readers;
+    uint read_batch;                // Bumped when the waiting readers are let in
+    rw_lock_stat stat;
 } rw_lock;
 
+void spin_lock(spinlock* lk);
+void spin_unlock(spinlock* lk);
+uint spin_holding(spinlock* lk);
 
 void acquire(yield_lock* lk);
 void release(yield_lock* lk);
 uint holding(yield_lock* lk);
 
+void init_rw_lock(rw_lock* lk, uint flags);
+void rw_lock_get_stat(rw_lock* lk, rw_lock_stat* stat);
 void start_writing(rw_lock* lk);
 void finish_writing(rw_lock* lk);
 void start_reading(rw_lock* lk);
 void finish_reading(rw_lock* lk);
 
-#endif
\ No newline at end of file
+#endif
@@ -18,11 +18,14 @@
 #define ARRAY_INDEX_FROM_FRAME_INDEX(a) ((a) / (8 * 4))
 // Get the 0-based offset into the uint32_t
 #define BIT_OFFSET_FROM_FRAME_INDEX(a) ((a) % (8 * 4))
+// Physical memory below this address is never handed out by the frame allocator
+#define LOW_MEMORY_END 0x100000
 
 void clear_frame(uint32_t frame_idx);
 uint32_t test_frame(uint32_t frame_idx);
 uint32_t first_free_frame();
 uint32_t n_free_frames(uint n);
+uint32_t count_free_frames();
 void initialize_bitmap(uint32_t mbt_physical_addr);
 
 #endif
\ No newline at end of file
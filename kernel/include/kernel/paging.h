@@ -34,6 +34,7 @@ uint32_t alloc_pages_at(pde* page_dir, uint32_t page_index, size_t page_count, b
 void dealloc_pages(pde* page_dir, uint32_t page_index, size_t page_count);
 
 uint map_pages_at(pde* page_dir, uint page_index, uint page_count, uint32_t* frames,  bool is_kernel, bool is_writeable, bool consecutive_frame);
+uint map_shared_pages_at(pde* page_dir, uint page_index, uint page_count, uint32_t* frames, bool is_writeable);
 uint32_t link_pages(pde* pd_source, uint32_t vaddr, uint32_t size, pde* pd_target, bool allow_alloc_source, bool alloc_source_rw, bool target_rw);
 void unmap_pages(pde* page_dir, uint32_t vaddr, uint32_t size);
 
@@ -42,6 +43,9 @@ uint32_t vaddr2paddr(pde* page_dir, uint32_t vaddr);
 
 void switch_page_directory(uint32_t physical_addr);
 void set_tss(uint32_t kernel_stack_esp);
+void init_gdt();
+void sync_kernel_tlb();
+uint32_t map_physical_memory(uint32_t paddr, uint32_t size, bool is_writeable);
 
 void copy_kernel_space_mapping(pde* page_dir);
 pde* copy_user_space(pde* page_dir);
@@ -0,0 +1,34 @@
+#ifndef _KERNEL_PREEMPT_H
+#define _KERNEL_PREEMPT_H
+
+#include <stdint.h>
+#include <common.h>
+#include <preempt.h>
+
+struct cpu;
+
+// Kernel preemption
+// Every lock held by the running process counts in the preempt_count of its CPU,
+// and the process is only switched out involuntarily while the count is zero.
+// A timer tick marks the CPU as needing a reschedule, which takes effect on the
+// next interrupt return or lock release bringing the count to zero with interrupts enabled.
+// The count travels with the process across voluntary yields,
+// e.g. a yield_lock holder waiting for the disk.
+//
+// The worst-case scheduling latency is then the longest stretch with preemption
+// disabled, which is measured per CPU along with the actual latencies.
+
+void preempt_disable();
+void preempt_enable();
+// Same as preempt_enable(), but blame ip for the time preemption was disabled
+void preempt_enable_ip(void* ip);
+uint preempt_count();
+// Ask for the current process to be switched out as soon as it is preemptible
+void resched_curr();
+// Called by the interrupt dispatcher with interrupts disabled, before returning
+void preempt_irq_exit();
+// Called by the scheduler once a process has left the CPU
+void preempt_sched_out(struct cpu* c);
+void preempt_get_stat(uint cpu_id, preempt_stat* stat);
+
+#endif
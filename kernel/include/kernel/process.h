@@ -3,14 +3,27 @@
 
 #include <kernel/paging.h>
 #include <arch/i386/kernel/isr.h>
+#include <procspawn.h>
+#include <kernel/lock.h>
 
-// maximum number of processes
-#define N_PROCESS        64  
+// proc structs allocated at a time when the process cache runs dry
+#define PROC_SLAB_SIZE 16
+// pid = generation << PID_GENERATION_SHIFT | slot, slot 0 is never used
+#define PID_GENERATION_SHIFT 16
+#define PID_MAX_SLOT ((1 << PID_GENERATION_SHIFT) - 1)
+#define PID_MAX_GENERATION 0x7FFF
 // number of pages allocating to each process's kernel stack
 // 256 page = 1Mib
 #define N_KERNEL_STACK_PAGE_SIZE 256
+// handles of a process are allocated in chunks on demand,
+// each chunk has one bitmap word, each bit tells if the handle is in use
+#define HANDLE_CHUNK_SIZE 32
+#define MAX_HANDLE_CHUNK 32
 // maximum number of opened hanldes for one process
-#define MAX_HANDLE_PER_PROCESS 16
+#define MAX_HANDLE_PER_PROCESS (HANDLE_CHUNK_SIZE*MAX_HANDLE_CHUNK)
+
+// size of the FXSAVE area
+#define FPU_STATE_SIZE 512
 
 // max number of command line arguments plus environment variables
 #define MAX_ARGC 20
@@ -22,6 +35,8 @@
 struct context;
 // trapframe shall be provided by ISR
 struct trapframe;
+struct spinlock;
+struct cpu;
 
 // Source: xv6/proc.h
 
@@ -38,6 +53,11 @@ struct handle_map {
     int grd; // global resource descriptor (unique among each source type)
 };
 
+struct handle_chunk {
+    uint32_t used; // bit i set if map[i] is in use
+    struct handle_map map[HANDLE_CHUNK_SIZE];
+};
+
 // Per-process state
 typedef struct proc {
   int32_t pid;                        // Process ID
@@ -51,25 +71,59 @@ typedef struct proc {
   uint32_t size;                      // process size, a pointer to the end of the process memory
   uint32_t orig_size;                 // original size, size shall not shrink below this
   int32_t exit_code;                  // exit code for zombie process
-  struct handle_map handles[MAX_HANDLE_PER_PROCESS];             // Opened handles for any system resources, e.g. files
+  struct handle_chunk* handles[MAX_HANDLE_CHUNK]; // Opened handles for any system resources, e.g. files
+  uint32_t full_handle_chunks;        // bit i set if handles[i] is allocated and full
   char* cwd;                          // Current working directory
   uint no_schedule;                   // if non zero, will not be scheduled to other process
+  struct vdso_proc* vdso;             // Kernel side address of the per-process vDSO page
+  struct proc* runq_next;             // Next process in the run queue of a CPU
+  void* chan;                         // If non-zero, sleeping on chan
+  uint is_kernel_thread;              // Runs in kernel space only, no user space program
+  void (*kthread_entry)(void*);       // Entry function of the kernel thread
+  void* kthread_arg;                  // Argument of kthread_entry
+  struct proc* leader;                // Thread group leader owning the shared user space, handles and cwd, NULL for the leader itself
+  uint n_threads;                     // Leader only: threads of the group not exited yet, including the leader
+  uint n_unreaped_threads;            // Leader only: threads other than the leader not reaped yet
+  uint32_t* clear_tid;                // User address zeroed and futex woken when the thread exits
+  uint killed;                        // If non-zero, exit when returning to user space
+  yield_lock group_lk;                // Leader only: guards handles and size shared by the thread group
+  uint slot;                          // Fixed for the lifetime of this struct, low bits of the pid
+  uint generation;                    // Bumped each time this struct is freed, high bits of the pid
+  struct proc* all_next;              // All processes in use, or the free proc cache
+  struct proc* all_prev;
+  uint fpu_used;                      // Has executed any FPU/SSE instruction, fpu_state is valid
+  struct cpu* fpu_cpu;                // CPU the FPU state was last loaded into
+  uint8_t fpu_state[FPU_STATE_SIZE + 16]; // FXSAVE area, aligned to 16 bytes inside
 } proc;
 
+// The process (thread group leader) owning the resources shared by thread p
+static inline proc* proc_leader(proc* p)
+{
+    return p->leader ? p->leader : p;
+}
+
 proc* create_process();
 void init_first_process();
 void scheduler();
+void make_runnable(proc* p);
+proc* create_kernel_thread(void (*entry)(void*), void* arg);
+void sleep(void* chan, struct spinlock* lk);
+void wakeup(void* chan);
 proc* curr_proc();
 // void process_IRQ(uint no_schedule);
 void yield();
 int fork();
+int clone(uint32_t entry, uint32_t stack, uint32_t* tid);
 void exit(int exit_code);
+void thread_exit();
+void exit_if_killed();
 int wait(int* wait_status);
 void switch_process_memory_mapping(proc* p);
 char* get_abs_path(const char* path);
 int chdir(const char* path);
 int getcwd(char* buf, size_t buf_size);
 int exec(const char* path, char* const* argv, char* const* envp);
+int spawn(const char* path, char* const * argv, char* const* envp, const struct spawn_file_action* actions, uint n_actions);
 
 // Manage per-process handles
 int alloc_handle(struct handle_map* pmap);
@@ -0,0 +1,41 @@
+#ifndef _KERNEL_RAMDISK_H
+#define _KERNEL_RAMDISK_H
+
+#include <stdint.h>
+#include <kernel/block_io.h>
+
+// Block storage backed by kernel memory, like Linux brd
+// Reads and writes are plain copies, so the storage is direct: neither the
+// buffer cache nor the request queue sit in front of it. Its content is lost
+// at reboot, it suits scratch volumes such as /tmp, and measuring the cost of
+// a file system apart from the disk.
+
+#define RAM_DISK_BLOCK_SIZE 512
+// Size of the one mounted at /tmp at boot
+#define RAM_DISK_DEFAULT_SIZE (4*1024*1024)
+#define RAM_DISK_MAX_SIZE (32*1024*1024)
+// All RAM disks made by ramdisk_create() together
+#define RAM_DISK_MAX_TOTAL_SIZE (64*1024*1024)
+// Memory left free for everything else when making one
+#define RAM_DISK_MIN_FREE_MEMORY (16*1024*1024)
+
+// Register a zero filled RAM disk of size bytes, rounded up to pages, into *storage
+// Return 0, -EINVAL if the size is out of range, -ENOMEM if memory is short,
+// -ENOSPC if the size limits or the storage slots are exhausted
+int ramdisk_create(uint32_t size, block_storage** storage);
+// Unregister a RAM disk made by ramdisk_create() and free its memory
+void ramdisk_destroy(block_storage* storage);
+
+// Command line of the boot module holding the initial ramdisk
+// must be in sync with the bootloader, see INITRD_MODULE_CMDLINE there
+#define INITRD_MODULE_CMDLINE "INITRD"
+// Where it is mounted, it holds the programs of this directory
+#define INITRD_MOUNT_TARGET "/usr/bin"
+
+// Remember where the bootloader put the initial ramdisk, if it did
+void find_initrd(uint32_t mbt_physical_addr);
+// The initial ramdisk as a read-only RAM disk, registered on the first call
+// NULL if the bootloader did not load one
+block_storage* ramdisk_initrd();
+
+#endif
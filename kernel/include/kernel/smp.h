@@ -0,0 +1,7 @@
+#ifndef _KERNEL_SMP_H
+#define _KERNEL_SMP_H
+
+// Symmetric multiprocessing: discover and start all CPUs
+void init_smp();
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _KERNEL_SOFTIRQ_H
+#define _KERNEL_SOFTIRQ_H
+
+#include <stdint.h>
+#include <common.h>
+#include <softirq.h>
+
+// Bottom halves of interrupt handling
+// A top half (the interrupt handler) acknowledges its device and raises a softirq,
+// which then runs with interrupts enabled when the outermost interrupt returns
+// If softirqs keep coming, the rest is left to the ksoftirqd kernel thread
+//
+// Softirq handlers must not sleep or wait on a yield_lock holder of the same CPU,
+// yield() is a no-op within them. The same softirq may run on several CPUs at once.
+
+// Stop running softirqs on interrupt exit after this many rounds or this long
+#define SOFTIRQ_MAX_RESTART 10
+#define SOFTIRQ_BUDGET_NS 2000000ULL
+
+typedef void (*softirq_handler)();
+
+void init_softirq();
+void open_softirq(enum softirq_nr nr, softirq_handler handler);
+// Mark the softirq pending on the calling CPU, usually from a top half
+void raise_softirq(enum softirq_nr nr);
+// Called by the interrupt dispatcher with interrupts disabled, before returning
+void softirq_irq_exit();
+uint in_softirq();
+void softirq_get_stat(enum softirq_nr nr, softirq_stat* stat);
+
+#endif
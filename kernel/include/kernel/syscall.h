@@ -3,13 +3,21 @@
 
 // Syscall int number
 #define INT_SYSCALL 88
+// trapno of trapframes built by the SYSENTER entry, not a real interrupt vector
+#define TRAPNO_SYSENTER 256
 
 // defined in interrupt.asm
 extern void int88();
 
+// defined in sysenter.asm
+extern void sysenter_entry();
+extern char vsyscall_begin[], vsyscall_end[], vsyscall_ret[];
+extern char vsyscall_int88_begin[], vsyscall_int88_end[];
+
 // arch specific, defined in isr.h
 struct trapframe;
 
+void init_sysenter();
 void syscall_handler(struct trapframe* r);
 
-#endif
\ No newline at end of file
+#endif
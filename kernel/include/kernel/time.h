@@ -8,5 +8,11 @@
 date_time current_datetime();
 time_t datetime2epoch(date_time* tim_p);
 int64_t cpu_freq();
+struct vdso_clock;
+
+void init_clocksource();
+void clocksource_snapshot(struct vdso_clock* vc);
+uint64_t clock_gettime_ns(int clk_id);
+time_t current_epoch();
 
 #endif
\ No newline at end of file
@@ -4,5 +4,6 @@
 #include <stdint.h>
 
 void init_timer(uint32_t freq, uint32_t tick_between_process_switch);
+void start_cpu_timer();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,11 @@
+#ifndef _KERNEL_VDSO_H
+#define _KERNEL_VDSO_H
+
+#include <kernel/process.h>
+
+void init_vdso();
+void vdso_update_clock();
+void vdso_map(proc* p, pde* page_dir);
+void vdso_release(proc* p);
+
+#endif
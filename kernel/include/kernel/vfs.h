@@ -9,12 +9,17 @@
 // maximum number of mount points
 #define N_MOUNT_POINT 16
 
+// opened files are allocated in chunks on demand
+#define FILE_CHUNK_SIZE 64
+#define MAX_FILE_CHUNK 64
 // maximum number of files opened
-#define N_FILE_STRUCTURE 64
+#define N_FILE_STRUCTURE (FILE_CHUNK_SIZE*MAX_FILE_CHUNK)
 
 int fs_mount(const char* target, enum file_system_type file_system_type, 
             fs_mount_option option, void* fs_option, fs_mount_point** mount_point);
 int fs_unmount(const char* mount_root);
+// Make a FAT32 formatted RAM disk of size bytes and mount it at target
+int fs_mount_ramdisk(const char* target, uint32_t size);
 int fs_getattr(const char * path, struct fs_stat * stat, int file_idx);
 int fs_mknod(const char * path, uint mode);
 int fs_mkdir(const char * path, uint mode);
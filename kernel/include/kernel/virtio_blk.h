@@ -0,0 +1,89 @@
+#ifndef _KERNEL_VIRTIO_BLK_H
+#define _KERNEL_VIRTIO_BLK_H
+
+#include <stdint.h>
+#include <common.h>
+
+// virtio-blk driver, legacy PCI transport
+// Ref: https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html
+//      https://wiki.osdev.org/Virtio
+
+#define VIRTIO_VENDOR_ID 0x1AF4
+// Transitional (legacy capable) block device
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+void init_virtio_blk(uint8_t bus, uint8_t device, uint8_t function);
+// Register the disks found by init_virtio_blk() as block storages
+void virtio_blk_add_block_storage();
+
+// Legacy register layout in the BAR0 I/O space
+#define VIRTIO_REG_DEVICE_FEATURES 0x00
+#define VIRTIO_REG_GUEST_FEATURES 0x04
+#define VIRTIO_REG_QUEUE_ADDRESS 0x08 // physical page number of the queue
+#define VIRTIO_REG_QUEUE_SIZE 0x0C
+#define VIRTIO_REG_QUEUE_SELECT 0x0E
+#define VIRTIO_REG_QUEUE_NOTIFY 0x10
+#define VIRTIO_REG_DEVICE_STATUS 0x12
+#define VIRTIO_REG_ISR_STATUS 0x13 // reading it acknowledges the interrupt
+// Device specific configuration, when MSI-X is disabled
+#define VIRTIO_REG_BLK_CAPACITY 0x14 // 64 bit, in 512 bytes sectors
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 1
+#define VIRTIO_STATUS_DRIVER 2
+#define VIRTIO_STATUS_DRIVER_OK 4
+#define VIRTIO_STATUS_FAILED 128
+
+#define VIRTIO_ISR_QUEUE 1
+
+#define VIRTIO_RING_F_INDIRECT_DESC (1u << 28)
+#define VIRTIO_RING_F_EVENT_IDX (1u << 29)
+
+// Queues of the legacy interface are aligned to 4KiB
+#define VIRTIO_QUEUE_ALIGN 4096
+
+typedef struct vring_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__ ((packed)) vring_desc;
+
+#define VRING_DESC_F_NEXT 1
+#define VRING_DESC_F_WRITE 2 // written by the device
+#define VRING_DESC_F_INDIRECT 4
+
+// Followed by uint16_t used_event if VIRTIO_RING_F_EVENT_IDX
+typedef struct vring_avail {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} __attribute__ ((packed)) vring_avail;
+
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+
+typedef struct vring_used_elem {
+    uint32_t id;
+    uint32_t len;
+} __attribute__ ((packed)) vring_used_elem;
+
+// Followed by uint16_t avail_event if VIRTIO_RING_F_EVENT_IDX
+typedef struct vring_used {
+    uint16_t flags;
+    uint16_t idx;
+    vring_used_elem ring[];
+} __attribute__ ((packed)) vring_used;
+
+#define VRING_USED_F_NO_NOTIFY 1
+
+typedef struct virtio_blk_req_hdr {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__ ((packed)) virtio_blk_req_hdr;
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+
+#define VIRTIO_BLK_S_OK 0
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef _KERNEL_WORKQUEUE_H
+#define _KERNEL_WORKQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <common.h>
+
+// Deferred work run by kernel worker threads, in a schedulable context
+// so it may block, yield or take yield_lock, unlike an interrupt handler
+// A work that is queued again while running may run on another worker
+// at the same time, the work function shall handle its own exclusion
+
+typedef struct work_struct {
+    void (*func)(void* arg);
+    void* arg;
+    struct work_struct* next;
+    volatile uint pending;      // Queued but not started yet
+} work_struct;
+
+typedef struct delayed_work {
+    work_struct work;
+    uint64_t due_ns;            // Monotonic time to queue the work
+    struct delayed_work* next;
+} delayed_work;
+
+void init_workqueue();
+void init_work(work_struct* work, void (*func)(void* arg), void* arg);
+void init_delayed_work(delayed_work* dwork, void (*func)(void* arg), void* arg);
+// Both return false if the work is already pending
+// Safe to call from interrupt handlers
+bool queue_work(work_struct* work);
+bool queue_delayed_work(delayed_work* dwork, uint32_t delay_ms);
+// Queue delayed works that are due, run as the timer softirq
+void workqueue_timer_tick();
+
+#endif
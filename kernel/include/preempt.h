@@ -0,0 +1,20 @@
+#ifndef _PREEMPT_H
+#define _PREEMPT_H
+
+#include <stdint.h>
+#include <syscall.h>
+
+// Run-time counters of kernel preemption on a CPU since boot
+typedef struct preempt_stat {
+    uint64_t n_preempt;         // Processes switched out on a reschedule request
+    uint64_t n_resched;         // Reschedule requests served, voluntarily or not
+    uint64_t total_latency_ns;  // From a reschedule request to the process leaving the CPU
+    uint64_t max_latency_ns;
+    uint64_t max_off_ns;        // Longest stretch with preemption disabled
+    uintptr_t max_off_ip;       // Where that stretch ended
+} preempt_stat;
+
+// Return 0, or -EINVAL if there is no such CPU
+static inline _syscall2(SYS_PREEMPT_STAT, int, syscall_preempt_stat, uint32_t, cpu_id, preempt_stat*, stat)
+
+#endif
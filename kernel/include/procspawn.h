@@ -0,0 +1,27 @@
+#ifndef _PROCSPAWN_H
+#define _PROCSPAWN_H
+
+#include <stdint.h>
+#include <syscall.h>
+
+// posix_spawn style process creation in one syscall, skipping the
+// user space copy and handle table duplication of fork followed by exec
+
+// max number of file actions accepted by one SYS_SPAWN
+#define MAX_SPAWN_FILE_ACTIONS 16
+
+enum spawn_file_action_type {
+    SPAWN_FILE_ACTION_CLOSE = 1,    // close fd in child
+    SPAWN_FILE_ACTION_DUP2,         // dup fd to new_fd in child, new_fd closed first if opened
+};
+
+struct spawn_file_action {
+    int32_t type;
+    int32_t fd;
+    int32_t new_fd;
+};
+
+// Returns child pid, or negative errno
+static inline _syscall5(SYS_SPAWN, int, syscall_spawn, const char*, path, char* const*, argv, char* const*, envp, const struct spawn_file_action*, actions, unsigned int, n_actions)
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _PROCTHREAD_H
+#define _PROCTHREAD_H
+
+#include <stdint.h>
+#include <syscall.h>
+
+// Threads of a process share its user space, handles and working directory,
+// each one has its own kernel stack and is scheduled independently
+
+// futex operations
+#define FUTEX_WAIT 0    // sleep if *uaddr == val, return -EAGAIN otherwise
+#define FUTEX_WAKE 1    // wake up at most val waiters of uaddr
+
+// Start a thread at entry with esp = stack, the caller lays out the stack (e.g. arguments, return address)
+// The thread ID is stored to *tid, which is then zeroed and futex woken when the thread exits
+// Returns the thread ID, or negative errno
+static inline _syscall3(SYS_CLONE, int, syscall_clone, void*, entry, void*, stack, volatile int*, tid)
+static inline _syscall3(SYS_FUTEX, int, syscall_futex, volatile int*, uaddr, int, op, int, val)
+// Terminate the calling thread only, the process exits with its last thread
+static inline _syscall0(SYS_THREAD_EXIT, int, syscall_thread_exit)
+static inline _syscall0(SYS_GETTID, int, syscall_gettid)
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef _RAMDISK_H
+#define _RAMDISK_H
+
+#include <stdint.h>
+#include <syscall.h>
+
+// Make a FAT32 formatted RAM disk of size bytes and mount it at path, an existing directory
+// Below about 32MiB the volume has fewer clusters than FAT32 requires, only simple-os can read it
+// The disk lives until reboot, return 0 or -errno
+// Sizes are limited, see RAM_DISK_MAX_SIZE and RAM_DISK_MAX_TOTAL_SIZE in kernel/ramdisk.h
+static inline _syscall2(SYS_RAMDISK, int, syscall_ramdisk, const char*, path, uint32_t, size)
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef _SOFTIRQ_H
+#define _SOFTIRQ_H
+
+#include <stdint.h>
+#include <syscall.h>
+
+// Sources of the kernel's bottom halves
+enum softirq_nr {
+    SOFTIRQ_TIMER,          // Delayed works due
+    SOFTIRQ_NET_RX,         // Network interface events
+    N_SOFTIRQ
+};
+
+// Run-time counters of a softirq source, summed over all CPUs since boot
+typedef struct softirq_stat {
+    uint64_t count;         // Times the handler ran
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t thread_count;  // Times run by ksoftirqd instead of on interrupt exit
+} softirq_stat;
+
+// Return 0, or -EINVAL if nr is not a softirq source
+static inline _syscall2(SYS_SOFTIRQ_STAT, int, syscall_softirq_stat, uint32_t, nr, softirq_stat*, stat)
+
+#endif
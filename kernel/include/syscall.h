@@ -2,15 +2,26 @@
 #define _SYSCALL_H
 
 #include <syscallnum.h>
+#include <vdso.h>
+
+// System calls enter the kernel through the vsyscall trampoline in the vDSO page (SYSENTER if supported)
+// eax: syscall number, ebx, ecx, edx, esi, edi, ebp: arguments, eax: return value
+// All other registers are preserved by the trampoline
+// The legacy int 88 entry (arguments pushed on stack after a fake return address) is still supported
+// Ref: https://wiki.osdev.org/SYSENTER
+
+#define __SYSCALL_STR(x) #x
+#define _SYSCALL_STR(x) __SYSCALL_STR(x)
+#define VSYSCALL_CALL "call " _SYSCALL_STR(VDSO_VSYSCALL_VADDR)
 
 #define _syscall0(syscall_num, retval_type, name) \
 retval_type name() \
 {\
     int ret_code; \
-    asm volatile ("push $0; int $88; pop %%ebx" \
+    asm volatile (VSYSCALL_CALL \
     :"=a"(ret_code) \
     :"a"(syscall_num) \
-    :"ebx"); \
+    :"memory", "cc"); \
     return (retval_type) ret_code; \
 }
 
@@ -18,10 +29,10 @@ retval_type name() \
 retval_type name(argtype1 arg1) \
 {\
     int ret_code; \
-    asm volatile ("push %2; push $0; int $88; pop %%ebx; pop %%ebx" \
+    asm volatile (VSYSCALL_CALL \
     :"=a"(ret_code) \
-    :"a"(syscall_num), "r"((unsigned int) arg1) \
-    :"ebx"); \
+    :"a"(syscall_num), "b"((unsigned int) arg1) \
+    :"memory", "cc"); \
     return (retval_type) ret_code; \
 }
 
@@ -29,10 +40,10 @@ retval_type name(argtype1 arg1) \
 retval_type name(argtype1 arg1, argtype2 arg2) \
 {\
     int ret_code; \
-    asm volatile ("push %2; push %3; push $0; int $88; pop %%ebx; pop %%ebx; pop %%ebx" \
+    asm volatile (VSYSCALL_CALL \
     :"=a"(ret_code) \
-    :"a"(syscall_num), "r"((unsigned int) arg2), "r"((unsigned int) arg1) \
-    :"ebx"); \
+    :"a"(syscall_num), "b"((unsigned int) arg1), "c"((unsigned int) arg2) \
+    :"memory", "cc"); \
     return (retval_type) ret_code; \
 }
 
@@ -40,10 +51,10 @@ retval_type name(argtype1 arg1, argtype2 arg2) \
 retval_type name(argtype1 arg1, argtype2 arg2, argtype3 arg3) \
 {\
     int ret_code; \
-    asm volatile ("push %2; push %3; push %4; push $0; int $88; pop %%ebx; pop %%ebx; pop %%ebx; pop %%ebx" \
+    asm volatile (VSYSCALL_CALL \
     :"=a"(ret_code) \
-    :"a"(syscall_num), "r"((unsigned int) arg3), "r"((unsigned int) arg2), "r"((unsigned int) arg1) \
-    :"ebx"); \
+    :"a"(syscall_num), "b"((unsigned int) arg1), "c"((unsigned int) arg2), "d"((unsigned int) arg3) \
+    :"memory", "cc"); \
     return (retval_type) ret_code; \
 }
 
@@ -51,10 +62,11 @@ retval_type name(argtype1 arg1, argtype2 arg2, argtype3 arg3) \
 retval_type name(argtype1 arg1, argtype2 arg2, argtype3 arg3, argtype4 arg4) \
 {\
     int ret_code; \
-    asm volatile ("push %2; push %3; push %4; push %5; push $0; int $88; pop %%ebx; pop %%ebx; pop %%ebx; pop %%ebx; pop %%ebx" \
+    asm volatile (VSYSCALL_CALL \
     :"=a"(ret_code) \
-    :"a"(syscall_num), "m"((unsigned int) arg4), "r"((unsigned int) arg3), "r"((unsigned int) arg2), "r"((unsigned int) arg1) \
-    :"ebx"); \
+    :"a"(syscall_num), "b"((unsigned int) arg1), "c"((unsigned int) arg2), "d"((unsigned int) arg3), \
+     "S"((unsigned int) arg4) \
+    :"memory", "cc"); \
     return (retval_type) ret_code; \
 }
 
@@ -62,22 +74,25 @@ retval_type name(argtype1 arg1, argtype2 arg2, argtype3 arg3, argtype4 arg4) \
 retval_type name(argtype1 arg1, argtype2 arg2, argtype3 arg3, argtype4 arg4, argtype5 arg5) \
 {\
     int ret_code; \
-    asm volatile ("push %2; push %3; push %4; push %5; push %6; push $0; int $88; pop %%ebx; pop %%ebx; pop %%ebx; pop %%ebx; pop %%ebx; pop %%ebx" \
+    asm volatile (VSYSCALL_CALL \
     :"=a"(ret_code) \
-    :"a"(syscall_num),  "m"((unsigned int) arg5), "m"((unsigned int) arg4), "r"((unsigned int) arg3), "r"((unsigned int) arg2), "r"((unsigned int) arg1) \
-    :"ebx"); \
+    :"a"(syscall_num), "b"((unsigned int) arg1), "c"((unsigned int) arg2), "d"((unsigned int) arg3), \
+     "S"((unsigned int) arg4), "D"((unsigned int) arg5) \
+    :"memory", "cc"); \
     return (retval_type) ret_code; \
 }
 
+// ebp can not be an asm operand (frame pointer), so arg6 is pushed first and then loaded into ebp
 #define _syscall6(syscall_num, retval_type, name, argtype1, arg1, argtype2, arg2, argtype3, arg3, argtype4, arg4, argtype5, arg5, argtype6, arg6) \
 retval_type name(argtype1 arg1, argtype2 arg2, argtype3 arg3, argtype4 arg4, argtype5 arg5, argtype6 arg6) \
 {\
     int ret_code; \
-    asm volatile ("push %2; push %3; push %4; push %5; push %6; push %7; push $0; int $88; pop %%ebx; pop %%ebx; pop %%ebx; pop %%ebx; pop %%ebx; pop %%ebx; pop %%ebx" \
+    asm volatile ("push %7; push %%ebp; mov 4(%%esp), %%ebp; " VSYSCALL_CALL "; pop %%ebp; add $4, %%esp" \
     :"=a"(ret_code) \
-    :"a"(syscall_num), "m"((unsigned int) arg6), "m"((unsigned int) arg5), "m"((unsigned int) arg4), "r"((unsigned int) arg3), "r"((unsigned int) arg2), "r"((unsigned int) arg1) \
-    :"ebx"); \
+    :"a"(syscall_num), "b"((unsigned int) arg1), "c"((unsigned int) arg2), "d"((unsigned int) arg3), \
+     "S"((unsigned int) arg4), "D"((unsigned int) arg5), "m"(arg6) \
+    :"memory", "cc"); \
     return (retval_type) ret_code; \
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -43,7 +43,20 @@
 #define SYS_SOCKET_SENDTO 37
 #define SYS_SOCKET_RECVFROM 38
 
+#define SYS_URING_ENTER 50
+#define SYS_SPAWN 51
+#define SYS_CLONE 52
+#define SYS_FUTEX 53
+#define SYS_THREAD_EXIT 54
+#define SYS_GETTID 55
+#define SYS_SYNC 56
+#define SYS_BCACHE_STAT 57
+#define SYS_RAMDISK 58
+#define SYS_SOFTIRQ_STAT 59
+#define SYS_PREEMPT_STAT 60
+
 #define SYS_CURR_TIME_EPOCH 70
+#define SYS_CLOCK_GETTIME 71
 #define SYS_GET_FILE_OFFSET 80
 
 #define SYS_BRK 90
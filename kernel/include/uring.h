@@ -0,0 +1,97 @@
+#ifndef _URING_H
+#define _URING_H
+
+#include <stdint.h>
+#include <syscall.h>
+#include <fs.h>
+#include <fsstat.h>
+
+// Batched asynchronous syscall ring, loosely modeled after Linux io_uring
+// Ref: https://kernel.dk/io_uring.pdf
+//
+// Both rings live in user memory. The process fills submission queue entries (SQE)
+// and advances sq_tail, then a single SYS_URING_ENTER makes the kernel consume them
+// and post one completion queue entry (CQE) per SQE, advancing cq_tail.
+// Indices are free running, ring sizes must be power of 2.
+
+enum uring_op {
+    URING_OP_NOP = 0,
+    URING_OP_OPEN,      // path, len = flags
+    URING_OP_READ,      // fd, addr, len
+    URING_OP_WRITE,     // fd, addr, len
+    URING_OP_GETATTR,   // path (or fd if path is NULL), addr = fs_stat*
+    URING_OP_READDIR,   // path, addr = fs_dirent*, len = buffer size, offset
+    URING_OP_CLOSE,     // fd
+};
+
+// Use the result of the previous SQE in the same batch as fd,
+// e.g. open followed by read and close without a round trip
+#define URING_SQE_FD_FROM_PREV 0x1
+
+struct uring_sqe {
+    uint8_t opcode;
+    uint8_t flags;
+    uint16_t reserved;
+    int32_t fd;
+    const char* path;
+    void* addr;
+    uint32_t len;
+    uint32_t offset;
+    uint32_t user_data;
+};
+
+struct uring_cqe {
+    uint32_t user_data;
+    int32_t res;
+};
+
+struct uring {
+    volatile uint32_t sq_head; // advanced by kernel
+    volatile uint32_t sq_tail; // advanced by user
+    uint32_t sq_entries;
+    volatile uint32_t cq_head; // advanced by user
+    volatile uint32_t cq_tail; // advanced by kernel
+    uint32_t cq_entries;
+    struct uring_sqe* sqes;
+    struct uring_cqe* cqes;
+};
+
+// Returns number of SQEs consumed, or negative on error
+static inline _syscall2(SYS_URING_ENTER, int, uring_enter, struct uring*, ring, uint32_t, to_submit)
+
+// NULL if the submission queue is full
+static inline struct uring_sqe* uring_get_sqe(struct uring* ring)
+{
+    if(ring->sq_tail - ring->sq_head >= ring->sq_entries) {
+        return NULL;
+    }
+    struct uring_sqe* sqe = &ring->sqes[ring->sq_tail & (ring->sq_entries - 1)];
+    *sqe = (struct uring_sqe) {0};
+    return sqe;
+}
+
+static inline void uring_commit_sqe(struct uring* ring)
+{
+    ring->sq_tail++;
+}
+
+static inline int uring_submit(struct uring* ring)
+{
+    return uring_enter(ring, ring->sq_tail - ring->sq_head);
+}
+
+// NULL if no completion available
+static inline struct uring_cqe* uring_peek_cqe(struct uring* ring)
+{
+    if(ring->cq_head == ring->cq_tail) {
+        return NULL;
+    }
+    return &ring->cqes[ring->cq_head & (ring->cq_entries - 1)];
+}
+
+static inline void uring_cqe_seen(struct uring* ring)
+{
+    ring->cq_head++;
+}
+
+#endif
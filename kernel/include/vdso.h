@@ -0,0 +1,41 @@
+#ifndef _VDSO_H
+#define _VDSO_H
+
+#include <stdint.h>
+
+// Read-only pages the kernel maps into every process at a fixed address,
+// letting user space read process and clock info without any syscall
+//
+// [VDSO_VADDR] vdso_clock, one frame shared by all processes
+// [VDSO_VADDR + 0x1000] vdso_proc, one frame per process
+// [VDSO_VADDR + 0x2000] vsyscall trampoline code, one frame shared by all processes
+//
+// Placed right below the guard page of the user stack, see exec()
+#define VDSO_VADDR 0xBFEFC000
+#define VDSO_PAGE_COUNT 3
+// Syscall entry: eax = syscall number, ebx, ecx, edx, esi, edi, ebp = arguments
+// Kept as a literal so it can be pasted into inline assembly, = VDSO_VADDR + 0x2000
+#define VDSO_VSYSCALL_VADDR 0xBFEFE000
+
+#define VDSO_CLOCK ((const volatile struct vdso_clock*) VDSO_VADDR)
+#define VDSO_PROC ((const volatile struct vdso_proc*) (VDSO_VADDR + 0x1000))
+
+// TSC to nanosecond conversion data, guarded by a sequence lock:
+// seq is odd while the kernel is updating the fields,
+// a reader retries if seq is odd or changed during its read
+// ns = (cycles * mult) >> shift
+struct vdso_clock {
+    uint32_t seq;
+    uint32_t mult;
+    uint32_t shift;
+    uint32_t reserved;
+    uint64_t boot_tsc;      // TSC value at boot_epoch
+    int64_t boot_epoch;     // UNIX epoch at boot_tsc
+    uint64_t tsc_hz;
+};
+
+struct vdso_proc {
+    int32_t pid;
+};
+
+#endif
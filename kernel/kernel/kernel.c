@@ -11,9 +11,13 @@
 #include <kernel/panic.h>
 #include <kernel/process.h>
 #include <kernel/block_io.h>
+#include <kernel/bcache.h>
 #include <kernel/vfs.h>
 #include <kernel/network.h>
+#include <kernel/workqueue.h>
+#include <kernel/softirq.h>
 #include <kernel/video.h>
+#include <kernel/lock.h>
 #include <arch/i386/kernel/cpu.h>
 
 typedef void entry_main(void);
@@ -62,8 +66,8 @@ void test_malloc()
 void test_ata()
 {
 	char* mbr = kmalloc(512);
-	int32_t max_lba = get_total_28bit_sectors(false);
-	printf("Disk max 28bit addressable LBA: %d\n", max_lba);
+	int64_t max_lba = get_total_sectors(false);
+	printf("Disk max addressable LBA: %lld\n", max_lba);
     read_sectors_ATA_PIO(false, mbr, 0, 1);
 
 	printf("(ATA) Disk MBR last four bytes: 0x%x\n", *(uint32_t*) &mbr[508]);
@@ -155,10 +159,106 @@ uint test_video()
     return fps;
 }
 
+// rw_lock microbenchmark, readers and writers working on a shared table at the same time
+// Runs in kernel threads once the scheduler starts, the last one done prints the result
+#define RW_BENCH_READERS 4
+#define RW_BENCH_WRITERS 2
+#define RW_BENCH_ITERATIONS 20000
+#define RW_BENCH_TABLE_SIZE 64
+
+static struct {
+	rw_lock lk;
+	spinlock done_lk;
+	uint32_t table[RW_BENCH_TABLE_SIZE];
+	uint64_t t0;
+	uint n_done;
+	uint n_torn;
+} rw_bench;
+
+static void rw_bench_start()
+{
+	spin_lock(&rw_bench.done_lk);
+	if(rw_bench.t0 == 0) {
+		rw_bench.t0 = rdtsc();
+	}
+	spin_unlock(&rw_bench.done_lk);
+}
+
+static void rw_bench_done(uint n_torn)
+{
+	spin_lock(&rw_bench.done_lk);
+	rw_bench.n_torn += n_torn;
+	uint last = ++rw_bench.n_done == RW_BENCH_READERS + RW_BENCH_WRITERS;
+	uint64_t total_cycle = rdtsc() - rw_bench.t0;
+	spin_unlock(&rw_bench.done_lk);
+	if(!last) {
+		return;
+	}
+
+	rw_lock_stat stat;
+	rw_lock_get_stat(&rw_bench.lk, &stat);
+	int64_t freq = cpu_freq();
+	uint64_t n_op = (RW_BENCH_READERS + RW_BENCH_WRITERS) * RW_BENCH_ITERATIONS;
+	int64_t op_per_sec = freq / (total_cycle / n_op);
+	printf("RW lock benchmark: %u readers, %u writers, %lld operations per second\n", RW_BENCH_READERS, RW_BENCH_WRITERS, op_per_sec);
+	printf("RW lock benchmark: Read waits[%llu/%llu] avg[%llu cycles], Write waits[%llu/%llu] avg[%llu cycles], Torn reads[%u]\n",
+		stat.n_read_wait, stat.n_read, stat.n_read_wait ? stat.read_wait_cycles / stat.n_read_wait : 0,
+		stat.n_write_wait, stat.n_write, stat.n_write_wait ? stat.write_wait_cycles / stat.n_write_wait : 0,
+		rw_bench.n_torn);
+}
+
+static void rw_bench_reader(void* arg)
+{
+	UNUSED_ARG(arg);
+	rw_bench_start();
+	uint n_torn = 0;
+	for(uint i=0; i<RW_BENCH_ITERATIONS; i++) {
+		start_reading(&rw_bench.lk);
+		// a writer updates every entry at once, so they shall all be equal
+		for(uint j=1; j<RW_BENCH_TABLE_SIZE; j++) {
+			if(rw_bench.table[j] != rw_bench.table[0]) {
+				n_torn++;
+				break;
+			}
+		}
+		finish_reading(&rw_bench.lk);
+	}
+	rw_bench_done(n_torn);
+}
+
+static void rw_bench_writer(void* arg)
+{
+	UNUSED_ARG(arg);
+	rw_bench_start();
+	for(uint i=0; i<RW_BENCH_ITERATIONS; i++) {
+		start_writing(&rw_bench.lk);
+		uint32_t v = rw_bench.table[0] + 1;
+		for(uint j=0; j<RW_BENCH_TABLE_SIZE; j++) {
+			rw_bench.table[j] = v;
+		}
+		finish_writing(&rw_bench.lk);
+	}
+	rw_bench_done(0);
+}
+
+void test_rw_lock()
+{
+	init_rw_lock(&rw_bench.lk, 0);
+	for(uint i=0; i<RW_BENCH_READERS; i++) {
+		create_kernel_thread(rw_bench_reader, NULL);
+	}
+	for(uint i=0; i<RW_BENCH_WRITERS; i++) {
+		create_kernel_thread(rw_bench_writer, NULL);
+	}
+}
+
 void init()
 {
 	initialize_block_storage();
 	init_vfs();
+	init_softirq();
+	init_workqueue();
+	init_bcache();
 	init_network();
 }
 
@@ -181,12 +281,14 @@ void kernel_main(uint32_t mbt_physical_addr) {
 	// test_ata();
 	// test_paging();
 	// test_video();
+	// test_rw_lock();
 
 	// unused tests
 	UNUSED_ARG(test_malloc);
 	UNUSED_ARG(test_ata);
 	UNUSED_ARG(test_paging);
 	UNUSED_ARG(test_video);
+	UNUSED_ARG(test_rw_lock);
 
 	// Enter user space and running init
 	init_first_process();
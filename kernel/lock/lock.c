@@ -2,50 +2,97 @@
 #include <kernel/process.h>
 #include <kernel/lock.h>
 #include <kernel/cpu.h>
+#include <kernel/paging.h>
+#include <kernel/preempt.h>
+#include <arch/i386/kernel/cpu.h>
 
 // Ref: xv6/spinlock.c
 
+// Number of busy waiting rounds before a yield_lock waiter yields the CPU
+#define YIELD_LOCK_SPIN_COUNT 1000
+
+static inline void cpu_relax()
+{
+    asm volatile("pause");
+}
+
+void spin_lock(spinlock* lk)
+{
+    push_cli();
+    preempt_disable();
+    if(spin_holding(lk)) {
+        PANIC("Spinlock Dead Lock");
+    }
+
+    // The xchg is atomic and also a full memory barrier on x86
+    while(xchg(&lk->locked, 1) != 0) {
+        cpu_relax();
+    }
+    // any kernel mapping changed since we last looked is now visible to us
+    sync_kernel_tlb();
+    lk->cpu = curr_cpu();
+}
+
+void spin_unlock(spinlock* lk)
+{
+    PANIC_ASSERT(!is_interrupt_enabled());
+    if(!spin_holding(lk)) {
+        PANIC("Releasing Non-holding spinlock");
+    }
+    lk->cpu = NULL;
+    // make sure the stores in critical region are visible before the lock is
+    __sync_synchronize();
+    xchg(&lk->locked, 0);
+    pop_cli();
+    preempt_enable_ip(__builtin_return_address(0));
+}
+
+uint spin_holding(spinlock* lk)
+{
+    push_cli();
+    uint r = lk->locked && lk->cpu == curr_cpu();
+    pop_cli();
+    return r;
+}
+
 void acquire(yield_lock* lk)
 {
-    // Assuming there is only one CPU, so disabling interrupt will be enough
-    // to ensure atomicity of the check-and-flag code below
-    // no need to use atomic assembly like xchg
     push_cli();
+    preempt_disable();
 
     proc* p = curr_proc();
     int pid = p?p->pid:0;
 
-    while(lk->locked) {
-        if(lk->holding_pid == pid) {
+    uint spin = 0;
+    while(xchg(&lk->locked, 1) != 0) {
+        if(pid && lk->holding_pid == pid) {
             PANIC("Deal Lock");
         }
-        
-        yield();
+        // The holder is either running on another CPU and will release soon,
+        // or has yielded on this CPU while holding the lock and needs us to yield
+        if(++spin < YIELD_LOCK_SPIN_COUNT) {
+            cpu_relax();
+        } else {
+            spin = 0;
+            yield();
+        }
     }
-    lk->locked = 1;
+    sync_kernel_tlb();
     lk->holding_pid = pid;
-    
-
-    // if in multi-core scenario, need to insert 
-    // __sync_synchronize()
-    // here
 }
 
 void release(yield_lock* lk)
 {
-    // Assuming there is only one CPU, so disabling interrupt will be enough
-    // to ensure atomicity of the check-and-flag code below
-    // no need to use atomic assembly like xchg
     PANIC_ASSERT(!is_interrupt_enabled());
     if(!lk->locked) {
         PANIC("Releasing Non-holding lock");
     }
-    
-    // if in multi-core scenario, need to insert 
-    // __sync_synchronize()
-    // here
-    lk->locked = 0;
+
+    lk->holding_pid = 0;
+    __sync_synchronize();
+    xchg(&lk->locked, 0);
     pop_cli();
+    preempt_enable_ip(__builtin_return_address(0));
 }
 
 uint holding(yield_lock* lk)
@@ -56,53 +103,98 @@ uint holding(yield_lock* lk)
   return r;
 }
 
+void init_rw_lock(rw_lock* lk, uint flags)
+{
+    *lk = (rw_lock) {.flags = flags};
+}
+
+void rw_lock_get_stat(rw_lock* lk, rw_lock_stat* stat)
+{
+    spin_lock(&lk->lk);
+    *stat = lk->stat;
+    spin_unlock(&lk->lk);
+}
+
+// Writers between the active or next one and the last ticket handed out
+static uint writers_queued(rw_lock* lk)
+{
+    return lk->write_next - lk->write_serving;
+}
+
 void start_writing(rw_lock* lk) 
 {
-    // push_cli();
-    acquire(&lk->lk);
     proc* p = curr_proc();
     PANIC_ASSERT(p != NULL);
-    while(lk->writing_pid || lk->reading) {
-        if(lk->writing_pid == p->pid) {
-            PANIC("RW Write Dead Lock");
+    spin_lock(&lk->lk);
+    if(lk->writing_pid == p->pid) {
+        PANIC("RW Write Dead Lock");
+    }
+    uint ticket = lk->write_next++;
+    if(lk->writing_pid || lk->reading || lk->write_serving != ticket) {
+        uint64_t t0 = rdtsc();
+        while(lk->writing_pid || lk->reading || lk->write_serving != ticket) {
+            sleep(&lk->write_serving, &lk->lk);
         }
-        release(&lk->lk);
-        yield();
-        acquire(&lk->lk);
+        lk->stat.n_write_wait++;
+        lk->stat.write_wait_cycles += rdtsc() - t0;
     }
     lk->writing_pid = p->pid;
-    release(&lk->lk);
-    // pop_cli();
+    lk->stat.n_write++;
+    spin_unlock(&lk->lk);
 }
 
 void finish_writing(rw_lock* lk) 
 {
-    acquire(&lk->lk);
+    spin_lock(&lk->lk);
     PANIC_ASSERT(lk->writing_pid);
     lk->writing_pid = 0;
-    release(&lk->lk);
+    lk->write_serving++;
+    if((lk->flags & RW_LOCK_PREFER_WRITER) && writers_queued(lk) > 0) {
+        // readers wait until no writer is left
+        wakeup(&lk->write_serving);
+    } else if(lk->waiting_readers > 0) {
+        // hand off to the readers who came during this write, the next writer follows them
+        lk->reading += lk->waiting_readers;
+        lk->waiting_readers = 0;
+        lk->read_batch++;
+        wakeup(&lk->read_batch);
+    } else if(writers_queued(lk) > 0) {
+        wakeup(&lk->write_serving);
+    }
+    spin_unlock(&lk->lk);
 }
 
 void start_reading(rw_lock* lk) 
 {
-    acquire(&lk->lk);
     proc* p = curr_proc();
     PANIC_ASSERT(p != NULL);
-    while(lk->writing_pid && lk->writing_pid != p->pid) {
-        release(&lk->lk);
-        yield();
-        acquire(&lk->lk);
+    spin_lock(&lk->lk);
+    lk->stat.n_read++;
+    // queue behind waiting writers, or active readers could keep them off forever
+    if(lk->writing_pid == p->pid || (!lk->writing_pid && writers_queued(lk) == 0)) {
+        lk->reading++;
+        spin_unlock(&lk->lk);
+        return;
+    }
+    // wait for a writer to let us in, it counts us in reading
+    uint64_t t0 = rdtsc();
+    uint batch = lk->read_batch;
+    lk->waiting_readers++;
+    while(lk->read_batch == batch) {
+        sleep(&lk->read_batch, &lk->lk);
     }
-    lk->reading++;
-    release(&lk->lk);
+    lk->stat.n_read_wait++;
+    lk->stat.read_wait_cycles += rdtsc() - t0;
+    spin_unlock(&lk->lk);
 }
 
 void finish_reading(rw_lock* lk) 
 {
-    acquire(&lk->lk);
+    spin_lock(&lk->lk);
     PANIC_ASSERT(lk->reading > 0);
     lk->reading--;
-    release(&lk->lk);
+    if(lk->reading == 0 && !lk->writing_pid && writers_queued(lk) > 0) {
+        wakeup(&lk->write_serving);
+    }
+    spin_unlock(&lk->lk);
 }
-
-
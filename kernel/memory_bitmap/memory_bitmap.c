@@ -16,18 +16,23 @@ static struct {
     uint32_t frames[ARRAY_INDEX_FROM_FRAME_INDEX(N_FRAMES)];
     // Last known allocated frame, not necessarily correct 
     uint32_t last_allocated_frame_idx;
-    yield_lock lk;
+    spinlock lk;
 } memmap;
 
-// Set a bit in the frames bitset
-static void set_frame(uint32_t frame_idx) {
-    // uint32_t frame_idx = FRAME_INDEX_FROM_ADDR(physical_addr);
+// Set a bit in the frames bitset, caller must hold memmap.lk
+static void set_frame_locked(uint32_t frame_idx) {
     uint32_t idx = ARRAY_INDEX_FROM_FRAME_INDEX(frame_idx);
     uint32_t off = BIT_OFFSET_FROM_FRAME_INDEX(frame_idx);
-    acquire(&memmap.lk);
     memmap.frames[idx] |= (0x1 << off);
     memmap.last_allocated_frame_idx = frame_idx;
-    release(&memmap.lk);
+}
+
+// Set a bit in the frames bitset
+static void set_frame(uint32_t frame_idx) {
+    // uint32_t frame_idx = FRAME_INDEX_FROM_ADDR(physical_addr);
+    spin_lock(&memmap.lk);
+    set_frame_locked(frame_idx);
+    spin_unlock(&memmap.lk);
 }
 
 // Clear a bit in the frames bitset
@@ -35,9 +40,9 @@ void clear_frame(uint32_t frame_idx) {
     // uint32_t frame_idx = FRAME_INDEX_FROM_ADDR(physical_addr);
     uint32_t idx = ARRAY_INDEX_FROM_FRAME_INDEX(frame_idx);
     uint32_t off = BIT_OFFSET_FROM_FRAME_INDEX(frame_idx);
-    acquire(&memmap.lk);
+    spin_lock(&memmap.lk);
     memmap.frames[idx] &= ~(0x1 << off);
-    release(&memmap.lk);
+    spin_unlock(&memmap.lk);
 }
 
 // Test if a bit is set.
@@ -45,12 +50,24 @@ uint32_t test_frame(uint32_t frame_idx) {
     // uint32_t frame_idx = FRAME_INDEX_FROM_ADDR(physical_addr);
     uint32_t idx = ARRAY_INDEX_FROM_FRAME_INDEX(frame_idx);
     uint32_t off = BIT_OFFSET_FROM_FRAME_INDEX(frame_idx);
-    acquire(&memmap.lk);
+    spin_lock(&memmap.lk);
     uint32_t is_used = (memmap.frames[idx] & (0x1 << off));
-    release(&memmap.lk);
+    spin_unlock(&memmap.lk);
     return is_used;
 }
 
+// Number of frames not in use
+uint32_t count_free_frames()
+{
+    uint32_t n_used = 0;
+    spin_lock(&memmap.lk);
+    for(uint32_t i=0; i<ARRAY_INDEX_FROM_FRAME_INDEX(N_FRAMES); i++) {
+        n_used += __builtin_popcount(memmap.frames[i]);
+    }
+    spin_unlock(&memmap.lk);
+    return N_FRAMES - n_used;
+}
+
 // Find N consecutive free frames and mark used
 //@return: first frame index of the series
 uint32_t n_free_frames(uint n)
@@ -60,7 +77,7 @@ uint32_t n_free_frames(uint n)
     uint32_t n_found = 0;
     uint32_t first_frame = 0;
 
-    acquire(&memmap.lk);
+    spin_lock(&memmap.lk);
     uint32_t frame_idx = (memmap.last_allocated_frame_idx + 1) % N_FRAMES;
     while(frame_idx != memmap.last_allocated_frame_idx) {
         uint32_t i = ARRAY_INDEX_FROM_FRAME_INDEX(frame_idx);
@@ -72,12 +89,12 @@ uint32_t n_free_frames(uint n)
             }
             n_found++;
             if(n_found == n) {
-                release(&memmap.lk);
-                // claim the returning frames
+                // claim the returning frames before releasing the lock,
+                // otherwise another CPU may find the same frames
                 for(uint i=0;i<n;i++) {
-                    set_frame(first_frame + i);
+                    set_frame_locked(first_frame + i);
                 }
-                
+                spin_unlock(&memmap.lk);
                 return first_frame;
             }
         } else {
@@ -173,5 +190,28 @@ void initialize_bitmap(uint32_t mbt_physical_addr) {
     for (uint32_t idx = kernel_frame_start; idx <= kernel_frame_end; idx++)     {
         set_frame(idx);
     }
-    printf("Kernel Frame Reserved: 0x%x - 0x%x", kernel_frame_start, kernel_frame_end);
+    printf("Kernel Frame Reserved: 0x%x - 0x%x\n", kernel_frame_start, kernel_frame_end);
+
+    // Keep the boot modules (VGA font, initial ramdisk) away from the allocator, they are used in place
+    if(mbt->flags & MULTIBOOT_INFO_MODS) {
+        struct multiboot_mod_list* mods = (struct multiboot_mod_list*) (mbt->mods_addr + 0xC0000000);
+        for(uint32_t i=0; i<mbt->mods_count; i++) {
+            if(mods[i].mod_end <= mods[i].mod_start) {
+                continue;
+            }
+            frame_idx = FRAME_INDEX_FROM_ADDR(mods[i].mod_start);
+            frame_idx_end = FRAME_INDEX_FROM_ADDR(mods[i].mod_end - 1);
+            printf("Module Frame Reserved: 0x%x - 0x%x\n", (uint32_t) frame_idx, (uint32_t) frame_idx_end);
+            while (frame_idx < N_FRAMES && frame_idx <= frame_idx_end) {
+                set_frame(frame_idx);
+                frame_idx++;
+            }
+        }
+    }
+
+    // Keep the first 1MiB away from the allocator, it holds BIOS data, ACPI tables
+    // and the trampoline used to start application processors in real mode
+    for (uint32_t idx = 0; idx < FRAME_INDEX_FROM_ADDR(LOW_MEMORY_END); idx++) {
+        set_frame(idx);
+    }
 }
\ No newline at end of file
@@ -137,11 +137,9 @@ int ipv4_process_packet(void* buf, uint len)
 int ipv4_wait_for_next_packet(void* buf, uint buf_size, uint timeout_sec)
 {
     uint64_t n = pkt_received;
-    date_time start = current_datetime(), end;
-    time_t epoch0 = datetime2epoch(&start), epoch1;
+    time_t epoch0 = current_epoch(), epoch1;
     while(pkt_received == n) {
-        end = current_datetime();
-        epoch1 = datetime2epoch(&end);
+        epoch1 = current_epoch();
         if((uint)(epoch1 - epoch0) > timeout_sec) {
             return -1;
         }
@@ -0,0 +1,131 @@
+#include <kernel/preempt.h>
+#include <kernel/process.h>
+#include <kernel/cpu.h>
+#include <kernel/time.h>
+#include <kernel/panic.h>
+#include <arch/i386/kernel/cpu.h>
+#include <string.h>
+
+// Ref: https://www.kernel.org/doc/html/latest/locking/preempt-locking.html
+
+// Kept in TSC cycles, so that the lock paths do not pay for the conversion
+typedef struct preempt_cycles {
+    uint64_t n_preempt;
+    uint64_t n_resched;
+    uint64_t total_latency;
+    uint64_t max_latency;
+    uint64_t max_off;
+    uintptr_t max_off_ip;
+} preempt_cycles;
+
+// Counted per CPU, so no atomic 64-bit update is needed
+static preempt_cycles stats[MAX_CPU];
+
+void preempt_disable()
+{
+    push_cli();
+    cpu* c = curr_cpu();
+    if(c->preempt_count++ == 0) {
+        c->preempt_off_tsc = rdtsc();
+    }
+    pop_cli();
+}
+
+static void preempt_schedule()
+{
+    push_cli();
+    stats[curr_cpu()->id].n_preempt++;
+    pop_cli();
+    yield();
+}
+
+void preempt_enable_ip(void* ip)
+{
+    push_cli();
+    cpu* c = curr_cpu();
+    PANIC_ASSERT(c->preempt_count > 0);
+    if(--c->preempt_count == 0) {
+        uint64_t off = rdtsc() - c->preempt_off_tsc;
+        preempt_cycles* s = &stats[c->id];
+        if(off > s->max_off) {
+            s->max_off = off;
+            s->max_off_ip = (uintptr_t) ip;
+        }
+    }
+    // Not preemptible yet if still in an interrupt handler or under push_cli
+    uint preempt = c->preempt_count == 0 && c->need_resched && c->cli_count == 1 && c->orig_if_flag && !c->in_softirq;
+    pop_cli();
+    if(preempt) {
+        preempt_schedule();
+    }
+}
+
+void preempt_enable()
+{
+    preempt_enable_ip(__builtin_return_address(0));
+}
+
+uint preempt_count()
+{
+    push_cli();
+    uint count = curr_cpu()->preempt_count;
+    pop_cli();
+    return count;
+}
+
+void resched_curr()
+{
+    push_cli();
+    cpu* c = curr_cpu();
+    // Idle in the scheduler, nothing to preempt
+    if(c->current_process != NULL && !c->need_resched) {
+        c->need_resched = 1;
+        c->resched_tsc = rdtsc();
+    }
+    pop_cli();
+}
+
+void preempt_irq_exit()
+{
+    PANIC_ASSERT(!is_interrupt_enabled());
+    cpu* c = curr_cpu();
+    // A zero cli_count means the interrupted code had interrupts enabled
+    if(c->need_resched && c->preempt_count == 0 && c->cli_count == 0 && !c->in_softirq) {
+        preempt_schedule();
+    }
+}
+
+void preempt_sched_out(cpu* c)
+{
+    if(c->need_resched) {
+        uint64_t latency = rdtsc() - c->resched_tsc;
+        preempt_cycles* s = &stats[c->id];
+        s->n_resched++;
+        s->total_latency += latency;
+        if(latency > s->max_latency) {
+            s->max_latency = latency;
+        }
+        c->need_resched = 0;
+    }
+}
+
+static uint64_t cycles2ns(uint64_t cycles, uint64_t mhz)
+{
+    return cycles * 1000 / mhz;
+}
+
+void preempt_get_stat(uint cpu_id, preempt_stat* stat)
+{
+    PANIC_ASSERT(cpu_id < MAX_CPU);
+    uint64_t mhz = cpu_freq() / 1000000;
+    PANIC_ASSERT(mhz > 0);
+    preempt_cycles* s = &stats[cpu_id];
+    *stat = (preempt_stat) {
+        .n_preempt = s->n_preempt,
+        .n_resched = s->n_resched,
+        .total_latency_ns = cycles2ns(s->total_latency, mhz),
+        .max_latency_ns = cycles2ns(s->max_latency, mhz),
+        .max_off_ns = cycles2ns(s->max_off, mhz),
+        .max_off_ip = s->max_off_ip
+    };
+}
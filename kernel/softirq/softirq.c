@@ -0,0 +1,150 @@
+#include <kernel/softirq.h>
+#include <kernel/process.h>
+#include <kernel/lock.h>
+#include <kernel/cpu.h>
+#include <kernel/time.h>
+#include <kernel/panic.h>
+#include <arch/i386/kernel/cpu.h>
+#include <datetime.h>
+#include <stddef.h>
+#include <string.h>
+
+// Ref: https://www.kernel.org/doc/html/latest/kernel-hacking/locking.html#softirqs
+
+static struct {
+    spinlock lk;            // Guards deferring to ksoftirqd
+    softirq_handler handlers[N_SOFTIRQ];
+    // Counted per CPU, so no atomic 64-bit update is needed
+    softirq_stat stats[MAX_CPU][N_SOFTIRQ];
+    uint enabled;
+} softirq;
+
+void open_softirq(enum softirq_nr nr, softirq_handler handler)
+{
+    PANIC_ASSERT(nr < N_SOFTIRQ);
+    softirq.handlers[nr] = handler;
+}
+
+void raise_softirq(enum softirq_nr nr)
+{
+    push_cli();
+    // ksoftirqd may take the pending bits from another CPU at the same time
+    __sync_fetch_and_or(&curr_cpu()->softirq_pending, 1 << nr);
+    pop_cli();
+}
+
+uint in_softirq()
+{
+    push_cli();
+    uint in = curr_cpu()->in_softirq;
+    pop_cli();
+    return in;
+}
+
+static void account(enum softirq_nr nr, uint64_t ns, uint by_thread)
+{
+    push_cli();
+    softirq_stat* stat = &softirq.stats[curr_cpu()->id][nr];
+    stat->count++;
+    stat->total_ns += ns;
+    if(ns > stat->max_ns) {
+        stat->max_ns = ns;
+    }
+    stat->thread_count += by_thread;
+    pop_cli();
+}
+
+static void run_softirqs(uint pending, uint by_thread)
+{
+    for(uint nr=0; nr<N_SOFTIRQ; nr++) {
+        if(!(pending & (1 << nr)) || softirq.handlers[nr] == NULL) {
+            continue;
+        }
+        uint64_t t0 = clock_gettime_ns(CLOCK_ID_MONOTONIC);
+        softirq.handlers[nr]();
+        account(nr, clock_gettime_ns(CLOCK_ID_MONOTONIC) - t0, by_thread);
+    }
+}
+
+void softirq_irq_exit()
+{
+    PANIC_ASSERT(!is_interrupt_enabled());
+    cpu* c = curr_cpu();
+    // Nested in a softirq, or ksoftirqd is going to take care of them
+    if(!softirq.enabled || c->in_softirq || c->softirq_deferred || c->softirq_pending == 0) {
+        return;
+    }
+
+    // The process will not be switched out until in_softirq is cleared,
+    // so we stay on this CPU with interrupts enabled
+    c->in_softirq = 1;
+    uint64_t t0 = clock_gettime_ns(CLOCK_ID_MONOTONIC);
+    uint pending;
+    uint restart = SOFTIRQ_MAX_RESTART;
+    while((pending = xchg(&c->softirq_pending, 0)) != 0) {
+        enable_interrupt();
+        run_softirqs(pending, 0);
+        disable_interrupt();
+        if(--restart == 0 || clock_gettime_ns(CLOCK_ID_MONOTONIC) - t0 > SOFTIRQ_BUDGET_NS) {
+            break;
+        }
+    }
+    c->in_softirq = 0;
+
+    if(c->softirq_pending) {
+        // Under load, let the rest compete with processes
+        spin_lock(&softirq.lk);
+        c->softirq_deferred = 1;
+        spin_unlock(&softirq.lk);
+        wakeup(&softirq);
+    }
+}
+
+// Runs softirqs deferred by any CPU
+static void ksoftirqd(void* arg)
+{
+    UNUSED_ARG(arg);
+    spin_lock(&softirq.lk);
+    while(1) {
+        cpu* c = NULL;
+        for(uint i=0; i<n_cpu; i++) {
+            if(cpus[i].softirq_deferred) {
+                c = &cpus[i];
+                break;
+            }
+        }
+        if(c == NULL) {
+            sleep(&softirq, &softirq.lk);
+            continue;
+        }
+        c->softirq_deferred = 0;
+        uint pending = xchg(&c->softirq_pending, 0);
+        spin_unlock(&softirq.lk);
+
+        run_softirqs(pending, 1);
+
+        spin_lock(&softirq.lk);
+    }
+}
+
+// Shall be called after the clocksource is initialized
+void init_softirq()
+{
+    create_kernel_thread(ksoftirqd, NULL);
+    softirq.enabled = 1;
+}
+
+void softirq_get_stat(enum softirq_nr nr, softirq_stat* stat)
+{
+    PANIC_ASSERT(nr < N_SOFTIRQ);
+    memset(stat, 0, sizeof(*stat));
+    for(uint i=0; i<MAX_CPU; i++) {
+        softirq_stat* s = &softirq.stats[i][nr];
+        stat->count += s->count;
+        stat->total_ns += s->total_ns;
+        stat->thread_count += s->thread_count;
+        if(s->max_ns > stat->max_ns) {
+            stat->max_ns = s->max_ns;
+        }
+    }
+}
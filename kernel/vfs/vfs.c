@@ -11,6 +11,7 @@
 #include <kernel/vfs.h>
 #include <kernel/fat.h>
 #include <kernel/tar.h>
+#include <kernel/ramdisk.h>
 #include <kernel/process.h>
 #include <kernel/console.h>
 #include <kernel/pipe.h>
@@ -22,7 +23,11 @@ static struct {
     uint next_mount_point_id;
     fs_mount_point mount_points[N_MOUNT_POINT];
     file_system fs[N_FILE_SYSTEM_TYPES];
-    file file_table[N_FILE_STRUCTURE]; // Global (kernel) file table for all opened files
+    // Global (kernel) file table for all opened files, grown by one chunk at a time
+    // chunks are never freed, so a file pointer stays valid while it is referenced
+    file* file_chunks[MAX_FILE_CHUNK];
+    uint n_file_chunk;
+    uint n_file_used;
     yield_lock lk;
 } vfs;
 
@@ -172,6 +177,32 @@ int fs_unmount(const char* mount_root)
     return 0;
 }
 
+int fs_mount_ramdisk(const char* target, uint32_t size)
+{
+    // fail early, before making a RAM disk for nothing
+    fs_stat st = {0};
+    int res = fs_getattr(target, &st, -1);
+    if(res < 0) {
+        return res;
+    }
+    block_storage* storage = NULL;
+    res = ramdisk_create(size, &storage);
+    if(res < 0) {
+        return res;
+    }
+    res = fat32_format(storage, "RAMDISK");
+    if(res == 0) {
+        fat_mount_option fat_opt = (fat_mount_option) {.storage = storage};
+        fs_mount_option mount_option = {.mode = S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO};
+        fs_mount_point* mp = NULL;
+        res = fs_mount(target, FILE_SYSTEM_FAT_32, mount_option, &fat_opt, &mp);
+    }
+    if(res < 0) {
+        ramdisk_destroy(storage);
+    }
+    return res;
+}
+
 int fs_mknod(const char * path, uint mode)
 {
     const char* remaining_path = NULL;
@@ -294,6 +325,32 @@ int fs_rename(const char * from, const char* to, uint flags)
     return res;
 }
 
+// Find an unused file structure, adding a chunk to the table if all are in use
+// Caller shall hold vfs.lk
+static file* alloc_file(int* file_idx)
+{
+    if(vfs.n_file_used == vfs.n_file_chunk*FILE_CHUNK_SIZE) {
+        if(vfs.n_file_chunk == MAX_FILE_CHUNK) {
+            return NULL;
+        }
+        file* chunk = malloc(sizeof(file)*FILE_CHUNK_SIZE);
+        if(chunk == NULL) {
+            return NULL;
+        }
+        memset(chunk, 0, sizeof(file)*FILE_CHUNK_SIZE);
+        vfs.file_chunks[vfs.n_file_chunk++] = chunk;
+    }
+    for(uint c=0; c<vfs.n_file_chunk; c++) {
+        for(uint i=0; i<FILE_CHUNK_SIZE; i++) {
+            if(vfs.file_chunks[c][i].ref == 0) {
+                *file_idx = c*FILE_CHUNK_SIZE + i;
+                return &vfs.file_chunks[c][i];
+            }
+        }
+    }
+    return NULL;
+}
+
 int fs_open(const char * path, int flags)
 {
     const char* remaining_path = NULL;
@@ -306,14 +363,7 @@ int fs_open(const char * path, int flags)
     acquire(&vfs.lk);
 
     // allocate kernel file structure
-    file* f = NULL; 
-    for(int i=0;i<N_FILE_STRUCTURE;i++) {
-        if(vfs.file_table[i].ref == 0) {
-            f = &vfs.file_table[i];
-            ret = i;
-            break;
-        }
-    }
+    file* f = alloc_file(&ret);
     if(f == NULL) {
         // No available file structure cache
         ret = -ENFILE;
@@ -348,6 +398,7 @@ int fs_open(const char * path, int flags)
         .readable = !(flags & O_WRONLY),
         .writable = (flags & O_WRONLY) || (flags & O_RDWR)
     };
+    vfs.n_file_used++;
 
 end:
     release(&vfs.lk);
@@ -356,10 +407,10 @@ end:
 
 file* idx2file(int file_idx)
 {
-    if(file_idx < 0 || file_idx >= N_FILE_STRUCTURE) {
+    if(file_idx < 0 || (uint) file_idx >= vfs.n_file_chunk*FILE_CHUNK_SIZE) {
         return NULL;
     }
-    file* f = &vfs.file_table[file_idx];
+    file* f = &vfs.file_chunks[file_idx / FILE_CHUNK_SIZE][file_idx % FILE_CHUNK_SIZE];
     if(f->ref == 0) {
         return NULL;
     }
@@ -497,6 +548,7 @@ int fs_release(int file_idx)
 
         free(f->path);
         memset(f, 0, sizeof(*f));
+        vfs.n_file_used--;
     }
 
     release(&vfs.lk);
@@ -621,8 +673,27 @@ int init_vfs()
     int32_t mount_res = fs_mount("/", FILE_SYSTEM_US_TAR, mount_option, &tar_opt, &mp);
     assert(mount_res == 0);
 
+    // mount the initial ramdisk loaded by the bootloader over /usr/bin (if any)
+    // so that init, the shell and the utilities are loaded from memory
+    storage = ramdisk_initrd();
+    if(storage != NULL) {
+        tar_opt = (tar_mount_option) {
+            .storage = storage,
+            .starting_LBA = 0
+        };
+        mount_res = fs_mount(INITRD_MOUNT_TARGET, FILE_SYSTEM_US_TAR, mount_option, &tar_opt, &mp);
+        assert(mount_res == 0);
+    }
+
 	// mount hdb (IDE slave drive) to be the home dir (assumed to be FAT-32 formated)
+	// or the first SATA or virtio disk if there is no IDE slave drive
 	storage = get_block_storage(IDE_SLAVE_DRIVE);
+	if(storage == NULL) {
+		storage = get_block_storage_by_type(BLK_STORAGE_TYP_AHCI_SATA);
+	}
+	if(storage == NULL) {
+		storage = get_block_storage_by_type(BLK_STORAGE_TYP_VIRTIO_BLK);
+	}
 	if(storage != NULL) {
         fat_mount_option fat_opt = (fat_mount_option) {.storage = storage};
 		// the existence of /home is guaranteed by the install-reserved-path target of kernel Makefile 
@@ -630,6 +701,11 @@ int init_vfs()
 		assert(mount_res == 0);
 	}
 
+    // scratch space in memory
+    // the existence of /tmp is guaranteed by the install-reserved-path target of kernel Makefile 
+    mount_res = fs_mount_ramdisk("/tmp", RAM_DISK_DEFAULT_SIZE);
+    assert(mount_res == 0);
+
     // mount console
     // the existence of /console is guaranteed by the install-reserved-path target of kernel Makefile 
     mount_option = (fs_mount_option) {.mode = S_IFREG | S_IRWXU | S_IRWXG | S_IRWXO};
@@ -18,6 +18,9 @@
 // Sluggish SVGA drivers: https://forum.osdev.org/viewtopic.php?f=15&t=22882
 // gui scroll is super slow: https://forum.osdev.org/viewtopic.php?f=1&t=23891&start=0 (in which Brendan suggested this buffer_curr/buffer_next method)
 
+// Pixels copied by video_refresh() between preemption points
+#define VIDEO_REFRESH_CHUNK 16384
+
 static struct {
   int initialized;
   uint32_t* framebuffer;
@@ -58,6 +61,11 @@ void video_refresh()
             video.buffer_curr[i] = video.buffer_next[i];
             video.framebuffer[i] = video.buffer_next[i];
         }
+        // let others in between chunks, the whole screen can take milliseconds
+        if((i + 1) % VIDEO_REFRESH_CHUNK == 0) {
+            release(&video.lk);
+            acquire(&video.lk);
+        }
     }
     release(&video.lk);
 }
@@ -188,9 +196,9 @@ int init_video(uint32_t info_phy_addr)
     for(uint32_t i=0; i<info->mods_count; i++) {
         // find boot module of BIOS VGA font
         if(memcmp((char*) (mods[i].cmdline + 0xC0000000), "VGA FONT", 9) == 0 && mods[i].mod_end - mods[i].mod_start == 256*FONT_WIDTH*FONT_HEIGHT) {
-            video.font = (uint8_t*) (mods->mod_start + 0xC0000000);
+            video.font = (uint8_t*) (mods[i].mod_start + 0xC0000000);
             // assert mapping is expected
-            PANIC_ASSERT(vaddr2paddr(curr_page_dir(), (uint32_t) video.font) == mods->mod_start);
+            PANIC_ASSERT(vaddr2paddr(curr_page_dir(), (uint32_t) video.font) == mods[i].mod_start);
             break;
         }
     }
@@ -0,0 +1,149 @@
+#include <kernel/workqueue.h>
+#include <kernel/process.h>
+#include <kernel/lock.h>
+#include <kernel/time.h>
+#include <kernel/panic.h>
+#include <kernel/softirq.h>
+#include <arch/i386/kernel/cpu.h>
+#include <datetime.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <common.h>
+
+static struct {
+    spinlock lk;
+    work_struct* head;          // FIFO of works to run
+    work_struct* tail;
+    delayed_work* delayed;      // Sorted by due_ns
+    uint n_worker;
+} wq;
+
+void init_work(work_struct* work, void (*func)(void* arg), void* arg)
+{
+    work->func = func;
+    work->arg = arg;
+    work->next = NULL;
+    work->pending = 0;
+}
+
+void init_delayed_work(delayed_work* dwork, void (*func)(void* arg), void* arg)
+{
+    init_work(&dwork->work, func, arg);
+    dwork->due_ns = 0;
+    dwork->next = NULL;
+}
+
+// Caller shall hold wq.lk
+static bool enqueue_work(work_struct* work)
+{
+    if(work->pending) {
+        return false;
+    }
+    work->pending = 1;
+    work->next = NULL;
+    if(wq.tail == NULL) {
+        wq.head = work;
+    } else {
+        wq.tail->next = work;
+    }
+    wq.tail = work;
+    return true;
+}
+
+bool queue_work(work_struct* work)
+{
+    spin_lock(&wq.lk);
+    bool queued = enqueue_work(work);
+    spin_unlock(&wq.lk);
+    // A worker about to sleep holds the process table lock before releasing wq.lk,
+    // so waking up after unlocking cannot be missed
+    if(queued) {
+        wakeup(&wq);
+    }
+    return queued;
+}
+
+// The delay has the granularity of the system tick
+bool queue_delayed_work(delayed_work* dwork, uint32_t delay_ms)
+{
+    if(delay_ms == 0) {
+        return queue_work(&dwork->work);
+    }
+    uint64_t due_ns = clock_gettime_ns(CLOCK_ID_MONOTONIC) + (uint64_t) delay_ms*1000000;
+
+    spin_lock(&wq.lk);
+    if(dwork->work.pending) {
+        spin_unlock(&wq.lk);
+        return false;
+    }
+    dwork->work.pending = 1;
+    dwork->due_ns = due_ns;
+    delayed_work** pp = &wq.delayed;
+    while(*pp != NULL && (*pp)->due_ns <= due_ns) {
+        pp = &(*pp)->next;
+    }
+    dwork->next = *pp;
+    *pp = dwork;
+    spin_unlock(&wq.lk);
+    return true;
+}
+
+void workqueue_timer_tick()
+{
+    if(wq.delayed == NULL) {
+        return;
+    }
+    uint64_t now = clock_gettime_ns(CLOCK_ID_MONOTONIC);
+    bool queued = false;
+
+    spin_lock(&wq.lk);
+    while(wq.delayed != NULL && wq.delayed->due_ns <= now) {
+        delayed_work* dwork = wq.delayed;
+        wq.delayed = dwork->next;
+        dwork->next = NULL;
+        // let enqueue_work() set it again
+        dwork->work.pending = 0;
+        queued |= enqueue_work(&dwork->work);
+    }
+    spin_unlock(&wq.lk);
+
+    if(queued) {
+        wakeup(&wq);
+    }
+}
+
+static void worker_thread(void* arg)
+{
+    UNUSED_ARG(arg);
+    spin_lock(&wq.lk);
+    while(1) {
+        if(wq.head == NULL) {
+            sleep(&wq, &wq.lk);
+            continue;
+        }
+        work_struct* work = wq.head;
+        wq.head = work->next;
+        if(wq.head == NULL) {
+            wq.tail = NULL;
+        }
+        // The work may queue itself again from now on
+        work->next = NULL;
+        work->pending = 0;
+        spin_unlock(&wq.lk);
+
+        work->func(work->arg);
+
+        spin_lock(&wq.lk);
+    }
+}
+
+// Start one worker thread per CPU
+void init_workqueue()
+{
+    open_softirq(SOFTIRQ_TIMER, workqueue_timer_tick);
+    wq.n_worker = n_cpu > 0 ? n_cpu : 1;
+    for(uint i=0; i<wq.n_worker; i++) {
+        create_kernel_thread(worker_thread, NULL);
+    }
+    printf("Workqueue: %u worker threads\n", wq.n_worker);
+}
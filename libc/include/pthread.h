@@ -0,0 +1,43 @@
+#ifndef _PTHREAD_H
+#define _PTHREAD_H 1
+
+#include <sys/types.h>
+
+// Minimal POSIX threads on top of SYS_CLONE and SYS_FUTEX
+
+typedef struct pthread* pthread_t;
+// Thread attributes are not supported, pass NULL
+typedef int pthread_attr_t;
+
+typedef struct {
+    volatile int state;     // 0: unlocked, 1: locked, 2: locked with waiters
+} pthread_mutex_t;
+typedef int pthread_mutexattr_t;
+
+typedef struct {
+    volatile int seq;       // bumped on every signal
+} pthread_cond_t;
+typedef int pthread_condattr_t;
+
+#define PTHREAD_MUTEX_INITIALIZER {0}
+#define PTHREAD_COND_INITIALIZER {0}
+
+int pthread_create(pthread_t* thread, const pthread_attr_t* attr, void* (*start_routine)(void*), void* arg);
+int pthread_join(pthread_t thread, void** retval);
+void pthread_exit(void* retval) __attribute__((noreturn));
+pthread_t pthread_self(void);
+int pthread_equal(pthread_t t1, pthread_t t2);
+
+int pthread_mutex_init(pthread_mutex_t* mutex, const pthread_mutexattr_t* attr);
+int pthread_mutex_destroy(pthread_mutex_t* mutex);
+int pthread_mutex_lock(pthread_mutex_t* mutex);
+int pthread_mutex_trylock(pthread_mutex_t* mutex);
+int pthread_mutex_unlock(pthread_mutex_t* mutex);
+
+int pthread_cond_init(pthread_cond_t* cond, const pthread_condattr_t* attr);
+int pthread_cond_destroy(pthread_cond_t* cond);
+int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex);
+int pthread_cond_signal(pthread_cond_t* cond);
+int pthread_cond_broadcast(pthread_cond_t* cond);
+
+#endif
@@ -2,9 +2,20 @@
 #define _TIME_H 1
 
 #include <sys/types.h>
+#include <datetime.h>
 
+typedef int clockid_t;
+
+#define CLOCK_REALTIME ((clockid_t) CLOCK_ID_REALTIME)
+#define CLOCK_MONOTONIC ((clockid_t) CLOCK_ID_MONOTONIC)
+
+struct timespec {
+    time_t tv_sec;      /* seconds */
+    long   tv_nsec;     /* nanoseconds */
+};
 
 time_t time(time_t *);
+int clock_gettime(clockid_t clock_id, struct timespec *tp);
 
 
 #endif
@@ -0,0 +1,10 @@
+#ifndef _UNISTD_H
+#define _UNISTD_H 1
+
+#include <sys/types.h>
+
+typedef int32_t pid_t;
+
+pid_t getpid(void);
+
+#endif
@@ -0,0 +1,210 @@
+#include <pthread.h>
+#include <procthread.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Ref: Ulrich Drepper, Futexes Are Tricky, https://www.akkadia.org/drepper/futex.pdf
+
+#define PTHREAD_STACK_SIZE (64*1024)
+#define PTHREAD_EBUSY 16
+#define PTHREAD_EAGAIN 11
+
+struct pthread {
+    volatile int tid;           // set by the kernel before the thread runs, zeroed when it exits
+    void* (*start_routine)(void*);
+    void* arg;
+    void* retval;
+    void* stack;
+    struct pthread* next;
+};
+
+// The thread running main(), never joined
+static struct pthread main_thread;
+// Threads created by pthread_create(), looked up by thread ID in pthread_self()
+static struct pthread* threads;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int pthread_mutex_init(pthread_mutex_t* mutex, const pthread_mutexattr_t* attr)
+{
+    (void) attr;
+    mutex->state = 0;
+    return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t* mutex)
+{
+    (void) mutex;
+    return 0;
+}
+
+int pthread_mutex_lock(pthread_mutex_t* mutex)
+{
+    int c = __sync_val_compare_and_swap(&mutex->state, 0, 1);
+    if(c == 0) {
+        // uncontended, no syscall
+        return 0;
+    }
+    // mark it contended, so the unlocker knows it has to wake someone up
+    if(c != 2) {
+        c = __sync_lock_test_and_set(&mutex->state, 2);
+    }
+    while(c != 0) {
+        syscall_futex(&mutex->state, FUTEX_WAIT, 2);
+        c = __sync_lock_test_and_set(&mutex->state, 2);
+    }
+    return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t* mutex)
+{
+    return __sync_val_compare_and_swap(&mutex->state, 0, 1) == 0 ? 0 : PTHREAD_EBUSY;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t* mutex)
+{
+    if(__sync_fetch_and_sub(&mutex->state, 1) != 1) {
+        mutex->state = 0;
+        syscall_futex(&mutex->state, FUTEX_WAKE, 1);
+    }
+    return 0;
+}
+
+int pthread_cond_init(pthread_cond_t* cond, const pthread_condattr_t* attr)
+{
+    (void) attr;
+    cond->seq = 0;
+    return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t* cond)
+{
+    (void) cond;
+    return 0;
+}
+
+// May wake up spuriously, callers re-check their predicate as POSIX requires
+int pthread_cond_wait(pthread_cond_t* cond, pthread_mutex_t* mutex)
+{
+    int seq = cond->seq;
+    pthread_mutex_unlock(mutex);
+    // returns at once if signaled after the unlock
+    syscall_futex(&cond->seq, FUTEX_WAIT, seq);
+    pthread_mutex_lock(mutex);
+    return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t* cond)
+{
+    __sync_fetch_and_add(&cond->seq, 1);
+    syscall_futex(&cond->seq, FUTEX_WAKE, 1);
+    return 0;
+}
+
+int pthread_cond_broadcast(pthread_cond_t* cond)
+{
+    __sync_fetch_and_add(&cond->seq, 1);
+    syscall_futex(&cond->seq, FUTEX_WAKE, INT32_MAX);
+    return 0;
+}
+
+static void unlink_thread(struct pthread* t)
+{
+    pthread_mutex_lock(&threads_lock);
+    for(struct pthread** pp = &threads; *pp != NULL; pp = &(*pp)->next) {
+        if(*pp == t) {
+            *pp = t->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&threads_lock);
+}
+
+// First function run by a new thread, on its own stack
+static void thread_start(struct pthread* t)
+{
+    pthread_exit(t->start_routine(t->arg));
+}
+
+// Each thread gets a PTHREAD_STACK_SIZE stack from malloc, attr is ignored
+int pthread_create(pthread_t* thread, const pthread_attr_t* attr, void* (*start_routine)(void*), void* arg)
+{
+    (void) attr;
+    struct pthread* t = malloc(sizeof(struct pthread));
+    if(t == NULL) {
+        return PTHREAD_EAGAIN;
+    }
+    t->stack = malloc(PTHREAD_STACK_SIZE);
+    if(t->stack == NULL) {
+        free(t);
+        return PTHREAD_EAGAIN;
+    }
+    t->tid = 0;
+    t->start_routine = start_routine;
+    t->arg = arg;
+    t->retval = NULL;
+
+    // mimic a call to thread_start(t), it never returns
+    uint32_t* sp = (uint32_t*) (((uint32_t) t->stack + PTHREAD_STACK_SIZE) & ~0xF);
+    *--sp = (uint32_t) t;
+    *--sp = 0;
+
+    pthread_mutex_lock(&threads_lock);
+    t->next = threads;
+    threads = t;
+    pthread_mutex_unlock(&threads_lock);
+
+    int tid = syscall_clone(thread_start, sp, &t->tid);
+    if(tid < 0) {
+        unlink_thread(t);
+        free(t->stack);
+        free(t);
+        return -tid;
+    }
+    *thread = t;
+    return 0;
+}
+
+int pthread_join(pthread_t thread, void** retval)
+{
+    int tid;
+    while((tid = thread->tid) != 0) {
+        syscall_futex(&thread->tid, FUTEX_WAIT, tid);
+    }
+    if(retval != NULL) {
+        *retval = thread->retval;
+    }
+    unlink_thread(thread);
+    free(thread->stack);
+    free(thread);
+    return 0;
+}
+
+void pthread_exit(void* retval)
+{
+    pthread_self()->retval = retval;
+    // the process keeps running until its last thread exits
+    syscall_thread_exit();
+    while(1);
+}
+
+pthread_t pthread_self(void)
+{
+    int tid = syscall_gettid();
+    pthread_mutex_lock(&threads_lock);
+    struct pthread* t = threads;
+    while(t != NULL && t->tid != tid) {
+        t = t->next;
+    }
+    pthread_mutex_unlock(&threads_lock);
+    if(t == NULL) {
+        main_thread.tid = tid;
+        t = &main_thread;
+    }
+    return t;
+}
+
+int pthread_equal(pthread_t t1, pthread_t t2)
+{
+    return t1 == t2;
+}
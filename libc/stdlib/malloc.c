@@ -20,6 +20,7 @@ void* malloc(uint32_t size) {
 
 #include <syscall.h>
 #include <stddef.h>
+#include <pthread.h>
 // #include <stdio.h>
 
 static inline _syscall1(SYS_SBRK, void*, sbrk, int, size_delta)
@@ -42,10 +43,12 @@ typedef union header Header;
 
 static Header base;
 static Header *freep;
+// shared by all threads of the process
+static pthread_mutex_t malloc_lock = PTHREAD_MUTEX_INITIALIZER;
 
 
-void
-free(void *ap)
+static void
+free_locked(void *ap)
 {
   // printf("free(%u)\n", ap);
   if(ap == NULL) return;
@@ -82,12 +85,20 @@ morecore(uint nu)
     return 0;
   hp = (Header*)p;
   hp->s.size = nu;
-  free((void*)(hp + 1));
+  free_locked((void*)(hp + 1));
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+void
+free(void *ap)
+{
+  pthread_mutex_lock(&malloc_lock);
+  free_locked(ap);
+  pthread_mutex_unlock(&malloc_lock);
+}
+
+static void*
+malloc_locked(uint nbytes)
 {
   // printf("malloc(%u)\n", nbytes);
   Header *p, *prevp;
@@ -116,4 +127,13 @@ malloc(uint nbytes)
   }
 }
 
+void*
+malloc(uint nbytes)
+{
+  pthread_mutex_lock(&malloc_lock);
+  void* p = malloc_locked(nbytes);
+  pthread_mutex_unlock(&malloc_lock);
+  return p;
+}
+
 #endif
\ No newline at end of file
@@ -3,24 +3,93 @@
 #include <sys/time.h>
 
 #include <syscall.h>
+#include <vdso.h>
 #include <common.h>
 
 static inline _syscall0(SYS_CURR_TIME_EPOCH, time_t, sys_curr_time_epoch)
+static inline _syscall2(SYS_CLOCK_GETTIME, int, sys_clock_gettime, int, clk_id, uint64_t*, ns)
+
+static inline uint64_t rdtsc()
+{
+    uint64_t ret;
+    asm volatile ( "rdtsc" : "=A"(ret) );
+    return ret;
+}
+
+// Read clock from the vDSO page, no syscall involved
+// Ref: kernel clocksource, ns = (cycles * mult) >> shift
+static int vdso_clock_ns(clockid_t clock_id, uint64_t* ns)
+{
+    const volatile struct vdso_clock* c = VDSO_CLOCK;
+    uint32_t seq, mult, shift;
+    uint64_t boot_tsc, cycles;
+    int64_t boot_epoch;
+    do {
+        seq = c->seq;
+        asm volatile("" ::: "memory");
+        mult = c->mult;
+        shift = c->shift;
+        boot_tsc = c->boot_tsc;
+        boot_epoch = c->boot_epoch;
+        cycles = rdtsc();
+        asm volatile("" ::: "memory");
+    } while((seq & 1) || seq != c->seq);
+
+    if(mult == 0) {
+        // clock not published, fall back to syscall
+        return sys_clock_gettime(clock_id, ns);
+    }
+    cycles -= boot_tsc;
+    uint64_t hi = (cycles >> 32) * mult;
+    uint64_t lo = (cycles & 0xFFFFFFFF) * mult;
+    *ns = (hi << (32 - shift)) + (lo >> shift);
+    if(clock_id == CLOCK_REALTIME) {
+        *ns += (uint64_t) boot_epoch * 1000000000ULL;
+    }
+    return 0;
+}
+
+// Get time of the given clock with nanosecond resolution
+int clock_gettime(clockid_t clock_id, struct timespec *tp)
+{
+    if(clock_id != CLOCK_REALTIME && clock_id != CLOCK_MONOTONIC) {
+        return -1;
+    }
+    uint64_t ns;
+    int res = vdso_clock_ns(clock_id, &ns);
+    if(res < 0) {
+        return res;
+    }
+    tp->tv_sec = ns / 1000000000ULL;
+    tp->tv_nsec = ns % 1000000000ULL;
+    return 0;
+}
 
 // Get current clock time
 int gettimeofday(struct timeval* tp, struct timezone * tz)
 {
     // printf("gettimeofday(%u,%u)\n", tp, tz);
     (void) tz;
-    tp->tv_sec = sys_curr_time_epoch();
-    tp->tv_usec = 0;
+    struct timespec ts;
+    int res = clock_gettime(CLOCK_REALTIME, &ts);
+    if(res < 0) {
+        return res;
+    }
+    tp->tv_sec = ts.tv_sec;
+    tp->tv_usec = ts.tv_nsec / 1000;
     return 0;
 }
 
 time_t time(time_t *t)
 {
     // printf("time(%u)\n", t);
-    time_t curr = sys_curr_time_epoch();
+    struct timespec ts;
+    time_t curr;
+    if(clock_gettime(CLOCK_REALTIME, &ts) < 0) {
+        curr = sys_curr_time_epoch();
+    } else {
+        curr = ts.tv_sec;
+    }
     if(t) {
         *t = curr;
     }
@@ -0,0 +1,8 @@
+#include <unistd.h>
+#include <vdso.h>
+
+// PID is read from the per-process vDSO page instead of SYS_GET_PID
+pid_t getpid(void)
+{
+    return VDSO_PROC->pid;
+}
@@ -10,11 +10,22 @@ else
 fi
 
 if [ -f testfs.fat ]; then
-  HDB="-hdb testfs.fat"
+  if [ "${AHCI:-0}" = "1" ]; then
+    # Attach it to an ICH9 AHCI controller instead, e.g. AHCI=1 ./qemu.sh
+    HDB="-device ich9-ahci,id=ahci -drive id=sata0,file=testfs.fat,if=none,format=raw -device ide-hd,drive=sata0,bus=ahci.0"
+  elif [ "${VIRTIO:-0}" = "1" ]; then
+    # Or to a legacy virtio-blk device, e.g. VIRTIO=1 ./qemu.sh
+    HDB="-drive file=testfs.fat,if=virtio,format=raw"
+  else
+    HDB="-hdb testfs.fat"
+  fi
 else
   HDB=""
 fi
 
+# Number of CPUs, override with e.g. SMP=1 ./qemu.sh
+SMP_ARG="-smp ${SMP:-4}"
+
 # To use user mode network:
 NET_ARG="-nic user,model=rtl8139,mac=52:54:98:76:54:32"
 # To use tap network (see setup_tap.sh and cleanup_tap.sh):
@@ -22,8 +33,8 @@ NET_ARG="-nic user,model=rtl8139,mac=52:54:98:76:54:32"
 
 if grep -q Microsoft /proc/version; then
   echo "Windows Subsystem for Linux"
-  qemu-system-$(./target-triplet-to-arch.sh $HOST).exe ${DEBUG_FLAG} -hda bootable_kernel.bin ${HDB} -serial file:serial_port_output.txt ${NET_ARG}
+  qemu-system-$(./target-triplet-to-arch.sh $HOST).exe ${DEBUG_FLAG} -hda bootable_kernel.bin ${HDB} ${SMP_ARG} -serial file:serial_port_output.txt ${NET_ARG}
 else
   echo "Native Linux"
-  qemu-system-$(./target-triplet-to-arch.sh $HOST) ${DEBUG_FLAG} -hda bootable_kernel.bin ${HDB} -serial file:serial_port_output.txt ${NET_ARG}
+  qemu-system-$(./target-triplet-to-arch.sh $HOST) ${DEBUG_FLAG} -hda bootable_kernel.bin ${HDB} ${SMP_ARG} -serial file:serial_port_output.txt ${NET_ARG}
 fi